@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../Recorder/BitrateController.h"
+
+/*
+ *	Runs the bitrate controller against a simulated stick. The encoder's output queues up in its
+ *	buffers whenever the stick is slower than the stream, the way it does in the recorder where the
+ *	writer waits for the previous megabyte before carrying on. Each scenario changes the stick's
+ *	speed over time and checks what the controller made of it.
+*/
+
+#define SIM_STEP 10000
+#define SIM_SAMPLE 1000000
+
+// Encoder output buffers and the chunk the writer waits on
+#define SIM_QUEUE_BYTES (2 * 1024 * 1024)
+#define SIM_CHUNK_BYTES (1024 * 1024)
+
+// Plain write() calls that don't wait on anything
+#define SIM_WRITE_LATENCY 2000
+
+#define SIM_CEILING 17000000
+#define SIM_FLOOR 4000000
+#define SIM_HOLD 10
+
+struct SimPhase
+{
+	// Seconds from the start, and the stick's speed from then on in bits per second
+	unsigned int start;
+	unsigned int rate;
+};
+
+struct SimResult
+{
+	// Bitrate at the end of every second
+	unsigned int bitrates[256];
+	unsigned int seconds;
+
+	unsigned int lowest;
+	uint64_t droppedBytes;
+
+	// Seconds since the previous change for the quickest step up
+	unsigned int shortestHold;
+};
+
+static bool g_verbose = false;
+
+static unsigned int GetRate(const SimPhase* phases, unsigned int phaseCount, unsigned int second)
+{
+	unsigned int rate = phases[0].rate;
+	for (unsigned int i = 0; (i < phaseCount) && (phases[i].start <= second); i++)
+		rate = phases[i].rate;
+
+	return rate;
+}
+
+static void Simulate(const char* name, const SimPhase* phases, unsigned int phaseCount, unsigned int seconds, SimResult* result)
+{
+	BitrateController controller;
+	controller.SetFloor(SIM_FLOOR);
+	controller.SetQueueThresholds(10, 50);
+	controller.SetLatencyThresholds(50000, 250000);
+	controller.SetHoldTime((uint64_t)SIM_HOLD * 1000000);
+	controller.SetCeiling(SIM_CEILING);
+
+	memset(result, 0, sizeof(SimResult));
+	result->lowest = controller.GetBitrate();
+	result->shortestHold = ~0u;
+
+	if (g_verbose)
+		printf("%s\n", name);
+
+	double queued = 0;
+	uint64_t time = 0;
+	uint64_t lastChange = 0;
+	for (unsigned int second = 0; (second < seconds) && (second < sizeof(result->bitrates) / sizeof(result->bitrates[0])); second++)
+	{
+		unsigned int rate = GetRate(phases, phaseCount, second);
+		unsigned int bitrate = controller.GetBitrate();
+
+		// Whatever the stick can't take stays in the encoder's buffers, until they overflow
+		double written = 0;
+		for (uint64_t step = 0; step < SIM_SAMPLE; step += SIM_STEP)
+		{
+			queued += (double)bitrate * SIM_STEP / 8000000;
+			double out = (double)rate * SIM_STEP / 8000000;
+			if (out > queued)
+				out = queued;
+			queued -= out;
+			written += out;
+
+			if (queued > SIM_QUEUE_BYTES)
+			{
+				result->droppedBytes += (uint64_t)(queued - SIM_QUEUE_BYTES);
+				queued = SIM_QUEUE_BYTES;
+			}
+		}
+		time += SIM_SAMPLE;
+
+		// The writer only waits when the stick is slower than the stream, for as long as the chunk takes it
+		// over the time the stream took to fill it
+		bool waiting = rate < bitrate;
+
+		StorageSample sample;
+		sample.time = time;
+		sample.queueDepth = (unsigned int)(queued * 100 / SIM_QUEUE_BYTES);
+		sample.bytesWritten = (waiting) ? (uint64_t)written : 0;
+		sample.writeTime = (waiting) ? SIM_SAMPLE : 0;
+		sample.maxWriteLatency = (waiting) ? (uint64_t)SIM_CHUNK_BYTES * 8000000 / rate - (uint64_t)SIM_CHUNK_BYTES * 8000000 / bitrate : SIM_WRITE_LATENCY;
+		sample.freeBytes = 0;
+
+		if (controller.Update(sample))
+		{
+			if (controller.GetBitrate() > bitrate)
+			{
+				unsigned int hold = (unsigned int)((time - lastChange) / 1000000);
+				if (hold < result->shortestHold)
+					result->shortestHold = hold;
+			}
+			lastChange = time;
+		}
+
+		result->bitrates[second] = controller.GetBitrate();
+		result->seconds = second + 1;
+		if (controller.GetBitrate() < result->lowest)
+			result->lowest = controller.GetBitrate();
+
+		if (g_verbose)
+		{
+			printf("  %3us stick %5u kbps  bitrate %5u kbps  queue %3u%%  estimate %5u kbps\n", second, rate / 1000,
+				controller.GetBitrate() / 1000, sample.queueDepth, controller.GetThroughput() / 1000);
+		}
+	}
+}
+
+static bool Check(bool passed, const char* description)
+{
+	printf("%s: %s\n", (passed) ? "pass" : "FAIL", description);
+	return passed;
+}
+
+// A stick that slows down to 8 Mbps after 20 seconds and back up after 80
+static bool TestCutAndStepUp()
+{
+	static const SimPhase phases[] = { { 0, 40000000 }, { 20, 8000000 }, { 80, 40000000 } };
+
+	SimResult result;
+	Simulate("slow patch", phases, sizeof(phases) / sizeof(phases[0]), 180, &result);
+
+	bool passed = Check(result.bitrates[19] == SIM_CEILING, "full bitrate while the stick keeps up");
+
+	// Within a few seconds the stream fits what the stick manages
+	passed &= Check(result.bitrates[22] <= 8000000, "cut below the stick's speed within 3 seconds");
+
+	// Once in a while it tries for more in case the stick has recovered, but backs off again before long
+	unsigned int over = 0, longestOver = 0;
+	for (unsigned int second = 23; second < 80; second++)
+	{
+		over = (result.bitrates[second] > 8000000) ? over + 1 : 0;
+		if (over > longestOver)
+			longestOver = over;
+	}
+	passed &= Check(longestOver < SIM_HOLD, "never over the stick's speed for a hold time");
+
+	passed &= Check(result.droppedBytes == 0, "nothing dropped from the encoder's buffers");
+
+	passed &= Check(result.shortestHold >= SIM_HOLD, "never stepped up sooner than the hold time after a change");
+
+	bool recovered = false;
+	for (unsigned int second = 80; second < result.seconds; second++)
+		recovered = recovered || (result.bitrates[second] == SIM_CEILING);
+	passed &= Check(recovered, "back to the full bitrate once the stick is fast again");
+
+	return passed;
+}
+
+// A stick that can never keep up with even the floor
+static bool TestFloor()
+{
+	static const SimPhase phases[] = { { 0, 40000000 }, { 10, 1500000 } };
+
+	SimResult result;
+	Simulate("hopeless stick", phases, sizeof(phases) / sizeof(phases[0]), 60, &result);
+
+	bool passed = Check(result.lowest == SIM_FLOOR, "never below the floor");
+	passed &= Check(result.bitrates[result.seconds - 1] == SIM_FLOOR, "held at the floor");
+	return passed;
+}
+
+// A queue that sits between the thresholds changes nothing, in either direction
+static bool TestHold()
+{
+	BitrateController controller;
+	controller.SetFloor(SIM_FLOOR);
+	controller.SetQueueThresholds(10, 50);
+	controller.SetLatencyThresholds(50000, 250000);
+	controller.SetHoldTime((uint64_t)SIM_HOLD * 1000000);
+	controller.SetCeiling(SIM_CEILING);
+
+	StorageSample sample;
+	memset(&sample, 0, sizeof(sample));
+	sample.queueDepth = 60;
+	sample.maxWriteLatency = SIM_WRITE_LATENCY;
+	sample.time = 1000000;
+	controller.Update(sample);
+	unsigned int cut = controller.GetBitrate();
+
+	bool changed = false;
+	for (unsigned int second = 2; second < 60; second++)
+	{
+		sample.time = (uint64_t)second * 1000000;
+		sample.queueDepth = 30;
+		sample.maxWriteLatency = 100000;
+		if (controller.Update(sample))
+			changed = true;
+	}
+
+	bool passed = Check(cut < SIM_CEILING, "cut on a full queue");
+	passed &= Check((!changed) && (controller.GetBitrate() == cut), "held while the queue is between the thresholds");
+	return passed;
+}
+
+static void Usage(const char* name)
+{
+	printf("Usage: %s [-v]\n", name);
+	printf("  Runs the bitrate controller against simulated sticks and checks how it reacts\n");
+	printf("  -v prints every second of each simulation\n");
+}
+
+int main(int argc, char** argv)
+{
+	int option;
+	while ((option = getopt(argc, argv, "vh")) != -1)
+	{
+		switch (option)
+		{
+		case 'v':
+			g_verbose = true;
+			break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	bool passed = TestCutAndStepUp();
+	passed &= TestFloor();
+	passed &= TestHold();
+
+	return (passed) ? 0 : 1;
+}
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../Recorder/FrameBroadcaster.h"
+
+/*
+ *	Measures what the fan-out costs per buffer with 1 to 8 consumers, on a made up stream laid out
+ *	the way the encoder hands it over: parameter sets in a buffer of their own ahead of each IDR,
+ *	then every frame split over a few buffers. The first consumer is lossless like the disk writer,
+ *	the others drop to the next IDR or skip to the latest frame and are busy every now and then, so
+ *	the skipping is part of what's measured. Every consumer checks that it never got part of a frame
+ *	and that a drop to IDR consumer only ever picked the stream up again at an IDR.
+*/
+
+#define BENCH_BUFFER_SIZE (16 * 1024)
+#define BENCH_BUFFERS_PER_FRAME 4
+#define BENCH_GOP 30
+
+#define BENCH_CONFIG_PART 0xFF
+
+class BenchConsumer : public FrameConsumer
+{
+public:
+	BenchConsumer(BroadcastPolicy policy, unsigned int busyFrames, unsigned int period)
+	{
+		m_policy = policy;
+		m_busyFrames = busyFrames;
+		m_period = period;
+		m_readyCalls = 0;
+
+		m_lastFrame = ~0u;
+		m_nextPart = 0;
+		m_frames = 0;
+		m_errors = 0;
+		m_checksum = 0;
+	}
+
+	// Busy for the first busyFrames of every period frames it's asked about
+	virtual bool IsReady()
+	{
+		return (m_period == 0) || ((m_readyCalls++ % m_period) >= m_busyFrames);
+	}
+
+	virtual bool BufferReceived(const uint8_t* data, size_t length, uint32_t flags, uint64_t time)
+	{
+		unsigned int frame;
+		memcpy(&frame, data, sizeof(frame));
+		unsigned int part = data[sizeof(frame)];
+		m_checksum += data[length - 1] + (unsigned int)time;
+
+		if (part == BENCH_CONFIG_PART)
+		{
+			// Always between frames
+			if (m_nextPart)
+				m_errors++;
+			return true;
+		}
+
+		if (part != m_nextPart)
+		{
+			m_errors++;
+		}
+		else if ((part == 0) && (frame != m_lastFrame + 1) && (m_policy == BROADCAST_DROP_TO_IDR) && (!(flags & BROADCAST_FLAG_SYNCFRAME)))
+		{
+			// Picked up again somewhere other than an IDR
+			m_errors++;
+		}
+
+		m_nextPart = part + 1;
+		if (flags & BROADCAST_FLAG_ENDOFFRAME)
+		{
+			m_nextPart = 0;
+			m_lastFrame = frame;
+			m_frames++;
+		}
+
+		return true;
+	}
+
+public:
+	BroadcastPolicy m_policy;
+	unsigned int m_busyFrames;
+	unsigned int m_period;
+	unsigned int m_readyCalls;
+
+	unsigned int m_lastFrame;
+	unsigned int m_nextPart;
+	unsigned int m_frames;
+	unsigned int m_errors;
+	unsigned int m_checksum;
+};
+
+static uint64_t GetNanoseconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+static const char* g_names[BROADCAST_MAX_CONSUMERS] = { "0", "1", "2", "3", "4", "5", "6", "7" };
+
+static bool Run(unsigned int consumerCount, unsigned int frames, bool verbose)
+{
+	FrameBroadcaster broadcaster("bench");
+	BenchConsumer* consumers[BROADCAST_MAX_CONSUMERS];
+	for (unsigned int i = 0; i < consumerCount; i++)
+	{
+		if (i == 0)
+			consumers[i] = new BenchConsumer(BROADCAST_LOSSLESS, 0, 0);
+		else if (i % 2)
+			consumers[i] = new BenchConsumer(BROADCAST_DROP_TO_IDR, 3, 50 + i);
+		else
+			consumers[i] = new BenchConsumer(BROADCAST_LATEST_ONLY, 1, 7 + i);
+
+		broadcaster.AddConsumer(consumers[i], g_names[i], consumers[i]->m_policy);
+	}
+
+	uint8_t* data = (uint8_t*)calloc(1, BENCH_BUFFER_SIZE);
+	if (!data)
+		return false;
+
+	uint64_t buffers = 0;
+	uint64_t start = GetNanoseconds();
+	for (unsigned int frame = 0; frame < frames; frame++)
+	{
+		bool keyframe = (frame % BENCH_GOP) == 0;
+		uint64_t time = (uint64_t)frame * 33333;
+		memcpy(data, &frame, sizeof(frame));
+
+		if (keyframe)
+		{
+			data[sizeof(frame)] = BENCH_CONFIG_PART;
+			broadcaster.Process(data, 32, BROADCAST_FLAG_CODECCONFIG, time);
+			buffers++;
+		}
+
+		for (unsigned int part = 0; part < BENCH_BUFFERS_PER_FRAME; part++)
+		{
+			uint32_t flags = (keyframe) ? BROADCAST_FLAG_SYNCFRAME : 0;
+			if (part == BENCH_BUFFERS_PER_FRAME - 1)
+				flags |= BROADCAST_FLAG_ENDOFFRAME;
+
+			data[sizeof(frame)] = part;
+			broadcaster.Process(data, BENCH_BUFFER_SIZE, flags, time);
+			buffers++;
+		}
+	}
+	uint64_t elapsed = GetNanoseconds() - start;
+
+	bool passed = consumers[0]->m_frames == frames;
+	unsigned int delivered = 0, errors = 0;
+	for (unsigned int i = 0; i < consumerCount; i++)
+	{
+		delivered += consumers[i]->m_frames;
+		errors += consumers[i]->m_errors;
+	}
+	passed = (passed) && (errors == 0);
+
+	printf("%9u %12llu %22llu %10u %8s\n", consumerCount, (unsigned long long)(elapsed / buffers),
+		(unsigned long long)(elapsed / buffers / consumerCount), consumerCount * frames - delivered, (passed) ? "ok" : "FAIL");
+
+	if (verbose)
+		broadcaster.PrintStats();
+
+	for (unsigned int i = 0; i < consumerCount; i++)
+		delete consumers[i];
+	free(data);
+
+	return passed;
+}
+
+static void Usage(const char* name)
+{
+	printf("Usage: %s [-f frames] [-v]\n", name);
+	printf("  Times the frame fan-out with 1 to %u consumers over a made up stream (10000 frames)\n", BROADCAST_MAX_CONSUMERS);
+	printf("  -v prints the broadcaster's own stats after each run\n");
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int frames = 10000;
+	bool verbose = false;
+
+	int option;
+	while ((option = getopt(argc, argv, "f:vh")) != -1)
+	{
+		switch (option)
+		{
+		case 'f':
+			frames = strtoul(optarg, nullptr, 0);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!frames)
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	printf("consumers  ns/buffer  ns/buffer/consumer  dropped  checks\n");
+
+	bool passed = true;
+	for (unsigned int consumers = 1; consumers <= BROADCAST_MAX_CONSUMERS; consumers++)
+		passed &= Run(consumers, frames, verbose);
+
+	return (passed) ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../Recorder/ControlServer.h"
+
+static void Usage(const char* name)
+{
+	printf("Usage: %s [-s socket] [-t timeout ms] command [argument]\n", name);
+	printf("  Sends a command to the recorder and prints its answer, exits with 1 unless it was ok\n");
+	printf("  clip [seconds]            keep the footage before and the next seconds\n");
+	printf("  protect                   keep the segment being written and the one before it\n");
+	printf("  bitrate <bps>             main stream bitrate until the next profile change\n");
+	printf("  profile driving|parking   switch profiles\n");
+	printf("  rotate                    start a new segment now\n");
+	printf("  flush                     start writing out what the recorder has buffered\n");
+	printf("  status                    the recorder's status\n");
+}
+
+int main(int argc, char** argv)
+{
+	const char* path = CONTROL_SOCKET_DEFAULT;
+	unsigned int timeout = 2000;
+
+	int option;
+	while ((option = getopt(argc, argv, "s:t:h")) != -1)
+	{
+		switch (option)
+		{
+		case 's':
+			path = optarg;
+			break;
+		case 't':
+			timeout = strtoul(optarg, nullptr, 0);
+			break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind == argc)
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	// The rest of the command line is the command, one datagram
+	char request[CONTROL_REQUEST_SIZE];
+	size_t length = 0;
+	for (int i = optind; i < argc; i++)
+	{
+		int written = snprintf(request + length, sizeof(request) - length, "%s%s", (i > optind) ? " " : "", argv[i]);
+		if ((written < 0) || (length + written >= sizeof(request)))
+		{
+			printf("Command too long\n");
+			return 1;
+		}
+		length += written;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd < 0)
+	{
+		printf("Failed to create a socket: %s\n", strerror(errno));
+		return 1;
+	}
+
+	// Binding just the family gets an abstract address from the kernel for the answer to come back to
+	struct sockaddr_un local;
+	memset(&local, 0, sizeof(local));
+	local.sun_family = AF_UNIX;
+	if (bind(fd, (struct sockaddr*)&local, sizeof(local.sun_family)) != 0)
+	{
+		printf("Failed to bind the socket: %s\n", strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+	if (sendto(fd, request, length, 0, (struct sockaddr*)&address, sizeof(address)) < 0)
+	{
+		printf("Failed to reach the recorder on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, timeout) <= 0)
+	{
+		printf("No answer from the recorder\n");
+		close(fd);
+		return 1;
+	}
+
+	static char reply[CONTROL_REPLY_SIZE + 1];
+	ssize_t received = recv(fd, reply, CONTROL_REPLY_SIZE, 0);
+	close(fd);
+	if (received < 0)
+	{
+		printf("Failed to read the answer: %s\n", strerror(errno));
+		return 1;
+	}
+	reply[received] = 0;
+
+	fputs(reply, stdout);
+	return (strncmp(reply, "ok", 2) == 0) ? 0 : 1;
+}
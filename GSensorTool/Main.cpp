@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../Recorder/GSensor.h"
+#include "../Recorder/ImpactDetector.h"
+#include "../Recorder/Timing.h"
+
+static void Usage(const char* name)
+{
+	printf("Usage: %s [-t threshold] [-d duration] [-o holdoff] [-p] <sample file>\n", name);
+	printf("  Plays a sample file (gsensor.dump) through the impact detector and lists the hits\n");
+	printf("  -t mg over gravity (1500), -d ms over it (10), -o seconds between hits (5)\n");
+	printf("  -p plays it in real time through the sampling thread and ring, the way the recorder does\n");
+	printf("Usage: %s -r <i2c device> [-a address] [-f rate] [-s seconds] <sample file>\n", name);
+	printf("  Records samples from a LIS3DH to play back later\n");
+}
+
+static int Record(AccelSource* source, unsigned int seconds, const char* fileName)
+{
+	FILE* file = fopen(fileName, "w");
+	if (!file)
+	{
+		printf("Failed to create %s\n", fileName);
+		delete source;
+		return 1;
+	}
+
+	GSensor sensor(source);
+	if (!sensor.Start())
+	{
+		fclose(file);
+		return 1;
+	}
+
+	uint64_t end = GetMonotonicTime() + (uint64_t)seconds * 1000000;
+	while (GetMonotonicTime() < end)
+	{
+		AccelSample sample;
+		while (sensor.Pop(&sample))
+			fprintf(file, "%llu %d %d %d\n", (unsigned long long)sample.time, sample.x, sample.y, sample.z);
+
+		usleep(10000);
+	}
+
+	sensor.Stop();
+	sensor.PrintStats();
+	fclose(file);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	const char* device = nullptr;
+	unsigned int address = LIS3DH_DEFAULT_ADDRESS;
+	unsigned int rate = 200;
+	unsigned int seconds = 60;
+
+	unsigned int threshold = 1500;
+	unsigned int duration = 10;
+	unsigned int holdoff = 5;
+	bool realTime = false;
+
+	int option;
+	while ((option = getopt(argc, argv, "r:a:f:s:t:d:o:ph")) != -1)
+	{
+		switch (option)
+		{
+		case 'r':
+			device = optarg;
+			break;
+		case 'a':
+			address = strtoul(optarg, nullptr, 0);
+			break;
+		case 'f':
+			rate = strtoul(optarg, nullptr, 0);
+			break;
+		case 's':
+			seconds = strtoul(optarg, nullptr, 0);
+			break;
+		case 't':
+			threshold = strtoul(optarg, nullptr, 0);
+			break;
+		case 'd':
+			duration = strtoul(optarg, nullptr, 0);
+			break;
+		case 'o':
+			holdoff = strtoul(optarg, nullptr, 0);
+			break;
+		case 'p':
+			realTime = true;
+			break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+	const char* fileName = argv[optind];
+
+	if (device)
+		return Record(new Lis3dhSource(device, address, rate), seconds, fileName);
+
+	ImpactDetector impact;
+	impact.SetThresholds(threshold, duration, holdoff * 1000);
+
+	// Straight from the file, or through the thread and the ring polled like the recorder's main loop
+	ReplaySource* source = new ReplaySource(fileName, realTime);
+	GSensor sensor(source);
+	if (realTime)
+	{
+		if (!sensor.Start())
+			return 1;
+	}
+	else if (!source->Open())
+	{
+		return 1;
+	}
+
+	unsigned int samples = 0;
+	uint64_t firstTime = 0;
+	uint64_t maxWait = 0;
+	uint64_t totalWait = 0;
+
+	while (true)
+	{
+		AccelSample sample;
+		bool got = (realTime) ? sensor.Pop(&sample) : source->Read(&sample);
+		if (!got)
+		{
+			if ((!realTime) || (sensor.IsFinished()))
+				break;
+
+			usleep(1000);
+			continue;
+		}
+
+		if (!samples)
+			firstTime = sample.time;
+		samples++;
+
+		// How long the sample sat in the ring
+		uint64_t wait = (realTime) ? GetMonotonicTime() - sample.time : 0;
+		totalWait += wait;
+		if (wait > maxWait)
+			maxWait = wait;
+
+		if (impact.Process(sample))
+		{
+			printf("%8.3f s: %u mg, over the threshold for %llu ms", (double)(sample.time - firstTime) / 1000000, impact.GetPeak(),
+				(unsigned long long)(impact.GetHitTime() - impact.GetOnsetTime()) / 1000);
+			if (realTime)
+				printf(", %llu us in the ring", (unsigned long long)wait);
+			printf("\n");
+		}
+	}
+
+	printf("%u samples, %u hits\n", samples, impact.GetHits());
+	if ((realTime) && (samples))
+	{
+		sensor.Stop();
+		sensor.PrintStats();
+		printf("Time in the ring: %llu us average, %llu us worst\n", (unsigned long long)(totalWait / samples), (unsigned long long)maxWait);
+	}
+
+	return 0;
+}
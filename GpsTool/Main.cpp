@@ -0,0 +1,502 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+
+#include "../Recorder/GpsReader.h"
+#include "../Recorder/GpsTrack.h"
+#include "../Recorder/Timing.h"
+
+/*
+ *	Replays an NMEA log into a pty one epoch at a time, every sentence with the same UTC time in
+ *	one write, and reads it back through GpsReader on its thread the way the recorder does. The
+ *	fixes go into a SubRip track against a made up 30 fps stream whose frames were captured in
+ *	step with the replay and come out of the encoder up to 20ms late, so an entry should start at
+ *	the moment its epoch was written into the pty.
+*/
+
+#define REPLAY_FRAME_TIME 33333
+#define REPLAY_FRAME_JITTER 10000
+
+// Encoder timestamp of the first frame, 0 would be a segment that hasn't started
+#define REPLAY_ENCODER_START 1000000
+
+// Time left for the last epoch to come through the pty before the reader is stopped
+#define REPLAY_TAIL 500000
+
+struct NmeaLog
+{
+	char* data;
+	size_t size;
+
+	// Where each epoch starts in data, it runs up to the next one
+	size_t* epochs;
+	unsigned int epochCount;
+};
+
+struct ReplayFix
+{
+	GpsFix fix;
+	// The epoch written most recently when the fix was stamped
+	unsigned int epoch;
+	uint64_t delay;
+};
+
+struct ReplayResult
+{
+	// When each epoch was written into the pty, from the start of the replay
+	uint64_t* sent;
+
+	ReplayFix* fixes;
+	unsigned int fixCount;
+	unsigned int fixCapacity;
+
+	unsigned int sentences;
+	unsigned int checksumErrors;
+};
+
+struct TrackEntry
+{
+	// ms from the start of the segment
+	uint64_t start;
+	uint64_t end;
+	double latitude;
+};
+
+static void Usage(const char* name)
+{
+	printf("Usage: %s [-r rate] [-o track] <nmea log>\n", name);
+	printf("  Replays an NMEA log into a pty at rate epochs a second (10) and reads it back through the GPS\n");
+	printf("  reader, listing the fixes and how long after their epoch was written each one was stamped\n");
+	printf("  -o keeps the SubRip track made from the fixes (gps.srt)\n");
+	printf("Usage: %s -t <scratch directory>\n", name);
+	printf("  Replays a made up 20 Hz log with some bad checksums and checks the fixes, the checksum error count\n");
+	printf("  and the timing of the track\n");
+}
+
+// The UTC time field of an RMC or GGA sentence, nullptr for any other line or one without a time
+static const char* GetEpochTime(const char* line, size_t length, size_t* timeLength)
+{
+	if ((length < 8) || (line[0] != '$') || ((memcmp(line + 3, "RMC,", 4) != 0) && (memcmp(line + 3, "GGA,", 4) != 0)) ||
+		(line[7] < '0') || (line[7] > '9'))
+		return nullptr;
+
+	const char* time = line + 7;
+	const char* end = (const char*)memchr(time, ',', length - 7);
+	*timeLength = (end) ? (size_t)(end - time) : 0;
+	return time;
+}
+
+// A new epoch starts at every RMC or GGA with a time other than the last one's
+static bool SplitEpochs(NmeaLog* log)
+{
+	unsigned int capacity = 0;
+	const char* epochTime = nullptr;
+	size_t epochTimeLength = 0;
+
+	log->epochs = nullptr;
+	log->epochCount = 0;
+
+	size_t offset = 0;
+	while (offset < log->size)
+	{
+		const char* line = log->data + offset;
+		const char* newline = (const char*)memchr(line, '\n', log->size - offset);
+		size_t length = (newline) ? (size_t)(newline - line) + 1 : log->size - offset;
+
+		size_t timeLength = 0;
+		const char* time = GetEpochTime(line, length, &timeLength);
+		bool newEpoch = (log->epochCount == 0) ||
+			((time) && ((!epochTime) || (timeLength != epochTimeLength) || (memcmp(time, epochTime, timeLength) != 0)));
+
+		if (newEpoch)
+		{
+			if (log->epochCount == capacity)
+			{
+				capacity = (capacity) ? capacity * 2 : 1024;
+				size_t* epochs = (size_t*)realloc(log->epochs, capacity * sizeof(size_t));
+				if (!epochs)
+					return false;
+				log->epochs = epochs;
+			}
+			log->epochs[log->epochCount++] = offset;
+		}
+
+		if (time)
+		{
+			epochTime = time;
+			epochTimeLength = timeLength;
+		}
+
+		offset += length;
+	}
+
+	return log->epochCount > 0;
+}
+
+static bool LoadLog(const char* fileName, NmeaLog* log)
+{
+	memset(log, 0, sizeof(NmeaLog));
+
+	FILE* file = fopen(fileName, "rb");
+	if (!file)
+	{
+		printf("Failed to open %s\n", fileName);
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	log->data = (size > 0) ? (char*)malloc(size) : nullptr;
+	log->size = (log->data) ? fread(log->data, 1, size, file) : 0;
+	fclose(file);
+
+	if (!SplitEpochs(log))
+	{
+		printf("No NMEA in %s\n", fileName);
+		return false;
+	}
+
+	return true;
+}
+
+static void FreeLog(NmeaLog* log)
+{
+	free(log->data);
+	free(log->epochs);
+}
+
+static void FreeResult(ReplayResult* result)
+{
+	free(result->sent);
+	free(result->fixes);
+}
+
+// Feeds the frames captured up to now to the track and hands it whatever fixes the reader has
+static void Service(GpsReader* reader, GpsTrack* track, const char* segmentName, uint64_t start, unsigned int sentCount,
+	unsigned int* frame, ReplayResult* result)
+{
+	uint64_t now = GetMonotonicTime();
+	for (; start + (uint64_t)*frame * REPLAY_FRAME_TIME <= now; (*frame)++)
+	{
+		uint64_t capture = (uint64_t)*frame * REPLAY_FRAME_TIME;
+		track->FrameReceived(REPLAY_ENCODER_START + capture, start + capture + (*frame % 3) * REPLAY_FRAME_JITTER);
+	}
+
+	track->Update(segmentName, REPLAY_ENCODER_START, true);
+
+	GpsFix fix;
+	while (reader->Pop(&fix))
+	{
+		track->AddFix(fix);
+		if (result->fixCount == result->fixCapacity)
+			continue;
+
+		// The epoch it came from is the last one written before it was stamped
+		unsigned int epoch = 0;
+		while ((epoch + 1 < sentCount) && (start + result->sent[epoch + 1] <= fix.time))
+			epoch++;
+
+		ReplayFix& replayFix = result->fixes[result->fixCount++];
+		replayFix.fix = fix;
+		replayFix.epoch = epoch;
+		replayFix.delay = ((sentCount) && (fix.time > start + result->sent[epoch])) ? fix.time - start - result->sent[epoch] : 0;
+	}
+}
+
+static bool Replay(const NmeaLog* log, unsigned int rate, const char* segmentName, ReplayResult* result)
+{
+	memset(result, 0, sizeof(ReplayResult));
+
+	// A receiver never completes more than one fix an epoch
+	result->sent = (uint64_t*)calloc(log->epochCount, sizeof(uint64_t));
+	result->fixes = (ReplayFix*)calloc(log->epochCount, sizeof(ReplayFix));
+	if ((!result->sent) || (!result->fixes))
+		return false;
+	result->fixCapacity = log->epochCount;
+
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0))
+	{
+		printf("Failed to create a pty\n");
+		if (master >= 0)
+			close(master);
+		return false;
+	}
+
+	GpsReader reader;
+	GpsTrack track;
+	if (!reader.Start(ptsname(master), 0))
+	{
+		close(master);
+		return false;
+	}
+
+	unsigned int frame = 0;
+	uint64_t start = GetMonotonicTime();
+	for (unsigned int i = 0; i < log->epochCount; i++)
+	{
+		uint64_t due = start + (uint64_t)i * 1000000 / rate;
+		for (;;)
+		{
+			Service(&reader, &track, segmentName, start, i, &frame, result);
+
+			uint64_t now = GetMonotonicTime();
+			if (now >= due)
+				break;
+			usleep((due - now < 2000) ? (useconds_t)(due - now) : 2000);
+		}
+
+		size_t end = (i + 1 < log->epochCount) ? log->epochs[i + 1] : log->size;
+		result->sent[i] = GetMonotonicTime() - start;
+		if (write(master, log->data + log->epochs[i], end - log->epochs[i]) != (ssize_t)(end - log->epochs[i]))
+			printf("Failed to write epoch %u into the pty\n", i);
+	}
+
+	uint64_t end = GetMonotonicTime() + REPLAY_TAIL;
+	while (GetMonotonicTime() < end)
+	{
+		Service(&reader, &track, segmentName, start, log->epochCount, &frame, result);
+		usleep(2000);
+	}
+
+	result->sentences = reader.GetSentences();
+	result->checksumErrors = reader.GetChecksumErrors();
+
+	reader.Stop();
+	track.Close();
+	close(master);
+	return true;
+}
+
+static unsigned int ReadTrack(const char* trackName, TrackEntry* entries, unsigned int maxEntries)
+{
+	FILE* file = fopen(trackName, "r");
+	if (!file)
+		return 0;
+
+	unsigned int count = 0;
+	char line[256];
+	while ((count < maxEntries) && (fgets(line, sizeof(line), file)))
+	{
+		unsigned int h1, m1, s1, ms1, h2, m2, s2, ms2;
+		if (sscanf(line, "%u:%u:%u,%u --> %u:%u:%u,%u", &h1, &m1, &s1, &ms1, &h2, &m2, &s2, &ms2) != 8)
+			continue;
+
+		TrackEntry& entry = entries[count++];
+		entry.start = (((uint64_t)h1 * 60 + m1) * 60 + s1) * 1000 + ms1;
+		entry.end = (((uint64_t)h2 * 60 + m2) * 60 + s2) * 1000 + ms2;
+
+		double longitude;
+		float speed;
+		entry.latitude = 0;
+		if ((fgets(line, sizeof(line), file)) && (sscanf(line, "%f km/h %lf, %lf", &speed, &entry.latitude, &longitude) != 3))
+			entry.latitude = 0;
+	}
+
+	fclose(file);
+	return count;
+}
+
+/*
+ *	Self test
+ *	100 epochs at 20 Hz of RMC and GGA, heading north 0.0001 degrees an epoch. Every tenth GGA from
+ *	the sixth on has a bad checksum, so those fixes only complete when the next epoch starts, and
+ *	one RMC does, so that epoch has no fix at all.
+*/
+
+#define TEST_RATE 20
+#define TEST_EPOCHS 100
+#define TEST_BAD_RMC 42
+
+// Stamped within this many us of the epoch being written
+#define TEST_TOLERANCE 5000
+
+static bool IsBadGGA(unsigned int epoch)
+{
+	return epoch % 10 == 5;
+}
+
+static double GetTestLatitude(unsigned int epoch)
+{
+	return 51.5 + epoch * 0.0001;
+}
+
+static void AppendSentence(char* data, size_t* size, const char* body, bool badChecksum)
+{
+	unsigned char checksum = 0;
+	for (const char* p = body; *p; p++)
+		checksum ^= (unsigned char)*p;
+	if (badChecksum)
+		checksum ^= 0x5A;
+
+	*size += sprintf(data + *size, "$%s*%02X\r\n", body, checksum);
+}
+
+static bool MakeTestLog(NmeaLog* log)
+{
+	memset(log, 0, sizeof(NmeaLog));
+	log->data = (char*)malloc(TEST_EPOCHS * 2 * 128);
+	if (!log->data)
+		return false;
+
+	for (unsigned int i = 0; i < TEST_EPOCHS; i++)
+	{
+		unsigned int ms = i * 1000 / TEST_RATE;
+		char time[16];
+		snprintf(time, sizeof(time), "1000%02u.%02u", ms / 1000, ms % 1000 / 10);
+
+		double minutes = (GetTestLatitude(i) - 51) * 60;
+		char body[128];
+		snprintf(body, sizeof(body), "GPRMC,%s,A,51%07.4f,N,00007.6500,W,%.1f,0.0,270516,,,A", time, minutes, 40 + i * 0.1);
+		AppendSentence(log->data, &log->size, body, i == TEST_BAD_RMC);
+		snprintf(body, sizeof(body), "GPGGA,%s,51%07.4f,N,00007.6500,W,1,09,0.9,35.0,M,47.0,M,,", time, minutes);
+		AppendSentence(log->data, &log->size, body, IsBadGGA(i));
+	}
+
+	return SplitEpochs(log);
+}
+
+static bool Check(bool passed, const char* description)
+{
+	printf("%s: %s\n", (passed) ? "pass" : "FAIL", description);
+	return passed;
+}
+
+static int RunSelfTest(const char* directory)
+{
+	char segmentName[255];
+	snprintf(segmentName, sizeof(segmentName), "%s/00000001-recording.h264", directory);
+	char trackName[255];
+	GpsTrackName(segmentName, trackName, sizeof(trackName));
+
+	NmeaLog log;
+	ReplayResult result;
+	bool passed = (MakeTestLog(&log)) && (log.epochCount == TEST_EPOCHS);
+	passed = (passed) && (Replay(&log, TEST_RATE, segmentName, &result));
+	if (!passed)
+	{
+		printf("FAIL: couldn't replay the test log\n");
+		FreeLog(&log);
+		return 1;
+	}
+
+	unsigned int badGGA = 0;
+	for (unsigned int i = 0; i < TEST_EPOCHS; i++)
+		badGGA += IsBadGGA(i) ? 1 : 0;
+	passed &= Check(result.checksumErrors == badGGA + 1, "every sentence with a bad checksum was counted and skipped");
+
+	// Every epoch but the one without its RMC, in order, stamped when the epoch was written
+	bool fixesMatch = result.fixCount == TEST_EPOCHS - 1;
+	bool stampsMatch = true;
+	uint64_t maxDelay = 0;
+	for (unsigned int i = 0; (fixesMatch) && (i < result.fixCount); i++)
+	{
+		const ReplayFix& replayFix = result.fixes[i];
+		unsigned int epoch = (i < TEST_BAD_RMC) ? i : i + 1;
+		fixesMatch = (replayFix.fix.utcTime == 36000000 + epoch * 1000 / TEST_RATE) && (replayFix.fix.valid) &&
+			(fabs(replayFix.fix.latitude - GetTestLatitude(epoch)) < 0.000001) && (fabs(replayFix.fix.longitude + 0.1275) < 0.000001) &&
+			(replayFix.fix.hasGGA == !IsBadGGA(epoch));
+
+		stampsMatch = (stampsMatch) && (replayFix.epoch == epoch) && (replayFix.delay <= TEST_TOLERANCE);
+		if (replayFix.delay > maxDelay)
+			maxDelay = replayFix.delay;
+	}
+	passed &= Check(fixesMatch, "one fix for every epoch with a good RMC, with or without its GGA");
+	passed &= Check(stampsMatch, "fixes are stamped when their epoch's first sentence arrived, even when they complete an epoch later");
+
+	// One entry a fix, each running up to the next and starting when its epoch went into the pty
+	TrackEntry entries[TEST_EPOCHS];
+	unsigned int entryCount = ReadTrack(trackName, entries, TEST_EPOCHS);
+	bool entriesMatch = entryCount == result.fixCount;
+	bool timingMatches = entriesMatch;
+	uint64_t maxError = 0;
+	for (unsigned int i = 0; (entriesMatch) && (i < entryCount); i++)
+	{
+		const ReplayFix& replayFix = result.fixes[i];
+		uint64_t expected = result.sent[replayFix.epoch] / 1000;
+		uint64_t error = (entries[i].start > expected) ? entries[i].start - expected : expected - entries[i].start;
+		if (error > maxError)
+			maxError = error;
+
+		uint64_t end = (i + 1 < entryCount) ? entries[i + 1].start : entries[i].start + GPS_TRACK_HOLD / 1000;
+		entriesMatch = (entries[i].end == end) && (fabs(entries[i].latitude - replayFix.fix.latitude) < 0.000001);
+		timingMatches = (timingMatches) && (error <= TEST_TOLERANCE / 1000);
+	}
+	passed &= Check(entriesMatch, "one subtitle a fix, each lasting until the next");
+	passed &= Check(timingMatches, "subtitles start when their epoch was written, against the frames");
+
+	printf("  fixes stamped at most %llu us after their epoch was written, subtitles at most %llu ms off\n",
+		(unsigned long long)maxDelay, (unsigned long long)maxError);
+
+	unlink(trackName);
+	FreeResult(&result);
+	FreeLog(&log);
+	return (passed) ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int rate = 10;
+	const char* trackName = "gps.srt";
+
+	int option;
+	while ((option = getopt(argc, argv, "r:o:t:h")) != -1)
+	{
+		switch (option)
+		{
+		case 'r':
+			rate = strtoul(optarg, nullptr, 0);
+			break;
+		case 'o':
+			trackName = optarg;
+			break;
+		case 't':
+			return RunSelfTest(optarg);
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((optind >= argc) || (!rate) || (rate > 1000))
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	NmeaLog log;
+	ReplayResult result;
+	if ((!LoadLog(argv[optind], &log)) || (!Replay(&log, rate, trackName, &result)))
+	{
+		FreeLog(&log);
+		return 1;
+	}
+
+	uint64_t maxDelay = 0;
+	for (unsigned int i = 0; i < result.fixCount; i++)
+	{
+		const GpsFix& fix = result.fixes[i].fix;
+		unsigned int seconds = fix.utcTime / 1000;
+		printf("Epoch %6u: %02u:%02u:%02u.%03u %s %.6f, %.6f %.1f km/h", result.fixes[i].epoch, seconds / 3600, seconds / 60 % 60,
+			seconds % 60, fix.utcTime % 1000, (fix.valid) ? "fix" : "no fix", fix.latitude, fix.longitude, fix.speed);
+		if (fix.hasGGA)
+			printf(" %u sats", fix.satellites);
+		printf(", stamped %llu us after the epoch was written\n", (unsigned long long)result.fixes[i].delay);
+
+		if (result.fixes[i].delay > maxDelay)
+			maxDelay = result.fixes[i].delay;
+	}
+
+	printf("%u epochs at %u Hz, %u sentences, %u checksum errors, %u fixes, stamped at most %llu us late\n", log.epochCount, rate,
+		result.sentences, result.checksumErrors, result.fixCount, (unsigned long long)maxDelay);
+	printf("Track written to %s\n", trackName);
+
+	FreeResult(&result);
+	FreeLog(&log);
+	return 0;
+}
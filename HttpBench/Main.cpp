@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../HttpServer/HttpServer.h"
+#include "../Recorder/Timing.h"
+
+/*
+ *	Runs the HTTP server on a loopback port over a scratch directory while a stand-in for the
+ *	recorder writes a segment at the main stream's bitrate, the way it does on the Pi: 64KB writes
+ *	and an fdatasync() every megabyte, timed. A finished segment is then downloaded by one client
+ *	and by several at once, a byte range is fetched and /live is followed for a few seconds. The
+ *	download rates are printed next to the worst write the recorder saw meanwhile, against what it
+ *	saw with nothing being downloaded.
+*/
+
+// Not exported by the C library, see linux/ioprio.h
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+#define BENCH_WRITE_SIZE (64 * 1024)
+#define BENCH_SYNC_BYTES (1024 * 1024)
+#define BENCH_IDLE_SECONDS 2
+#define BENCH_LIVE_SECONDS 3
+#define BENCH_MAX_CLIENTS 8
+
+enum BenchPhase
+{
+	BENCH_PHASE_IDLE,
+	BENCH_PHASE_SINGLE,
+	BENCH_PHASE_PARALLEL,
+	BENCH_PHASE_RANGE,
+	BENCH_PHASE_LIVE,
+	BENCH_PHASES
+};
+
+static const char* g_phaseNames[BENCH_PHASES] = { "nothing", "one download", "parallel downloads", "range request", "live" };
+
+struct BenchRecorder
+{
+	char path[512];
+	unsigned int bitrate;
+
+	volatile bool stop;
+	volatile int phase;
+
+	// Writes and the worst write plus sync per phase, in microseconds
+	unsigned int writes[BENCH_PHASES];
+	uint64_t maxLatency[BENCH_PHASES];
+	uint64_t bytes;
+};
+
+struct BenchDownload
+{
+	unsigned int port;
+	const char* url;
+	const char* range;
+	// Gives up after this long, 0 to read to the end
+	unsigned int seconds;
+
+	int status;
+	uint64_t contentLength;
+	uint64_t bytes;
+	bool success;
+};
+
+static volatile bool g_serverStop = false;
+
+static void* ServerThread(void* arg)
+{
+	HttpServer* server = (HttpServer*)arg;
+
+	// Same as httpserver.bin, downloads only get the disk when the recorder isn't using it
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+		printf("Failed to set idle IO priority\n");
+
+	while (!g_serverStop)
+		server->Update(100);
+
+	return nullptr;
+}
+
+static void* RecorderThread(void* arg)
+{
+	BenchRecorder* recorder = (BenchRecorder*)arg;
+
+	int file = open(recorder->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (file < 0)
+	{
+		printf("Failed to create %s\n", recorder->path);
+		return nullptr;
+	}
+
+	uint8_t* data = (uint8_t*)malloc(BENCH_WRITE_SIZE);
+	memset(data, 0x5A, BENCH_WRITE_SIZE);
+
+	uint64_t start = GetMonotonicTime();
+	uint64_t unsynced = 0;
+	while (!recorder->stop)
+	{
+		// Keep to the bitrate, like the encoder would
+		uint64_t due = start + (recorder->bytes * 8000000) / recorder->bitrate;
+		uint64_t now = GetMonotonicTime();
+		if (due > now)
+			usleep(due - now);
+
+		uint64_t writeStart = GetMonotonicTime();
+		if (write(file, data, BENCH_WRITE_SIZE) != BENCH_WRITE_SIZE)
+		{
+			printf("Failed to write %s (%d)\n", recorder->path, errno);
+			break;
+		}
+
+		unsynced += BENCH_WRITE_SIZE;
+		if (unsynced >= BENCH_SYNC_BYTES)
+		{
+			fdatasync(file);
+			unsynced = 0;
+		}
+
+		uint64_t latency = GetMonotonicTime() - writeStart;
+		int phase = recorder->phase;
+		recorder->writes[phase]++;
+		if (latency > recorder->maxLatency[phase])
+			recorder->maxLatency[phase] = latency;
+
+		recorder->bytes += BENCH_WRITE_SIZE;
+	}
+
+	free(data);
+	close(file);
+	return nullptr;
+}
+
+static void* DownloadThread(void* arg)
+{
+	BenchDownload* download = (BenchDownload*)arg;
+	download->status = 0;
+	download->contentLength = 0;
+	download->bytes = 0;
+	download->success = false;
+
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0)
+		return nullptr;
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(download->port);
+
+	// A followed segment never ends, so only wait a second for each read
+	struct timeval timeout = { 1, 0 };
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	char request[512];
+	int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n%s%s%s\r\n",
+		download->url, (download->range) ? "Range: " : "", (download->range) ? download->range : "", (download->range) ? "\r\n" : "");
+
+	if ((connect(sock, (struct sockaddr*)&address, sizeof(address)) != 0) || (send(sock, request, length, MSG_NOSIGNAL) != length))
+	{
+		close(sock);
+		return nullptr;
+	}
+
+	static const size_t bufferSize = 256 * 1024;
+	char* buffer = (char*)malloc(bufferSize);
+
+	// Headers first, whatever follows them in the same read is body
+	size_t headerLength = 0;
+	char* body = nullptr;
+	while (!body)
+	{
+		ssize_t received = recv(sock, buffer + headerLength, bufferSize - headerLength - 1, 0);
+		if (received <= 0)
+			break;
+
+		headerLength += received;
+		buffer[headerLength] = 0;
+		body = strstr(buffer, "\r\n\r\n");
+	}
+
+	if (body)
+	{
+		body += 4;
+		download->bytes = buffer + headerLength - body;
+		sscanf(buffer, "HTTP/1.1 %d", &download->status);
+
+		const char* contentLength = strstr(buffer, "Content-Length: ");
+		if ((contentLength) && (contentLength < body))
+			download->contentLength = strtoull(contentLength + 16, nullptr, 10);
+
+		uint64_t end = (download->seconds) ? GetMonotonicTime() + (uint64_t)download->seconds * 1000000 : 0;
+		while ((!end) || (GetMonotonicTime() < end))
+		{
+			ssize_t received = recv(sock, buffer, bufferSize, 0);
+			if (received == 0)
+				break;
+			if ((received < 0) && (errno != EAGAIN) && (errno != EINTR))
+				break;
+			if (received > 0)
+				download->bytes += received;
+		}
+
+		download->success = true;
+	}
+
+	free(buffer);
+	close(sock);
+	return nullptr;
+}
+
+static bool CreateSegment(const char* path, unsigned int megabytes)
+{
+	int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (file < 0)
+		return false;
+
+	uint8_t* data = (uint8_t*)malloc(BENCH_SYNC_BYTES);
+	bool success = data != nullptr;
+	for (unsigned int i = 0; (success) && (i < megabytes); i++)
+	{
+		memset(data, i, BENCH_SYNC_BYTES);
+		success = write(file, data, BENCH_SYNC_BYTES) == BENCH_SYNC_BYTES;
+	}
+
+	// Downloads have to come off the storage rather than out of the page cache
+	fdatasync(file);
+	posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+
+	free(data);
+	close(file);
+	return success;
+}
+
+static void DropCache(const char* path)
+{
+	int file = open(path, O_RDONLY);
+	if (file < 0)
+		return;
+
+	posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+	close(file);
+}
+
+// Runs count downloads at once, returns the combined rate in KB/s
+static unsigned int RunDownloads(BenchDownload* downloads, unsigned int count)
+{
+	pthread_t threads[BENCH_MAX_CLIENTS];
+
+	uint64_t start = GetMonotonicTime();
+	for (unsigned int i = 0; i < count; i++)
+		pthread_create(&threads[i], nullptr, DownloadThread, &downloads[i]);
+
+	uint64_t bytes = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		pthread_join(threads[i], nullptr);
+		bytes += downloads[i].bytes;
+	}
+	uint64_t elapsed = GetMonotonicTime() - start;
+
+	return (elapsed) ? (unsigned int)(bytes * 1000000 / 1024 / elapsed) : 0;
+}
+
+static bool Check(bool passed, const char* description)
+{
+	if (!passed)
+		printf("FAIL: %s\n", description);
+	return passed;
+}
+
+static void Usage(const char* name)
+{
+	printf("Usage: %s [-p port] [-s MB] [-c clients] [-b bitrate] <scratch directory>\n", name);
+	printf("  Downloads from the HTTP server over loopback while a segment is being recorded into the same directory\n");
+	printf("  -p port (8080), -s size of the downloaded segment (64), -c parallel downloads (4, up to %u),\n", BENCH_MAX_CLIENTS);
+	printf("  -b recording bitrate in bits per second (17000000)\n");
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int port = 8080;
+	unsigned int megabytes = 64;
+	unsigned int clients = 4;
+	unsigned int bitrate = 17000000;
+
+	int option;
+	while ((option = getopt(argc, argv, "p:s:c:b:h")) != -1)
+	{
+		switch (option)
+		{
+		case 'p':
+			port = strtoul(optarg, nullptr, 0);
+			break;
+		case 's':
+			megabytes = strtoul(optarg, nullptr, 0);
+			break;
+		case 'c':
+			clients = strtoul(optarg, nullptr, 0);
+			break;
+		case 'b':
+			bitrate = strtoul(optarg, nullptr, 0);
+			break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((optind >= argc) || (!megabytes) || (!clients) || (clients > BENCH_MAX_CLIENTS) || (!bitrate))
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	// sendfile() to a client that gave up raises SIGPIPE, httpserver.bin ignores it too
+	signal(SIGPIPE, SIG_IGN);
+
+	char rootDir[255];
+	snprintf(rootDir, sizeof(rootDir), "%s/httpbench.XXXXXX", argv[optind]);
+	if (!mkdtemp(rootDir))
+	{
+		printf("Failed to create a directory in %s\n", argv[optind]);
+		return 1;
+	}
+
+	char sessionDir[320], finished[400], statusFile[320], catalogName[320];
+	snprintf(sessionDir, sizeof(sessionDir), "%s/session", rootDir);
+	snprintf(catalogName, sizeof(catalogName), "%s/%s", rootDir, POOL_CATALOG_FILE);
+	snprintf(finished, sizeof(finished), "%s/00000000-recording.h264", sessionDir);
+	snprintf(statusFile, sizeof(statusFile), "%s/recorder.status", rootDir);
+
+	BenchRecorder recorder;
+	memset(&recorder, 0, sizeof(recorder));
+	recorder.bitrate = bitrate;
+	snprintf(recorder.path, sizeof(recorder.path), "%s/00000001-recording.h264", sessionDir);
+
+	FILE* status = nullptr;
+	bool success = (mkdir(sessionDir, 0777) == 0) && (CreateSegment(finished, megabytes));
+	if (success)
+	{
+		// Just enough of the recorder's status file for /live
+		status = fopen(statusFile, "w");
+		success = status != nullptr;
+	}
+	if (status)
+	{
+		fprintf(status, "segment: %s\n", recorder.path);
+		fclose(status);
+	}
+
+	HttpServer server;
+	pthread_t serverThread, recorderThread;
+	success = (success) && (server.Open(port, rootDir, statusFile));
+	if (!success)
+	{
+		printf("Failed to set up the benchmark in %s\n", rootDir);
+	}
+	else
+	{
+		pthread_create(&serverThread, nullptr, ServerThread, &server);
+		pthread_create(&recorderThread, nullptr, RecorderThread, &recorder);
+
+		sleep(BENCH_IDLE_SECONDS);
+
+		char url[64];
+		snprintf(url, sizeof(url), "/session/00000000-recording.h264");
+		uint64_t fileSize = (uint64_t)megabytes * BENCH_SYNC_BYTES;
+
+		BenchDownload downloads[BENCH_MAX_CLIENTS];
+		for (unsigned int i = 0; i < BENCH_MAX_CLIENTS; i++)
+		{
+			memset(&downloads[i], 0, sizeof(BenchDownload));
+			downloads[i].port = port;
+			downloads[i].url = url;
+		}
+
+		recorder.phase = BENCH_PHASE_SINGLE;
+		unsigned int single = RunDownloads(downloads, 1);
+		success &= Check((downloads[0].success) && (downloads[0].status == 200) && (downloads[0].bytes == fileSize), "one download got the whole segment");
+
+		DropCache(finished);
+		recorder.phase = BENCH_PHASE_PARALLEL;
+		unsigned int parallel = RunDownloads(downloads, clients);
+		for (unsigned int i = 0; i < clients; i++)
+			success &= Check((downloads[i].success) && (downloads[i].bytes == fileSize), "every parallel download got the whole segment");
+
+		recorder.phase = BENCH_PHASE_RANGE;
+		downloads[0].range = "bytes=1000-1999";
+		RunDownloads(downloads, 1);
+		success &= Check((downloads[0].status == 206) && (downloads[0].contentLength == 1000) && (downloads[0].bytes == 1000), "a range request got 1000 bytes");
+		downloads[0].range = nullptr;
+
+		// The same file as a recycled pool file with only its first half recorded
+		PoolEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		snprintf(entry.path, sizeof(entry.path), "session/00000000-recording.h264");
+		entry.state = POOL_ENTRY_DONE;
+		entry.length = fileSize / 2;
+		entry.dirty = fileSize;
+		int catalog = open(catalogName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if ((catalog >= 0) && (PoolCatalogWrite(catalog, 0, &entry)))
+		{
+			// Past the server's once a second look at the status and catalog
+			sleep(2);
+			RunDownloads(downloads, 1);
+			success &= Check((downloads[0].status == 200) && (downloads[0].contentLength == entry.length) && (downloads[0].bytes == entry.length),
+				"a pool file was cut at its length in the catalog");
+
+			char range[64];
+			snprintf(range, sizeof(range), "bytes=%llu-", (unsigned long long)entry.length);
+			downloads[0].range = range;
+			RunDownloads(downloads, 1);
+			success &= Check(downloads[0].status == 416, "a range past a pool file's length was refused");
+			downloads[0].range = nullptr;
+		}
+		else
+		{
+			success &= Check(false, "a pool file was cut at its length in the catalog");
+		}
+		if (catalog >= 0)
+			close(catalog);
+
+		recorder.phase = BENCH_PHASE_LIVE;
+		downloads[0].url = "/live";
+		downloads[0].seconds = BENCH_LIVE_SECONDS;
+		unsigned int live = RunDownloads(downloads, 1);
+		success &= Check((downloads[0].status == 200) && (downloads[0].bytes > 0), "/live followed the segment being recorded");
+
+		printf("One download: %u KB/s\n", single);
+		printf("%u parallel downloads: %u KB/s\n", clients, parallel);
+		printf("Live: %u KB/s while recording at %u KB/s\n", live, bitrate / 8 / 1024);
+		for (unsigned int i = 0; i < BENCH_PHASES; i++)
+		{
+			if (recorder.writes[i])
+				printf("Worst of %u recorder writes during %s: %llu us\n", recorder.writes[i], g_phaseNames[i], (unsigned long long)recorder.maxLatency[i]);
+		}
+
+		recorder.stop = true;
+		g_serverStop = true;
+		pthread_join(recorderThread, nullptr);
+		pthread_join(serverThread, nullptr);
+		server.Close();
+	}
+
+	unlink(finished);
+	unlink(recorder.path);
+	unlink(statusFile);
+	unlink(catalogName);
+	rmdir(sessionDir);
+	rmdir(rootDir);
+
+	return (success) ? 0 : 1;
+}
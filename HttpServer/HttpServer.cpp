@@ -0,0 +1,892 @@
+#include "HttpServer.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Largest single sendfile() call, keeps one client from hogging the loop
+#define HTTP_SEND_CHUNK (256 * 1024)
+
+static uint64_t GetMonotonicTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+static bool SetNonBlocking(int socket)
+{
+	int flags = fcntl(socket, F_GETFL, 0);
+	return (flags >= 0) && (fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0);
+}
+
+// Collapses repeated slashes so paths from the recorder and from the URL compare equal
+static void NormalisePath(char* path)
+{
+	char* out = path;
+	for (char* in = path; *in; in++)
+	{
+		if ((*in == '/') && (out > path) && (out[-1] == '/'))
+			continue;
+		*out++ = *in;
+	}
+	if ((out > path + 1) && (out[-1] == '/'))
+		out--;
+	*out = 0;
+}
+
+static int HexValue(char c)
+{
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return -1;
+}
+
+static bool UrlDecode(const char* in, char* out, size_t size)
+{
+	size_t o = 0;
+	while (*in && (o + 1 < size))
+	{
+		if (*in == '%')
+		{
+			int high = HexValue(in[1]);
+			int low = (high >= 0) ? HexValue(in[2]) : -1;
+			if (low < 0)
+				return false;
+			out[o++] = (char)((high << 4) | low);
+			in += 3;
+		}
+		else
+		{
+			out[o++] = *in++;
+		}
+	}
+	out[o] = 0;
+	return (*in == 0);
+}
+
+static void UrlEncode(const char* in, char* out, size_t size)
+{
+	static const char hex[] = "0123456789ABCDEF";
+
+	size_t o = 0;
+	for (; *in && (o + 4 < size); in++)
+	{
+		unsigned char c = *in;
+		if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')) || strchr("-_.~/", c))
+		{
+			out[o++] = c;
+		}
+		else
+		{
+			out[o++] = '%';
+			out[o++] = hex[c >> 4];
+			out[o++] = hex[c & 0xF];
+		}
+	}
+	out[o] = 0;
+}
+
+static const char* GetContentType(const char* path)
+{
+	const char* extension = strrchr(path, '.');
+	if (!extension)
+		return "application/octet-stream";
+	if (strcmp(extension, ".h264") == 0)
+		return "video/h264";
+	if (strcmp(extension, ".jpg") == 0)
+		return "image/jpeg";
+	if (strcmp(extension, ".txt") == 0)
+		return "text/plain";
+	if (strcmp(extension, ".m3u8") == 0)
+		return "application/vnd.apple.mpegurl";
+	if (strcmp(extension, ".ts") == 0)
+		return "video/mp2t";
+	return "application/octet-stream";
+}
+
+// Parses a single "bytes=first-last" range, returns false if it can't be satisfied
+static bool ParseRange(const char* range, off_t size, off_t* first, off_t* last)
+{
+	if (strncmp(range, "bytes=", 6) != 0)
+		return false;
+	range += 6;
+
+	char* end;
+	if (*range == '-')
+	{
+		// Suffix range, the last n bytes
+		long long length = strtoll(range + 1, &end, 10);
+		if ((end == range + 1) || (length <= 0) || (size == 0))
+			return false;
+		*first = (length >= size) ? 0 : (size - length);
+		*last = size - 1;
+		return true;
+	}
+
+	long long start = strtoll(range, &end, 10);
+	if ((end == range) || (*end != '-') || (start >= size))
+		return false;
+
+	*first = start;
+	*last = size - 1;
+	if (end[1] && (end[1] != ','))
+	{
+		long long stop = strtoll(end + 1, &end, 10);
+		if (stop < start)
+			return false;
+		if (stop < *last)
+			*last = stop;
+	}
+	return true;
+}
+
+HttpServer::HttpServer()
+{
+	m_listenSocket = -1;
+	m_rootDir[0] = 0;
+	m_hlsDir[0] = 0;
+	m_statusFile[0] = 0;
+	m_activeSegment[0] = 0;
+	m_statusTime = 0;
+	m_activeLength = 0;
+	m_previousSegment[0] = 0;
+	m_previousLength = 0;
+	m_poolEntries = nullptr;
+	m_poolEntryCount = 0;
+	m_poolEntryCapacity = 0;
+
+	for (unsigned int i = 0; i < HTTP_MAX_CLIENTS; i++)
+	{
+		memset(&m_clients[i], 0, sizeof(HttpClient));
+		m_clients[i].state = HTTP_CLIENT_FREE;
+		m_clients[i].socket = -1;
+		m_clients[i].file = -1;
+	}
+}
+
+HttpServer::~HttpServer()
+{
+	Close();
+	free(m_poolEntries);
+}
+
+bool HttpServer::Open(unsigned int port, const char* rootDir, const char* statusFile)
+{
+	snprintf(m_rootDir, sizeof(m_rootDir), "%s", rootDir);
+	NormalisePath(m_rootDir);
+	snprintf(m_statusFile, sizeof(m_statusFile), "%s", statusFile);
+
+	m_listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+	if (m_listenSocket < 0)
+	{
+		printf("Failed to create HTTP socket (%d)\n", errno);
+		return false;
+	}
+
+	int reuse = 1;
+	setsockopt(m_listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+
+	if ((bind(m_listenSocket, (struct sockaddr*)&address, sizeof(address)) != 0) || (listen(m_listenSocket, 4) != 0) || (!SetNonBlocking(m_listenSocket)))
+	{
+		printf("Failed to listen on HTTP port %u (%d)\n", port, errno);
+		close(m_listenSocket);
+		m_listenSocket = -1;
+		return false;
+	}
+
+	printf("Serving %s over HTTP on port %u\n", m_rootDir, port);
+	return true;
+}
+
+void HttpServer::SetHlsDir(const char* hlsDir)
+{
+	snprintf(m_hlsDir, sizeof(m_hlsDir), "%s", hlsDir);
+	NormalisePath(m_hlsDir);
+}
+
+void HttpServer::Close()
+{
+	for (unsigned int i = 0; i < HTTP_MAX_CLIENTS; i++)
+	{
+		if (m_clients[i].state != HTTP_CLIENT_FREE)
+			CloseClient(&m_clients[i]);
+	}
+
+	if (m_listenSocket >= 0)
+	{
+		close(m_listenSocket);
+		m_listenSocket = -1;
+	}
+}
+
+void HttpServer::Update(int timeout)
+{
+	struct pollfd fds[HTTP_MAX_CLIENTS + 1];
+	HttpClient* clients[HTTP_MAX_CLIENTS + 1];
+	unsigned int count = 0;
+
+	fds[count].fd = m_listenSocket;
+	fds[count].events = POLLIN;
+	clients[count++] = nullptr;
+
+	bool following = false;
+	for (unsigned int i = 0; i < HTTP_MAX_CLIENTS; i++)
+	{
+		HttpClient* client = &m_clients[i];
+		if (client->state == HTTP_CLIENT_FREE)
+			continue;
+
+		// A live tail that has caught up with the recorder is polled on the timeout instead
+		bool waiting = (client->state == HTTP_CLIENT_SENDING) && (client->follow) && (client->headerSent == client->headerLength) && (client->fileOffset >= client->fileEnd);
+		if (waiting)
+			following = true;
+
+		fds[count].fd = client->socket;
+		fds[count].events = (client->state == HTTP_CLIENT_READING) ? POLLIN : (waiting ? 0 : POLLOUT);
+		clients[count++] = client;
+	}
+
+	if (following && ((timeout < 0) || (timeout > 100)))
+		timeout = 100;
+
+	if (poll(fds, count, timeout) < 0)
+		return;
+
+	for (unsigned int i = 1; i < count; i++)
+	{
+		HttpClient* client = clients[i];
+		if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+		{
+			CloseClient(client);
+			continue;
+		}
+
+		if (client->state == HTTP_CLIENT_READING)
+		{
+			if (fds[i].revents & POLLIN)
+				Read(client);
+		}
+		else if ((fds[i].revents & POLLOUT) || (client->follow))
+		{
+			Send(client);
+		}
+	}
+
+	if (fds[0].revents & POLLIN)
+		Accept();
+}
+
+void HttpServer::Accept()
+{
+	struct sockaddr_in address;
+	socklen_t addressLength = sizeof(address);
+	int socket = accept(m_listenSocket, (struct sockaddr*)&address, &addressLength);
+	if (socket < 0)
+		return;
+
+	HttpClient* client = nullptr;
+	for (unsigned int i = 0; i < HTTP_MAX_CLIENTS; i++)
+	{
+		if (m_clients[i].state == HTTP_CLIENT_FREE)
+		{
+			client = &m_clients[i];
+			break;
+		}
+	}
+
+	if ((!client) || (!SetNonBlocking(socket)))
+	{
+		static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+		send(socket, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+		close(socket);
+		return;
+	}
+
+	int noDelay = 1;
+	setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+	client->state = HTTP_CLIENT_READING;
+	client->socket = socket;
+	client->requestLength = 0;
+}
+
+void HttpServer::Read(HttpClient* client)
+{
+	ssize_t received = recv(client->socket, client->request + client->requestLength, HTTP_REQUEST_SIZE - 1 - client->requestLength, 0);
+	if (received <= 0)
+	{
+		if ((received == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+			CloseClient(client);
+		return;
+	}
+
+	client->requestLength += received;
+	client->request[client->requestLength] = 0;
+
+	if (strstr(client->request, "\r\n\r\n"))
+	{
+		HandleRequest(client);
+	}
+	else if (client->requestLength >= HTTP_REQUEST_SIZE - 1)
+	{
+		client->keepAlive = false;
+		SendError(client, "431 Request Header Fields Too Large");
+	}
+}
+
+void HttpServer::HandleRequest(HttpClient* client)
+{
+	// Take the request out of the buffer, anything after it is the next pipelined request
+	char request[HTTP_REQUEST_SIZE];
+	char* end = strstr(client->request, "\r\n\r\n");
+	size_t length = end - client->request;
+	memcpy(request, client->request, length);
+	request[length] = 0;
+
+	length += 4;
+	memmove(client->request, client->request + length, client->requestLength - length + 1);
+	client->requestLength -= length;
+
+	char method[8] = { 0 };
+	char target[512] = { 0 };
+	char version[16] = { 0 };
+	if (sscanf(request, "%7s %511s %15s", method, target, version) != 3)
+	{
+		client->keepAlive = false;
+		SendError(client, "400 Bad Request");
+		return;
+	}
+
+	// HTTP/1.1 keeps the connection open unless asked otherwise, 1.0 only when asked
+	const char* range = nullptr;
+	client->keepAlive = (strcmp(version, "HTTP/1.1") == 0);
+	for (char* line = strstr(request, "\r\n"); line; line = strstr(line, "\r\n"))
+	{
+		line += 2;
+		if (strncasecmp(line, "Range:", 6) == 0)
+		{
+			range = line + 6;
+			while (*range == ' ')
+				range++;
+		}
+		else if (strncasecmp(line, "Connection:", 11) == 0)
+		{
+			const char* value = line + 11;
+			while (*value == ' ')
+				value++;
+			if (strncasecmp(value, "close", 5) == 0)
+				client->keepAlive = false;
+			else if (strncasecmp(value, "keep-alive", 10) == 0)
+				client->keepAlive = true;
+		}
+	}
+
+	// Terminate the range value at the end of its line
+	char rangeValue[64] = { 0 };
+	if (range)
+	{
+		size_t length = strcspn(range, "\r\n");
+		if (length >= sizeof(rangeValue))
+			length = sizeof(rangeValue) - 1;
+		memcpy(rangeValue, range, length);
+		range = rangeValue;
+	}
+
+	bool head = (strcmp(method, "HEAD") == 0);
+	if ((!head) && (strcmp(method, "GET") != 0))
+	{
+		SendError(client, "405 Method Not Allowed");
+		return;
+	}
+
+	bool follow = false;
+	char* query = strchr(target, '?');
+	if (query)
+	{
+		*query++ = 0;
+		follow = (strstr(query, "follow") != nullptr);
+	}
+
+	char url[512];
+	if ((target[0] != '/') || (!UrlDecode(target, url, sizeof(url))) || (strstr(url, "..")))
+	{
+		SendError(client, "400 Bad Request");
+		return;
+	}
+
+	char path[640];
+	if (strcmp(url, "/live") == 0)
+	{
+		// The segment the recorder is writing right now, followed until it moves on
+		ReadStatus();
+		if (!m_activeSegment[0])
+		{
+			SendError(client, "404 Not Found");
+			return;
+		}
+		snprintf(path, sizeof(path), "%s", m_activeSegment);
+		follow = true;
+	}
+	else if ((m_hlsDir[0]) && ((strcmp(url, "/hls") == 0) || (strncmp(url, "/hls/", 5) == 0)))
+	{
+		snprintf(path, sizeof(path), "%s%s", m_hlsDir, url + 4);
+		NormalisePath(path);
+	}
+	else
+	{
+		snprintf(path, sizeof(path), "%s%s", m_rootDir, url);
+		NormalisePath(path);
+	}
+
+	struct stat sb;
+	if (stat(path, &sb) != 0)
+	{
+		SendError(client, "404 Not Found");
+		return;
+	}
+
+	bool ok;
+	if (S_ISDIR(sb.st_mode))
+		ok = ListDirectory(client, path, url);
+	else
+		ok = ServeFile(client, path, range, follow);
+
+	if (!ok)
+		return;
+
+	if (head)
+	{
+		free(client->body);
+		client->body = nullptr;
+		client->bodyLength = 0;
+		if (client->file >= 0)
+		{
+			close(client->file);
+			client->file = -1;
+		}
+		client->follow = false;
+	}
+
+	client->state = HTTP_CLIENT_SENDING;
+	client->startTime = GetMonotonicTime();
+	client->bytesSent = 0;
+	Send(client);
+}
+
+void HttpServer::SendError(HttpClient* client, const char* status)
+{
+	client->headerLength = snprintf(client->header, HTTP_HEADER_SIZE,
+		"HTTP/1.1 %s\r\nContent-Type: text/plain\r\nContent-Length: %u\r\nConnection: %s\r\n\r\n%s\n",
+		status, (unsigned int)strlen(status) + 1, client->keepAlive ? "keep-alive" : "close", status);
+	client->headerSent = 0;
+	client->state = HTTP_CLIENT_SENDING;
+	Send(client);
+}
+
+bool HttpServer::ListDirectory(HttpClient* client, const char* path, const char* url)
+{
+	struct dirent** entries = nullptr;
+	int count = scandir(path, &entries, nullptr, alphasort);
+	if (count < 0)
+	{
+		SendError(client, "403 Forbidden");
+		return false;
+	}
+
+	char* body = nullptr;
+	size_t bodyLength = 0;
+	FILE* stream = open_memstream(&body, &bodyLength);
+	if (!stream)
+	{
+		for (int i = 0; i < count; i++)
+			free(entries[i]);
+		free(entries);
+		SendError(client, "500 Internal Server Error");
+		return false;
+	}
+
+	char base[512];
+	snprintf(base, sizeof(base), "%s", url);
+	NormalisePath(base);
+	if (strcmp(base, "/") == 0)
+		base[0] = 0;
+
+	fprintf(stream, "<html><head><title>%s/</title></head><body>\n<h1>%s/</h1>\n", base, base);
+	ReadStatus();
+	if (m_activeSegment[0])
+		fprintf(stream, "<p><a href=\"/live\">Live</a></p>\n");
+	fprintf(stream, "<pre>\n");
+	if (base[0])
+		fprintf(stream, "<a href=\"../\">../</a>\n");
+
+	for (int i = 0; i < count; i++)
+	{
+		const char* name = entries[i]->d_name;
+		if (name[0] != '.')
+		{
+			char fileName[512];
+			snprintf(fileName, sizeof(fileName), "%s/%s", path, name);
+
+			struct stat sb;
+			if (stat(fileName, &sb) == 0)
+			{
+				char link[768];
+				UrlEncode(name, link, sizeof(link));
+
+				if (S_ISDIR(sb.st_mode))
+					fprintf(stream, "<a href=\"%s/%s/\">%s/</a>\n", base, link, name);
+				else
+					fprintf(stream, "<a href=\"%s/%s\">%s</a> %llu%s\n", base, link, name, (unsigned long long)GetSegmentEnd(fileName, sb.st_size),
+						IsActiveSegment(fileName) ? " (recording)" : "");
+			}
+		}
+		free(entries[i]);
+	}
+	free(entries);
+
+	fprintf(stream, "</pre></body></html>\n");
+	fclose(stream);
+
+	client->body = body;
+	client->bodyLength = bodyLength;
+	client->bodySent = 0;
+
+	client->headerLength = snprintf(client->header, HTTP_HEADER_SIZE,
+		"HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: %u\r\nCache-Control: no-cache\r\nConnection: %s\r\n\r\n",
+		(unsigned int)bodyLength, client->keepAlive ? "keep-alive" : "close");
+	client->headerSent = 0;
+	return true;
+}
+
+bool HttpServer::ServeFile(HttpClient* client, const char* path, const char* range, bool follow)
+{
+	int file = open(path, O_RDONLY);
+	if (file < 0)
+	{
+		SendError(client, "403 Forbidden");
+		return false;
+	}
+
+	struct stat sb;
+	fstat(file, &sb);
+	off_t size = GetSegmentEnd(path, sb.st_size);
+
+	// Only the segment being recorded can be followed, everything else is a plain download
+	if ((follow) && (!IsActiveSegment(path)))
+		follow = false;
+
+	const char* connection = client->keepAlive ? "keep-alive" : "close";
+	off_t first = 0;
+	off_t last = size - 1;
+
+	if (follow)
+	{
+		// The length isn't known yet, so the end of the response is the connection closing
+		client->keepAlive = false;
+		client->headerLength = snprintf(client->header, HTTP_HEADER_SIZE,
+			"HTTP/1.1 200 OK\r\nContent-Type: %s\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n",
+			GetContentType(path));
+		last = -1;
+	}
+	else if (range)
+	{
+		if (!ParseRange(range, size, &first, &last))
+		{
+			close(file);
+			client->headerLength = snprintf(client->header, HTTP_HEADER_SIZE,
+				"HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%llu\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n",
+				(unsigned long long)size, connection);
+			client->headerSent = 0;
+			client->state = HTTP_CLIENT_SENDING;
+			Send(client);
+			return false;
+		}
+
+		client->headerLength = snprintf(client->header, HTTP_HEADER_SIZE,
+			"HTTP/1.1 206 Partial Content\r\nContent-Type: %s\r\nContent-Length: %llu\r\nContent-Range: bytes %llu-%llu/%llu\r\nAccept-Ranges: bytes\r\nConnection: %s\r\n\r\n",
+			GetContentType(path), (unsigned long long)(last - first + 1), (unsigned long long)first, (unsigned long long)last, (unsigned long long)size, connection);
+	}
+	else
+	{
+		// Live playlists change every segment, players have to fetch them again each time
+		const char* extension = strrchr(path, '.');
+		bool playlist = (extension) && (strcmp(extension, ".m3u8") == 0);
+
+		client->headerLength = snprintf(client->header, HTTP_HEADER_SIZE,
+			"HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %llu\r\nAccept-Ranges: bytes\r\n%sConnection: %s\r\n\r\n",
+			GetContentType(path), (unsigned long long)size, playlist ? "Cache-Control: no-cache\r\n" : "", connection);
+	}
+
+	client->headerSent = 0;
+	client->file = file;
+	client->fileOffset = first;
+	client->fileEnd = follow ? size : (last + 1);
+	client->follow = follow;
+	snprintf(client->fileName, sizeof(client->fileName), "%s", path);
+
+	// Downloads read the whole file once, tell the kernel not to bother keeping it cached
+	if (!follow)
+		posix_fadvise(file, first, client->fileEnd - first, POSIX_FADV_SEQUENTIAL);
+
+	return true;
+}
+
+void HttpServer::Send(HttpClient* client)
+{
+	while (client->headerSent < client->headerLength)
+	{
+		ssize_t sent = send(client->socket, client->header + client->headerSent, client->headerLength - client->headerSent, MSG_NOSIGNAL);
+		if (sent <= 0)
+		{
+			if ((sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+				return;
+			CloseClient(client);
+			return;
+		}
+		client->headerSent += sent;
+	}
+
+	while (client->bodySent < client->bodyLength)
+	{
+		ssize_t sent = send(client->socket, client->body + client->bodySent, client->bodyLength - client->bodySent, MSG_NOSIGNAL);
+		if (sent <= 0)
+		{
+			if ((sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+				return;
+			CloseClient(client);
+			return;
+		}
+		client->bodySent += sent;
+		client->bytesSent += sent;
+	}
+
+	if (client->file >= 0)
+	{
+		if ((client->follow) && (client->fileOffset >= client->fileEnd))
+		{
+			// Caught up, pick up whatever the recorder has written since
+			struct stat sb;
+			if (fstat(client->file, &sb) == 0)
+				client->fileEnd = GetSegmentEnd(client->fileName, sb.st_size);
+
+			if (client->fileOffset >= client->fileEnd)
+			{
+				if (IsActiveSegment(client->fileName))
+					return;
+
+				// The recorder has moved on, check once more for the final write and finish
+				if (fstat(client->file, &sb) == 0)
+					client->fileEnd = GetSegmentEnd(client->fileName, sb.st_size);
+				client->follow = false;
+			}
+		}
+
+		while (client->fileOffset < client->fileEnd)
+		{
+			off_t remaining = client->fileEnd - client->fileOffset;
+			size_t chunk = (remaining > HTTP_SEND_CHUNK) ? HTTP_SEND_CHUNK : (size_t)remaining;
+
+			ssize_t sent = sendfile(client->socket, client->file, &client->fileOffset, chunk);
+			if (sent <= 0)
+			{
+				if ((sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+					return;
+
+				// The file shrank or vanished under us, nothing sensible left to send
+				CloseClient(client);
+				return;
+			}
+			client->bytesSent += sent;
+
+			// Give the other clients a turn
+			if ((size_t)sent == chunk)
+				return;
+		}
+
+		if (client->follow)
+			return;
+	}
+
+	Finish(client);
+}
+
+void HttpServer::Finish(HttpClient* client)
+{
+	if (client->file >= 0)
+	{
+		uint64_t elapsed = GetMonotonicTime() - client->startTime;
+		uint64_t rate = (elapsed > 0) ? (client->bytesSent * 1000000 / elapsed) : 0;
+		printf("Sent %s: %llu bytes in %llu ms (%llu KB/s)\n", client->fileName, (unsigned long long)client->bytesSent, (unsigned long long)(elapsed / 1000), (unsigned long long)(rate / 1024));
+
+		close(client->file);
+		client->file = -1;
+	}
+
+	free(client->body);
+	client->body = nullptr;
+	client->bodyLength = 0;
+	client->bodySent = 0;
+	client->headerLength = 0;
+	client->headerSent = 0;
+	client->follow = false;
+
+	if (!client->keepAlive)
+	{
+		CloseClient(client);
+		return;
+	}
+
+	// Pipelined requests already in the buffer are handled straight away
+	client->state = HTTP_CLIENT_READING;
+	if (strstr(client->request, "\r\n\r\n"))
+		HandleRequest(client);
+}
+
+void HttpServer::CloseClient(HttpClient* client)
+{
+	if (client->file >= 0)
+		close(client->file);
+	if (client->socket >= 0)
+		close(client->socket);
+	free(client->body);
+
+	memset(client, 0, sizeof(HttpClient));
+	client->state = HTTP_CLIENT_FREE;
+	client->socket = -1;
+	client->file = -1;
+}
+
+bool HttpServer::IsActiveSegment(const char* path)
+{
+	ReadStatus();
+	return (m_activeSegment[0]) && (strcmp(path, m_activeSegment) == 0);
+}
+
+void HttpServer::ReadStatus()
+{
+	uint64_t now = GetMonotonicTime();
+	if ((m_statusTime) && (now - m_statusTime < 1000000))
+		return;
+	m_statusTime = now;
+
+	m_activeSegment[0] = 0;
+	m_activeLength = 0;
+	m_previousSegment[0] = 0;
+	m_previousLength = 0;
+
+	ReadPoolCatalog();
+
+	// The recorder renames a complete status file into place, so this never sees a partial one
+	FILE* file = fopen(m_statusFile, "r");
+	if (!file)
+		return;
+
+	char line[512];
+	while (fgets(line, sizeof(line), file))
+	{
+		if (strncmp(line, "segment: ", 9) == 0)
+		{
+			line[strcspn(line, "\r\n")] = 0;
+			snprintf(m_activeSegment, sizeof(m_activeSegment), "%s", line + 9);
+			NormalisePath(m_activeSegment);
+		}
+		else if (strncmp(line, "segment.length: ", 16) == 0)
+		{
+			m_activeLength = strtoull(line + 16, nullptr, 10);
+		}
+		else if (strncmp(line, "segment.previous: ", 18) == 0)
+		{
+			// "<length> <path>"
+			char* path = nullptr;
+			m_previousLength = strtoull(line + 18, &path, 10);
+			line[strcspn(line, "\r\n")] = 0;
+			snprintf(m_previousSegment, sizeof(m_previousSegment), "%s", path + strspn(path, " "));
+			NormalisePath(m_previousSegment);
+		}
+	}
+	fclose(file);
+}
+
+void HttpServer::ReadPoolCatalog()
+{
+	m_poolEntryCount = 0;
+
+	char catalogName[255];
+	snprintf(catalogName, sizeof(catalogName), "%s/%s", m_rootDir, POOL_CATALOG_FILE);
+
+	// Without a pool there is no catalog and every file is all recording
+	int catalog = open(catalogName, O_RDONLY);
+	if (catalog < 0)
+		return;
+
+	PoolEntry entry;
+	for (unsigned int index = 0; PoolCatalogRead(catalog, index, &entry); index++)
+	{
+		if (entry.state == POOL_ENTRY_MISSING)
+			continue;
+
+		if (m_poolEntryCount == m_poolEntryCapacity)
+		{
+			unsigned int capacity = (m_poolEntryCapacity) ? m_poolEntryCapacity * 2 : 64;
+			PoolEntry* entries = (PoolEntry*)realloc(m_poolEntries, capacity * sizeof(PoolEntry));
+			if (!entries)
+				break;
+
+			m_poolEntries = entries;
+			m_poolEntryCapacity = capacity;
+		}
+
+		NormalisePath(entry.path);
+		m_poolEntries[m_poolEntryCount++] = entry;
+	}
+	close(catalog);
+}
+
+off_t HttpServer::GetSegmentEnd(const char* path, off_t fileSize)
+{
+	ReadStatus();
+
+	// The status file is more recent than the catalog for the segments it names
+	if ((m_activeLength) && (strcmp(path, m_activeSegment) == 0))
+		return ((off_t)m_activeLength < fileSize) ? (off_t)m_activeLength : fileSize;
+	if ((m_previousLength) && (strcmp(path, m_previousSegment) == 0))
+		return ((off_t)m_previousLength < fileSize) ? (off_t)m_previousLength : fileSize;
+
+	// Pool paths are relative to the recordings directory
+	size_t rootLength = strlen(m_rootDir);
+	while ((rootLength) && (m_rootDir[rootLength - 1] == '/'))
+		rootLength--;
+	if ((strncmp(path, m_rootDir, rootLength) != 0) || (path[rootLength] != '/'))
+		return fileSize;
+	path += rootLength + 1;
+
+	for (unsigned int i = 0; i < m_poolEntryCount; i++)
+	{
+		if (strcmp(path, m_poolEntries[i].path) == 0)
+			return ((off_t)m_poolEntries[i].length < fileSize) ? (off_t)m_poolEntries[i].length : fileSize;
+	}
+
+	return fileSize;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "../libs/Storage/PoolCatalog.h"
+
+/*
+ *	HttpServer
+ *	Small HTTP/1.1 server for browsing and downloading the recordings.
+ *	Sessions and segments are listed as plain HTML, files are sent with sendfile() and support
+ *	byte ranges, and /live (or any file with ?follow) keeps sending the active segment as it grows.
+ *	The recorder's HLS directory, when there is one, is served under /hls/.
+ *	Files from the recorder's segment pool are served up to the length of their recording in the
+ *	pool catalog, a recycled file can still have the previous recording after it.
+*/
+
+#define HTTP_MAX_CLIENTS 8
+#define HTTP_REQUEST_SIZE 2048
+#define HTTP_HEADER_SIZE 1024
+
+enum HttpClientState
+{
+	HTTP_CLIENT_FREE,
+	HTTP_CLIENT_READING,
+	HTTP_CLIENT_SENDING,
+};
+
+struct HttpClient
+{
+	HttpClientState state;
+	int socket;
+
+	char request[HTTP_REQUEST_SIZE];
+	unsigned int requestLength;
+	bool keepAlive;
+
+	// Response headers, then either a generated body or a file
+	char header[HTTP_HEADER_SIZE];
+	size_t headerLength;
+	size_t headerSent;
+
+	char* body;
+	size_t bodyLength;
+	size_t bodySent;
+
+	int file;
+	off_t fileOffset;
+	off_t fileEnd;
+
+	// Keep sending the file as it grows for as long as it is the recorder's active segment
+	bool follow;
+	char fileName[512];
+
+	uint64_t startTime;
+	uint64_t bytesSent;
+};
+
+class HttpServer
+{
+public:
+	HttpServer();
+	~HttpServer();
+
+	bool Open(unsigned int port, const char* rootDir, const char* statusFile);
+	void SetHlsDir(const char* hlsDir);
+	void Close();
+
+	// Waits up to timeout ms for something to do
+	void Update(int timeout);
+
+private:
+	void Accept();
+	void Read(HttpClient* client);
+	void Send(HttpClient* client);
+	void Finish(HttpClient* client);
+	void CloseClient(HttpClient* client);
+
+	void HandleRequest(HttpClient* client);
+	void SendError(HttpClient* client, const char* status);
+	bool ListDirectory(HttpClient* client, const char* path, const char* url);
+	bool ServeFile(HttpClient* client, const char* path, const char* range, bool follow);
+
+	bool IsActiveSegment(const char* path);
+	void ReadStatus();
+	void ReadPoolCatalog();
+
+	// Where a segment's recording ends, a recycled pool file can be longer than that
+	off_t GetSegmentEnd(const char* path, off_t fileSize);
+
+private:
+	int m_listenSocket;
+	char m_rootDir[128];
+	char m_hlsDir[128];
+	char m_statusFile[128];
+
+	HttpClient m_clients[HTTP_MAX_CLIENTS];
+
+	// Active segment from the recorder's status file, re-read at most once a second
+	char m_activeSegment[512];
+	uint64_t m_statusTime;
+
+	// Only known when the recorder uses a segment pool
+	uint64_t m_activeLength;
+	char m_previousSegment[512];
+	uint64_t m_previousLength;
+
+	// The pool catalog, re-read along with the status file
+	PoolEntry* m_poolEntries;
+	unsigned int m_poolEntryCount;
+	unsigned int m_poolEntryCapacity;
+};
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#include "HttpServer.h"
+
+// Not exported by the C library, see linux/ioprio.h
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+static bool g_shouldExit = false;
+
+void sig_handler(int signo)
+{
+	g_shouldExit = true;
+}
+
+static void Usage(const char* name)
+{
+	printf("Usage: %s [-p port] [-d recordings] [-s status file] [-l hls directory]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int port = 80;
+	const char* rootDir = "/recordings";
+	const char* statusFile = "/tmp/recorder.status";
+	const char* hlsDir = "/tmp/hls";
+
+	int option;
+	while ((option = getopt(argc, argv, "p:d:s:l:h")) != -1)
+	{
+		switch (option)
+		{
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'd':
+			rootDir = optarg;
+			break;
+		case 's':
+			statusFile = optarg;
+			break;
+		case 'l':
+			hlsDir = optarg;
+			break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+	signal(SIGPIPE, SIG_IGN);
+
+	// Downloads only get the disk when the recorder isn't using it, so they can never make it drop frames
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+		printf("Failed to set idle IO priority\n");
+	setpriority(PRIO_PROCESS, 0, 10);
+
+	HttpServer server;
+	if (!server.Open(port, rootDir, statusFile))
+		return 1;
+	server.SetHlsDir(hlsDir);
+
+	while (!g_shouldExit)
+		server.Update(1000);
+
+	server.Close();
+	return 0;
+}
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../Recorder/MotionDetector.h"
+
+#define MAX_EVENTS 256
+
+struct MotionEvent
+{
+	unsigned int frame;
+	int region;
+	// Tenths of a percent
+	unsigned int score;
+};
+
+struct ReplayResult
+{
+	MotionEvent events[MAX_EVENTS];
+	unsigned int eventCount;
+
+	unsigned int frames;
+	unsigned int movingFrames;
+	unsigned int maxScore;
+};
+
+static void Usage(const char* name)
+{
+	printf("Usage: %s [-W width] [-H height] [-r regions] [-m magnitude] [-s sad] [-p percent] [-f frames] <dump file>\n", name);
+	printf("  Plays a vector dump (motion.dump) through the motion detector and lists the events\n");
+	printf("  -W and -H are the main stream's size when it was recorded (1920x1080), the others are the\n");
+	printf("  motion.* keys of the same name (whole frame, 2, 0, 2, 3)\n");
+	printf("Usage: %s -t\n", name);
+	printf("  Plays made up dumps through the detector and checks the regions, SAD filter and frame count\n");
+}
+
+// One frame's worth of vectors at a time, the way the encoder hands them over
+static bool Replay(FILE* file, MotionDetector* motion, ReplayResult* result)
+{
+	memset(result, 0, sizeof(ReplayResult));
+
+	size_t size = motion->GetVectorBufferSize();
+	uint8_t* vectors = (uint8_t*)malloc(size);
+	if (!vectors)
+		return false;
+
+	while (fread(vectors, 1, size, file) == size)
+	{
+		if ((motion->Process(vectors, size)) && (result->eventCount < MAX_EVENTS))
+		{
+			MotionEvent& event = result->events[result->eventCount++];
+			event.frame = result->frames;
+			event.region = motion->GetTriggerRegion();
+			event.score = motion->GetLastScore();
+		}
+
+		if (motion->InMotion())
+			result->movingFrames++;
+		if (motion->GetLastScore() > result->maxScore)
+			result->maxScore = motion->GetLastScore();
+
+		result->frames++;
+	}
+
+	free(vectors);
+	return true;
+}
+
+/*
+ *	Self test
+ *	A 320x240 stream has 20x15 macroblocks plus the extra column. Two regions, the top left and the
+ *	bottom right quarter, with 10% of a region moving by 2 or more over 3 frames to trigger, and
+ *	vectors with a SAD over 300 ignored.
+*/
+
+#define TEST_WIDTH 320
+#define TEST_HEIGHT 240
+#define TEST_COLUMNS 21
+#define TEST_ROWS 15
+
+#define TEST_REGIONS "0,0,50,50;50,50,50,50"
+#define TEST_MAGNITUDE 2
+#define TEST_SAD 300
+#define TEST_PERCENT 10
+#define TEST_FRAMES 3
+
+#define TEST_GOOD_SAD 100
+#define TEST_BAD_SAD 1000
+
+enum TestArea
+{
+	TEST_AREA_NONE,
+	TEST_AREA_TOP_LEFT,
+	TEST_AREA_BOTTOM_RIGHT,
+	// Outside both regions
+	TEST_AREA_TOP_RIGHT,
+	// The column that isn't part of the picture
+	TEST_AREA_EXTRA_COLUMN,
+};
+
+struct TestFrames
+{
+	TestArea area;
+	unsigned int sad;
+	unsigned int count;
+};
+
+// Appends frames with every macroblock in the area moving, and a little sub-threshold jitter everywhere else
+static void WriteFrames(FILE* file, const TestFrames* frames, unsigned int frameCount)
+{
+	MotionVector vectors[TEST_COLUMNS * TEST_ROWS];
+
+	for (unsigned int i = 0; i < frameCount; i++)
+	{
+		unsigned int left = 0, top = 0, right = 0, bottom = 0;
+		switch (frames[i].area)
+		{
+		case TEST_AREA_TOP_LEFT:
+			right = 5;
+			bottom = 4;
+			break;
+		case TEST_AREA_BOTTOM_RIGHT:
+			left = 12;
+			top = 10;
+			right = 17;
+			bottom = 14;
+			break;
+		case TEST_AREA_TOP_RIGHT:
+			left = 12;
+			right = 20;
+			bottom = 7;
+			break;
+		case TEST_AREA_EXTRA_COLUMN:
+			left = 20;
+			right = 21;
+			bottom = TEST_ROWS;
+			break;
+		default:
+			break;
+		}
+
+		for (unsigned int frame = 0; frame < frames[i].count; frame++)
+		{
+			for (unsigned int y = 0; y < TEST_ROWS; y++)
+			{
+				for (unsigned int x = 0; x < TEST_COLUMNS; x++)
+				{
+					MotionVector& mv = vectors[y * TEST_COLUMNS + x];
+					bool moving = (x >= left) && (x < right) && (y >= top) && (y < bottom);
+					mv.x = (moving) ? 3 : (int8_t)((x + y + frame) % 2);
+					mv.y = (moving) ? -1 : 0;
+					mv.sad = (moving) ? frames[i].sad : TEST_GOOD_SAD;
+				}
+			}
+
+			fwrite(vectors, 1, sizeof(vectors), file);
+		}
+	}
+}
+
+static bool RunTest(const char* description, const TestFrames* frames, unsigned int frameCount, unsigned int maxSad,
+	unsigned int expectedCount, const MotionEvent* expected)
+{
+	FILE* file = tmpfile();
+	if (!file)
+	{
+		printf("FAIL: %s, no temporary file\n", description);
+		return false;
+	}
+
+	WriteFrames(file, frames, frameCount);
+	rewind(file);
+
+	MotionDetector motion;
+	motion.SetRegions(TEST_REGIONS);
+	motion.SetThresholds(TEST_MAGNITUDE, maxSad, TEST_PERCENT, TEST_FRAMES);
+	motion.SetFrameSize(TEST_WIDTH, TEST_HEIGHT);
+
+	ReplayResult result;
+	bool passed = Replay(file, &motion, &result);
+	fclose(file);
+
+	passed = passed && (result.eventCount == expectedCount);
+	for (unsigned int i = 0; (passed) && (i < expectedCount); i++)
+		passed = (result.events[i].frame == expected[i].frame) && (result.events[i].region == expected[i].region);
+
+	printf("%s: %s\n", (passed) ? "pass" : "FAIL", description);
+	if (!passed)
+	{
+		for (unsigned int i = 0; i < result.eventCount; i++)
+			printf("  event at frame %u in region %d\n", result.events[i].frame, result.events[i].region);
+	}
+
+	return passed;
+}
+
+static int RunSelfTest()
+{
+	bool passed = true;
+
+	{
+		static const TestFrames frames[] = { { TEST_AREA_NONE, 0, 5 }, { TEST_AREA_BOTTOM_RIGHT, TEST_GOOD_SAD, 6 } };
+		static const MotionEvent expected[] = { { 7, 1, 0 } };
+		passed &= RunTest("motion in the second region raises an event for it", frames, 2, TEST_SAD, 1, expected);
+	}
+	{
+		static const TestFrames frames[] = { { TEST_AREA_TOP_RIGHT, TEST_GOOD_SAD, 10 }, { TEST_AREA_EXTRA_COLUMN, TEST_GOOD_SAD, 10 } };
+		passed &= RunTest("motion outside the regions and in the extra column is ignored", frames, 2, TEST_SAD, 0, nullptr);
+	}
+	{
+		static const TestFrames frames[] = { { TEST_AREA_TOP_LEFT, TEST_BAD_SAD, 10 } };
+		passed &= RunTest("vectors over motion.sad don't count", frames, 1, TEST_SAD, 0, nullptr);
+
+		static const MotionEvent expected[] = { { 2, 0, 0 } };
+		passed &= RunTest("the same vectors count with motion.sad = 0", frames, 1, 0, 1, expected);
+	}
+	{
+		static const TestFrames frames[] = {
+			{ TEST_AREA_TOP_LEFT, TEST_GOOD_SAD, 2 }, { TEST_AREA_NONE, 0, 1 },
+			{ TEST_AREA_TOP_LEFT, TEST_GOOD_SAD, 2 }, { TEST_AREA_NONE, 0, 1 },
+		};
+		passed &= RunTest("fewer moving frames in a row than motion.frames raise nothing", frames, 4, TEST_SAD, 0, nullptr);
+	}
+	{
+		// Once in motion it takes a still frame before the next event
+		static const TestFrames frames[] = {
+			{ TEST_AREA_TOP_LEFT, TEST_GOOD_SAD, 8 }, { TEST_AREA_NONE, 0, 1 },
+			{ TEST_AREA_BOTTOM_RIGHT, TEST_GOOD_SAD, 3 },
+		};
+		static const MotionEvent expected[] = { { 2, 0, 0 }, { 11, 1, 0 } };
+		passed &= RunTest("one event per run of motion, another after a still frame", frames, 3, TEST_SAD, 2, expected);
+	}
+
+	return (passed) ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int width = 1920;
+	unsigned int height = 1080;
+	const char* regions = "";
+	unsigned int magnitude = 2;
+	unsigned int maxSad = 0;
+	unsigned int percent = 2;
+	unsigned int frames = 3;
+
+	int option;
+	while ((option = getopt(argc, argv, "W:H:r:m:s:p:f:th")) != -1)
+	{
+		switch (option)
+		{
+		case 'W':
+			width = strtoul(optarg, nullptr, 0);
+			break;
+		case 'H':
+			height = strtoul(optarg, nullptr, 0);
+			break;
+		case 'r':
+			regions = optarg;
+			break;
+		case 'm':
+			magnitude = strtoul(optarg, nullptr, 0);
+			break;
+		case 's':
+			maxSad = strtoul(optarg, nullptr, 0);
+			break;
+		case 'p':
+			percent = strtoul(optarg, nullptr, 0);
+			break;
+		case 'f':
+			frames = strtoul(optarg, nullptr, 0);
+			break;
+		case 't':
+			return RunSelfTest();
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	FILE* file = fopen(argv[optind], "rb");
+	if (!file)
+	{
+		printf("Failed to open %s\n", argv[optind]);
+		return 1;
+	}
+
+	MotionDetector motion;
+	if (!motion.SetRegions(regions))
+		printf("Some motion regions were invalid\n");
+	motion.SetThresholds(magnitude, maxSad, percent, frames);
+	motion.SetFrameSize(width, height);
+
+	ReplayResult result;
+	bool success = Replay(file, &motion, &result);
+	fclose(file);
+	if (!success)
+		return 1;
+
+	for (unsigned int i = 0; i < result.eventCount; i++)
+	{
+		const MotionEvent& event = result.events[i];
+		printf("Frame %6u: motion in region %d (%u.%u%% moving)\n", event.frame, event.region, event.score / 10, event.score % 10);
+	}
+
+	printf("%u frames, %u events, in motion for %u frames, at most %u.%u%% moving\n", result.frames, result.eventCount,
+		result.movingFrames, result.maxScore / 10, result.maxScore % 10);
+	return 0;
+}
@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "../libs/Storage/RawLog.h"
+#include "../libs/Storage/RawLogReader.h"
+#include "../libs/Storage/RawLogWriter.h"
+#include "../Recorder/H264.h"
+
+static void Usage(const char* name)
+{
+	printf("Usage: %s format [-e extent size in kB] <device>\n", name);
+	printf("       %s list <device>\n", name);
+	printf("       %s export [-s start] [-e end] [-o output.h264] <device>\n", name);
+	printf("       %s import [-f framerate] [-t start] -i input.h264 <device>\n", name);
+	printf("Times are \"YYYY-MM-DD HH:MM:SS\" local time or seconds since the epoch\n");
+}
+
+static bool ParseTime(const char* text, uint64_t* time)
+{
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+
+	const char* end = strptime(text, "%Y-%m-%d %H:%M:%S", &tm);
+	if ((end) && (!*end))
+	{
+		tm.tm_isdst = -1;
+		*time = (uint64_t)mktime(&tm) * 1000000;
+		return true;
+	}
+
+	char* numberEnd;
+	unsigned long long seconds = strtoull(text, &numberEnd, 10);
+	if ((numberEnd == text) || (*numberEnd))
+	{
+		printf("Can't read the time '%s'\n", text);
+		return false;
+	}
+
+	*time = (uint64_t)seconds * 1000000;
+	return true;
+}
+
+static const char* FormatTime(uint64_t time, char* text, size_t size)
+{
+	time_t seconds = (time_t)(time / 1000000);
+	strftime(text, size, "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+	return text;
+}
+
+static int Format(const char* device, unsigned int extentSize)
+{
+	int fd = open(device, O_RDWR);
+	if (fd < 0)
+	{
+		printf("Failed to open %s: %s\n", device, strerror(errno));
+		return 1;
+	}
+
+	bool success = RawLogFormat(fd, extentSize);
+	close(fd);
+	return (success) ? 0 : 1;
+}
+
+static int List(const char* device)
+{
+	RawLogReader reader;
+	if (!reader.Open(device))
+		return 1;
+
+	const RawLogSuperblock* superblock = reader.GetSuperblock();
+	printf("%u of %u extents of %u bytes in use\n", reader.GetExtentCount(), superblock->extentCount, superblock->extentSize);
+
+	// Runs of consecutive extents, a break means extents were lost or the recorder was restarted without one
+	char start[32];
+	char end[32];
+	unsigned int runStart = 0;
+	for (unsigned int i = 1; i <= reader.GetExtentCount(); i++)
+	{
+		if ((i < reader.GetExtentCount()) && (reader.GetExtent(i)->sequence == reader.GetExtent(i - 1)->sequence + 1))
+			continue;
+
+		const RawLogIndexEntry* first = reader.GetExtent(runStart);
+		const RawLogIndexEntry* last = reader.GetExtent(i - 1);
+		printf("  extents %llu-%llu: %s to %s\n", (unsigned long long)first->sequence, (unsigned long long)last->sequence,
+			FormatTime(first->firstTime, start, sizeof(start)), FormatTime(last->lastTime, end, sizeof(end)));
+
+		runStart = i;
+	}
+
+	return 0;
+}
+
+// A decoder can start at the first of a run of parameter sets, or at an IDR that doesn't follow any
+static bool IsStartPoint(const RawLogRecord* record, bool afterConfig)
+{
+	if ((record->flags & RAWLOG_RECORD_CONTINUED) || (afterConfig))
+		return false;
+
+	return (record->flags & (RAWLOG_RECORD_CONFIG | RAWLOG_RECORD_KEYFRAME)) != 0;
+}
+
+static int Export(const char* device, uint64_t startTime, uint64_t endTime, const char* outputName)
+{
+	RawLogReader reader;
+	if (!reader.Open(device))
+		return 1;
+
+	// Begin on an extent holding the last keyframe before the start, or the first one after it
+	unsigned int firstExtent = reader.FindExtent(startTime);
+	if (firstExtent == reader.GetExtentCount())
+	{
+		printf("Nothing was recorded after the start time\n");
+		return 1;
+	}
+
+	while ((firstExtent > 0) && ((reader.GetExtent(firstExtent)->firstTime > startTime) || (!(reader.GetExtent(firstExtent)->flags & RAWLOG_EXTENT_KEYFRAME))))
+		firstExtent--;
+
+	// First pass, find where to start
+	unsigned int startExtent = reader.GetExtentCount();
+	unsigned int startRecord = 0;
+	bool afterConfig = false;
+	for (unsigned int i = firstExtent; i < reader.GetExtentCount(); i++)
+	{
+		if (!reader.ReadExtent(i))
+			continue;
+
+		const RawLogRecord* record;
+		const uint8_t* data;
+		for (unsigned int index = 0; (record = reader.NextRecord(&data)) != nullptr; index++)
+		{
+			if ((IsStartPoint(record, afterConfig)) && ((record->time <= startTime) || (startExtent == reader.GetExtentCount())))
+			{
+				startExtent = i;
+				startRecord = index;
+			}
+			afterConfig = (record->flags & RAWLOG_RECORD_CONFIG) != 0;
+
+			if ((record->time > startTime) && (startExtent != reader.GetExtentCount()))
+				break;
+		}
+
+		if ((startExtent != reader.GetExtentCount()) && (reader.GetExtent(i)->lastTime > startTime))
+			break;
+	}
+
+	if (startExtent == reader.GetExtentCount())
+	{
+		printf("No keyframe found in the time range\n");
+		return 1;
+	}
+
+	FILE* output = (outputName) ? fopen(outputName, "wb") : stdout;
+	if (!output)
+	{
+		printf("Failed to create %s: %s\n", outputName, strerror(errno));
+		return 1;
+	}
+
+	// Messages go to stderr from here on if the clip goes to stdout
+	FILE* log = (output == stdout) ? stderr : stdout;
+
+	uint64_t bytes = 0;
+	uint64_t firstTime = 0;
+	uint64_t lastTime = 0;
+	unsigned int gaps = 0;
+	bool writing = false;
+	bool frameStart = true;
+	bool done = false;
+	afterConfig = false;
+	uint64_t expectedSequence = reader.GetExtent(startExtent)->sequence;
+
+	for (unsigned int i = startExtent; (i < reader.GetExtentCount()) && (!done); i++)
+	{
+		// After a gap the stream can only carry on from the next keyframe
+		bool valid = reader.ReadExtent(i);
+		if ((!valid) || (reader.GetExtent(i)->sequence != expectedSequence))
+		{
+			if (writing)
+				gaps++;
+			writing = false;
+			frameStart = true;
+		}
+		expectedSequence = reader.GetExtent(i)->sequence + 1;
+
+		if (!valid)
+			continue;
+
+		const RawLogRecord* record;
+		const uint8_t* data;
+		for (unsigned int index = 0; (record = reader.NextRecord(&data)) != nullptr; index++)
+		{
+			if ((i == startExtent) && (index < startRecord))
+				continue;
+
+			if ((frameStart) && (!(record->flags & RAWLOG_RECORD_CONTINUED)) && (record->time > endTime) && (bytes))
+			{
+				done = true;
+				break;
+			}
+
+			if ((!writing) && (IsStartPoint(record, afterConfig)))
+			{
+				writing = true;
+				if (!(record->flags & RAWLOG_RECORD_CONFIG))
+					fprintf(log, "No SPS/PPS in front of the keyframe at %llu, the clip may not play\n", (unsigned long long)record->time);
+			}
+
+			afterConfig = (record->flags & RAWLOG_RECORD_CONFIG) != 0;
+			frameStart = (record->flags & (RAWLOG_RECORD_FRAME_END | RAWLOG_RECORD_CONFIG)) != 0;
+
+			if (!writing)
+				continue;
+
+			if (fwrite(data, 1, record->length, output) != record->length)
+			{
+				fprintf(log, "Failed to write the clip: %s\n", strerror(errno));
+				done = true;
+				break;
+			}
+
+			if (!bytes)
+				firstTime = record->time;
+			lastTime = record->time;
+			bytes += record->length;
+		}
+	}
+
+	if (output != stdout)
+		fclose(output);
+	else
+		fflush(output);
+
+	char start[32];
+	char end[32];
+	fprintf(log, "Exported %llu bytes from %s to %s, %u gaps, %u damaged extents skipped\n", (unsigned long long)bytes,
+		FormatTime(firstTime, start, sizeof(start)), FormatTime(lastTime, end, sizeof(end)), gaps, reader.GetDamaged());
+
+	return (bytes) ? 0 : 1;
+}
+
+// Writes an Annex B file into the log as if it had been recorded, one NAL per record
+static int Import(const char* device, const char* inputName, unsigned int framerate, uint64_t startTime)
+{
+	FILE* input = fopen(inputName, "rb");
+	if (!input)
+	{
+		printf("Failed to open %s: %s\n", inputName, strerror(errno));
+		return 1;
+	}
+
+	fseek(input, 0, SEEK_END);
+	long size = ftell(input);
+	fseek(input, 0, SEEK_SET);
+
+	uint8_t* stream = (uint8_t*)malloc(size);
+	if ((!stream) || (fread(stream, 1, size, input) != (size_t)size))
+	{
+		printf("Failed to read %s\n", inputName);
+		fclose(input);
+		free(stream);
+		return 1;
+	}
+	fclose(input);
+
+	RawLogWriter writer;
+	if (!writer.Open(device))
+	{
+		free(stream);
+		return 1;
+	}
+
+	uint64_t time = startTime;
+	unsigned int frames = 0;
+	bool success = true;
+
+	size_t nal = H264FindNal(stream, size, 0);
+	while ((nal < (size_t)size) && (success))
+	{
+		// Each record keeps its start code, so the exported clip is the same bytes as the input
+		size_t start = ((nal >= 4) && (stream[nal - 4] == 0)) ? nal - 4 : nal - 3;
+		size_t next = H264FindNal(stream, size, nal);
+		size_t end = (next < (size_t)size) ? next - 3 : (size_t)size;
+		if ((next < (size_t)size) && (end > nal) && (stream[end - 1] == 0))
+			end--;
+
+		unsigned int type = H264NalType(stream[nal]);
+		uint32_t flags = 0;
+		if ((type == H264_NAL_SPS) || (type == H264_NAL_PPS))
+			flags = RAWLOG_RECORD_CONFIG;
+		else if (type == H264_NAL_IDR)
+			flags = RAWLOG_RECORD_KEYFRAME | RAWLOG_RECORD_FRAME_END;
+		else if (type == H264_NAL_SLICE)
+			flags = RAWLOG_RECORD_FRAME_END;
+
+		success = writer.Write(stream + start, end - start, flags, time);
+
+		// Single slice frames, every picture moves the clock on by one frame
+		if (flags & RAWLOG_RECORD_FRAME_END)
+		{
+			time += 1000000 / framerate;
+			frames++;
+		}
+
+		nal = next;
+	}
+
+	free(stream);
+
+	if (success)
+		success = writer.Flush();
+
+	printf("Imported %u frames, the log is at extent %llu\n", frames, (unsigned long long)writer.GetSequence());
+	writer.PrintStats();
+	writer.Close();
+
+	return (success) ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	const char* command = argv[1];
+
+	unsigned int extentSize = RAWLOG_DEFAULT_EXTENT_SIZE;
+	unsigned int framerate = 25;
+	uint64_t startTime = 0;
+	uint64_t endTime = UINT64_MAX;
+	bool startSet = false;
+	const char* outputName = nullptr;
+	const char* inputName = nullptr;
+
+	// Options come after the command
+	optind = 2;
+	int option;
+	while ((option = getopt(argc, argv, "e:s:t:o:i:f:h")) != -1)
+	{
+		switch (option)
+		{
+		case 'e':
+			if (!strcmp(command, "format"))
+				extentSize = atoi(optarg) * 1024;
+			else if (!ParseTime(optarg, &endTime))
+				return 1;
+			break;
+		case 's':
+		case 't':
+			if (!ParseTime(optarg, &startTime))
+				return 1;
+			startSet = true;
+			break;
+		case 'o':
+			outputName = optarg;
+			break;
+		case 'i':
+			inputName = optarg;
+			break;
+		case 'f':
+			framerate = atoi(optarg);
+			break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+	const char* device = argv[optind];
+
+	if (!strcmp(command, "format"))
+		return Format(device, extentSize);
+
+	if (!strcmp(command, "list"))
+		return List(device);
+
+	if (!strcmp(command, "export"))
+		return Export(device, startTime, endTime, outputName);
+
+	if ((!strcmp(command, "import")) && (inputName) && (framerate))
+	{
+		if (!startSet)
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_REALTIME, &now);
+			startTime = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+		}
+
+		return Import(device, inputName, framerate, startTime);
+	}
+
+	Usage(argv[0]);
+	return 1;
+}
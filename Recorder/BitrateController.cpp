@@ -0,0 +1,175 @@
+#include "BitrateController.h"
+
+// Step sizes, cuts are multiplicative and increases additive so a struggling stick is caught quickly
+#define BITRATE_CUT_NUM 3
+#define BITRATE_CUT_DEN 4
+#define BITRATE_STEP_DEN 10
+
+// Only aim for this share of the measured throughput, leaving room for the filesystem and the substream
+#define THROUGHPUT_HEADROOM_NUM 3
+#define THROUGHPUT_HEADROOM_DEN 4
+
+// Without waiting on the storage for this many hold times its throughput is assumed to have recovered
+#define THROUGHPUT_EXPIRY_HOLDS 3
+
+// Changes smaller than 1/20th of the current bitrate aren't worth a reconfigure
+#define BITRATE_DEADBAND_DEN 20
+
+BitrateController::BitrateController()
+{
+	m_floor = 0;
+	m_ceiling = 0;
+	m_bitrate = 0;
+
+	m_queueLow = 10;
+	m_queueHigh = 50;
+	m_latencyLow = 50000;
+	m_latencyHigh = 250000;
+	m_holdTime = 10000000;
+	m_reserve = 0;
+
+	m_throughput = 0;
+	m_throughputTime = 0;
+
+	m_lastChange = 0;
+	m_healthySince = 0;
+
+	m_reductions = 0;
+	m_increases = 0;
+}
+
+void BitrateController::SetFloor(unsigned int floor)
+{
+	m_floor = floor;
+}
+
+void BitrateController::SetQueueThresholds(unsigned int low, unsigned int high)
+{
+	m_queueLow = low;
+	m_queueHigh = high;
+}
+
+void BitrateController::SetLatencyThresholds(uint64_t low, uint64_t high)
+{
+	m_latencyLow = low;
+	m_latencyHigh = high;
+}
+
+void BitrateController::SetHoldTime(uint64_t holdTime)
+{
+	m_holdTime = holdTime;
+}
+
+void BitrateController::SetReserve(unsigned int seconds)
+{
+	m_reserve = seconds;
+}
+
+void BitrateController::SetCeiling(unsigned int ceiling)
+{
+	// If nothing was holding the bitrate back follow the ceiling straight up, so escalations aren't slowed down
+	if ((!m_bitrate) || (m_bitrate >= m_ceiling) || (m_bitrate > ceiling))
+		m_bitrate = ceiling;
+
+	m_ceiling = ceiling;
+}
+
+unsigned int BitrateController::Clamp(uint64_t bitrate) const
+{
+	if (bitrate > m_ceiling)
+		bitrate = m_ceiling;
+
+	// The floor wins over everything, below it the recording isn't worth having
+	if (bitrate < m_floor)
+		bitrate = (m_floor < m_ceiling) ? m_floor : m_ceiling;
+
+	return (unsigned int)bitrate;
+}
+
+bool BitrateController::Update(const StorageSample& sample)
+{
+	if (!m_ceiling)
+		return false;
+
+	// Rolling estimate of what the storage manages while the writer is waiting on it
+	if ((sample.writeTime) && (sample.bytesWritten))
+	{
+		m_throughputTime = sample.time;
+
+		uint64_t throughput = (sample.bytesWritten * 8 * 1000000) / sample.writeTime;
+		if (throughput > 0xFFFFFFFF)
+			throughput = 0xFFFFFFFF;
+
+		if (!m_throughput)
+			m_throughput = (unsigned int)throughput;
+		else
+			m_throughput = (unsigned int)(((uint64_t)m_throughput * 3 + throughput) / 4);
+	}
+
+	// Nothing has had to wait on the storage for a while, so it has been keeping up with whatever it got
+	if ((m_throughput) && (sample.time - m_throughputTime > m_holdTime * THROUGHPUT_EXPIRY_HOLDS))
+		m_throughput = 0;
+
+	bool congested = (sample.queueDepth >= m_queueHigh) || (sample.maxWriteLatency >= m_latencyHigh);
+	bool healthy = (sample.queueDepth <= m_queueLow) && (sample.maxWriteLatency <= m_latencyLow);
+
+	uint64_t target = m_bitrate;
+
+	if (congested)
+	{
+		m_healthySince = 0;
+
+		target = ((uint64_t)m_bitrate * BITRATE_CUT_NUM) / BITRATE_CUT_DEN;
+
+		uint64_t sustainable = ((uint64_t)m_throughput * THROUGHPUT_HEADROOM_NUM) / THROUGHPUT_HEADROOM_DEN;
+		if ((sustainable) && (sustainable < target))
+			target = sustainable;
+	}
+	else if (healthy)
+	{
+		if (!m_healthySince)
+			m_healthySince = sample.time;
+
+		// Hysteresis, only step up after a full hold time of good behaviour since the last change
+		if ((m_bitrate < m_ceiling) && (sample.time - m_healthySince >= m_holdTime) && (sample.time - m_lastChange >= m_holdTime))
+		{
+			target = (uint64_t)m_bitrate + (m_ceiling / BITRATE_STEP_DEN);
+
+			// Don't climb past what the storage has shown it can take
+			if ((m_throughput) && (m_throughput < target))
+				target = (m_throughput > m_bitrate) ? m_throughput : m_bitrate;
+		}
+	}
+	else
+	{
+		// In between the thresholds, hold
+		m_healthySince = 0;
+	}
+
+	// Stretch the remaining space so it still holds the reserve
+	if ((m_reserve) && (sample.freeBytes))
+	{
+		uint64_t spaceLimit = (sample.freeBytes * 8) / m_reserve;
+		if (spaceLimit < target)
+			target = spaceLimit;
+	}
+
+	unsigned int bitrate = Clamp(target);
+	if (bitrate == m_bitrate)
+		return false;
+
+	// Skip tiny adjustments, unless they are needed to reach a limit
+	unsigned int difference = (bitrate > m_bitrate) ? bitrate - m_bitrate : m_bitrate - bitrate;
+	if ((difference < m_bitrate / BITRATE_DEADBAND_DEN) && (bitrate != m_floor) && (bitrate != m_ceiling))
+		return false;
+
+	if (bitrate < m_bitrate)
+		m_reductions++;
+	else
+		m_increases++;
+
+	m_bitrate = bitrate;
+	m_lastChange = sample.time;
+
+	return true;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ *	BitrateController
+ *	Closed loop control of the main stream's bitrate from how well the storage keeps up.
+ *	Backs off quickly when the encoder's output queue fills or writes stall, creeps back up
+ *	once things have been healthy for the hold time, and never goes below the floor.
+ *
+ *	The storage's throughput is only known from the times the writer had to wait for it, which is
+ *	when it can't keep up. A write() that returns straight away only shows the page cache, so
+ *	without such waits for a few hold times the storage is taken to be keeping up again.
+ *
+ *	Only plain numbers go in and out so it can be driven by a simulated storage model on the host
+ *	(bitratesim.bin).
+*/
+struct StorageSample
+{
+	uint64_t time;
+
+	// Percentage of the encoder's output buffers waiting to be written
+	unsigned int queueDepth;
+
+	// Bytes the storage was seen to write since the previous sample and how long it took over them,
+	// only counting the times the writer had to wait for it
+	uint64_t bytesWritten;
+	uint64_t writeTime;
+	uint64_t maxWriteLatency;
+
+	// 0 if unknown
+	uint64_t freeBytes;
+};
+
+class BitrateController
+{
+public:
+	BitrateController();
+
+	void SetFloor(unsigned int floor);
+	void SetQueueThresholds(unsigned int low, unsigned int high);
+	void SetLatencyThresholds(uint64_t low, uint64_t high);
+	void SetHoldTime(uint64_t holdTime);
+
+	// Seconds of recording the free space should still hold, 0 ignores free space
+	void SetReserve(unsigned int seconds);
+
+	// Highest bitrate allowed, normally whatever the current profile asks for
+	void SetCeiling(unsigned int ceiling);
+
+	// Returns true when GetBitrate() has changed
+	bool Update(const StorageSample& sample);
+
+public:
+	unsigned int GetBitrate() const { return m_bitrate; }
+
+	// Estimated rate the storage sustains while writing, in bits per second, 0 while it keeps up
+	unsigned int GetThroughput() const { return m_throughput; }
+
+	bool IsLimited() const { return m_bitrate < m_ceiling; }
+
+	unsigned int GetReductions() const { return m_reductions; }
+	unsigned int GetIncreases() const { return m_increases; }
+
+private:
+	unsigned int Clamp(uint64_t bitrate) const;
+
+private:
+	unsigned int m_floor;
+	unsigned int m_ceiling;
+	unsigned int m_bitrate;
+
+	unsigned int m_queueLow;
+	unsigned int m_queueHigh;
+	uint64_t m_latencyLow;
+	uint64_t m_latencyHigh;
+	uint64_t m_holdTime;
+	unsigned int m_reserve;
+
+	unsigned int m_throughput;
+	uint64_t m_throughputTime;
+
+	// Time of the last change and the start of the current healthy run, 0 when not healthy
+	uint64_t m_lastChange;
+	uint64_t m_healthySince;
+
+	unsigned int m_reductions;
+	unsigned int m_increases;
+};
@@ -0,0 +1,305 @@
+#include "Config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stddef.h>
+
+enum ConfigType
+{
+	CONFIG_UINT,
+	CONFIG_BOOL,
+	CONFIG_STRING
+};
+
+struct ConfigKey
+{
+	const char* name;
+	ConfigType type;
+	size_t offset;
+	size_t size;
+};
+
+#define CONFIG_ENTRY( name, type, member ) { name, type, offsetof( RecorderConfig, member ), sizeof( ((RecorderConfig*)0)->member ) }
+
+static const ConfigKey g_configKeys[] = {
+	CONFIG_ENTRY("width", CONFIG_UINT, driving.width),
+	CONFIG_ENTRY("height", CONFIG_UINT, driving.height),
+	CONFIG_ENTRY("framerate", CONFIG_UINT, driving.framerate),
+	CONFIG_ENTRY("bitrate", CONFIG_UINT, driving.bitrate),
+	CONFIG_ENTRY("rotation", CONFIG_UINT, rotation),
+	CONFIG_ENTRY("idr.period", CONFIG_UINT, idrPeriod),
+	CONFIG_ENTRY("inline.headers", CONFIG_BOOL, inlineHeaders),
+	CONFIG_ENTRY("lowlatency", CONFIG_BOOL, lowLatency),
+	CONFIG_ENTRY("slice.rows", CONFIG_UINT, sliceRows),
+
+	CONFIG_ENTRY("parking.width", CONFIG_UINT, parking.width),
+	CONFIG_ENTRY("parking.height", CONFIG_UINT, parking.height),
+	CONFIG_ENTRY("parking.framerate", CONFIG_UINT, parking.framerate),
+	CONFIG_ENTRY("parking.bitrate", CONFIG_UINT, parking.bitrate),
+	CONFIG_ENTRY("parking.timelapse", CONFIG_BOOL, parkingTimelapse),
+	CONFIG_ENTRY("parking.escalate.framerate", CONFIG_UINT, parkingEscalateFramerate),
+	CONFIG_ENTRY("parking.escalate.bitrate", CONFIG_UINT, parkingEscalateBitrate),
+	CONFIG_ENTRY("parking.quiet", CONFIG_UINT, parkingQuietTime),
+
+	CONFIG_ENTRY("substream.enabled", CONFIG_BOOL, substreamEnabled),
+	CONFIG_ENTRY("substream.width", CONFIG_UINT, substreamWidth),
+	CONFIG_ENTRY("substream.height", CONFIG_UINT, substreamHeight),
+	CONFIG_ENTRY("substream.bitrate", CONFIG_UINT, substreamBitrate),
+
+	CONFIG_ENTRY("bitrate.adaptive", CONFIG_BOOL, bitrateAdaptive),
+	CONFIG_ENTRY("bitrate.min", CONFIG_UINT, bitrateMin),
+	CONFIG_ENTRY("bitrate.qpmin", CONFIG_UINT, bitrateMinQuant),
+	CONFIG_ENTRY("bitrate.qpmax", CONFIG_UINT, bitrateMaxQuant),
+	CONFIG_ENTRY("bitrate.queue.low", CONFIG_UINT, bitrateQueueLow),
+	CONFIG_ENTRY("bitrate.queue.high", CONFIG_UINT, bitrateQueueHigh),
+	CONFIG_ENTRY("bitrate.latency.low", CONFIG_UINT, bitrateLatencyLow),
+	CONFIG_ENTRY("bitrate.latency.high", CONFIG_UINT, bitrateLatencyHigh),
+	CONFIG_ENTRY("bitrate.hold", CONFIG_UINT, bitrateHoldTime),
+	CONFIG_ENTRY("bitrate.reserve", CONFIG_UINT, bitrateReserve),
+
+	CONFIG_ENTRY("rtsp.enabled", CONFIG_BOOL, rtspEnabled),
+	CONFIG_ENTRY("rtsp.port", CONFIG_UINT, rtspPort),
+
+	CONFIG_ENTRY("hls.enabled", CONFIG_BOOL, hlsEnabled),
+	CONFIG_ENTRY("hls.dir", CONFIG_STRING, hlsDir),
+	CONFIG_ENTRY("hls.duration", CONFIG_UINT, hlsDuration),
+	CONFIG_ENTRY("hls.window", CONFIG_UINT, hlsWindow),
+	CONFIG_ENTRY("hls.maxsize", CONFIG_UINT, hlsMaxSize),
+
+	CONFIG_ENTRY("stats.qp", CONFIG_BOOL, statsQP),
+	CONFIG_ENTRY("stats.window", CONFIG_UINT, statsWindow),
+	CONFIG_ENTRY("status.file", CONFIG_STRING, statusFile),
+	CONFIG_ENTRY("status.interval", CONFIG_UINT, statusInterval),
+	CONFIG_ENTRY("control.socket", CONFIG_STRING, controlSocket),
+
+	CONFIG_ENTRY("recordings.dir", CONFIG_STRING, recordingsDir),
+	CONFIG_ENTRY("segment.size", CONFIG_UINT, segmentSize),
+	CONFIG_ENTRY("segment.blocksize", CONFIG_UINT, segmentBlockSize),
+	CONFIG_ENTRY("segment.pool", CONFIG_UINT, segmentPool),
+	CONFIG_ENTRY("segment.checksum", CONFIG_UINT, segmentChecksum),
+	CONFIG_ENTRY("metadata.sei", CONFIG_BOOL, metadataSei),
+	CONFIG_ENTRY("metadata.interval", CONFIG_UINT, metadataInterval),
+	CONFIG_ENTRY("rawlog.device", CONFIG_STRING, rawlogDevice),
+	CONFIG_ENTRY("rawlog.segments", CONFIG_BOOL, rawlogSegments),
+	CONFIG_ENTRY("storage.requiremount", CONFIG_BOOL, storageRequireMount),
+	CONFIG_ENTRY("storage.recover", CONFIG_BOOL, storageRecover),
+	CONFIG_ENTRY("storage.bench", CONFIG_STRING, storageBench),
+	CONFIG_ENTRY("storage.bitrate", CONFIG_UINT, storageBitrate),
+	CONFIG_ENTRY("storage.stall", CONFIG_UINT, storageStall),
+	CONFIG_ENTRY("spool.size", CONFIG_UINT, spoolSize),
+
+	CONFIG_ENTRY("motion.enabled", CONFIG_BOOL, motionEnabled),
+	CONFIG_ENTRY("motion.regions", CONFIG_STRING, motionRegions),
+	CONFIG_ENTRY("motion.magnitude", CONFIG_UINT, motionMagnitude),
+	CONFIG_ENTRY("motion.sad", CONFIG_UINT, motionMaxSad),
+	CONFIG_ENTRY("motion.threshold", CONFIG_UINT, motionThreshold),
+	CONFIG_ENTRY("motion.frames", CONFIG_UINT, motionFrames),
+	CONFIG_ENTRY("motion.dump", CONFIG_STRING, motionDump),
+
+	CONFIG_ENTRY("still.enabled", CONFIG_BOOL, stillEnabled),
+	CONFIG_ENTRY("still.width", CONFIG_UINT, stillWidth),
+	CONFIG_ENTRY("still.height", CONFIG_UINT, stillHeight),
+	CONFIG_ENTRY("still.quality", CONFIG_UINT, stillQuality),
+	CONFIG_ENTRY("still.thumbnails", CONFIG_BOOL, stillThumbnails),
+	CONFIG_ENTRY("still.onevent", CONFIG_BOOL, stillOnEvent),
+
+	CONFIG_ENTRY("gps.device", CONFIG_STRING, gpsDevice),
+	CONFIG_ENTRY("gps.baud", CONFIG_UINT, gpsBaud),
+
+	CONFIG_ENTRY("gsensor.device", CONFIG_STRING, gsensorDevice),
+	CONFIG_ENTRY("gsensor.address", CONFIG_UINT, gsensorAddress),
+	CONFIG_ENTRY("gsensor.rate", CONFIG_UINT, gsensorRate),
+	CONFIG_ENTRY("gsensor.threshold", CONFIG_UINT, gsensorThreshold),
+	CONFIG_ENTRY("gsensor.duration", CONFIG_UINT, gsensorDuration),
+	CONFIG_ENTRY("gsensor.holdoff", CONFIG_UINT, gsensorHoldoff),
+	CONFIG_ENTRY("gsensor.post", CONFIG_UINT, gsensorPost),
+	CONFIG_ENTRY("gsensor.dump", CONFIG_STRING, gsensorDump),
+};
+
+RecorderConfig::RecorderConfig()
+{
+	driving.name = "driving";
+	driving.width = 1920;
+	driving.height = 1080;
+	driving.framerate = 25;
+	driving.bitrate = 25000000;
+
+	parking.name = "parking";
+	parking.width = 1280;
+	parking.height = 720;
+	parking.framerate = 5;
+	parking.bitrate = 2000000;
+
+	rotation = 180;
+	idrPeriod = 0;
+	inlineHeaders = true;
+	lowLatency = false;
+	sliceRows = 0;
+
+	parkingTimelapse = false;
+	parkingEscalateFramerate = 25;
+	parkingEscalateBitrate = 10000000;
+	parkingQuietTime = 30;
+
+	substreamEnabled = true;
+	substreamWidth = 640;
+	substreamHeight = 360;
+	substreamBitrate = 1000000;
+
+	bitrateAdaptive = true;
+	bitrateMin = 4000000;
+	bitrateMinQuant = 0;
+	bitrateMaxQuant = 0;
+	bitrateQueueLow = 10;
+	bitrateQueueHigh = 50;
+	bitrateLatencyLow = 50;
+	bitrateLatencyHigh = 250;
+	bitrateHoldTime = 10;
+	bitrateReserve = 600;
+
+	rtspEnabled = false;
+	rtspPort = 8554;
+
+	hlsEnabled = false;
+	strcpy(hlsDir, "/tmp/hls");
+	hlsDuration = 4;
+	hlsWindow = 5;
+	// 8MB
+	hlsMaxSize = 8388608;
+
+	statsQP = true;
+	statsWindow = 1500;
+	strcpy(statusFile, "/tmp/recorder.status");
+	statusInterval = 5;
+	strcpy(controlSocket, "/tmp/recorder.sock");
+
+	strcpy(recordingsDir, "/recordings");
+	// 50MB
+	segmentSize = 52428800;
+	segmentBlockSize = 0;
+	segmentPool = 0;
+	segmentChecksum = 1048576;
+	metadataSei = true;
+	metadataInterval = 0;
+	rawlogDevice[0] = 0;
+	rawlogSegments = true;
+	storageRequireMount = true;
+	storageRecover = true;
+	strcpy(storageBench, "/dashpi/bin/storagebench.bin");
+	storageBitrate = 0;
+	storageStall = 0;
+	// 64MB
+	spoolSize = 67108864;
+
+	motionEnabled = false;
+	motionRegions[0] = 0;
+	motionMagnitude = 2;
+	motionMaxSad = 0;
+	motionThreshold = 2;
+	motionFrames = 3;
+	motionDump[0] = 0;
+
+	stillEnabled = true;
+	stillWidth = 1280;
+	stillHeight = 720;
+	stillQuality = 80;
+	stillThumbnails = true;
+	stillOnEvent = true;
+
+	gpsDevice[0] = 0;
+	gpsBaud = 9600;
+
+	gsensorDevice[0] = 0;
+	// LIS3DH with SDO low
+	gsensorAddress = 0x18;
+	gsensorRate = 200;
+	gsensorThreshold = 1500;
+	gsensorDuration = 10;
+	gsensorHoldoff = 5;
+	gsensorPost = 10;
+	gsensorDump[0] = 0;
+}
+
+static char* trim(char* str)
+{
+	while (isspace((unsigned char)*str))
+		++str;
+
+	char* end = str + strlen(str);
+	while ((end > str) && (isspace((unsigned char)end[-1])))
+		--end;
+	*end = 0;
+
+	return str;
+}
+
+bool RecorderConfig::Load(const char* fileName)
+{
+	FILE* file = fopen(fileName, "r");
+	if (!file)
+		return false;
+
+	char line[256];
+	unsigned int lineNum = 0;
+	while (fgets(line, sizeof(line), file))
+	{
+		++lineNum;
+
+		char* comment = strchr(line, '#');
+		if (comment)
+			*comment = 0;
+
+		char* sep = strchr(line, '=');
+		if (!sep)
+			continue;
+
+		*sep = 0;
+		char* key = trim(line);
+		char* value = trim(sep + 1);
+
+		const ConfigKey* entry = nullptr;
+		for (unsigned int i = 0; i < sizeof(g_configKeys) / sizeof(g_configKeys[0]); ++i)
+		{
+			if (!strcmp(g_configKeys[i].name, key))
+			{
+				entry = &g_configKeys[i];
+				break;
+			}
+		}
+
+		if (!entry)
+		{
+			printf("%s:%u: Unknown key '%s'\n", fileName, lineNum, key);
+			continue;
+		}
+
+		char* member = (char*)this + entry->offset;
+		switch (entry->type)
+		{
+		case CONFIG_UINT:
+			*(unsigned int*)member = strtoul(value, nullptr, 0);
+			break;
+
+		case CONFIG_BOOL:
+			*(bool*)member = (!strcmp(value, "1")) || (!strcmp(value, "yes")) || (!strcmp(value, "true")) || (!strcmp(value, "on"));
+			break;
+
+		case CONFIG_STRING:
+			strncpy(member, value, entry->size - 1);
+			member[entry->size - 1] = 0;
+			break;
+		}
+	}
+
+	fclose(file);
+
+	// Escalating has to ask the camera for some rate, and the escalation latency is measured against its frame interval
+	if (!parkingEscalateFramerate)
+	{
+		parkingEscalateFramerate = (driving.framerate) ? driving.framerate : 25;
+		printf("%s: parking.escalate.framerate can't be 0, using %u\n", fileName, parkingEscalateFramerate);
+	}
+
+	return true;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+/*
+ *	Recorder configuration
+ *	Read from a simple "key = value" file, anything not in the file keeps its default
+*/
+
+#define RECORDER_CONFIG_FILE "/etc/recorder.conf"
+
+struct RecordingProfile
+{
+	const char* name;
+
+	unsigned int width;
+	unsigned int height;
+	unsigned int framerate;
+	unsigned int bitrate;
+};
+
+struct RecorderConfig
+{
+	RecorderConfig();
+
+	bool Load(const char* fileName);
+
+	// Main stream, the driving profile is used at startup
+	RecordingProfile driving;
+	RecordingProfile parking;
+	unsigned int rotation;
+
+	// Frames between IDRs, 0 keeps the encoder's default. Rotation, exit and events ask for an IDR when they need one
+	unsigned int idrPeriod;
+
+	// Repeat the SPS/PPS before every IDR so each segment decodes on its own
+	bool inlineHeaders;
+
+	// Live view stream comes out NAL by NAL, with the frame split into slices of sliceRows macroblock rows
+	bool lowLatency;
+	unsigned int sliceRows;
+
+	// Parking mode, escalates to the given rate on an event and decays after the quiet time
+	bool parkingTimelapse;
+	unsigned int parkingEscalateFramerate;
+	unsigned int parkingEscalateBitrate;
+	unsigned int parkingQuietTime;
+
+	// Low resolution substream encoded from the camera preview port
+	bool substreamEnabled;
+	unsigned int substreamWidth;
+	unsigned int substreamHeight;
+	unsigned int substreamBitrate;
+
+	// Adaptive bitrate, the main stream backs off when the storage can't keep up
+	bool bitrateAdaptive;
+	unsigned int bitrateMin;
+	unsigned int bitrateMinQuant;
+	unsigned int bitrateMaxQuant;
+	unsigned int bitrateQueueLow;
+	unsigned int bitrateQueueHigh;
+	unsigned int bitrateLatencyLow;
+	unsigned int bitrateLatencyHigh;
+	unsigned int bitrateHoldTime;
+	unsigned int bitrateReserve;
+
+	// RTSP live view of the live stream
+	bool rtspEnabled;
+	unsigned int rtspPort;
+
+	// HLS packaging of the live stream
+	bool hlsEnabled;
+	char hlsDir[128];
+	unsigned int hlsDuration;
+	unsigned int hlsWindow;
+	unsigned int hlsMaxSize;
+
+	// Encoded stream statistics, written to the status file and a per-segment summary
+	bool statsQP;
+	unsigned int statsWindow;
+	char statusFile[128];
+	unsigned int statusInterval;
+
+	// Unix datagram socket for recorderctl.bin, empty for none
+	char controlSocket[108];
+
+	// Segments
+	char recordingsDir[128];
+	unsigned int segmentSize;
+	unsigned int segmentBlockSize;
+	// Main stream segment files kept and recycled, 0 creates a new file for every segment
+	unsigned int segmentPool;
+	// Bytes per CRC-32C in each segment's .crc sidecar, 0 for no sidecar
+	unsigned int segmentChecksum;
+	// Time, GPS and G-sensor in an SEI before every IDR of the main stream, and every interval frames
+	bool metadataSei;
+	unsigned int metadataInterval;
+
+	// Main stream into a raw partition, without a filesystem
+	char rawlogDevice[128];
+	bool rawlogSegments;
+
+	// Keeps recording into RAM while the storage isn't mounted
+	bool storageRequireMount;
+	unsigned int spoolSize;
+
+	// Repairs sessions left unclosed by a power cut whenever a stick is mounted
+	bool storageRecover;
+
+	// Benchmark run on every new stick, its results are loaded from the stick like this file
+	char storageBench[128];
+	unsigned int storageBitrate;
+	unsigned int storageStall;
+
+	// Motion detection from the main encoder's inline motion vectors
+	bool motionEnabled;
+	char motionRegions[128];
+	unsigned int motionMagnitude;
+	unsigned int motionMaxSad;
+	unsigned int motionThreshold;
+	unsigned int motionFrames;
+	char motionDump[128];
+
+	// JPEG stills from the camera still port, a thumbnail per segment and snapshots on events
+	bool stillEnabled;
+	unsigned int stillWidth;
+	unsigned int stillHeight;
+	unsigned int stillQuality;
+	bool stillThumbnails;
+	bool stillOnEvent;
+
+	// NMEA receiver on a tty, its fixes go into a .srt next to each segment. Empty for none
+	char gpsDevice[128];
+	unsigned int gpsBaud;
+
+	// Accelerometer on I2C, or a file of samples to play back. An impact protects the footage around it
+	char gsensorDevice[128];
+	unsigned int gsensorAddress;
+	unsigned int gsensorRate;
+	unsigned int gsensorThreshold;
+	unsigned int gsensorDuration;
+	unsigned int gsensorHoldoff;
+	unsigned int gsensorPost;
+	char gsensorDump[128];
+};
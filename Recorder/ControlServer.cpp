@@ -0,0 +1,215 @@
+#include "ControlServer.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+struct ControlCommandName
+{
+	const char* name;
+	ControlCommandType type;
+};
+
+static const ControlCommandName g_commandNames[] =
+{
+	{ "clip", CONTROL_COMMAND_CLIP },
+	{ "protect", CONTROL_COMMAND_PROTECT },
+	{ "bitrate", CONTROL_COMMAND_BITRATE },
+	{ "profile", CONTROL_COMMAND_PROFILE },
+	{ "rotate", CONTROL_COMMAND_ROTATE },
+	{ "flush", CONTROL_COMMAND_FLUSH },
+	{ "status", CONTROL_COMMAND_STATUS },
+};
+
+ControlServer::ControlServer()
+{
+	m_socket = -1;
+	m_path[0] = 0;
+
+	m_senderLength = 0;
+	m_replyFile = nullptr;
+
+	m_commands = 0;
+	m_rejected = 0;
+	m_unanswered = 0;
+}
+
+ControlServer::~ControlServer()
+{
+	Close();
+}
+
+bool ControlServer::Open(const char* path)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		printf("Control socket path %s is too long\n", path);
+		return false;
+	}
+	strcpy(address.sun_path, path);
+
+	m_socket = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_socket < 0)
+		return false;
+
+	// Left behind by a recorder that didn't exit cleanly
+	unlink(path);
+
+	if (bind(m_socket, (struct sockaddr*)&address, sizeof(address)) != 0)
+	{
+		printf("Failed to create the control socket %s: %s\n", path, strerror(errno));
+		close(m_socket);
+		m_socket = -1;
+		return false;
+	}
+	strcpy(m_path, path);
+
+	m_replyFile = fmemopen(m_reply, sizeof(m_reply), "w");
+	if (!m_replyFile)
+	{
+		Close();
+		return false;
+	}
+
+	printf("Control socket on %s\n", path);
+	return true;
+}
+
+void ControlServer::Close()
+{
+	if (m_socket >= 0)
+	{
+		close(m_socket);
+		m_socket = -1;
+	}
+
+	if (m_path[0])
+	{
+		unlink(m_path);
+		m_path[0] = 0;
+	}
+
+	if (m_replyFile)
+	{
+		fclose(m_replyFile);
+		m_replyFile = nullptr;
+	}
+}
+
+bool ControlServer::Receive(ControlCommand* command)
+{
+	if (m_socket < 0)
+		return false;
+
+	m_senderLength = sizeof(m_sender);
+	ssize_t received = recvfrom(m_socket, m_request, sizeof(m_request) - 1, 0, (struct sockaddr*)&m_sender, &m_senderLength);
+	if (received < 0)
+		return false;
+
+	m_request[received] = 0;
+	m_commands++;
+
+	// A bad command has been answered already, but still counts towards the caller's limit
+	if (!Parse(m_request, command))
+	{
+		m_rejected++;
+		return false;
+	}
+
+	return true;
+}
+
+bool ControlServer::Parse(char* request, ControlCommand* command)
+{
+	char* save = nullptr;
+	char* name = strtok_r(request, " \t\r\n", &save);
+	if (!name)
+	{
+		Reply("error empty command");
+		return false;
+	}
+
+	bool found = false;
+	for (unsigned int i = 0; i < sizeof(g_commandNames) / sizeof(g_commandNames[0]); i++)
+	{
+		if (strcmp(name, g_commandNames[i].name) == 0)
+		{
+			command->type = g_commandNames[i].type;
+			found = true;
+			break;
+		}
+	}
+
+	if (!found)
+	{
+		Reply("error unknown command %s", name);
+		return false;
+	}
+
+	command->argument = strtok_r(nullptr, " \t\r\n", &save);
+	command->value = 0;
+	command->hasValue = false;
+	if (command->argument)
+	{
+		char* end;
+		unsigned long value = strtoul(command->argument, &end, 0);
+		if ((end != command->argument) && (!*end))
+		{
+			command->value = (unsigned int)value;
+			command->hasValue = true;
+		}
+	}
+
+	return true;
+}
+
+void ControlServer::Reply(const char* format, ...)
+{
+	if (!m_replyFile)
+		return;
+
+	rewind(m_replyFile);
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(m_replyFile, format, args);
+	va_end(args);
+
+	fputc('\n', m_replyFile);
+	SendReply();
+}
+
+FILE* ControlServer::BeginReply()
+{
+	rewind(m_replyFile);
+	fprintf(m_replyFile, "ok\n");
+	return m_replyFile;
+}
+
+void ControlServer::SendReply()
+{
+	fflush(m_replyFile);
+	long length = ftell(m_replyFile);
+	if ((length <= 0) || (length > (long)sizeof(m_reply)))
+		length = strnlen(m_reply, sizeof(m_reply));
+
+	// A client that didn't bind an address of its own, or that isn't reading, goes without
+	if ((m_senderLength <= sizeof(m_sender.sun_family)) ||
+		(sendto(m_socket, m_reply, length, MSG_DONTWAIT, (struct sockaddr*)&m_sender, m_senderLength) < 0))
+	{
+		m_unanswered++;
+	}
+}
+
+void ControlServer::PrintStats()
+{
+	if (m_socket < 0)
+		return;
+
+	printf("Control socket: %u commands, %u rejected, %u answers not delivered\n", m_commands, m_rejected, m_unanswered);
+}
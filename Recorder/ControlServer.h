@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ *	ControlServer
+ *	Takes commands from recorderctl.bin on a Unix datagram socket, one line of text per datagram,
+ *	and sends the answer back to the sender the same way. The first line of an answer is "ok" or
+ *	"error <why>", anything after it is the answer itself (the status for "status").
+ *
+ *	The socket is non-blocking and read from the main loop a few commands at a time, so a flood of
+ *	them can't hold up the encoder's buffers. Requests are parsed in place and answers written
+ *	into a fixed buffer, nothing is allocated after Open().
+ *
+ *	clip [seconds]            keep the footage before and the next seconds, like an impact
+ *	protect                   keep the segment being written and the one before it
+ *	bitrate <bps>             main stream bitrate until the next profile change
+ *	profile driving|parking   switch profiles
+ *	rotate                    start a new segment on an IDR now
+ *	flush                     hand the segments' buffered data to the kernel and start writing it out
+ *	status                    the same as the status file
+*/
+
+#define CONTROL_SOCKET_DEFAULT "/tmp/recorder.sock"
+
+#define CONTROL_REQUEST_SIZE 256
+#define CONTROL_REPLY_SIZE 8192
+
+// Highest bitrate the bitrate command takes, level 4 for the High profile
+#define CONTROL_MAX_BITRATE 25000000
+
+// Commands handled per main loop iteration, the rest wait in the socket for the next one
+#define CONTROL_MAX_COMMANDS 4
+
+enum ControlCommandType
+{
+	CONTROL_COMMAND_CLIP,
+	CONTROL_COMMAND_PROTECT,
+	CONTROL_COMMAND_BITRATE,
+	CONTROL_COMMAND_PROFILE,
+	CONTROL_COMMAND_ROTATE,
+	CONTROL_COMMAND_FLUSH,
+	CONTROL_COMMAND_STATUS,
+};
+
+struct ControlCommand
+{
+	ControlCommandType type;
+
+	// The command's argument, as a number where it is one
+	const char* argument;
+	unsigned int value;
+	bool hasValue;
+};
+
+class ControlServer
+{
+public:
+	ControlServer();
+	~ControlServer();
+
+	bool Open(const char* path);
+	void Close();
+
+	// Next command waiting on the socket, never blocks. Anything that isn't a command is answered here
+	bool Receive(ControlCommand* command);
+
+	// Answers the last command received with one line
+	void Reply(const char* format, ...);
+
+	// For a longer answer: write it after the "ok" line into the returned file, then SendReply()
+	FILE* BeginReply();
+	void SendReply();
+
+	void PrintStats();
+
+private:
+	bool Parse(char* request, ControlCommand* command);
+
+private:
+	int m_socket;
+	char m_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+	char m_request[CONTROL_REQUEST_SIZE];
+
+	// Who sent the last command, no address means it can't be answered
+	struct sockaddr_un m_sender;
+	socklen_t m_senderLength;
+
+	// A stdio stream over m_reply, so the status can be written with the same code as the status file
+	char m_reply[CONTROL_REPLY_SIZE];
+	FILE* m_replyFile;
+
+	unsigned int m_commands;
+	unsigned int m_rejected;
+	unsigned int m_unanswered;
+};
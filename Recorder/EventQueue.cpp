@@ -0,0 +1,53 @@
+#include "EventQueue.h"
+#include "Timing.h"
+
+EventQueue::EventQueue()
+{
+	m_head = 0;
+	m_count = 0;
+
+	pthread_mutex_init(&m_lock, NULL);
+}
+
+EventQueue::~EventQueue()
+{
+	pthread_mutex_destroy(&m_lock);
+}
+
+bool EventQueue::Post(RecorderEventType type, unsigned int value)
+{
+	pthread_mutex_lock(&m_lock);
+
+	if (m_count == EVENT_QUEUE_SIZE)
+	{
+		pthread_mutex_unlock(&m_lock);
+		return false;
+	}
+
+	RecorderEvent& event = m_events[(m_head + m_count) % EVENT_QUEUE_SIZE];
+	event.type = type;
+	event.time = GetMonotonicTime();
+	event.value = value;
+	++m_count;
+
+	pthread_mutex_unlock(&m_lock);
+	return true;
+}
+
+bool EventQueue::Pop(RecorderEvent* event)
+{
+	pthread_mutex_lock(&m_lock);
+
+	if (!m_count)
+	{
+		pthread_mutex_unlock(&m_lock);
+		return false;
+	}
+
+	*event = m_events[m_head];
+	m_head = (m_head + 1) % EVENT_QUEUE_SIZE;
+	--m_count;
+
+	pthread_mutex_unlock(&m_lock);
+	return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ *	EventQueue
+ *	Small fixed size queue of things that happened (motion, sensor hits, commands)
+ *	Sources on other threads post into it, the main loop drains it
+*/
+
+enum RecorderEventType
+{
+	RECORDER_EVENT_MOTION,
+	RECORDER_EVENT_IMPACT,
+	// Footage asked for over the control socket, value is the seconds after it to keep
+	RECORDER_EVENT_CLIP,
+};
+
+struct RecorderEvent
+{
+	RecorderEventType type;
+	uint64_t time;
+	unsigned int value;
+};
+
+#define EVENT_QUEUE_SIZE 32
+
+class EventQueue
+{
+public:
+	EventQueue();
+	~EventQueue();
+
+	// Returns false if the queue is full and the event was dropped
+	bool Post(RecorderEventType type, unsigned int value = 0);
+	bool Pop(RecorderEvent* event);
+
+private:
+	RecorderEvent m_events[EVENT_QUEUE_SIZE];
+	unsigned int m_head;
+	unsigned int m_count;
+
+	pthread_mutex_t m_lock;
+};
@@ -0,0 +1,165 @@
+#include "FrameBroadcaster.h"
+#include "Timing.h"
+#include <string.h>
+
+static const char* g_policyNames[] = { "lossless", "drop to idr", "latest only" };
+
+FrameBroadcaster::FrameBroadcaster(const char* name)
+{
+	m_name = name;
+	m_consumerCount = 0;
+	m_frameStart = true;
+
+	m_buffers = 0;
+	m_overhead = 0;
+	m_maxOverhead = 0;
+}
+
+bool FrameBroadcaster::AddConsumer(FrameConsumer* consumer, const char* name, BroadcastPolicy policy)
+{
+	if (m_consumerCount >= BROADCAST_MAX_CONSUMERS)
+		return false;
+
+	BroadcastConsumer* entry = &m_consumers[m_consumerCount++];
+	memset(entry, 0, sizeof(BroadcastConsumer));
+	entry->consumer = consumer;
+	entry->name = name;
+	entry->policy = policy;
+
+	// Joining mid-stream is the same as having fallen behind, start at a clean point
+	entry->skipping = (policy == BROADCAST_DROP_TO_IDR);
+	return true;
+}
+
+void FrameBroadcaster::RemoveConsumer(FrameConsumer* consumer)
+{
+	for (unsigned int i = 0; i < m_consumerCount; i++)
+	{
+		if (m_consumers[i].consumer == consumer)
+		{
+			memmove(&m_consumers[i], &m_consumers[i + 1], (m_consumerCount - i - 1) * sizeof(BroadcastConsumer));
+			m_consumerCount--;
+			return;
+		}
+	}
+}
+
+bool FrameBroadcaster::Process(const uint8_t* data, size_t length, uint32_t flags, uint64_t time)
+{
+	uint64_t start = GetMonotonicTime();
+	uint64_t consumerTime = 0;
+
+	// Parameter sets come in a buffer of their own ahead of the IDR, they are a place to pick the stream up too
+	bool frameStart = m_frameStart;
+	bool resumable = (frameStart) && (flags & (BROADCAST_FLAG_SYNCFRAME | BROADCAST_FLAG_CODECCONFIG));
+	bool frameEnd = (flags & (BROADCAST_FLAG_ENDOFFRAME | BROADCAST_FLAG_CODECCONFIG)) != 0;
+	m_frameStart = frameEnd;
+
+	bool ok = true;
+	for (unsigned int i = 0; i < m_consumerCount; i++)
+	{
+		BroadcastConsumer* entry = &m_consumers[i];
+
+		if (entry->policy == BROADCAST_DROP_TO_IDR)
+		{
+			if ((entry->skipping) && (resumable) && (entry->consumer->IsReady()))
+			{
+				entry->skipping = false;
+			}
+			else if ((!entry->skipping) && (frameStart) && (!entry->consumer->IsReady()))
+			{
+				entry->skipping = true;
+				entry->dropRuns++;
+			}
+		}
+		else if ((entry->policy == BROADCAST_LATEST_ONLY) && (frameStart))
+		{
+			bool ready = entry->consumer->IsReady();
+			if ((!ready) && (!entry->skipping))
+				entry->dropRuns++;
+			entry->skipping = !ready;
+		}
+
+		if (entry->skipping)
+		{
+			if (frameEnd)
+			{
+				entry->drops++;
+				entry->lag++;
+				if (entry->lag > entry->maxLag)
+					entry->maxLag = entry->lag;
+			}
+			continue;
+		}
+
+		uint64_t deliverStart = GetMonotonicTime();
+		bool delivered = entry->consumer->BufferReceived(data, length, flags, time);
+		uint64_t busy = GetMonotonicTime() - deliverStart;
+
+		consumerTime += busy;
+		entry->busyTime += busy;
+		if (busy > entry->maxBusyTime)
+			entry->maxBusyTime = busy;
+
+		if (!delivered)
+		{
+			if (entry->policy == BROADCAST_LOSSLESS)
+			{
+				printf("%s consumer %s failed\n", m_name, entry->name);
+				ok = false;
+			}
+			else
+			{
+				// Whatever it got of this frame is useless now, same as not being ready for it
+				entry->skipping = true;
+				entry->dropRuns++;
+				if (frameEnd)
+				{
+					entry->drops++;
+					entry->lag++;
+				}
+			}
+		}
+		else if (frameEnd)
+		{
+			entry->frames++;
+			entry->lag = 0;
+		}
+	}
+
+	uint64_t overhead = GetMonotonicTime() - start - consumerTime;
+	m_overhead += overhead;
+	if (overhead > m_maxOverhead)
+		m_maxOverhead = overhead;
+	m_buffers++;
+
+	return ok;
+}
+
+void FrameBroadcaster::WriteStatus(FILE* file)
+{
+	for (unsigned int i = 0; i < m_consumerCount; i++)
+	{
+		const BroadcastConsumer* entry = &m_consumers[i];
+		fprintf(file, "%s consumer %s (%s): %llu frames, %llu dropped in %u runs, %u behind (peak %u), holds buffers %llu us max\n",
+			m_name, entry->name, g_policyNames[entry->policy], (unsigned long long)entry->frames, (unsigned long long)entry->drops, entry->dropRuns,
+			entry->lag, entry->maxLag, (unsigned long long)entry->maxBusyTime);
+	}
+}
+
+void FrameBroadcaster::PrintStats()
+{
+	if (!m_buffers)
+		return;
+
+	printf("%s broadcast to %u consumers: %llu buffers, overhead %llu ns average, %llu us max\n", m_name, m_consumerCount,
+		(unsigned long long)m_buffers, (unsigned long long)(m_overhead * 1000 / m_buffers), (unsigned long long)m_maxOverhead);
+
+	for (unsigned int i = 0; i < m_consumerCount; i++)
+	{
+		const BroadcastConsumer* entry = &m_consumers[i];
+		printf("\t%s (%s): %llu frames, %llu dropped in %u runs, peak %u frames behind, %llu us average / %llu us max per buffer\n",
+			entry->name, g_policyNames[entry->policy], (unsigned long long)entry->frames, (unsigned long long)entry->drops, entry->dropRuns,
+			entry->maxLag, (unsigned long long)(entry->busyTime / m_buffers), (unsigned long long)entry->maxBusyTime);
+	}
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *	FrameBroadcaster
+ *	Hands each of an encoder's output buffers to every consumer of that stream, in the order they
+ *	were added. Each consumer has a policy deciding what happens when it can't keep up:
+ *
+ *	BROADCAST_LOSSLESS		Gets every buffer, the encoder's buffer is held until it is done (the disk writer)
+ *	BROADCAST_DROP_TO_IDR		Skips from the first frame it isn't ready for up to the next IDR, so what it gets still decodes
+ *	BROADCAST_LATEST_ONLY		Frames arriving while it is busy are skipped, it picks up again at the newest one
+ *
+ *	Only lossless consumers are allowed to take their time, so a stuck network or preview consumer
+ *	never holds up the encoder. Decisions are made at frame boundaries, a consumer never gets part of a frame.
+ *
+ *	Buffers are passed as their data, flags and timestamp so nothing here depends on OMX and the
+ *	fan-out can be built and measured on a PC (broadcastbench.bin). The flags are the encoder's
+ *	OMX_BUFFERFLAG_* bits unchanged, the timestamp is in microseconds.
+*/
+
+#define BROADCAST_MAX_CONSUMERS 8
+
+// The OMX_BUFFERFLAG_* bits the fan-out looks at, fixed by the OpenMAX IL spec
+#define BROADCAST_FLAG_ENDOFFRAME 0x00000010
+#define BROADCAST_FLAG_SYNCFRAME 0x00000020
+#define BROADCAST_FLAG_CODECCONFIG 0x00000080
+
+enum BroadcastPolicy
+{
+	BROADCAST_LOSSLESS,
+	BROADCAST_DROP_TO_IDR,
+	BROADCAST_LATEST_ONLY,
+};
+
+class FrameConsumer
+{
+public:
+	virtual ~FrameConsumer() {}
+
+	// Asked at the start of each frame of consumers that are allowed to drop
+	virtual bool IsReady() { return true; }
+
+	// Returns false if the buffer couldn't be handled
+	virtual bool BufferReceived(const uint8_t* data, size_t length, uint32_t flags, uint64_t time) = 0;
+};
+
+struct BroadcastConsumer
+{
+	FrameConsumer* consumer;
+	const char* name;
+	BroadcastPolicy policy;
+
+	// Dropping until the next IDR, or the rest of this frame
+	bool skipping;
+
+	// Stats
+	uint64_t frames;
+	uint64_t drops;
+	unsigned int dropRuns;
+	unsigned int lag;
+	unsigned int maxLag;
+	uint64_t busyTime;
+	uint64_t maxBusyTime;
+};
+
+class FrameBroadcaster
+{
+public:
+	FrameBroadcaster(const char* name);
+
+	bool AddConsumer(FrameConsumer* consumer, const char* name, BroadcastPolicy policy);
+	void RemoveConsumer(FrameConsumer* consumer);
+
+	// Returns false if a lossless consumer failed, anything else just drops
+	bool Process(const uint8_t* data, size_t length, uint32_t flags, uint64_t time);
+
+	// Per consumer frames, drops, frames behind and time spent holding the buffer
+	void WriteStatus(FILE* file);
+	void PrintStats();
+
+public:
+	unsigned int GetConsumerCount() const { return m_consumerCount; }
+
+private:
+	const char* m_name;
+
+	BroadcastConsumer m_consumers[BROADCAST_MAX_CONSUMERS];
+	unsigned int m_consumerCount;
+
+	bool m_frameStart;
+
+	// Fan-out overhead, the time spent in Process() outside the consumers
+	uint64_t m_buffers;
+	uint64_t m_overhead;
+	uint64_t m_maxOverhead;
+};
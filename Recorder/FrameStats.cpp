@@ -0,0 +1,303 @@
+#include "FrameStats.h"
+#include <string.h>
+
+FrameStats::FrameStats()
+{
+	m_parseQP = true;
+	m_framerate = 25;
+	m_window = 1500;
+
+	m_sps.valid = false;
+	m_pps.valid = false;
+
+	m_frameStart = true;
+	m_frameBytes = 0;
+	m_frameBuffers = 0;
+	m_frameKey = false;
+	m_frameQP = -1;
+	m_frameTime = 0;
+
+	memset(m_histograms, 0, sizeof(m_histograms));
+	m_currentHistogram = 0;
+
+	memset(m_gopBitrates, 0, sizeof(m_gopBitrates));
+	memset(m_gopFrameCounts, 0, sizeof(m_gopFrameCounts));
+	m_gopNext = 0;
+	m_gopCount = 0;
+	m_gopBytes = 0;
+	m_gopFrames = 0;
+	m_gopStartTime = 0;
+
+	m_totalFrames = 0;
+	m_totalBytes = 0;
+	m_headerBytes = 0;
+	m_largestIDR = 0;
+	m_largestP = 0;
+	m_mostBuffers = 0;
+
+	m_segmentFrames = 0;
+	m_segmentIDRs = 0;
+	m_segmentBytes = 0;
+	m_segmentQPTotal = 0;
+	m_segmentQPCount = 0;
+	m_segmentLargest = 0;
+	m_segmentStartTime = 0;
+	m_segmentEndTime = 0;
+	m_segmentMinGop = 0;
+	m_segmentMaxGop = 0;
+}
+
+void FrameStats::SetWindow(unsigned int frames)
+{
+	m_window = (frames) ? frames : 1;
+}
+
+void FrameStats::SetParseQP(bool parse)
+{
+	m_parseQP = parse;
+}
+
+void FrameStats::SetFramerate(unsigned int framerate)
+{
+	m_framerate = framerate;
+}
+
+static unsigned int SizeBucket(uint32_t size)
+{
+	unsigned int bucket = 0;
+	while ((size >>= 1) && (bucket < FRAME_STATS_SIZE_BUCKETS - 1))
+		bucket++;
+
+	return bucket;
+}
+
+void FrameStats::ParseBuffer(const uint8_t* data, size_t length)
+{
+	size_t nal = H264FindNal(data, length, 0);
+	while (nal < length)
+	{
+		size_t next = H264FindNal(data, length, nal + 1);
+		unsigned int type = H264NalType(data[nal]);
+
+		if (type == H264_NAL_SPS)
+		{
+			H264ParseSPS(data + nal, next - nal, &m_sps);
+		}
+		else if (type == H264_NAL_PPS)
+		{
+			H264ParsePPS(data + nal, next - nal, &m_pps);
+		}
+		else if ((type == H264_NAL_IDR) || (type == H264_NAL_SLICE))
+		{
+			// All slices of a frame share the QP closely enough, the first one will do
+			if ((m_parseQP) && (m_frameQP < 0))
+				m_frameQP = H264ParseSliceQP(data + nal, length - nal, &m_sps, &m_pps);
+
+			// Only the slice header was wanted, don't walk through the rest of the picture
+			return;
+		}
+
+		nal = next;
+	}
+}
+
+void FrameStats::Process(const uint8_t* data, size_t length, uint32_t flags, uint64_t time)
+{
+	if ((!length) || (flags & OMX_BUFFERFLAG_CODECSIDEINFO))
+		return;
+
+	if (flags & OMX_BUFFERFLAG_CODECCONFIG)
+	{
+		m_headerBytes += length;
+		ParseBuffer(data, length);
+		return;
+	}
+
+	if (m_frameStart)
+	{
+		m_frameBytes = 0;
+		m_frameBuffers = 0;
+		m_frameKey = false;
+		m_frameQP = -1;
+		m_frameTime = time;
+	}
+
+	// Buffers normally start on a NAL, so the slice header is right at the front
+	if (m_frameQP < 0)
+		ParseBuffer(data, length);
+
+	m_frameBytes += length;
+	m_frameBuffers++;
+	if (flags & OMX_BUFFERFLAG_SYNCFRAME)
+		m_frameKey = true;
+
+	m_frameStart = (flags & OMX_BUFFERFLAG_ENDOFFRAME) != 0;
+	if (m_frameStart)
+		FrameDone();
+}
+
+void FrameStats::GopDone(uint64_t endTime)
+{
+	if (!m_gopFrames)
+		return;
+
+	// Fall back to the frame rate if the timestamps don't move forward
+	uint64_t duration = (endTime > m_gopStartTime) ? endTime - m_gopStartTime : 0;
+	if ((!duration) && (m_framerate))
+		duration = ((uint64_t)m_gopFrames * 1000000) / m_framerate;
+
+	uint32_t bitrate = (duration) ? (uint32_t)((m_gopBytes * 8 * 1000000) / duration) : 0;
+
+	m_gopBitrates[m_gopNext] = bitrate;
+	m_gopFrameCounts[m_gopNext] = m_gopFrames;
+	m_gopNext = (m_gopNext + 1) % FRAME_STATS_GOPS;
+	if (m_gopCount < FRAME_STATS_GOPS)
+		m_gopCount++;
+
+	if ((!m_segmentMinGop) || (bitrate < m_segmentMinGop))
+		m_segmentMinGop = bitrate;
+	if (bitrate > m_segmentMaxGop)
+		m_segmentMaxGop = bitrate;
+}
+
+void FrameStats::FrameDone()
+{
+	if (m_frameKey)
+	{
+		GopDone(m_frameTime);
+
+		m_gopBytes = 0;
+		m_gopFrames = 0;
+		m_gopStartTime = m_frameTime;
+	}
+
+	m_gopBytes += m_frameBytes;
+	m_gopFrames++;
+
+	FrameHistogram* histogram = &m_histograms[m_currentHistogram];
+	if (histogram->frames >= m_window)
+	{
+		m_currentHistogram ^= 1;
+		histogram = &m_histograms[m_currentHistogram];
+		memset(histogram, 0, sizeof(*histogram));
+	}
+
+	unsigned int bucket = SizeBucket(m_frameBytes);
+	if (m_frameKey)
+	{
+		histogram->idrSizes[bucket]++;
+		if (m_frameBytes > m_largestIDR)
+			m_largestIDR = m_frameBytes;
+	}
+	else
+	{
+		histogram->pSizes[bucket]++;
+		if (m_frameBytes > m_largestP)
+			m_largestP = m_frameBytes;
+	}
+
+	if (m_frameQP >= 0)
+	{
+		histogram->qp[m_frameQP]++;
+		m_segmentQPTotal += m_frameQP;
+		m_segmentQPCount++;
+	}
+
+	histogram->frames++;
+
+	if (m_frameBuffers > m_mostBuffers)
+		m_mostBuffers = m_frameBuffers;
+
+	m_totalFrames++;
+	m_totalBytes += m_frameBytes;
+
+	if (!m_segmentFrames)
+		m_segmentStartTime = m_frameTime;
+	m_segmentEndTime = m_frameTime;
+	m_segmentFrames++;
+	m_segmentBytes += m_frameBytes;
+	if (m_frameKey)
+		m_segmentIDRs++;
+	if (m_frameBytes > m_segmentLargest)
+		m_segmentLargest = m_frameBytes;
+}
+
+void FrameStats::EndSegment(FILE* file, unsigned int index)
+{
+	if ((file) && (m_segmentFrames))
+	{
+		// The last frame's own duration isn't in the timestamps, add it from the frame rate
+		uint64_t duration = m_segmentEndTime - m_segmentStartTime;
+		if (m_framerate)
+			duration += 1000000 / m_framerate;
+
+		fprintf(file, "%.8u frames=%u idr=%u bytes=%llu duration=%llums bitrate=%llu gop.min=%u gop.max=%u largest=%u qp=",
+			index, m_segmentFrames, m_segmentIDRs, (unsigned long long)m_segmentBytes, (unsigned long long)duration / 1000,
+			(unsigned long long)((duration) ? (m_segmentBytes * 8 * 1000000) / duration : 0), m_segmentMinGop, m_segmentMaxGop, m_segmentLargest);
+
+		if (m_segmentQPCount)
+			fprintf(file, "%.1f\n", (double)m_segmentQPTotal / m_segmentQPCount);
+		else
+			fprintf(file, "-\n");
+
+		fflush(file);
+	}
+
+	m_segmentFrames = 0;
+	m_segmentIDRs = 0;
+	m_segmentBytes = 0;
+	m_segmentQPTotal = 0;
+	m_segmentQPCount = 0;
+	m_segmentLargest = 0;
+	m_segmentMinGop = 0;
+	m_segmentMaxGop = 0;
+}
+
+void FrameStats::WriteStatus(FILE* file)
+{
+	fprintf(file, "frames: %llu\n", (unsigned long long)m_totalFrames);
+	fprintf(file, "bytes: %llu\n", (unsigned long long)m_totalBytes);
+	fprintf(file, "header bytes: %llu\n", (unsigned long long)m_headerBytes);
+	fprintf(file, "largest idr: %u\n", m_largestIDR);
+	fprintf(file, "largest p: %u\n", m_largestP);
+	fprintf(file, "most buffers per frame: %u\n", m_mostBuffers);
+
+	// Most recent GOP first
+	fprintf(file, "gop bitrates:");
+	for (unsigned int i = 0; i < m_gopCount; i++)
+	{
+		unsigned int gop = (m_gopNext + FRAME_STATS_GOPS - 1 - i) % FRAME_STATS_GOPS;
+		fprintf(file, " %u/%u", m_gopBitrates[gop], m_gopFrameCounts[gop]);
+	}
+	fprintf(file, "\n");
+
+	uint32_t frames = m_histograms[0].frames + m_histograms[1].frames;
+	fprintf(file, "window frames: %u\n", frames);
+
+	fprintf(file, "idr sizes:");
+	for (unsigned int i = 0; i < FRAME_STATS_SIZE_BUCKETS; i++)
+	{
+		uint32_t count = m_histograms[0].idrSizes[i] + m_histograms[1].idrSizes[i];
+		if (count)
+			fprintf(file, " %u:%u", 1u << i, count);
+	}
+	fprintf(file, "\n");
+
+	fprintf(file, "p sizes:");
+	for (unsigned int i = 0; i < FRAME_STATS_SIZE_BUCKETS; i++)
+	{
+		uint32_t count = m_histograms[0].pSizes[i] + m_histograms[1].pSizes[i];
+		if (count)
+			fprintf(file, " %u:%u", 1u << i, count);
+	}
+	fprintf(file, "\n");
+
+	fprintf(file, "qp:");
+	for (unsigned int i = 0; i < FRAME_STATS_QP_BUCKETS; i++)
+	{
+		uint32_t count = m_histograms[0].qp[i] + m_histograms[1].qp[i];
+		if (count)
+			fprintf(file, " %u:%u", i, count);
+	}
+	fprintf(file, "\n");
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "../libs/OMXHelper/OMXCore.h"
+#include "H264.h"
+
+/*
+ *	FrameStats
+ *	Per-frame statistics of the encoded stream, taken from the output buffers as they are written:
+ *	frame size and type, buffers per frame and, if enabled, the QP parsed from the first slice header.
+ *	Everything is kept in fixed size histograms so memory doesn't grow however long the recording runs.
+*/
+
+// Frame sizes go into power of two buckets, bucket n holds frames of 2^n up to 2^(n+1) - 1 bytes
+#define FRAME_STATS_SIZE_BUCKETS 24
+#define FRAME_STATS_QP_BUCKETS 52
+#define FRAME_STATS_GOPS 32
+
+struct FrameHistogram
+{
+	uint32_t idrSizes[FRAME_STATS_SIZE_BUCKETS];
+	uint32_t pSizes[FRAME_STATS_SIZE_BUCKETS];
+	uint32_t qp[FRAME_STATS_QP_BUCKETS];
+	uint32_t frames;
+};
+
+class FrameStats
+{
+public:
+	FrameStats();
+
+	// Histograms cover the last one to two windows of this many frames
+	void SetWindow(unsigned int frames);
+	void SetParseQP(bool parse);
+
+	// Used for GOP bitrates when the timestamps aren't any good
+	void SetFramerate(unsigned int framerate);
+
+	// time is the encoder's timestamp in microseconds
+	void Process(const uint8_t* data, size_t length, uint32_t flags, uint64_t time);
+
+	// Writes a line about the segment that just finished and starts counting the next one
+	void EndSegment(FILE* file, unsigned int index);
+
+	void WriteStatus(FILE* file);
+
+private:
+	void ParseBuffer(const uint8_t* data, size_t length);
+	void FrameDone();
+	void GopDone(uint64_t endTime);
+
+private:
+	bool m_parseQP;
+	unsigned int m_framerate;
+	unsigned int m_window;
+
+	H264SPS m_sps;
+	H264PPS m_pps;
+
+	// Frame being assembled from its buffers
+	bool m_frameStart;
+	uint32_t m_frameBytes;
+	uint32_t m_frameBuffers;
+	bool m_frameKey;
+	int m_frameQP;
+	uint64_t m_frameTime;
+
+	// Two windows, the older one is cleared and reused once the current one is full
+	FrameHistogram m_histograms[2];
+	unsigned int m_currentHistogram;
+
+	// Ring of the most recent GOP bitrates
+	uint32_t m_gopBitrates[FRAME_STATS_GOPS];
+	uint32_t m_gopFrameCounts[FRAME_STATS_GOPS];
+	unsigned int m_gopNext;
+	unsigned int m_gopCount;
+	uint64_t m_gopBytes;
+	uint32_t m_gopFrames;
+	uint64_t m_gopStartTime;
+
+	// Since startup
+	uint64_t m_totalFrames;
+	uint64_t m_totalBytes;
+	uint64_t m_headerBytes;
+	uint32_t m_largestIDR;
+	uint32_t m_largestP;
+	uint32_t m_mostBuffers;
+
+	// Current segment
+	uint32_t m_segmentFrames;
+	uint32_t m_segmentIDRs;
+	uint64_t m_segmentBytes;
+	uint64_t m_segmentQPTotal;
+	uint32_t m_segmentQPCount;
+	uint32_t m_segmentLargest;
+	uint64_t m_segmentStartTime;
+	uint64_t m_segmentEndTime;
+	uint32_t m_segmentMinGop;
+	uint32_t m_segmentMaxGop;
+};
@@ -0,0 +1,376 @@
+#include "GSensor.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "Timing.h"
+
+#define LIS3DH_WHO_AM_I 0x0f
+#define LIS3DH_ID 0x33
+#define LIS3DH_CTRL_REG1 0x20
+#define LIS3DH_CTRL_REG4 0x23
+#define LIS3DH_OUT_X_L 0x28
+
+// Set on the register address to read several in a row
+#define LIS3DH_AUTO_INCREMENT 0x80
+
+// Block data update, +-16g, high resolution: 12 bits at 12 mg a digit
+#define LIS3DH_CTRL_REG4_VALUE 0xb8
+#define LIS3DH_MG_PER_DIGIT 12
+
+// Give up on the chip after this many failed reads in a row
+#define LIS3DH_MAX_ERRORS 100
+
+AccelSource* CreateAccelSource(const char* device, unsigned int address, unsigned int rate)
+{
+	if (strncmp(device, "/dev/i2c", 8) == 0)
+		return new Lis3dhSource(device, address, rate);
+
+	return new ReplaySource(device, true);
+}
+
+Lis3dhSource::Lis3dhSource(const char* device, unsigned int address, unsigned int rate)
+{
+	strncpy(m_device, device, sizeof(m_device) - 1);
+	m_device[sizeof(m_device) - 1] = 0;
+	m_address = address;
+	m_rate = rate;
+	m_fd = -1;
+
+	m_period = 1000000 / ((rate) ? rate : 100);
+	m_nextTime = 0;
+	m_errors = 0;
+}
+
+Lis3dhSource::~Lis3dhSource()
+{
+	Close();
+}
+
+bool Lis3dhSource::Open()
+{
+	// Output data rate in the top nibble of CTRL_REG1, all three axes enabled
+	uint8_t dataRate;
+	switch (m_rate)
+	{
+	case 100: dataRate = 0x5; break;
+	case 200: dataRate = 0x6; break;
+	case 400: dataRate = 0x7; break;
+	default:
+		printf("Unsupported G-sensor rate %u Hz\n", m_rate);
+		return false;
+	}
+
+	m_fd = open(m_device, O_RDWR);
+	if (m_fd < 0)
+	{
+		printf("Failed to open %s\n", m_device);
+		return false;
+	}
+
+	uint8_t id = 0;
+	if ((!ReadRegisters(LIS3DH_WHO_AM_I, &id, 1)) || (id != LIS3DH_ID))
+	{
+		printf("No LIS3DH at 0x%02x on %s (id 0x%02x)\n", m_address, m_device, id);
+		Close();
+		return false;
+	}
+
+	if ((!WriteRegister(LIS3DH_CTRL_REG4, LIS3DH_CTRL_REG4_VALUE)) || (!WriteRegister(LIS3DH_CTRL_REG1, (dataRate << 4) | 0x07)))
+	{
+		printf("Failed to set up the LIS3DH\n");
+		Close();
+		return false;
+	}
+
+	m_nextTime = GetMonotonicTime();
+	m_errors = 0;
+	return true;
+}
+
+void Lis3dhSource::Close()
+{
+	if (m_fd < 0)
+		return;
+
+	// Power down
+	WriteRegister(LIS3DH_CTRL_REG1, 0);
+
+	close(m_fd);
+	m_fd = -1;
+}
+
+bool Lis3dhSource::Read(AccelSample* sample)
+{
+	while (m_errors < LIS3DH_MAX_ERRORS)
+	{
+		// Paced off the schedule rather than the last read, so the rate doesn't drift with how long reads take
+		m_nextTime += m_period;
+		uint64_t now = GetMonotonicTime();
+		if (m_nextTime > now)
+		{
+			struct timespec wake;
+			wake.tv_sec = m_nextTime / 1000000;
+			wake.tv_nsec = (m_nextTime % 1000000) * 1000;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, nullptr);
+		}
+		else if (now - m_nextTime > m_period * 4)
+		{
+			// Fell well behind, don't try to make up for it with a burst of reads
+			m_nextTime = now;
+		}
+
+		uint8_t data[6];
+		if (!ReadRegisters(LIS3DH_OUT_X_L | LIS3DH_AUTO_INCREMENT, data, sizeof(data)))
+		{
+			m_errors++;
+			continue;
+		}
+		m_errors = 0;
+
+		// Left justified 12 bit values
+		sample->time = GetMonotonicTime();
+		sample->x = (int16_t)((int16_t)(data[0] | (data[1] << 8)) >> 4) * LIS3DH_MG_PER_DIGIT;
+		sample->y = (int16_t)((int16_t)(data[2] | (data[3] << 8)) >> 4) * LIS3DH_MG_PER_DIGIT;
+		sample->z = (int16_t)((int16_t)(data[4] | (data[5] << 8)) >> 4) * LIS3DH_MG_PER_DIGIT;
+		return true;
+	}
+
+	printf("G-sensor stopped responding\n");
+	return false;
+}
+
+bool Lis3dhSource::ReadRegisters(uint8_t reg, uint8_t* data, unsigned int length)
+{
+	// Register address then a repeated start for the read
+	struct i2c_msg messages[2];
+	messages[0].addr = m_address;
+	messages[0].flags = 0;
+	messages[0].len = 1;
+	messages[0].buf = &reg;
+	messages[1].addr = m_address;
+	messages[1].flags = I2C_M_RD;
+	messages[1].len = length;
+	messages[1].buf = data;
+
+	struct i2c_rdwr_ioctl_data transfer;
+	transfer.msgs = messages;
+	transfer.nmsgs = 2;
+
+	return ioctl(m_fd, I2C_RDWR, &transfer) >= 0;
+}
+
+bool Lis3dhSource::WriteRegister(uint8_t reg, uint8_t value)
+{
+	uint8_t data[2] = { reg, value };
+
+	struct i2c_msg message;
+	message.addr = m_address;
+	message.flags = 0;
+	message.len = sizeof(data);
+	message.buf = data;
+
+	struct i2c_rdwr_ioctl_data transfer;
+	transfer.msgs = &message;
+	transfer.nmsgs = 1;
+
+	return ioctl(m_fd, I2C_RDWR, &transfer) >= 0;
+}
+
+ReplaySource::ReplaySource(const char* fileName, bool realTime)
+{
+	strncpy(m_fileName, fileName, sizeof(m_fileName) - 1);
+	m_fileName[sizeof(m_fileName) - 1] = 0;
+	m_realTime = realTime;
+	m_file = nullptr;
+
+	m_fileStart = 0;
+	m_playStart = 0;
+}
+
+ReplaySource::~ReplaySource()
+{
+	Close();
+}
+
+bool ReplaySource::Open()
+{
+	m_file = fopen(m_fileName, "r");
+	if (!m_file)
+	{
+		printf("Failed to open %s\n", m_fileName);
+		return false;
+	}
+
+	m_fileStart = 0;
+	m_playStart = 0;
+	return true;
+}
+
+void ReplaySource::Close()
+{
+	if (m_file)
+		fclose(m_file);
+	m_file = nullptr;
+}
+
+bool ReplaySource::Read(AccelSample* sample)
+{
+	char line[128];
+	while (fgets(line, sizeof(line), m_file))
+	{
+		unsigned long long time;
+		int x, y, z;
+		if (sscanf(line, "%llu %d %d %d", &time, &x, &y, &z) != 4)
+			continue;
+
+		sample->time = time;
+		sample->x = (int16_t)x;
+		sample->y = (int16_t)y;
+		sample->z = (int16_t)z;
+
+		if (!m_realTime)
+			return true;
+
+		if (!m_playStart)
+		{
+			m_fileStart = time;
+			m_playStart = GetMonotonicTime();
+		}
+
+		// Same gap from the start as when it was recorded
+		uint64_t due = m_playStart + (time - m_fileStart);
+		uint64_t now = GetMonotonicTime();
+		if (due > now)
+			usleep(due - now);
+
+		sample->time = GetMonotonicTime();
+		return true;
+	}
+
+	return false;
+}
+
+AccelRing::AccelRing()
+{
+	m_head = 0;
+	m_tail = 0;
+}
+
+bool AccelRing::Push(const AccelSample& sample)
+{
+	unsigned int head = m_head.load(std::memory_order_relaxed);
+	if (head - m_tail.load(std::memory_order_acquire) == GSENSOR_RING_SIZE)
+		return false;
+
+	m_samples[head % GSENSOR_RING_SIZE] = sample;
+	m_head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+bool AccelRing::Pop(AccelSample* sample)
+{
+	unsigned int tail = m_tail.load(std::memory_order_relaxed);
+	if (tail == m_head.load(std::memory_order_acquire))
+		return false;
+
+	*sample = m_samples[tail % GSENSOR_RING_SIZE];
+	m_tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+GSensor::GSensor(AccelSource* source)
+{
+	m_source = source;
+
+	m_started = false;
+	m_running = false;
+	m_finished = false;
+
+	m_dropped = 0;
+
+	m_samples = 0;
+	m_firstTime = 0;
+	m_lastTime = 0;
+}
+
+GSensor::~GSensor()
+{
+	Stop();
+	delete m_source;
+}
+
+bool GSensor::Start()
+{
+	if (!m_source->Open())
+		return false;
+
+	m_running = true;
+	if (pthread_create(&m_thread, NULL, ThreadMain, this) != 0)
+	{
+		printf("Failed to start the G-sensor thread\n");
+		m_running = false;
+		m_source->Close();
+		return false;
+	}
+
+	m_started = true;
+	return true;
+}
+
+void GSensor::Stop()
+{
+	if (!m_started)
+		return;
+
+	m_running = false;
+	pthread_join(m_thread, NULL);
+	m_started = false;
+
+	m_source->Close();
+}
+
+void* GSensor::ThreadMain(void* param)
+{
+	((GSensor*)param)->Run();
+	return nullptr;
+}
+
+void GSensor::Run()
+{
+	AccelSample sample;
+	while (m_running)
+	{
+		if (!m_source->Read(&sample))
+		{
+			m_finished = true;
+			break;
+		}
+
+		if (!m_samples)
+			m_firstTime = sample.time;
+		m_lastTime = sample.time;
+		m_samples++;
+
+		// A full ring means the main loop is stuck, the newest samples are the ones to lose
+		if (!m_ring.Push(sample))
+			m_dropped++;
+	}
+}
+
+bool GSensor::Pop(AccelSample* sample)
+{
+	return m_ring.Pop(sample);
+}
+
+void GSensor::PrintStats()
+{
+	// The thread's counters are only safe to read once it has been stopped
+	if (m_started)
+		return;
+
+	unsigned int rate = ((m_samples > 1) && (m_lastTime > m_firstTime)) ? (unsigned int)((uint64_t)(m_samples - 1) * 1000000 / (m_lastTime - m_firstTime)) : 0;
+	printf("G-sensor: %u samples at %u Hz, %u dropped\n", m_samples, rate, (unsigned int)m_dropped);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+
+/*
+ *	GSensor
+ *	Samples an accelerometer on its own thread at a steady rate and hands the samples to the main
+ *	loop through a lock-free ring, so neither side ever waits on the other. The samples come from
+ *	an AccelSource: a LIS3DH on /dev/i2c-*, or a file of samples played back at the pace it was
+ *	recorded at, which is how the impact thresholds are tried out without a car.
+ *
+ *	Sample files are text, a line per sample: <monotonic time in us> <x> <y> <z> in mg.
+*/
+
+// Power of two, over a second at the highest rate in case the main loop is held up by the storage
+#define GSENSOR_RING_SIZE 1024
+
+#define LIS3DH_DEFAULT_ADDRESS 0x18
+
+struct AccelSample
+{
+	uint64_t time;
+
+	// mg
+	int16_t x;
+	int16_t y;
+	int16_t z;
+};
+
+class AccelSource
+{
+public:
+	virtual ~AccelSource() {}
+
+	virtual bool Open() = 0;
+	virtual void Close() = 0;
+
+	// Waits for the next sample, false once there are no more
+	virtual bool Read(AccelSample* sample) = 0;
+};
+
+// A path under /dev/i2c is a LIS3DH at the given address, anything else a sample file played back in real time
+AccelSource* CreateAccelSource(const char* device, unsigned int address, unsigned int rate);
+
+class Lis3dhSource : public AccelSource
+{
+public:
+	// rate is 100, 200 or 400 Hz
+	Lis3dhSource(const char* device, unsigned int address, unsigned int rate);
+	virtual ~Lis3dhSource();
+
+	virtual bool Open();
+	virtual void Close();
+	virtual bool Read(AccelSample* sample);
+
+private:
+	bool ReadRegisters(uint8_t reg, uint8_t* data, unsigned int length);
+	bool WriteRegister(uint8_t reg, uint8_t value);
+
+private:
+	char m_device[128];
+	unsigned int m_address;
+	unsigned int m_rate;
+	int m_fd;
+
+	uint64_t m_period;
+	uint64_t m_nextTime;
+	unsigned int m_errors;
+};
+
+class ReplaySource : public AccelSource
+{
+public:
+	// realTime waits out the gaps between the samples and stamps them with the time they're read,
+	// otherwise they're returned straight away with the times in the file
+	ReplaySource(const char* fileName, bool realTime);
+	virtual ~ReplaySource();
+
+	virtual bool Open();
+	virtual void Close();
+	virtual bool Read(AccelSample* sample);
+
+private:
+	char m_fileName[128];
+	bool m_realTime;
+	FILE* m_file;
+
+	uint64_t m_fileStart;
+	uint64_t m_playStart;
+};
+
+// Single producer, single consumer
+class AccelRing
+{
+public:
+	AccelRing();
+
+	bool Push(const AccelSample& sample);
+	bool Pop(AccelSample* sample);
+
+private:
+	AccelSample m_samples[GSENSOR_RING_SIZE];
+	std::atomic<unsigned int> m_head;
+	std::atomic<unsigned int> m_tail;
+};
+
+class GSensor
+{
+public:
+	// Takes the source over
+	GSensor(AccelSource* source);
+	~GSensor();
+
+	bool Start();
+	void Stop();
+
+	bool Pop(AccelSample* sample);
+
+	// The source ran out, the end of a sample file
+	bool IsFinished() const { return m_finished; }
+
+	void PrintStats();
+
+private:
+	static void* ThreadMain(void* param);
+	void Run();
+
+private:
+	AccelSource* m_source;
+
+	pthread_t m_thread;
+	bool m_started;
+	volatile bool m_running;
+	volatile bool m_finished;
+
+	AccelRing m_ring;
+	std::atomic<unsigned int> m_dropped;
+
+	// Only touched by the thread until it has been stopped
+	unsigned int m_samples;
+	uint64_t m_firstTime;
+	uint64_t m_lastTime;
+};
@@ -0,0 +1,269 @@
+#include "GpsReader.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "Timing.h"
+
+static speed_t GetSpeed(unsigned int baud)
+{
+	switch (baud)
+	{
+	case 4800: return B4800;
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	}
+	return B0;
+}
+
+GpsReader::GpsReader()
+{
+	m_device[0] = 0;
+	m_baud = 0;
+	m_fd = -1;
+
+	m_started = false;
+	m_running = false;
+
+	pthread_mutex_init(&m_lock, NULL);
+
+	m_head = 0;
+	m_count = 0;
+
+	memset(&m_latest, 0, sizeof(m_latest));
+	m_statFixes = 0;
+	m_statDropped = 0;
+	m_statSentences = 0;
+	m_statChecksumErrors = 0;
+}
+
+GpsReader::~GpsReader()
+{
+	Stop();
+	pthread_mutex_destroy(&m_lock);
+}
+
+bool GpsReader::Start(const char* device, unsigned int baud)
+{
+	strncpy(m_device, device, sizeof(m_device) - 1);
+	m_device[sizeof(m_device) - 1] = 0;
+	m_baud = baud;
+
+	if ((m_baud) && (GetSpeed(m_baud) == B0))
+	{
+		printf("Unsupported GPS baud rate %u\n", m_baud);
+		return false;
+	}
+
+	// The receiver may well turn up later, the thread keeps trying
+	if (!OpenDevice())
+		printf("Failed to open GPS %s, retrying in the background\n", m_device);
+
+	m_running = true;
+	if (pthread_create(&m_thread, NULL, ThreadMain, this) != 0)
+	{
+		printf("Failed to start the GPS thread\n");
+		m_running = false;
+		CloseDevice();
+		return false;
+	}
+
+	m_started = true;
+	return true;
+}
+
+void GpsReader::Stop()
+{
+	if (!m_started)
+		return;
+
+	m_running = false;
+	pthread_join(m_thread, NULL);
+	m_started = false;
+
+	CloseDevice();
+}
+
+bool GpsReader::OpenDevice()
+{
+	m_fd = open(m_device, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+	if (m_fd < 0)
+		return false;
+
+	// Raw, so nothing is echoed, translated or held back until a line is complete
+	struct termios tio;
+	if (tcgetattr(m_fd, &tio) == 0)
+	{
+		cfmakeraw(&tio);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tio.c_cc[VMIN] = 0;
+		tio.c_cc[VTIME] = 0;
+		if (m_baud)
+		{
+			cfsetispeed(&tio, GetSpeed(m_baud));
+			cfsetospeed(&tio, GetSpeed(m_baud));
+		}
+		tcsetattr(m_fd, TCSANOW, &tio);
+		tcflush(m_fd, TCIFLUSH);
+	}
+
+	return true;
+}
+
+void GpsReader::CloseDevice()
+{
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+}
+
+void* GpsReader::ThreadMain(void* param)
+{
+	((GpsReader*)param)->Run();
+	return nullptr;
+}
+
+void GpsReader::Run()
+{
+	// 10 bits a byte on the wire, a pty hands over whole sentences at once
+	uint64_t byteTime = (m_baud) ? 10000000 / m_baud : 0;
+	uint64_t lastRead = 0;
+	unsigned int retries = 0;
+	char data[256];
+
+	while (m_running)
+	{
+		if (m_fd < 0)
+		{
+			usleep(GPS_POLL_TIMEOUT * 1000);
+			if ((++retries % (1000 / GPS_POLL_TIMEOUT) == 0) && (OpenDevice()))
+				printf("GPS %s opened\n", m_device);
+			continue;
+		}
+
+		struct pollfd pfd;
+		pfd.fd = m_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, GPS_POLL_TIMEOUT) <= 0)
+			continue;
+
+		ssize_t length = read(m_fd, data, sizeof(data));
+		uint64_t now = GetMonotonicTime();
+		if ((length < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+			continue;
+
+		// Unplugged, or the other end of the pty closed
+		if ((length <= 0) || (pfd.revents & (POLLERR | POLLHUP)))
+		{
+			printf("GPS %s went away\n", m_device);
+			CloseDevice();
+			continue;
+		}
+
+		pthread_mutex_lock(&m_lock);
+
+		for (ssize_t i = 0; i < length; i++)
+		{
+			// The last byte arrived just now and the ones before it a byte time apart, but never before the last read
+			uint64_t time = now - (uint64_t)(length - 1 - i) * byteTime;
+			if (time < lastRead)
+				time = lastRead;
+
+			if (!m_parser.Feed(data[i], time))
+				continue;
+
+			const GpsFix& fix = m_parser.GetFix();
+			m_latest = fix;
+			m_statFixes++;
+
+			if (m_count == GPS_FIX_QUEUE)
+			{
+				m_statDropped++;
+				continue;
+			}
+
+			m_fixes[(m_head + m_count) % GPS_FIX_QUEUE] = fix;
+			++m_count;
+		}
+
+		m_statSentences = m_parser.GetSentences();
+		m_statChecksumErrors = m_parser.GetChecksumErrors();
+
+		pthread_mutex_unlock(&m_lock);
+
+		lastRead = now;
+	}
+}
+
+bool GpsReader::Pop(GpsFix* fix)
+{
+	pthread_mutex_lock(&m_lock);
+
+	if (!m_count)
+	{
+		pthread_mutex_unlock(&m_lock);
+		return false;
+	}
+
+	*fix = m_fixes[m_head];
+	m_head = (m_head + 1) % GPS_FIX_QUEUE;
+	--m_count;
+
+	pthread_mutex_unlock(&m_lock);
+	return true;
+}
+
+void GpsReader::WriteStatus(FILE* file)
+{
+	pthread_mutex_lock(&m_lock);
+
+	fprintf(file, "gps.fix: %s\n", (m_latest.valid) ? "yes" : "no");
+	if (m_latest.valid)
+	{
+		fprintf(file, "gps.position: %.6f %.6f\n", m_latest.latitude, m_latest.longitude);
+		fprintf(file, "gps.speed: %.1f\n", m_latest.speed);
+	}
+	if (m_latest.hasGGA)
+		fprintf(file, "gps.satellites: %u\n", m_latest.satellites);
+	fprintf(file, "gps.sentences: %u %u\n", m_statSentences, m_statChecksumErrors);
+
+	pthread_mutex_unlock(&m_lock);
+}
+
+unsigned int GpsReader::GetFixes()
+{
+	pthread_mutex_lock(&m_lock);
+	unsigned int fixes = m_statFixes;
+	pthread_mutex_unlock(&m_lock);
+	return fixes;
+}
+
+unsigned int GpsReader::GetSentences()
+{
+	pthread_mutex_lock(&m_lock);
+	unsigned int sentences = m_statSentences;
+	pthread_mutex_unlock(&m_lock);
+	return sentences;
+}
+
+unsigned int GpsReader::GetChecksumErrors()
+{
+	pthread_mutex_lock(&m_lock);
+	unsigned int errors = m_statChecksumErrors;
+	pthread_mutex_unlock(&m_lock);
+	return errors;
+}
+
+void GpsReader::PrintStats()
+{
+	pthread_mutex_lock(&m_lock);
+	printf("GPS: %u sentences, %u checksum errors, %u fixes, %u dropped\n", m_statSentences, m_statChecksumErrors, m_statFixes, m_statDropped);
+	pthread_mutex_unlock(&m_lock);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "Nmea.h"
+
+/*
+ *	GpsReader
+ *	Reads NMEA from a GPS receiver on its own thread, so a slow serial port never holds up the
+ *	main loop. The device is any tty: a UART, a USB receiver's ttyACM/ttyUSB, or a pty with a log
+ *	being replayed into it. Fixes are queued for the main loop to pick up with Pop().
+ *
+ *	Each byte is stamped with when it came off the wire, worked back from the read at the serial
+ *	rate, so a fix's time doesn't depend on how the reads happened to be split up.
+ *	A receiver that goes away is opened again once a second.
+*/
+
+#define GPS_FIX_QUEUE 32
+
+// Longest the thread waits for data before checking whether it should stop, in ms
+#define GPS_POLL_TIMEOUT 200
+
+class GpsReader
+{
+public:
+	GpsReader();
+	~GpsReader();
+
+	// Starts the thread, a baud of 0 leaves the port as it is, as for a pty
+	bool Start(const char* device, unsigned int baud);
+	void Stop();
+
+	bool Pop(GpsFix* fix);
+
+	void WriteStatus(FILE* file);
+	void PrintStats();
+
+public:
+	unsigned int GetFixes();
+	unsigned int GetSentences();
+	unsigned int GetChecksumErrors();
+
+private:
+	static void* ThreadMain(void* param);
+	void Run();
+	bool OpenDevice();
+	void CloseDevice();
+
+private:
+	char m_device[128];
+	unsigned int m_baud;
+	int m_fd;
+
+	pthread_t m_thread;
+	bool m_started;
+	volatile bool m_running;
+
+	NmeaParser m_parser;
+
+	// Everything below is shared with the main loop
+	pthread_mutex_t m_lock;
+
+	GpsFix m_fixes[GPS_FIX_QUEUE];
+	unsigned int m_head;
+	unsigned int m_count;
+
+	GpsFix m_latest;
+	unsigned int m_statFixes;
+	unsigned int m_statDropped;
+	unsigned int m_statSentences;
+	unsigned int m_statChecksumErrors;
+};
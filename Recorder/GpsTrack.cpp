@@ -0,0 +1,189 @@
+#include "GpsTrack.h"
+#include <string.h>
+
+// Moves of the offset bigger than this are the encoder's clock starting over, not drift
+#define GPS_CLOCK_JUMP 1000000
+
+void GpsTrackName(const char* segmentName, char* trackName, size_t size)
+{
+	const char* extension = strrchr(segmentName, '.');
+	const char* slash = strrchr(segmentName, '/');
+	int baseLength = ((extension) && ((!slash) || (extension > slash))) ? (int)(extension - segmentName) : (int)strlen(segmentName);
+
+	snprintf(trackName, size, "%.*s.srt", baseLength, segmentName);
+}
+
+static void FormatTime(char* text, size_t size, uint64_t time)
+{
+	uint64_t ms = time / 1000;
+	snprintf(text, size, "%02u:%02u:%02u,%03u", (unsigned int)(ms / 3600000), (unsigned int)(ms / 60000 % 60),
+		(unsigned int)(ms / 1000 % 60), (unsigned int)(ms % 1000));
+}
+
+GpsTrack::GpsTrack()
+{
+	m_file = nullptr;
+	m_segmentName[0] = 0;
+	m_segmentStart = 0;
+	m_index = 0;
+	m_lastFlush = 0;
+	m_openFailed = false;
+
+	memset(&m_pending, 0, sizeof(m_pending));
+	m_pendingTime = 0;
+	m_hasPending = false;
+
+	m_clockKnown = false;
+	m_clockOffset = 0;
+	m_windowOffset = 0;
+	m_windowStart = 0;
+
+	m_statEntries = 0;
+}
+
+GpsTrack::~GpsTrack()
+{
+	Close();
+}
+
+void GpsTrack::FrameReceived(uint64_t timestamp, uint64_t now)
+{
+	// The quickest a frame ever comes out of the encoder is the closest to the time it was captured
+	int64_t offset = (int64_t)(now - timestamp);
+
+	if ((!m_clockKnown) || (offset > m_clockOffset + GPS_CLOCK_JUMP) || (offset < m_clockOffset - GPS_CLOCK_JUMP))
+	{
+		m_clockKnown = true;
+		m_clockOffset = offset;
+		m_windowOffset = offset;
+		m_windowStart = now;
+		return;
+	}
+
+	if (offset < m_windowOffset)
+		m_windowOffset = offset;
+	if (offset < m_clockOffset)
+		m_clockOffset = offset;
+
+	// Forget the old window so the offset can follow the two clocks drifting apart
+	if (now - m_windowStart >= GPS_CLOCK_WINDOW)
+	{
+		m_clockOffset = m_windowOffset;
+		m_windowOffset = offset;
+		m_windowStart = now;
+	}
+}
+
+void GpsTrack::Update(const char* segmentName, uint64_t segmentStart, bool live)
+{
+	// Fixes only make sense next to the frames being written right now, not a spooled backlog
+	live = (live) && (segmentStart);
+	bool sameSegment = (strcmp(segmentName, m_segmentName) == 0);
+
+	if ((live) && (sameSegment) && ((m_file) || (m_openFailed)))
+		return;
+	if ((!live) && (!m_file))
+		return;
+
+	if (m_file)
+	{
+		// The last fix runs up to the cut and carries on into the next segment
+		uint64_t end = m_pendingTime + GPS_TRACK_HOLD;
+		if ((live) && (!sameSegment) && (segmentStart < end))
+			end = segmentStart;
+		if (m_hasPending)
+			WriteEntry(end);
+
+		fclose(m_file);
+		m_file = nullptr;
+	}
+
+	if (!live)
+	{
+		m_hasPending = false;
+		return;
+	}
+
+	// Coming back to the same segment after the storage was away carries on where its track stopped
+	if (!sameSegment)
+	{
+		snprintf(m_segmentName, sizeof(m_segmentName), "%s", segmentName);
+		m_segmentStart = segmentStart;
+		m_index = 0;
+		m_openFailed = false;
+	}
+
+	char trackName[255];
+	GpsTrackName(m_segmentName, trackName, sizeof(trackName));
+	m_file = fopen(trackName, (sameSegment) ? "a" : "w");
+	if (!m_file)
+	{
+		printf("Failed to create %s\n", trackName);
+		m_openFailed = true;
+	}
+}
+
+void GpsTrack::AddFix(const GpsFix& fix)
+{
+	// Nothing to line the fix up with yet
+	if (!m_clockKnown)
+		return;
+
+	uint64_t time = fix.time - m_clockOffset;
+
+	if (m_hasPending)
+		WriteEntry((time < m_pendingTime + GPS_TRACK_HOLD) ? time : m_pendingTime + GPS_TRACK_HOLD);
+
+	// A fix that was lost ends the last entry without starting another
+	m_hasPending = fix.valid;
+	m_pending = fix;
+	m_pendingTime = time;
+}
+
+void GpsTrack::Close()
+{
+	if (!m_file)
+		return;
+
+	if (m_hasPending)
+		WriteEntry(m_pendingTime + GPS_TRACK_HOLD);
+	m_hasPending = false;
+
+	fclose(m_file);
+	m_file = nullptr;
+	m_segmentName[0] = 0;
+}
+
+void GpsTrack::WriteEntry(uint64_t end)
+{
+	if (!m_file)
+		return;
+
+	// A fix from before the first frame of the segment shows from its start
+	uint64_t start = (m_pendingTime > m_segmentStart) ? m_pendingTime : m_segmentStart;
+	if (end <= start)
+		return;
+
+	char startText[16], endText[16];
+	FormatTime(startText, sizeof(startText), start - m_segmentStart);
+	FormatTime(endText, sizeof(endText), end - m_segmentStart);
+
+	const GpsFix& fix = m_pending;
+	unsigned int seconds = fix.utcTime / 1000;
+
+	fprintf(m_file, "%u\n%s --> %s\n%.0f km/h %.6f, %.6f\n%02u/%02u/20%02u %02u:%02u:%02u UTC", ++m_index, startText, endText,
+		fix.speed, fix.latitude, fix.longitude, fix.date / 10000, fix.date / 100 % 100, fix.date % 100,
+		seconds / 3600, seconds / 60 % 60, seconds % 60);
+	if (fix.hasGGA)
+		fprintf(m_file, " %u sats %.0f m", fix.satellites, fix.altitude);
+	fprintf(m_file, "\n\n");
+
+	m_statEntries++;
+
+	// Once a second is plenty to lose little in a power cut without lots of small writes
+	if (end - m_lastFlush >= 1000000)
+	{
+		fflush(m_file);
+		m_lastFlush = end;
+	}
+}
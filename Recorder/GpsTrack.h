@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "Nmea.h"
+
+/*
+ *	GpsTrack
+ *	Writes the GPS fixes as SubRip subtitles next to each main stream segment, with the extension
+ *	swapped for .srt, so a player shows the speed and position over the footage as it plays:
+ *
+ *	  12
+ *	  00:00:01,200 --> 00:00:01,300
+ *	  87 km/h 51.507220, -0.127500
+ *	  27/05/2016 10:00:01 UTC 9 sats 35 m
+ *
+ *	Fixes are stamped with the monotonic clock and frames with the encoder's, the track learns the
+ *	offset between the two from the frames as they come out of the encoder. An entry runs until the
+ *	next fix, for at most GPS_TRACK_HOLD.
+*/
+
+#define GPS_TRACK_HOLD 2000000
+
+// The offset is the smallest seen over a window, so one frame held up in the pipeline doesn't move it
+#define GPS_CLOCK_WINDOW 5000000
+
+// <name>.h264 becomes <name>.srt
+void GpsTrackName(const char* segmentName, char* trackName, size_t size);
+
+class GpsTrack
+{
+public:
+	GpsTrack();
+	~GpsTrack();
+
+	// A main stream frame, its encoder timestamp and when it came out of the encoder
+	void FrameReceived(uint64_t timestamp, uint64_t now);
+
+	// Follows the writer onto its current segment, call before AddFix. live is false while the writer
+	// is catching up on a backlog or has no segment open, and a segment that hasn't started has a start of 0
+	void Update(const char* segmentName, uint64_t segmentStart, bool live);
+
+	void AddFix(const GpsFix& fix);
+
+	void Close();
+
+public:
+	unsigned int GetEntries() const { return m_statEntries; }
+
+private:
+	void WriteEntry(uint64_t end);
+
+private:
+	FILE* m_file;
+	char m_segmentName[255];
+	uint64_t m_segmentStart;
+	unsigned int m_index;
+	uint64_t m_lastFlush;
+	bool m_openFailed;
+
+	// Fix waiting for the next one to know when its entry ends, times on the encoder's clock
+	GpsFix m_pending;
+	uint64_t m_pendingTime;
+	bool m_hasPending;
+
+	// Monotonic time minus encoder time, the smallest in this window and the last
+	bool m_clockKnown;
+	int64_t m_clockOffset;
+	int64_t m_windowOffset;
+	uint64_t m_windowStart;
+
+	unsigned int m_statEntries;
+};
@@ -0,0 +1,300 @@
+#include "H264.h"
+
+H264BitReader::H264BitReader(const uint8_t* data, size_t length)
+{
+	m_data = data;
+	m_length = length;
+	m_offset = 0;
+	m_bit = 0;
+	m_zeros = 0;
+	m_overrun = false;
+}
+
+unsigned int H264BitReader::ReadBit()
+{
+	if (m_offset >= m_length)
+	{
+		m_overrun = true;
+		return 0;
+	}
+
+	// 00 00 03 only exists to stop start codes appearing, the 03 isn't part of the payload
+	if ((m_bit == 0) && (m_zeros >= 2) && (m_data[m_offset] == 0x03))
+	{
+		m_offset++;
+		m_zeros = 0;
+
+		if (m_offset >= m_length)
+		{
+			m_overrun = true;
+			return 0;
+		}
+	}
+
+	unsigned int bit = (m_data[m_offset] >> (7 - m_bit)) & 0x01;
+
+	if (++m_bit == 8)
+	{
+		m_zeros = (m_data[m_offset] == 0) ? m_zeros + 1 : 0;
+		m_bit = 0;
+		m_offset++;
+	}
+
+	return bit;
+}
+
+unsigned int H264BitReader::ReadBits(unsigned int count)
+{
+	unsigned int value = 0;
+	for (unsigned int i = 0; i < count; i++)
+		value = (value << 1) | ReadBit();
+
+	return value;
+}
+
+unsigned int H264BitReader::ReadUE()
+{
+	unsigned int leadingZeros = 0;
+	while ((!ReadBit()) && (!m_overrun))
+	{
+		if (++leadingZeros > 31)
+		{
+			m_overrun = true;
+			return 0;
+		}
+	}
+
+	return ((1u << leadingZeros) - 1) + ReadBits(leadingZeros);
+}
+
+int H264BitReader::ReadSE()
+{
+	unsigned int value = ReadUE();
+	return (value & 0x01) ? (int)((value + 1) / 2) : -(int)(value / 2);
+}
+
+static void SkipScalingList(H264BitReader& reader, unsigned int size)
+{
+	int last = 8;
+	int next = 8;
+	for (unsigned int i = 0; i < size; i++)
+	{
+		if (next != 0)
+			next = (last + reader.ReadSE() + 256) % 256;
+
+		last = (next == 0) ? last : next;
+	}
+}
+
+bool H264ParseSPS(const uint8_t* nal, size_t length, H264SPS* sps)
+{
+	sps->valid = false;
+	if (length < 4)
+		return false;
+
+	H264BitReader reader(nal + 1, length - 1);
+
+	unsigned int profile = reader.ReadBits(8);
+	reader.ReadBits(16);	// Constraint flags and level
+	reader.ReadUE();		// seq_parameter_set_id
+
+	sps->separateColourPlane = false;
+	if ((profile == 100) || (profile == 110) || (profile == 122) || (profile == 244) || (profile == 44) ||
+		(profile == 83) || (profile == 86) || (profile == 118) || (profile == 128))
+	{
+		unsigned int chromaFormat = reader.ReadUE();
+		if (chromaFormat == 3)
+			sps->separateColourPlane = reader.ReadBit() != 0;
+
+		reader.ReadUE();	// bit_depth_luma_minus8
+		reader.ReadUE();	// bit_depth_chroma_minus8
+		reader.ReadBit();	// qpprime_y_zero_transform_bypass_flag
+
+		if (reader.ReadBit())
+		{
+			unsigned int lists = (chromaFormat == 3) ? 12 : 8;
+			for (unsigned int i = 0; i < lists; i++)
+			{
+				if (reader.ReadBit())
+					SkipScalingList(reader, (i < 6) ? 16 : 64);
+			}
+		}
+	}
+
+	sps->log2MaxFrameNum = reader.ReadUE() + 4;
+	sps->pocType = reader.ReadUE();
+	sps->log2MaxPocLsb = 0;
+	sps->deltaPicOrderAlwaysZero = false;
+
+	if (sps->pocType == 0)
+	{
+		sps->log2MaxPocLsb = reader.ReadUE() + 4;
+	}
+	else if (sps->pocType == 1)
+	{
+		sps->deltaPicOrderAlwaysZero = reader.ReadBit() != 0;
+		reader.ReadSE();	// offset_for_non_ref_pic
+		reader.ReadSE();	// offset_for_top_to_bottom_field
+
+		unsigned int cycle = reader.ReadUE();
+		for (unsigned int i = 0; (i < cycle) && (!reader.Overrun()); i++)
+			reader.ReadSE();
+	}
+
+	reader.ReadUE();	// max_num_ref_frames
+	reader.ReadBit();	// gaps_in_frame_num_value_allowed_flag
+	reader.ReadUE();	// pic_width_in_mbs_minus1
+	reader.ReadUE();	// pic_height_in_map_units_minus1
+	sps->frameMbsOnly = reader.ReadBit() != 0;
+
+	sps->valid = !reader.Overrun();
+	return sps->valid;
+}
+
+bool H264ParsePPS(const uint8_t* nal, size_t length, H264PPS* pps)
+{
+	pps->valid = false;
+	if (length < 2)
+		return false;
+
+	H264BitReader reader(nal + 1, length - 1);
+
+	reader.ReadUE();	// pic_parameter_set_id
+	reader.ReadUE();	// seq_parameter_set_id
+	pps->cabac = reader.ReadBit() != 0;
+	pps->bottomFieldPicOrder = reader.ReadBit() != 0;
+
+	// Slice groups never come out of our encoder, don't bother following them
+	if (reader.ReadUE() != 0)
+		return false;
+
+	pps->numRefIdxL0 = reader.ReadUE() + 1;
+	pps->numRefIdxL1 = reader.ReadUE() + 1;
+	pps->weightedPred = reader.ReadBit() != 0;
+	pps->weightedBipred = reader.ReadBits(2);
+	pps->picInitQp = 26 + reader.ReadSE();
+	reader.ReadSE();	// pic_init_qs_minus26
+	reader.ReadSE();	// chroma_qp_index_offset
+	reader.ReadBit();	// deblocking_filter_control_present_flag
+	reader.ReadBit();	// constrained_intra_pred_flag
+	pps->redundantPicCnt = reader.ReadBit() != 0;
+
+	pps->valid = !reader.Overrun();
+	return pps->valid;
+}
+
+static void SkipRefPicListModification(H264BitReader& reader)
+{
+	if (!reader.ReadBit())
+		return;
+
+	unsigned int idc;
+	while (((idc = reader.ReadUE()) != 3) && (!reader.Overrun()))
+		reader.ReadUE();
+}
+
+int H264ParseSliceQP(const uint8_t* nal, size_t length, const H264SPS* sps, const H264PPS* pps)
+{
+	if ((!sps->valid) || (!pps->valid) || (length < 2))
+		return -1;
+
+	unsigned int nalType = H264NalType(nal[0]);
+	bool idr = (nalType == H264_NAL_IDR);
+
+	H264BitReader reader(nal + 1, length - 1);
+
+	reader.ReadUE();	// first_mb_in_slice
+	unsigned int sliceType = reader.ReadUE() % 5;
+	reader.ReadUE();	// pic_parameter_set_id
+
+	if (sps->separateColourPlane)
+		reader.ReadBits(2);
+
+	reader.ReadBits(sps->log2MaxFrameNum);
+
+	bool field = false;
+	if (!sps->frameMbsOnly)
+	{
+		field = reader.ReadBit() != 0;
+		if (field)
+			reader.ReadBit();
+	}
+
+	if (idr)
+		reader.ReadUE();	// idr_pic_id
+
+	if (sps->pocType == 0)
+	{
+		reader.ReadBits(sps->log2MaxPocLsb);
+		if ((pps->bottomFieldPicOrder) && (!field))
+			reader.ReadSE();
+	}
+	else if ((sps->pocType == 1) && (!sps->deltaPicOrderAlwaysZero))
+	{
+		reader.ReadSE();
+		if ((pps->bottomFieldPicOrder) && (!field))
+			reader.ReadSE();
+	}
+
+	if (pps->redundantPicCnt)
+		reader.ReadUE();
+
+	// 0 P, 1 B, 2 I, 3 SP, 4 SI
+	if (sliceType == 1)
+		reader.ReadBit();	// direct_spatial_mv_pred_flag
+
+	if ((sliceType == 0) || (sliceType == 1) || (sliceType == 3))
+	{
+		if (reader.ReadBit())
+		{
+			reader.ReadUE();
+			if (sliceType == 1)
+				reader.ReadUE();
+		}
+	}
+
+	if ((sliceType != 2) && (sliceType != 4))
+	{
+		SkipRefPicListModification(reader);
+		if (sliceType == 1)
+			SkipRefPicListModification(reader);
+	}
+
+	// Weight tables would need the chroma format and reference counts, give up on those
+	if (((pps->weightedPred) && ((sliceType == 0) || (sliceType == 3))) || ((pps->weightedBipred == 1) && (sliceType == 1)))
+		return -1;
+
+	if (H264NalRefIdc(nal[0]))
+	{
+		if (idr)
+		{
+			reader.ReadBit();	// no_output_of_prior_pics_flag
+			reader.ReadBit();	// long_term_reference_flag
+		}
+		else if (reader.ReadBit())
+		{
+			unsigned int operation;
+			while (((operation = reader.ReadUE()) != 0) && (!reader.Overrun()))
+			{
+				if ((operation == 1) || (operation == 3))
+					reader.ReadUE();
+				if (operation == 2)
+					reader.ReadUE();
+				if ((operation == 3) || (operation == 6))
+					reader.ReadUE();
+				if (operation == 4)
+					reader.ReadUE();
+			}
+		}
+	}
+
+	if ((pps->cabac) && (sliceType != 2) && (sliceType != 4))
+		reader.ReadUE();	// cabac_init_idc
+
+	int qp = pps->picInitQp + reader.ReadSE();
+
+	if ((reader.Overrun()) || (qp < 0) || (qp > 51))
+		return -1;
+
+	return qp;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *	Just enough H.264 Annex B parsing to find NAL units in the encoder's output
+ *	and read the slice QP back out of its slice headers
+*/
+
+enum H264NalType
+{
+	H264_NAL_SLICE = 1,
+	H264_NAL_IDR = 5,
+	H264_NAL_SEI = 6,
+	H264_NAL_SPS = 7,
+	H264_NAL_PPS = 8,
+	H264_NAL_AUD = 9,
+};
+
+// Finds the next 00 00 01 start code at or after offset, returns the offset of the NAL header byte or len if there isn't one
+static inline size_t H264FindNal(const uint8_t* data, size_t len, size_t offset)
+{
+	for (size_t i = offset; i + 3 < len; i++)
+	{
+		if ((data[i] == 0) && (data[i + 1] == 0) && (data[i + 2] == 1))
+			return i + 3;
+	}
+
+	return len;
+}
+
+static inline unsigned int H264NalType(uint8_t header)
+{
+	return header & 0x1F;
+}
+
+static inline unsigned int H264NalRefIdc(uint8_t header)
+{
+	return (header >> 5) & 0x03;
+}
+
+// Only the fields needed to get through a slice header to slice_qp_delta
+struct H264SPS
+{
+	bool valid;
+	bool separateColourPlane;
+	unsigned int log2MaxFrameNum;
+	unsigned int pocType;
+	unsigned int log2MaxPocLsb;
+	bool deltaPicOrderAlwaysZero;
+	bool frameMbsOnly;
+};
+
+struct H264PPS
+{
+	bool valid;
+	bool cabac;
+	bool bottomFieldPicOrder;
+	unsigned int numRefIdxL0;
+	unsigned int numRefIdxL1;
+	bool weightedPred;
+	unsigned int weightedBipred;
+	int picInitQp;
+	bool redundantPicCnt;
+};
+
+// Reads RBSP bits, skipping emulation prevention bytes. Reading past the end sets overrun and returns zeros
+class H264BitReader
+{
+public:
+	H264BitReader(const uint8_t* data, size_t length);
+
+	unsigned int ReadBit();
+	unsigned int ReadBits(unsigned int count);
+	unsigned int ReadUE();
+	int ReadSE();
+
+public:
+	bool Overrun() const { return m_overrun; }
+
+private:
+	const uint8_t* m_data;
+	size_t m_length;
+	size_t m_offset;
+	unsigned int m_bit;
+	unsigned int m_zeros;
+	bool m_overrun;
+};
+
+// nal points at the NAL header byte
+bool H264ParseSPS(const uint8_t* nal, size_t length, H264SPS* sps);
+bool H264ParsePPS(const uint8_t* nal, size_t length, H264PPS* pps);
+
+// Returns the slice's QP, or -1 if the header can't be followed
+int H264ParseSliceQP(const uint8_t* nal, size_t length, const H264SPS* sps, const H264PPS* pps);
@@ -0,0 +1,498 @@
+#include "HlsPackager.h"
+#include "H264.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define TS_PAT_PID 0x0000
+#define TS_PMT_PID 0x1000
+#define TS_VIDEO_PID 0x0100
+#define TS_STREAM_TYPE_H264 0x1B
+
+// Payload of a packet whose adaptation field carries a PCR
+#define TS_PCR_PAYLOAD (TS_PACKET_SIZE - 4 - 8)
+
+// Keeps the PTS ahead of the PCR so the decoder has time to buffer the frame
+#define TS_PTS_OFFSET 90000
+
+#define PLAYLIST_NAME "live.m3u8"
+
+static const uint8_t g_startCode[4] = { 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t g_accessUnitDelimiter[6] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xF0 };
+
+// CRC-32/MPEG-2 for the PSI tables
+static uint32_t Crc32(const uint8_t* data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < length; i++)
+	{
+		crc ^= (uint32_t)data[i] << 24;
+		for (unsigned int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000) ? ((crc << 1) ^ 0x04C11DB7) : (crc << 1);
+	}
+	return crc;
+}
+
+HlsPackager::HlsPackager()
+{
+	m_directory[0] = 0;
+	m_targetDuration = 4;
+	m_window = 5;
+	m_maxSegmentSize = 0;
+
+	m_file = nullptr;
+	m_sequence = 0;
+	m_segmentStart = 0;
+	m_segmentBytes = 0;
+	m_discontinuity = false;
+
+	m_segmentCount = 0;
+	m_firstSequence = 0;
+	m_discontinuitySequence = 0;
+
+	m_frameStart = true;
+	m_inPes = false;
+	m_keyframeWanted = false;
+	m_keyframeRequested = false;
+	m_lastTimestamp = 0;
+	m_frameInterval = 0;
+
+	m_spsLength = 0;
+	m_ppsLength = 0;
+
+	m_payloadLength = 0;
+	m_payloadStart = false;
+	m_randomAccess = false;
+	m_pcr = 0;
+	m_videoCounter = 0;
+	m_tableCounter = 0;
+
+	m_totalSegments = 0;
+	m_totalBytes = 0;
+	m_longestSegment = 0;
+}
+
+HlsPackager::~HlsPackager()
+{
+	Close();
+}
+
+bool HlsPackager::Open(const char* directory, unsigned int targetDuration, unsigned int window, unsigned int maxSegmentSize)
+{
+	snprintf(m_directory, sizeof(m_directory), "%s", directory);
+	m_targetDuration = (targetDuration > 0) ? targetDuration : 1;
+	m_window = (window < 1) ? 1 : ((window > HLS_MAX_WINDOW) ? HLS_MAX_WINDOW : window);
+	m_maxSegmentSize = maxSegmentSize;
+
+	mkdir(m_directory, 0755);
+
+	// Anything left from the last run would never be cleaned up
+	DIR* dir = opendir(m_directory);
+	if (!dir)
+	{
+		printf("Failed to open HLS directory %s\n", m_directory);
+		m_directory[0] = 0;
+		return false;
+	}
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr)
+	{
+		size_t length = strlen(entry->d_name);
+		if (((length > 3) && (strcmp(entry->d_name + length - 3, ".ts") == 0)) || (strncmp(entry->d_name, PLAYLIST_NAME, strlen(PLAYLIST_NAME)) == 0))
+		{
+			char fileName[512];
+			snprintf(fileName, sizeof(fileName), "%s/%s", m_directory, entry->d_name);
+			unlink(fileName);
+		}
+	}
+	closedir(dir);
+
+	printf("Writing HLS to %s/%s, %us segments, %u in the playlist\n", m_directory, PLAYLIST_NAME, m_targetDuration, m_window);
+	return true;
+}
+
+void HlsPackager::Close()
+{
+	if (!m_directory[0])
+		return;
+
+	if (m_file)
+	{
+		if (m_inPes)
+			FlushPacket();
+		m_inPes = false;
+
+		EndSegment(m_lastTimestamp + m_frameInterval);
+	}
+
+	if (m_segmentCount)
+		WritePlaylist(true);
+
+	if (m_totalSegments)
+		printf("HLS: %llu segments, %llu bytes, longest segment %llums\n", (unsigned long long)m_totalSegments, (unsigned long long)m_totalBytes, (unsigned long long)(m_longestSegment / 1000));
+
+	m_directory[0] = 0;
+}
+
+bool HlsPackager::KeyframeWanted()
+{
+	bool wanted = m_keyframeWanted;
+	m_keyframeWanted = false;
+	return wanted;
+}
+
+void HlsPackager::NalReceived(const NalChunk& chunk)
+{
+	if (!m_directory[0])
+		return;
+
+	uint64_t timestamp = chunk.timestamp;
+
+	// Parameter sets are kept and sent in front of every IDR, so each segment starts with its own
+	bool parameterSet = (chunk.nalStart) && (chunk.nalEnd) && ((chunk.type == H264_NAL_SPS) || (chunk.type == H264_NAL_PPS));
+	if (parameterSet)
+	{
+		if (chunk.length <= HLS_PARAMETER_SET_SIZE)
+		{
+			if (chunk.type == H264_NAL_SPS)
+			{
+				memcpy(m_sps, chunk.data, chunk.length);
+				m_spsLength = chunk.length;
+			}
+			else
+			{
+				memcpy(m_pps, chunk.data, chunk.length);
+				m_ppsLength = chunk.length;
+			}
+		}
+	}
+	else if ((m_frameStart) && (chunk.nalStart))
+	{
+		m_frameStart = false;
+
+		if ((m_lastTimestamp) && (timestamp > m_lastTimestamp))
+			m_frameInterval = timestamp - m_lastTimestamp;
+		m_lastTimestamp = timestamp;
+
+		bool idr = (chunk.type == H264_NAL_IDR) || (chunk.keyframe);
+		uint64_t duration = (m_file) ? (timestamp - m_segmentStart) : 0;
+
+		if ((idr) && (m_spsLength) && (m_ppsLength))
+		{
+			if (!m_file)
+			{
+				StartSegment(timestamp);
+			}
+			else if (duration >= (uint64_t)m_targetDuration * 1000000)
+			{
+				EndSegment(timestamp);
+				StartSegment(timestamp);
+			}
+		}
+		else if (m_file)
+		{
+			if ((m_maxSegmentSize) && (m_segmentBytes >= m_maxSegmentSize))
+			{
+				// Stop here rather than let the segment grow, the next one starts at the next IDR
+				printf("HLS segment %llu reached %u bytes without an IDR\n", (unsigned long long)m_sequence, m_maxSegmentSize);
+				EndSegment(timestamp);
+				m_discontinuity = true;
+				m_keyframeWanted = true;
+			}
+			else if ((duration >= (uint64_t)m_targetDuration * 1000000) && (!m_keyframeRequested))
+			{
+				// The GOP is longer than the segments, ask for an IDR rather than wait for it
+				m_keyframeWanted = true;
+				m_keyframeRequested = true;
+			}
+		}
+
+		if (m_file)
+			StartPes(timestamp, idr);
+	}
+
+	if ((m_inPes) && (!parameterSet))
+	{
+		if (chunk.nalStart)
+			WritePayload(g_startCode, sizeof(g_startCode));
+		WritePayload(chunk.data, chunk.length);
+	}
+
+	if (chunk.frameEnd)
+	{
+		if (m_inPes)
+			FlushPacket();
+		m_inPes = false;
+		m_frameStart = true;
+	}
+}
+
+void HlsPackager::WriteStatus(FILE* file)
+{
+	fprintf(file, "hls: %u segments in playlist, sequence %llu, %llu bytes written, longest segment %llums\n",
+		m_segmentCount, (unsigned long long)m_sequence, (unsigned long long)m_totalBytes, (unsigned long long)(m_longestSegment / 1000));
+}
+
+void HlsPackager::StartSegment(uint64_t timestamp)
+{
+	char fileName[512];
+	snprintf(fileName, sizeof(fileName), "%s/segment%llu.ts", m_directory, (unsigned long long)m_sequence);
+
+	m_file = fopen(fileName, "w");
+	if (!m_file)
+	{
+		printf("Failed to create HLS segment %s\n", fileName);
+		return;
+	}
+
+	m_segmentStart = timestamp;
+	m_segmentBytes = 0;
+	m_keyframeRequested = false;
+
+	WriteTables();
+}
+
+void HlsPackager::EndSegment(uint64_t endTimestamp)
+{
+	fclose(m_file);
+	m_file = nullptr;
+
+	uint64_t duration = (endTimestamp > m_segmentStart) ? (endTimestamp - m_segmentStart) : m_frameInterval;
+	if (duration > m_longestSegment)
+		m_longestSegment = duration;
+	m_totalSegments++;
+
+	// Slide the window along, the segment leaving it is deleted once its grace period is over
+	if (m_segmentCount == m_window)
+	{
+		if (m_discontinuities[0])
+			m_discontinuitySequence++;
+
+		memmove(&m_durations[0], &m_durations[1], (m_segmentCount - 1) * sizeof(m_durations[0]));
+		memmove(&m_discontinuities[0], &m_discontinuities[1], (m_segmentCount - 1) * sizeof(m_discontinuities[0]));
+		m_segmentCount--;
+
+		if (m_firstSequence >= HLS_GRACE_SEGMENTS)
+			RemoveSegment(m_firstSequence - HLS_GRACE_SEGMENTS);
+		m_firstSequence++;
+	}
+
+	m_durations[m_segmentCount] = duration;
+	m_discontinuities[m_segmentCount] = m_discontinuity;
+	m_segmentCount++;
+	m_discontinuity = false;
+	m_sequence++;
+
+	WritePlaylist(false);
+}
+
+void HlsPackager::WritePlaylist(bool ended)
+{
+	char fileName[512];
+	char tempName[520];
+	snprintf(fileName, sizeof(fileName), "%s/%s", m_directory, PLAYLIST_NAME);
+	snprintf(tempName, sizeof(tempName), "%s.tmp", fileName);
+
+	// The target duration has to cover every segment once rounded
+	unsigned int targetDuration = m_targetDuration;
+	for (unsigned int i = 0; i < m_segmentCount; i++)
+	{
+		unsigned int seconds = (unsigned int)((m_durations[i] + 500000) / 1000000);
+		if (seconds > targetDuration)
+			targetDuration = seconds;
+	}
+
+	FILE* file = fopen(tempName, "w");
+	if (!file)
+		return;
+
+	fprintf(file, "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%u\n#EXT-X-MEDIA-SEQUENCE:%llu\n", targetDuration, (unsigned long long)m_firstSequence);
+	if (m_discontinuitySequence)
+		fprintf(file, "#EXT-X-DISCONTINUITY-SEQUENCE:%u\n", m_discontinuitySequence);
+
+	for (unsigned int i = 0; i < m_segmentCount; i++)
+	{
+		if (m_discontinuities[i])
+			fprintf(file, "#EXT-X-DISCONTINUITY\n");
+		fprintf(file, "#EXTINF:%.3f,\nsegment%llu.ts\n", (double)m_durations[i] / 1000000, (unsigned long long)(m_firstSequence + i));
+	}
+
+	if (ended)
+		fprintf(file, "#EXT-X-ENDLIST\n");
+
+	fclose(file);
+	rename(tempName, fileName);
+}
+
+void HlsPackager::RemoveSegment(uint64_t sequence)
+{
+	char fileName[512];
+	snprintf(fileName, sizeof(fileName), "%s/segment%llu.ts", m_directory, (unsigned long long)sequence);
+	unlink(fileName);
+}
+
+void HlsPackager::StartPes(uint64_t timestamp, bool keyframe)
+{
+	uint64_t pts = ((timestamp * 9) / 100 + TS_PTS_OFFSET) & 0x1FFFFFFFFULL;
+	m_pcr = (timestamp * 9) / 100;
+
+	m_inPes = true;
+	m_payloadLength = 0;
+	m_payloadStart = true;
+	m_randomAccess = keyframe;
+
+	// Video PES with a PTS and no length, the end of the frame is the start of the next PES
+	uint8_t header[14];
+	header[0] = 0x00;
+	header[1] = 0x00;
+	header[2] = 0x01;
+	header[3] = 0xE0;
+	header[4] = 0x00;
+	header[5] = 0x00;
+	header[6] = 0x80;
+	header[7] = 0x80;
+	header[8] = 5;
+	header[9] = 0x21 | ((pts >> 29) & 0x0E);
+	header[10] = (pts >> 22) & 0xFF;
+	header[11] = ((pts >> 14) & 0xFE) | 0x01;
+	header[12] = (pts >> 7) & 0xFF;
+	header[13] = ((pts << 1) & 0xFE) | 0x01;
+	WritePayload(header, sizeof(header));
+
+	// Players expect an access unit delimiter at the start of every frame in a transport stream
+	WritePayload(g_accessUnitDelimiter, sizeof(g_accessUnitDelimiter));
+
+	if (keyframe)
+	{
+		WritePayload(g_startCode, sizeof(g_startCode));
+		WritePayload(m_sps, m_spsLength);
+		WritePayload(g_startCode, sizeof(g_startCode));
+		WritePayload(m_pps, m_ppsLength);
+	}
+}
+
+void HlsPackager::WritePayload(const uint8_t* data, size_t length)
+{
+	while (length > 0)
+	{
+		size_t capacity = (m_payloadStart) ? TS_PCR_PAYLOAD : (TS_PACKET_SIZE - 4);
+		size_t copy = capacity - m_payloadLength;
+		if (copy > length)
+			copy = length;
+
+		memcpy(m_payload + m_payloadLength, data, copy);
+		m_payloadLength += copy;
+		data += copy;
+		length -= copy;
+
+		if (m_payloadLength == capacity)
+			FlushPacket();
+	}
+}
+
+void HlsPackager::FlushPacket()
+{
+	if ((m_payloadLength == 0) && (!m_payloadStart))
+		return;
+
+	uint8_t packet[TS_PACKET_SIZE];
+	packet[0] = 0x47;
+	packet[1] = ((m_payloadStart) ? 0x40 : 0x00) | (TS_VIDEO_PID >> 8);
+	packet[2] = TS_VIDEO_PID & 0xFF;
+
+	// Whatever the payload doesn't fill is adaptation field, with the PCR on the first packet of each frame
+	size_t adaptation = TS_PACKET_SIZE - 4 - m_payloadLength;
+	size_t offset = 4;
+	if (adaptation > 0)
+	{
+		packet[3] = 0x30 | m_videoCounter;
+		packet[offset++] = adaptation - 1;
+		if (adaptation > 1)
+		{
+			uint8_t flags = 0;
+			if (m_payloadStart)
+				flags |= 0x10 | ((m_randomAccess) ? 0x40 : 0x00);
+			packet[offset++] = flags;
+
+			if (m_payloadStart)
+			{
+				packet[offset++] = (m_pcr >> 25) & 0xFF;
+				packet[offset++] = (m_pcr >> 17) & 0xFF;
+				packet[offset++] = (m_pcr >> 9) & 0xFF;
+				packet[offset++] = (m_pcr >> 1) & 0xFF;
+				packet[offset++] = ((m_pcr & 1) << 7) | 0x7E;
+				packet[offset++] = 0x00;
+			}
+
+			memset(packet + offset, 0xFF, TS_PACKET_SIZE - m_payloadLength - offset);
+			offset = TS_PACKET_SIZE - m_payloadLength;
+		}
+	}
+	else
+	{
+		packet[3] = 0x10 | m_videoCounter;
+	}
+
+	memcpy(packet + offset, m_payload, m_payloadLength);
+	WritePacket(packet);
+
+	m_videoCounter = (m_videoCounter + 1) & 0x0F;
+	m_payloadLength = 0;
+	m_payloadStart = false;
+}
+
+void HlsPackager::WriteTables()
+{
+	uint8_t packet[TS_PACKET_SIZE];
+
+	// PAT, program 1 is at the PMT PID
+	memset(packet, 0xFF, sizeof(packet));
+	packet[0] = 0x47;
+	packet[1] = 0x40 | (TS_PAT_PID >> 8);
+	packet[2] = TS_PAT_PID & 0xFF;
+	packet[3] = 0x10 | m_tableCounter;
+	packet[4] = 0x00;
+
+	uint8_t* section = packet + 5;
+	const uint8_t pat[] = { 0x00, 0xB0, 0x0D, 0x00, 0x01, 0xC1, 0x00, 0x00, 0x00, 0x01, 0xE0 | (TS_PMT_PID >> 8), TS_PMT_PID & 0xFF };
+	memcpy(section, pat, sizeof(pat));
+	uint32_t crc = Crc32(section, sizeof(pat));
+	section[sizeof(pat)] = crc >> 24;
+	section[sizeof(pat) + 1] = (crc >> 16) & 0xFF;
+	section[sizeof(pat) + 2] = (crc >> 8) & 0xFF;
+	section[sizeof(pat) + 3] = crc & 0xFF;
+	WritePacket(packet);
+
+	// PMT, a single H.264 stream that also carries the PCR
+	memset(packet, 0xFF, sizeof(packet));
+	packet[0] = 0x47;
+	packet[1] = 0x40 | (TS_PMT_PID >> 8);
+	packet[2] = TS_PMT_PID & 0xFF;
+	packet[3] = 0x10 | m_tableCounter;
+	packet[4] = 0x00;
+
+	const uint8_t pmt[] = { 0x02, 0xB0, 0x12, 0x00, 0x01, 0xC1, 0x00, 0x00, 0xE0 | (TS_VIDEO_PID >> 8), TS_VIDEO_PID & 0xFF, 0xF0, 0x00,
+		TS_STREAM_TYPE_H264, 0xE0 | (TS_VIDEO_PID >> 8), TS_VIDEO_PID & 0xFF, 0xF0, 0x00 };
+	memcpy(section, pmt, sizeof(pmt));
+	crc = Crc32(section, sizeof(pmt));
+	section[sizeof(pmt)] = crc >> 24;
+	section[sizeof(pmt) + 1] = (crc >> 16) & 0xFF;
+	section[sizeof(pmt) + 2] = (crc >> 8) & 0xFF;
+	section[sizeof(pmt) + 3] = crc & 0xFF;
+	WritePacket(packet);
+
+	m_tableCounter = (m_tableCounter + 1) & 0x0F;
+}
+
+void HlsPackager::WritePacket(const uint8_t* packet)
+{
+	if (!m_file)
+		return;
+
+	fwrite(packet, 1, TS_PACKET_SIZE, m_file);
+	m_segmentBytes += TS_PACKET_SIZE;
+	m_totalBytes += TS_PACKET_SIZE;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "NalStream.h"
+
+/*
+ *	HlsPackager
+ *	Packages the live stream into MPEG-TS segments and a rolling .m3u8 playlist for phones to play.
+ *	Segments are only ever cut in front of an IDR (with its SPS/PPS), once the target duration has
+ *	passed. The chunks are packetised straight out of the encoder's buffers, nothing is re-read from disk.
+ *
+ *	Only the last few segments are kept, so the files in the (tmpfs) directory never grow past
+ *	window + HLS_GRACE_SEGMENTS segments of at most maxSegmentSize bytes. The playlist is written
+ *	to a temporary file and renamed so a player never reads half of it.
+*/
+
+#define HLS_MAX_WINDOW 16
+// Segments that have left the playlist stay on disk a little longer for players still fetching them
+#define HLS_GRACE_SEGMENTS 2
+#define HLS_PARAMETER_SET_SIZE 256
+
+#define TS_PACKET_SIZE 188
+
+class HlsPackager : public NalConsumer
+{
+public:
+	HlsPackager();
+	~HlsPackager();
+
+	bool Open(const char* directory, unsigned int targetDuration, unsigned int window, unsigned int maxSegmentSize);
+	void Close();
+
+	virtual void NalReceived(const NalChunk& chunk);
+
+	// True once when a segment has run past its target duration without an IDR
+	bool KeyframeWanted();
+
+	void WriteStatus(FILE* file);
+
+private:
+	void StartSegment(uint64_t timestamp);
+	void EndSegment(uint64_t endTimestamp);
+	void WritePlaylist(bool ended);
+	void RemoveSegment(uint64_t sequence);
+
+	void StartPes(uint64_t timestamp, bool keyframe);
+	void WritePayload(const uint8_t* data, size_t length);
+	void FlushPacket();
+	void WriteTables();
+	void WritePacket(const uint8_t* packet);
+
+private:
+	char m_directory[128];
+	unsigned int m_targetDuration;
+	unsigned int m_window;
+	unsigned int m_maxSegmentSize;
+
+	FILE* m_file;
+	uint64_t m_sequence;
+	uint64_t m_segmentStart;
+	uint64_t m_segmentBytes;
+	bool m_discontinuity;
+
+	// Finished segments in the playlist, oldest first
+	uint64_t m_durations[HLS_MAX_WINDOW];
+	bool m_discontinuities[HLS_MAX_WINDOW];
+	unsigned int m_segmentCount;
+	uint64_t m_firstSequence;
+	unsigned int m_discontinuitySequence;
+
+	// Access unit state
+	bool m_frameStart;
+	bool m_inPes;
+	bool m_keyframeWanted;
+	bool m_keyframeRequested;
+	uint64_t m_lastTimestamp;
+	uint64_t m_frameInterval;
+
+	// Latest parameter sets, repeated in front of every IDR
+	uint8_t m_sps[HLS_PARAMETER_SET_SIZE];
+	size_t m_spsLength;
+	uint8_t m_pps[HLS_PARAMETER_SET_SIZE];
+	size_t m_ppsLength;
+
+	// Payload of the TS packet being filled
+	uint8_t m_payload[TS_PACKET_SIZE];
+	size_t m_payloadLength;
+	bool m_payloadStart;
+	bool m_randomAccess;
+	uint64_t m_pcr;
+	uint8_t m_videoCounter;
+	uint8_t m_tableCounter;
+
+	// Stats
+	uint64_t m_totalSegments;
+	uint64_t m_totalBytes;
+	uint64_t m_longestSegment;
+};
@@ -0,0 +1,92 @@
+#include "ImpactDetector.h"
+#include <math.h>
+
+ImpactDetector::ImpactDetector()
+{
+	m_threshold = 1500;
+	m_duration = 10000;
+	m_holdoff = 5000000;
+
+	m_gravityKnown = false;
+	m_gravity[0] = m_gravity[1] = m_gravity[2] = 0;
+	m_lastTime = 0;
+
+	m_over = false;
+	m_hit = false;
+	m_onsetTime = 0;
+	m_hitTime = 0;
+	m_eventPeak = 0;
+	m_peak = 0;
+	m_hits = 0;
+	m_magnitude = 0;
+}
+
+void ImpactDetector::SetThresholds(unsigned int threshold, unsigned int duration, unsigned int holdoff)
+{
+	m_threshold = threshold;
+	m_duration = (uint64_t)duration * 1000;
+	m_holdoff = (uint64_t)holdoff * 1000;
+}
+
+bool ImpactDetector::Process(const AccelSample& sample)
+{
+	float axes[3] = { (float)sample.x, (float)sample.y, (float)sample.z };
+
+	if (!m_gravityKnown)
+	{
+		for (unsigned int i = 0; i < 3; i++)
+			m_gravity[i] = axes[i];
+		m_gravityKnown = true;
+		m_lastTime = sample.time;
+		return false;
+	}
+
+	float sum = 0;
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		float delta = axes[i] - m_gravity[i];
+		sum += delta * delta;
+	}
+	unsigned int magnitude = (unsigned int)sqrtf(sum);
+	m_magnitude = magnitude;
+
+	bool hit = false;
+	if (magnitude >= m_threshold)
+	{
+		if (!m_over)
+		{
+			m_over = true;
+			m_hit = false;
+			m_onsetTime = sample.time;
+			m_eventPeak = 0;
+		}
+
+		if (magnitude > m_eventPeak)
+			m_eventPeak = magnitude;
+
+		if ((!m_hit) && (sample.time - m_onsetTime >= m_duration) && ((!m_hits) || (sample.time - m_hitTime >= m_holdoff)))
+		{
+			m_hit = true;
+			m_hitTime = sample.time;
+			m_hits++;
+			hit = true;
+		}
+
+		// Carries on rising while the hit lasts
+		if (m_hit)
+			m_peak = m_eventPeak;
+	}
+	else
+	{
+		m_over = false;
+
+		float alpha = (float)(sample.time - m_lastTime) / IMPACT_GRAVITY_TIME;
+		if (alpha > 1)
+			alpha = 1;
+		for (unsigned int i = 0; i < 3; i++)
+			m_gravity[i] += (axes[i] - m_gravity[i]) * alpha;
+	}
+
+	m_lastTime = sample.time;
+	return hit;
+}
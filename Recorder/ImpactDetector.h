@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include "GSensor.h"
+
+/*
+ *	ImpactDetector
+ *	Looks for knocks in the accelerometer samples. Gravity, and however the camera is mounted,
+ *	is tracked with a slow average per axis and taken off each sample. What is left is how hard
+ *	the car is being shaken, and a hit is when it stays over the threshold long enough.
+ *	The average stands still during a hit so the impact isn't taken for a new mounting angle.
+*/
+
+// Time constant of the gravity average in us
+#define IMPACT_GRAVITY_TIME 1000000
+
+class ImpactDetector
+{
+public:
+	ImpactDetector();
+
+	// threshold: mg over gravity
+	// duration: ms it has to stay over the threshold, 0 for a single sample
+	// holdoff: ms after a hit before there can be another one
+	void SetThresholds(unsigned int threshold, unsigned int duration, unsigned int holdoff);
+
+	// Returns true when the sample makes a hit
+	bool Process(const AccelSample& sample);
+
+public:
+	// Largest acceleration over gravity since the hit started, in mg
+	unsigned int GetPeak() const { return m_peak; }
+
+	// Sample time the acceleration first went over the threshold and the one that made it a hit
+	uint64_t GetOnsetTime() const { return m_onsetTime; }
+	uint64_t GetHitTime() const { return m_hitTime; }
+
+	unsigned int GetHits() const { return m_hits; }
+
+	// Acceleration over gravity of the last sample in mg
+	unsigned int GetMagnitude() const { return m_magnitude; }
+
+private:
+	unsigned int m_threshold;
+	uint64_t m_duration;
+	uint64_t m_holdoff;
+
+	bool m_gravityKnown;
+	float m_gravity[3];
+	uint64_t m_lastTime;
+
+	bool m_over;
+	bool m_hit;
+	uint64_t m_onsetTime;
+	uint64_t m_hitTime;
+	unsigned int m_eventPeak;
+	unsigned int m_peak;
+	unsigned int m_hits;
+	unsigned int m_magnitude;
+};
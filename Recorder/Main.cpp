@@ -1,19 +1,59 @@
 #include "Main.h"
 #include <stdio.h>
+#include <string.h>
 
 #include <bcm_host.h>
 #include <IL/OMX_Core.h>
 
+#include <unistd.h>
+#include <signal.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 
 #include "../libs/OMXHelper/OMXCore.h"
 #include "../libs/OMXHelper/OMXClock.h"
-#include "../libs/OMXHelper/OMXCamera.h"
-#include "../libs/OMXHelper/OMXVideoEncoder.h"
-#include "../libs/OMXHelper/OMXNull.h"
+
+#include "Config.h"
+#include "Pipeline.h"
+#include "SegmentWriter.h"
+#include "Timing.h"
+#include "EventQueue.h"
+#include "MotionDetector.h"
+#include "GSensor.h"
+#include "ImpactDetector.h"
+#include "ParkingMode.h"
+#include "StillCapture.h"
+#include "BitrateController.h"
+#include "NalStream.h"
+#include "FrameStats.h"
+#include "RtspServer.h"
+#include "HlsPackager.h"
+#include "FrameBroadcaster.h"
+#include "RecordingOutput.h"
+#include "StorageMonitor.h"
+#include "GpsReader.h"
+#include "GpsTrack.h"
+#include "StreamMetadata.h"
+#include "StorageSetup.h"
+#include "StartupProfile.h"
+#include "ControlServer.h"
+#include "../StorageBench/StorageBench.h"
+
+// The broadcasters are handed the encoder's flags as they are
+static_assert((BROADCAST_FLAG_ENDOFFRAME == OMX_BUFFERFLAG_ENDOFFRAME) && (BROADCAST_FLAG_SYNCFRAME == OMX_BUFFERFLAG_SYNCFRAME) &&
+	(BROADCAST_FLAG_CODECCONFIG == OMX_BUFFERFLAG_CODECCONFIG), "broadcast flags differ from OMX");
 
 static bool g_shouldExit = false;
 
+enum ProfileRequest
+{
+	PROFILE_REQUEST_NONE,
+	PROFILE_REQUEST_DRIVING,
+	PROFILE_REQUEST_PARKING
+};
+static volatile int g_profileRequest = PROFILE_REQUEST_NONE;
+static volatile bool g_flushRequest = false;
+
 void exited()
 {
 	printf("Done recording...\n");
@@ -31,30 +71,82 @@ void sig_handler(int signo)
 void sighup_handler(int signo)
 {
 	// Flush to disk on HUP
+	g_flushRequest = true;
 }
 
-int main()
+void sigusr_handler(int signo)
 {
-	atexit(exited);
-	bcm_host_init();
+	// USR1 drops to the parking profile, USR2 goes back to driving
+	g_profileRequest = (signo == SIGUSR1) ? PROFILE_REQUEST_PARKING : PROFILE_REQUEST_DRIVING;
+}
 
-	OMX_ERRORTYPE omxerr;
-	printf("Initialising OpenMAX...");
-	if ((omxerr = OMX_Init()) != OMX_ErrorNone)
-	{
-		printf("FAILED! Err: %u\n", omxerr);
-		return 1;
-	}
-	else
-		printf("OK!\n");
+// The status file, and the answer to a status command
+static void WriteStatus(FILE* file, Pipeline* pipeline, SegmentWriter* writer, FrameStats* stats, FrameBroadcaster* mainOutput, FrameBroadcaster* subOutput, RtspServer* rtsp, HlsPackager* hls, GpsReader* gps, StartupProfile* startup)
+{
+	fprintf(file, "profile: %s\n", pipeline->GetProfile()->name);
+	fprintf(file, "framerate: %u\n", pipeline->GetFramerate());
+	fprintf(file, "bitrate: %u\n", pipeline->GetBitrate());
+	fprintf(file, "segment: %s\n", writer->GetFileName());
+	writer->WriteStatus(file);
+	stats->WriteStatus(file);
+	mainOutput->WriteStatus(file);
+	subOutput->WriteStatus(file);
+	if (rtsp)
+		rtsp->WriteStatus(file);
+	if (hls)
+		hls->WriteStatus(file);
+	if (gps)
+		gps->WriteStatus(file);
+	startup->WriteStatus(file);
+}
+
+// Picks up the benchmark results kept on the stick, a stick without any isn't limited
+static void LoadStorageBench(RecorderConfig* config)
+{
+	char resultsName[255];
+	snprintf(resultsName, sizeof(resultsName), "%s/%s", config->recordingsDir, BENCH_RESULTS_FILE);
+
+	config->storageBitrate = 0;
+	config->storageStall = 0;
+	if (!config->Load(resultsName))
+		return;
+
+	printf("Storage: up to %u bps with %u byte writes, worst stall %u ms\n", config->storageBitrate, config->segmentBlockSize, config->storageStall);
+
+	// The bitrate controller treats a slow write as the storage falling behind
+	if (config->storageStall > config->bitrateLatencyHigh)
+		printf("The storage stalls for longer than bitrate.latency.high, expect bitrate cuts\n");
+}
+
+// The profile's bitrate, held down to what the storage was measured to sustain
+static unsigned int GetBitrateCeiling(Pipeline* pipeline, const RecorderConfig& config)
+{
+	unsigned int ceiling = pipeline->GetNominalBitrate();
+	if ((config.storageBitrate) && (config.storageBitrate < ceiling))
+		ceiling = (config.storageBitrate > config.bitrateMin) ? config.storageBitrate : config.bitrateMin;
+
+	return ceiling;
+}
+
+int main()
+{
+	// Every phase of the startup is timed from here
+	StartupProfile startup;
 
 	signal(SIGTERM, sig_handler);
 	signal(SIGINT, sig_handler);
 	signal(SIGHUP, sighup_handler);
+	signal(SIGUSR1, sigusr_handler);
+	signal(SIGUSR2, sigusr_handler);
 
 	printf("Pi Recorder - Version 1\n");
 	printf("\tCreated by Craig Richards\n");
 
+	RecorderConfig config;
+	if (config.Load(RECORDER_CONFIG_FILE))
+		printf("Loaded config from %s\n", RECORDER_CONFIG_FILE);
+	startup.Mark("config");
+
 	char directory[255] = { 0 };
 	time_t startTime;
 	/*{
@@ -65,149 +157,417 @@ int main()
 		strftime(directory, sizeof(directory), "/recordings/%d-%m-%y %H-%M-%S/", timeinfo);
 	}*/
 
+	// The recorder doesn't wait for the USB stick, it records into RAM until the stick is mounted
+	// A stick that is already there is set up on its own thread while the camera pipeline is created
+	StorageMonitor storage(config.recordingsDir, config.storageRequireMount);
+	StorageSetup setup(&config);
+	bool storagePending = false;
+	if (storage.IsAvailable())
 	{
-		unsigned int index = 0;
-		bool dirFound = false;
-		struct stat sb;
-		while (!dirFound)
-		{
-			sprintf(directory, "/recordings/%u", index);
+		storagePending = setup.Start(nullptr);
+	}
+	else if (!config.spoolSize)
+	{
+		printf("%s isn't mounted. Uber fail...\n", config.recordingsDir);
+		return 1;
+	}
+	else
+	{
+		printf("Waiting for %s to be mounted, spooling up to %u bytes in RAM\n", config.recordingsDir, config.spoolSize);
+	}
 
-			if (stat(directory, &sb) == 0 && S_ISDIR(sb.st_mode))
-			{
-				// Directory currently exists, skip it
-				dirFound = false;
-			}
-			else
-			{
-				dirFound = true;
-				break;
-			}
+	atexit(exited);
+	bcm_host_init();
 
-			index++;
-		}
+	OMX_ERRORTYPE omxerr;
+	printf("Initialising OpenMAX...");
+	if ((omxerr = OMX_Init()) != OMX_ErrorNone)
+	{
+		printf("FAILED! Err: %u\n", omxerr);
+		return 1;
+	}
+	else
+		printf("OK!\n");
+	startup.Mark("omx");
 
-		if (!dirFound)
+	Pipeline* pipeline = new Pipeline();
+	if (!pipeline->Open(&config))
+	{
+		printf("Failed to create the camera pipeline\n");
+		return 1;
+	}
+	startup.Mark("pipeline");
+
+	// Without a spool there is nowhere for the frames to go until the session directory exists
+	if (!config.spoolSize)
+	{
+		storagePending = false;
+		if (!setup.Finish())
 		{
-			printf("Failed to find empty directroy for recordings...\n");
+			printf("No directory to record into. Uber fail...\n");
 			return 1;
 		}
+
+		setup.PrintStats();
+		snprintf(directory, sizeof(directory), "%s", setup.GetDirectory());
+		LoadStorageBench(&config);
+		startup.Mark("storage");
 	}
 
-	char fileName[255] = { 0 };
-	sprintf(fileName, "%s/00000000-recording.h264", directory);
+	// Segments run on by up to a GOP past segment.size, leave room for that in the pool's files
+	SegmentPool* pool = nullptr;
+	if (config.segmentPool)
+	{
+		pool = new SegmentPool(config.segmentPool, (uint64_t)config.segmentSize + config.segmentSize / 4);
 
-	char cmd[255] = { 0 };
-	printf("Creating directory %s...\n", directory);
-	sprintf(cmd, "mkdir -p \"%s\"", directory);
-	system(cmd);
+		// Only the main stream is pooled, the substream and thumbnail of a recycled segment go with it
+		pool->AddCompanion("substream.h264");
+		pool->AddCompanion("substream.crc");
+		pool->AddCompanion("thumbnail.jpg");
+		if (directory[0])
+			pool->Open(config.recordingsDir);
+	}
+
+	// Filled in from the GPS and the G-sensor as they come in
+	StreamMetadata metadata;
 
-	FILE* outFile = fopen(fileName, "w+");
-	if (!outFile)
+	SegmentWriter* mainWriter = new SegmentWriter(directory, "recording", config.segmentSize);
+	mainWriter->SetBlockSize(config.segmentBlockSize);
+	mainWriter->SetPool(pool);
+	mainWriter->SetChecksums(config.segmentChecksum);
+	if (config.metadataSei)
+		mainWriter->SetMetadata(&metadata, config.metadataInterval);
+	if (config.spoolSize)
+	{
+		mainWriter->SetSpool(config.spoolSize);
+	}
+	else if ((config.rawlogSegments) && (!mainWriter->Open()))
 	{
 		printf("Failed to open initial file. Uber fail...\n");
 		return 1;
 	}
 
-	printf( "Creating camera component...\n" );
-	OMXCamera* camera = new OMXCamera();
-	printf( "Opening camera...\n" );
-	camera->Open(nullptr);
+	RawLogWriter* rawLog = nullptr;
+	if (config.rawlogDevice[0])
+	{
+		rawLog = new RawLogWriter();
+		if (!rawLog->Open(config.rawlogDevice))
+		{
+			printf("Failed to open the raw log. Uber fail...\n");
+			return 1;
+		}
+	}
+
+	OMXCoreComponent* encodingComponent = pipeline->GetMainEncoder();
+	OMXCoreComponent* subEncodingComponent = pipeline->GetSubEncoder();
+
+	// Live view consumers get the stream NAL by NAL, the stats alone are worth having in low latency mode
+	NalStream liveStream;
+	liveStream.SetSeparateNALs(config.lowLatency);
+	bool liveFromMain = (pipeline->GetLiveEncoder() == encodingComponent);
+
+	RtspServer* rtsp = nullptr;
+	if (config.rtspEnabled)
+	{
+		rtsp = new RtspServer();
+		if (rtsp->Open(config.rtspPort))
+		{
+			liveStream.AddConsumer(rtsp);
+		}
+		else
+		{
+			delete rtsp;
+			rtsp = nullptr;
+		}
+	}
+
+	HlsPackager* hls = nullptr;
+	if (config.hlsEnabled)
+	{
+		hls = new HlsPackager();
+		if (hls->Open(config.hlsDir, config.hlsDuration, config.hlsWindow, config.hlsMaxSize))
+		{
+			liveStream.AddConsumer(hls);
+		}
+		else
+		{
+			delete hls;
+			hls = nullptr;
+		}
+	}
+
+	ControlServer* control = nullptr;
+	if (config.controlSocket[0])
+	{
+		control = new ControlServer();
+		if (!control->Open(config.controlSocket))
+		{
+			delete control;
+			control = nullptr;
+		}
+	}
+
+	// The substream rotates alongside the main stream so both share a sequence number
+	SegmentWriter* subWriter = nullptr;
+	if (subEncodingComponent)
+	{
+		subWriter = new SegmentWriter(directory, "substream", config.segmentSize);
+		subWriter->SetBlockSize(config.segmentBlockSize);
+		subWriter->SetChecksums(config.segmentChecksum);
+		if (config.spoolSize)
+		{
+			// The substream is a fraction of the main stream's bitrate
+			subWriter->SetSpool(config.spoolSize / 4);
+		}
+		else if (!subWriter->Open())
+		{
+			printf("Failed to open initial substream file\n");
+			delete subWriter;
+			subWriter = nullptr;
+		}
+	}
+
+	EventQueue events;
+	ParkingMode parking(&config, pipeline);
+
+	MotionDetector* motion = nullptr;
+	FILE* motionDump = nullptr;
+	if (config.motionEnabled)
+	{
+		motion = new MotionDetector();
+		if (!motion->SetRegions(config.motionRegions))
+			printf("Some motion regions were invalid\n");
+		motion->SetThresholds(config.motionMagnitude, config.motionMaxSad, config.motionThreshold, config.motionFrames);
+		motion->SetFrameSize(config.driving.width, config.driving.height);
+
+		if (config.motionDump[0])
+			motionDump = fopen(config.motionDump, "ab");
+	}
+
+	GpsReader* gps = nullptr;
+	if (config.gpsDevice[0])
+	{
+		gps = new GpsReader();
+		if (!gps->Start(config.gpsDevice, config.gpsBaud))
+		{
+			delete gps;
+			gps = nullptr;
+		}
+	}
+	GpsTrack gpsTrack;
+
+	GSensor* gsensor = nullptr;
+	ImpactDetector impact;
+	FILE* gsensorDump = nullptr;
+	if (config.gsensorDevice[0])
+	{
+		gsensor = new GSensor(CreateAccelSource(config.gsensorDevice, config.gsensorAddress, config.gsensorRate));
+		if (!gsensor->Start())
+		{
+			printf("G-sensor disabled\n");
+			delete gsensor;
+			gsensor = nullptr;
+		}
+		impact.SetThresholds(config.gsensorThreshold, config.gsensorDuration, config.gsensorHoldoff * 1000);
+
+		if ((gsensor) && (config.gsensorDump[0]))
+			gsensorDump = fopen(config.gsensorDump, "a");
+	}
+
+	// Segments started before this are kept along with the ones leading up to the impact
+	uint64_t eventClipEnd = 0;
+
+	FrameStats frameStats;
+	frameStats.SetParseQP(config.statsQP);
+	frameStats.SetWindow(config.statsWindow);
+	frameStats.SetFramerate(pipeline->GetFramerate());
+	uint64_t lastStatusTime = GetMonotonicTime();
 
-	printf( "Setting frame info...\n" );
-	camera->SetFrameInfo(1920, 1080, 25);
-	printf( "Setting rotation...\n" );
-	camera->SetRotation(180);
+	char segmentLogName[255] = { 0 };
+	FILE* segmentLog = nullptr;
+	if (directory[0])
+	{
+		sprintf(segmentLogName, "%s/segments.txt", directory);
+		segmentLog = fopen(segmentLogName, "a");
+	}
 
-	printf( "Creating encoder component...\n" );
-	OMXVideoEncoder* encoder = new OMXVideoEncoder();
-	encoder->Open();
+	// Each encoder's buffers go to all of its consumers, only the disk writers may hold them up
+	// Live view goes first so it never waits on the storage
+	bool liveActive = (config.lowLatency) || (liveStream.HasConsumers());
 
-	encoder->SetFrameInfo(1920, 1080, 25, 25000000);
-	encoder->SetBitrate(25000000);
-	encoder->SetOutputFormat(OMX_VIDEO_CodingAVC);
-	encoder->SetAVCProfile(OMX_VIDEO_AVCProfileHigh);
+	FrameBroadcaster mainOutput("main");
+	if ((liveFromMain) && (liveActive))
+		mainOutput.AddConsumer(&liveStream, "live", BROADCAST_DROP_TO_IDR);
 
-	printf( "Creating null_sink component...\n" );
+	RecordingOutput recording(mainWriter, &parking, &frameStats, pipeline);
+	recording.SetSegmentLog(segmentLog);
+	recording.SetRawLog(rawLog, config.rawlogSegments);
+	mainOutput.AddConsumer(&recording, "recording", BROADCAST_LOSSLESS);
 
-	OMXNull* nullsink = new OMXNull();
-	camera->SetupPreviewTunnel(nullsink, 240);
-	OMXCoreComponent* encodingComponent = encoder->GetComponent();
-	camera->SetupCaptureTunnel(encodingComponent, encodingComponent->GetInputPort());
+	FrameBroadcaster subOutput("substream");
+	if ((!liveFromMain) && (liveActive))
+		subOutput.AddConsumer(&liveStream, "live", BROADCAST_DROP_TO_IDR);
+	if (subWriter)
+		subOutput.AddConsumer(subWriter, "recording", BROADCAST_LOSSLESS);
 
-	printf( "Allocating encodeer buffers...\n" );
-	// Allocate the buffer AFTER setting up the tunnel else bad things ahppen
-	encoder->AllocateBuffers();
-	
-	encoder->Execute();
-	camera->Execute();
-	printf( "Enabling camera capture...\n" );
-	camera->EnableCapture(true);
+	BitrateController* rateControl = nullptr;
+	if (config.bitrateAdaptive)
+	{
+		rateControl = new BitrateController();
+		rateControl->SetFloor(config.bitrateMin);
+		rateControl->SetQueueThresholds(config.bitrateQueueLow, config.bitrateQueueHigh);
+		rateControl->SetLatencyThresholds((uint64_t)config.bitrateLatencyLow * 1000, (uint64_t)config.bitrateLatencyHigh * 1000);
+		rateControl->SetHoldTime((uint64_t)config.bitrateHoldTime * 1000000);
+		rateControl->SetReserve(config.bitrateReserve);
+		rateControl->SetCeiling(GetBitrateCeiling(pipeline, config));
+
+		// Keeps the page cache from hiding a slow stick until it's tens of megabytes behind
+		mainWriter->SetWriteBehind(WRITE_BEHIND_CHUNK);
+	}
+	else
+	{
+		pipeline->SetBitrateLimit(config.storageBitrate);
+	}
+	uint64_t lastRateUpdate = GetMonotonicTime();
+
+	StillCapture* still = nullptr;
+	if (pipeline->GetStillEncoder())
+		still = new StillCapture(pipeline);
+
+	pipeline->Start();
+	startup.Mark("capture");
+
+	// Thumbnails sit next to their segment, e.g. 00000003-thumbnail.jpg
+	char stillName[255] = { 0 };
+	if ((still) && (config.stillThumbnails) && (directory[0]))
+	{
+		sprintf(stillName, "%s/%.8u-thumbnail.jpg", directory, mainWriter->GetSegmentIndex());
+		still->Request(stillName);
+	}
 
 	OMX_BUFFERHEADERTYPE* buffer = nullptr;
 
-	unsigned int i = 0;
-	unsigned int initialFrames = 0;
+	// Profile switches are timed from the last frame before the switch to the first one after it
+	uint64_t lastFrameTime = 0;
+	uint64_t switchStartTime = 0;
+	uint64_t switchDoneTime = 0;
+	bool measuringSwitch = false;
 
-	unsigned int headerByteCount = 0;
-	char headerBytes[29] = { 0 };
+	bool exitKeyframeRequested = false;
+	bool exitKeyframeStarted = false;
 
-	unsigned int bufferLen = 0;
-	bool bChangeFile = false;
 	time(&startTime);
 
 	printf( "Start time: %lu\n", startTime );
 
 	while (true)
 	{
+		if ((g_profileRequest != PROFILE_REQUEST_NONE) && (!g_shouldExit))
+		{
+			const RecordingProfile* profile = (g_profileRequest == PROFILE_REQUEST_PARKING) ? &config.parking : &config.driving;
+			g_profileRequest = PROFILE_REQUEST_NONE;
+
+			if (profile != pipeline->GetProfile())
+			{
+				switchStartTime = GetMonotonicTime();
+				if (pipeline->SwitchProfile(profile))
+				{
+					switchDoneTime = GetMonotonicTime();
+					measuringSwitch = true;
+
+					mainWriter->StreamRestarted();
+					frameStats.SetFramerate(profile->framerate);
+					if (motion)
+						motion->SetFrameSize(profile->width, profile->height);
+
+					if (profile == &config.parking)
+						parking.Enter(switchDoneTime);
+					else
+						parking.Leave(switchDoneTime);
+				}
+				else
+				{
+					printf("Profile switch failed. Exiting...\n");
+					break;
+				}
+			}
+		}
+
 		buffer = encodingComponent->GetOutputBuffer();
 		if (buffer)
 		{
-			if (buffer->nFilledLen)
+			if (buffer->nFlags & OMX_BUFFERFLAG_CODECSIDEINFO)
 			{
-				fwrite(buffer->pBuffer + buffer->nOffset, 1, buffer->nFilledLen, outFile);
-				//printf("Read from output buffer and wrote to output file %d/%d\n", buffer->nFilledLen, buffer->nAllocLen);
+				// Inline motion vectors, these never go into the recording
+				const uint8_t* vectors = buffer->pBuffer + buffer->nOffset;
 
-				if (initialFrames < 2)
-				{
-					memcpy(headerBytes + headerByteCount, buffer->pBuffer, buffer->nFilledLen);
+				if ((motion) && (motion->Process(vectors, buffer->nFilledLen)))
+					events.Post(RECORDER_EVENT_MOTION, motion->GetTriggerRegion());
+
+				if ((motion) && (motion->InMotion()))
+					parking.KeepAlive(GetMonotonicTime());
 
-					headerByteCount += buffer->nFilledLen;
-					++initialFrames;
+				if (motionDump)
+					fwrite(vectors, 1, buffer->nFilledLen, motionDump);
+			}
+			else if (!mainOutput.Process(buffer->pBuffer + buffer->nOffset, buffer->nFilledLen, buffer->nFlags, FromOMXTime(buffer->nTimeStamp)))
+			{
+				break;
+			}
+
+			if ((buffer->nFilledLen) && (!(buffer->nFlags & (OMX_BUFFERFLAG_CODECCONFIG | OMX_BUFFERFLAG_CODECSIDEINFO))))
+			{
+				uint64_t now = GetMonotonicTime();
+
+				if (measuringSwitch)
+				{
+					printf("Switched to %s profile: reconfigure %llu ms, capture gap %llu ms\n", pipeline->GetProfile()->name,
+						(unsigned long long)(switchDoneTime - switchStartTime) / 1000, (unsigned long long)(now - ((lastFrameTime) ? lastFrameTime : switchStartTime)) / 1000);
+					measuringSwitch = false;
 				}
-				bufferLen += buffer->nFilledLen;
 
-				// 50MB
-				// Change file every 50MB at the keyframe
-				if (bufferLen > 52428800)
-					bChangeFile = true;
+				if (!lastFrameTime)
+					startup.Mark("frame");
+				lastFrameTime = now;
+
+				if (buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
+					pipeline->KeyframeReceived(now);
+
+				if ((still) && (buffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME))
+					still->VideoFrame(now);
+
+				if (gps)
+					gpsTrack.FrameReceived(FromOMXTime(buffer->nTimeStamp), now);
+			}
 
-				if (bChangeFile)
+			if (mainWriter->Rotated())
+			{
+				if ((eventClipEnd) && (GetMonotonicTime() < eventClipEnd))
+					mainWriter->ProtectSegment();
+
+				if (subWriter)
+					subWriter->RequestRotation(mainWriter->GetSegmentIndex());
+
+				if ((still) && (config.stillThumbnails) && (directory[0]))
 				{
-					if (buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
-					{
-						fclose(outFile);
-
-						// File name is <sequence>-recording.h264
-						sprintf(fileName, "%s/%.8u-recording.h264", directory, ++i);
-						printf("Changing file to %s...\n", fileName);
-						outFile = fopen(fileName, "w+");
-						if (!outFile)
-							break;
-
-						// Write the headers to the file
-						fwrite(headerBytes, 1, headerByteCount, outFile);
-
-						bufferLen = 0;
-						bChangeFile = false;
-					}
+					sprintf(stillName, "%s/%.8u-thumbnail.jpg", directory, mainWriter->GetSegmentIndex());
+					still->Request(stillName);
 				}
 			}
-			
+
 			if (g_shouldExit)
 			{
-				// Wait for a keyframe before exiting
+				if (!exitKeyframeRequested)
+				{
+					pipeline->RequestKeyframe();
+					exitKeyframeRequested = true;
+				}
+
+				// Wait for a keyframe before exiting, and for the rest of its buffers so it goes in whole
 				if (buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
+					exitKeyframeStarted = true;
+
+				if ((exitKeyframeStarted) && (buffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) && (!(buffer->nFlags & OMX_BUFFERFLAG_CODECSIDEINFO)))
 				{
 					printf("Exit was requested and keyframe reached. Exiting main loop...\n");
 					break;
@@ -228,29 +588,464 @@ int main()
 				break;
 			}
 		}*/
+
+		// Drain whatever the substream has produced without blocking the main stream
+		if (subEncodingComponent)
+		{
+			while ((buffer = subEncodingComponent->GetOutputBuffer(0)) != nullptr)
+			{
+				if (!subOutput.Process(buffer->pBuffer + buffer->nOffset, buffer->nFilledLen, buffer->nFlags, FromOMXTime(buffer->nTimeStamp)))
+				{
+					printf("Failed to write substream, disabling it\n");
+					subOutput.RemoveConsumer(subWriter);
+					delete subWriter;
+					subWriter = nullptr;
+				}
+
+				subEncodingComponent->FillThisBuffer(buffer);
+			}
+
+			if ((subWriter) && (subWriter->KeyframeWanted()))
+				pipeline->RequestSubstreamKeyframe();
+		}
+
+		if ((config.spoolSize) && (storage.Update()))
+		{
+			if (storage.IsAvailable())
+			{
+				// A new stick is measured, repaired and given a session on the setup thread, the spool covers for it meanwhile
+				storagePending = setup.Start(directory);
+			}
+			else
+			{
+				if (storagePending)
+				{
+					setup.Cancel();
+					storagePending = false;
+				}
+
+				printf("Storage unmounted, spooling up to %u bytes in RAM\n", config.spoolSize);
+
+				mainWriter->StorageLost();
+				if (subWriter)
+					subWriter->StorageLost();
+				if (pool)
+					pool->Close();
+
+				recording.Finish();
+				recording.SetSegmentLog(nullptr);
+				if (segmentLog)
+					fclose(segmentLog);
+				segmentLog = nullptr;
+			}
+		}
+
+		if ((storagePending) && (setup.IsDone()))
+		{
+			storagePending = false;
+			bool sessionReady = setup.Finish();
+			setup.PrintStats();
+
+			LoadStorageBench(&config);
+			mainWriter->SetBlockSize(config.segmentBlockSize);
+			if (subWriter)
+				subWriter->SetBlockSize(config.segmentBlockSize);
+			if (rateControl)
+				rateControl->SetCeiling(GetBitrateCeiling(pipeline, config));
+			else
+				pipeline->SetBitrateLimit(config.storageBitrate);
+
+			if (sessionReady)
+			{
+				unsigned int index = (setup.IsNewSession()) ? 0 : mainWriter->GetSegmentIndex() + 1;
+				snprintf(directory, sizeof(directory), "%s", setup.GetDirectory());
+
+				printf("Storage mounted, writing to %s from segment %u\n", directory, index);
+
+				sprintf(segmentLogName, "%s/segments.txt", directory);
+				segmentLog = fopen(segmentLogName, "a");
+				recording.SetSegmentLog(segmentLog);
+
+				if (pool)
+					pool->Open(config.recordingsDir);
+
+				mainWriter->StorageAvailable(directory, index);
+				if (subWriter)
+					subWriter->StorageAvailable(directory, index);
+
+				startup.Mark("storage");
+			}
+			else
+			{
+				printf("Still spooling...\n");
+			}
+		}
+
+		// Logged once recording is under way, with the stick if there was one to set up
+		if ((!startup.IsPrinted()) && (lastFrameTime) && (!storagePending))
+			startup.Print();
+
+		// Catch up on the backlog a slice at a time so the live buffers never wait on it for long
+		if (config.spoolSize)
+		{
+			mainWriter->Drain(SPOOL_DRAIN_BYTES);
+			if (subWriter)
+				subWriter->Drain(SPOOL_DRAIN_BYTES / 4);
+		}
+
+		if (gps)
+		{
+			gpsTrack.Update(mainWriter->GetFileName(), mainWriter->GetSegmentStartTime(), mainWriter->IsLive());
+
+			GpsFix fix;
+			while (gps->Pop(&fix))
+			{
+				gpsTrack.AddFix(fix);
+				metadata.SetFix(fix);
+			}
+		}
+
+		if (gsensor)
+		{
+			AccelSample sample;
+			while (gsensor->Pop(&sample))
+			{
+				if (gsensorDump)
+					fprintf(gsensorDump, "%llu %d %d %d\n", (unsigned long long)sample.time, sample.x, sample.y, sample.z);
+
+				if (impact.Process(sample))
+					events.Post(RECORDER_EVENT_IMPACT, impact.GetPeak());
+				metadata.AddAcceleration(impact.GetMagnitude());
+			}
+		}
+
+		if (g_flushRequest)
+		{
+			g_flushRequest = false;
+			mainWriter->Flush();
+			if (subWriter)
+				subWriter->Flush();
+		}
+
+		// Commands from recorderctl.bin, a few at a time so they never hold up the encoder
+		ControlCommand command;
+		for (unsigned int i = 0; (control) && (i < CONTROL_MAX_COMMANDS) && (control->Receive(&command)); i++)
+		{
+			switch (command.type)
+			{
+			case CONTROL_COMMAND_CLIP:
+			{
+				// Handled along with the other events, the same way as an impact
+				unsigned int seconds = (command.hasValue) ? command.value : config.gsensorPost;
+				if (events.Post(RECORDER_EVENT_CLIP, seconds))
+					control->Reply("ok keeping the next %u seconds", seconds);
+				else
+					control->Reply("error too many events waiting");
+				break;
+			}
+
+			case CONTROL_COMMAND_PROTECT:
+				// Without a pool nothing is ever recycled, and nothing is marked as protected either
+				if (!pool)
+				{
+					control->Reply("error no segment pool");
+					break;
+				}
+
+				mainWriter->ProtectSegment();
+				control->Reply("ok segment %u", mainWriter->GetSegmentIndex());
+				break;
+
+			case CONTROL_COMMAND_BITRATE:
+				if ((!command.hasValue) || (command.value < config.bitrateMin) || (command.value > CONTROL_MAX_BITRATE))
+				{
+					control->Reply("error bitrate is %u to %u bps", config.bitrateMin, CONTROL_MAX_BITRATE);
+					break;
+				}
+
+				// The bitrate controller and the storage limit still hold it down
+				pipeline->SetRate(pipeline->GetFramerate(), command.value);
+				if (rateControl)
+					rateControl->SetCeiling(GetBitrateCeiling(pipeline, config));
+				control->Reply("ok %u bps", pipeline->GetBitrate());
+				break;
+
+			case CONTROL_COMMAND_PROFILE:
+				if ((command.argument) && (strcmp(command.argument, config.driving.name) == 0))
+				{
+					g_profileRequest = PROFILE_REQUEST_DRIVING;
+				}
+				else if ((command.argument) && (strcmp(command.argument, config.parking.name) == 0))
+				{
+					g_profileRequest = PROFILE_REQUEST_PARKING;
+				}
+				else
+				{
+					control->Reply("error profile is %s or %s", config.driving.name, config.parking.name);
+					break;
+				}
+				control->Reply("ok");
+				break;
+
+			case CONTROL_COMMAND_ROTATE:
+				// The substream follows once the main stream has rotated
+				mainWriter->RequestRotation(0);
+				pipeline->RequestKeyframe();
+				control->Reply("ok");
+				break;
+
+			case CONTROL_COMMAND_FLUSH:
+				mainWriter->Flush();
+				if (subWriter)
+					subWriter->Flush();
+				control->Reply("ok");
+				break;
+
+			case CONTROL_COMMAND_STATUS:
+				frameStats.SetFramerate(pipeline->GetFramerate());
+				WriteStatus(control->BeginReply(), pipeline, mainWriter, &frameStats, &mainOutput, &subOutput, rtsp, hls, gps, &startup);
+				control->SendReply();
+				break;
+			}
+		}
+
+		RecorderEvent event;
+		while (events.Pop(&event))
+		{
+			switch (event.type)
+			{
+			case RECORDER_EVENT_MOTION:
+				printf("Motion detected in region %u (%u.%u%% moving)\n", event.value, motion->GetLastScore() / 10, motion->GetLastScore() % 10);
+				parking.Trigger(event.time);
+
+				// While driving the picture never stops moving, protecting every segment would fill the stick
+				if (!parking.IsActive())
+					break;
+
+				mainWriter->ProtectSegment();
+
+				// Start the event footage on a fresh IDR
+				pipeline->RequestKeyframe();
+
+				if ((still) && (config.stillOnEvent) && (storage.IsAvailable()) && (!storagePending) && (directory[0]))
+				{
+					sprintf(stillName, "%s/snapshot-%lu.jpg", directory, (unsigned long)time(0));
+					still->Request(stillName);
+				}
+				break;
+
+			case RECORDER_EVENT_IMPACT:
+				printf("Impact of %u mg, over the threshold for %llu ms, %llu ms until it was handled\n", event.value,
+					(unsigned long long)(impact.GetHitTime() - impact.GetOnsetTime()) / 1000, (unsigned long long)(event.time - impact.GetHitTime()) / 1000);
+				parking.Trigger(event.time);
+
+				// The segment before, this one, and any that start within gsensor.post seconds
+				mainWriter->ProtectSegment();
+				eventClipEnd = event.time + (uint64_t)config.gsensorPost * 1000000;
+
+				pipeline->RequestKeyframe();
+
+				if ((still) && (config.stillOnEvent) && (storage.IsAvailable()) && (!storagePending) && (directory[0]))
+				{
+					sprintf(stillName, "%s/snapshot-%lu.jpg", directory, (unsigned long)time(0));
+					still->Request(stillName);
+				}
+				break;
+
+			case RECORDER_EVENT_CLIP:
+				printf("Event clip requested, keeping the next %u seconds\n", event.value);
+				parking.Trigger(event.time);
+
+				mainWriter->ProtectSegment();
+				if (event.time + (uint64_t)event.value * 1000000 > eventClipEnd)
+					eventClipEnd = event.time + (uint64_t)event.value * 1000000;
+
+				pipeline->RequestKeyframe();
+
+				if ((still) && (config.stillOnEvent) && (storage.IsAvailable()) && (!storagePending) && (directory[0]))
+				{
+					sprintf(stillName, "%s/snapshot-%lu.jpg", directory, (unsigned long)time(0));
+					still->Request(stillName);
+				}
+				break;
+			}
+		}
+
+		if (still)
+			still->Update(GetMonotonicTime());
+
+		parking.Update(GetMonotonicTime());
+
+		if (rtsp)
+		{
+			rtsp->Update();
+
+			// A new player shouldn't have to wait for the end of the GOP
+			if (rtsp->KeyframeWanted())
+			{
+				if (liveFromMain)
+					pipeline->RequestKeyframe();
+				else
+					pipeline->RequestSubstreamKeyframe();
+			}
+		}
+
+		// HLS segments are only cut on IDRs, don't let one run on for a whole long GOP
+		if ((hls) && (hls->KeyframeWanted()))
+		{
+			if (liveFromMain)
+				pipeline->RequestKeyframe();
+			else
+				pipeline->RequestSubstreamKeyframe();
+		}
+
+		if ((config.statusFile[0]) && (config.statusInterval) && (GetMonotonicTime() - lastStatusTime >= (uint64_t)config.statusInterval * 1000000))
+		{
+			char tempName[255];
+			snprintf(tempName, sizeof(tempName), "%s.tmp", config.statusFile);
+
+			// Written to a temporary file and renamed, so whoever reads it never sees half an update
+			FILE* file = fopen(tempName, "w");
+			if (file)
+			{
+				frameStats.SetFramerate(pipeline->GetFramerate());
+				WriteStatus(file, pipeline, mainWriter, &frameStats, &mainOutput, &subOutput, rtsp, hls, gps, &startup);
+				fclose(file);
+				rename(tempName, config.statusFile);
+			}
+			lastStatusTime = GetMonotonicTime();
+		}
+
+		// Once a second feed the storage's behaviour back into the main stream's bitrate
+		if ((rateControl) && (GetMonotonicTime() - lastRateUpdate >= 1000000))
+		{
+			StorageSample sample;
+			sample.time = GetMonotonicTime();
+			sample.queueDepth = (encodingComponent->GetOutputBufferSize()) ? (encodingComponent->GetOutputBufferSpace() * 100) / encodingComponent->GetOutputBufferSize() : 0;
+			mainWriter->TakeWriteStats(&sample.bytesWritten, &sample.writeTime, &sample.maxWriteLatency);
+
+			if (rawLog)
+			{
+				uint64_t bytes, writeTime, maxLatency;
+				rawLog->TakeWriteStats(&bytes, &writeTime, &maxLatency);
+
+				sample.bytesWritten += bytes;
+				sample.writeTime += writeTime;
+				if (maxLatency > sample.maxWriteLatency)
+					sample.maxWriteLatency = maxLatency;
+			}
+
+			struct statvfs fs;
+			sample.freeBytes = ((storage.IsAvailable()) && (statvfs(directory, &fs) == 0)) ? (uint64_t)fs.f_bavail * fs.f_frsize : 0;
+
+			unsigned int previous = pipeline->GetBitrate();
+
+			rateControl->SetCeiling(GetBitrateCeiling(pipeline, config));
+			rateControl->Update(sample);
+
+			// Only limit while the controller is holding back, so profile changes and escalations go straight through
+			pipeline->SetBitrateLimit((rateControl->IsLimited()) ? rateControl->GetBitrate() : 0);
+
+			if (pipeline->GetBitrate() != previous)
+			{
+				printf("Bitrate %u -> %u bps (queue %u%%, slowest write %llu ms, storage %u kbps)\n", previous, pipeline->GetBitrate(),
+					sample.queueDepth, (unsigned long long)sample.maxWriteLatency / 1000, rateControl->GetThroughput() / 1000);
+			}
+
+			lastRateUpdate = sample.time;
+		}
+
 		usleep(1000);		
 	}
 
-	// Disable capture on exit
-	camera->EnableCapture(false);
-	camera->StopPreviewTunnel();
-	camera->StopCaptureTunnel();
+	parking.Leave(GetMonotonicTime());
 
-	if ( outFile )
-		fclose(outFile);
+	if (rateControl)
+		printf("Bitrate controller: %u reductions, %u increases\n", rateControl->GetReductions(), rateControl->GetIncreases());
 
-	sprintf( cmd, "echo \"%u seconds\n\" > \"%s/length.txt\"", time(0) - startTime, directory);
-	system(cmd);
-	// Create the file list
-	// Place the file list in the same dir as the recordings so we can pass that to ffmpeg
-	sprintf(cmd, "(for f in \"%s\"*.h264; do echo \"file '$f'\"; done) > \"%s/filelist.txt\"", directory, directory);
-	system(cmd);
+	pipeline->PrintKeyframeStats();
+	liveStream.PrintStats();
+	mainOutput.PrintStats();
+	subOutput.PrintStats();
+	pipeline->Stop();
+
+	// Give whatever is still spooled one last chance to reach the storage
+	if (config.spoolSize)
+	{
+		mainWriter->Drain(config.spoolSize);
+		if (subWriter)
+			subWriter->Drain(config.spoolSize);
+	}
+
+	mainWriter->Close();
+	if (subWriter)
+		subWriter->Close();
+
+	gpsTrack.Close();
+	if (gps)
+	{
+		gps->Stop();
+		gps->PrintStats();
+	}
+
+	if (gsensor)
+	{
+		gsensor->Stop();
+		gsensor->PrintStats();
+		printf("Impacts: %u\n", impact.GetHits());
+	}
+	if (gsensorDump)
+		fclose(gsensorDump);
+
+	mainWriter->PrintLatency();
+	if (control)
+		control->PrintStats();
+	if (pool)
+	{
+		pool->PrintStats();
+		pool->Close();
+	}
+
+	if (rawLog)
+	{
+		rawLog->Close();
+		rawLog->PrintStats();
+	}
+
+	char cmd[255] = { 0 };
+	if (directory[0])
+	{
+		sprintf( cmd, "echo \"%u seconds\n\" > \"%s/length.txt\"", time(0) - startTime, directory);
+		system(cmd);
+		// Create the file list
+		// Place the file list in the same dir as the recordings so we can pass that to ffmpeg
+		sprintf(cmd, "(for f in \"%s\"/*-recording.h264; do echo \"file '$f'\"; done) > \"%s/filelist.txt\"", directory, directory);
+		system(cmd);
+	}
 
 	/*system("ffmpeg -f concat -safe 0 -i /tmp/filelist.txt -vcodec copy recording.mkv");
 	system("rm /tmp/filelist.txt");*/
 	
-	delete camera;
-	delete encoder;
+	recording.Finish();
+	if (segmentLog)
+		fclose(segmentLog);
+
+	if (motionDump)
+		fclose(motionDump);
+	delete motion;
+	delete still;
+	delete rateControl;
+	delete rtsp;
+	delete hls;
+	delete rawLog;
+	delete gps;
+	delete gsensor;
+	delete control;
+
+	delete subWriter;
+	delete mainWriter;
+	delete pool;
+	delete pipeline;
 
 	return 0;
 }
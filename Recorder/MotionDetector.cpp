@@ -0,0 +1,160 @@
+#include "MotionDetector.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+MotionDetector::MotionDetector()
+{
+	m_regionCount = 0;
+
+	m_columns = 0;
+	m_rows = 0;
+
+	m_magnitudeSq = 4;
+	m_maxSad = 0;
+	m_permille = 20;
+	m_frames = 3;
+
+	m_movingFrames = 0;
+	m_lastScore = 0;
+	m_triggerRegion = -1;
+	m_inMotion = false;
+
+	SetRegions("");
+}
+
+bool MotionDetector::SetRegions(const char* regions)
+{
+	m_regionCount = 0;
+
+	const char* pos = regions;
+	while ((pos) && (*pos) && (m_regionCount < MOTION_MAX_REGIONS))
+	{
+		Region& region = m_regions[m_regionCount];
+		if (sscanf(pos, " %u , %u , %u , %u", &region.left, &region.top, &region.width, &region.height) != 4)
+		{
+			printf("Invalid motion region '%s'\n", pos);
+			break;
+		}
+
+		if ((region.left < 100) && (region.top < 100) && (region.width) && (region.height))
+			++m_regionCount;
+
+		pos = strchr(pos, ';');
+		if (pos)
+			++pos;
+	}
+
+	bool valid = (m_regionCount > 0) || (!regions) || (!*regions);
+
+	// Default to the whole frame
+	if (!m_regionCount)
+	{
+		m_regions[0].left = 0;
+		m_regions[0].top = 0;
+		m_regions[0].width = 100;
+		m_regions[0].height = 100;
+		m_regionCount = 1;
+	}
+
+	UpdateRegions();
+
+	return valid;
+}
+
+void MotionDetector::SetThresholds(unsigned int magnitude, unsigned int maxSad, unsigned int percent, unsigned int frames)
+{
+	m_magnitudeSq = magnitude * magnitude;
+	m_maxSad = maxSad;
+	m_permille = percent * 10;
+	m_frames = (frames) ? frames : 1;
+}
+
+void MotionDetector::SetFrameSize(unsigned int width, unsigned int height)
+{
+	m_columns = ((width + 15) / 16) + 1;
+	m_rows = (height + 15) / 16;
+
+	m_movingFrames = 0;
+	m_inMotion = false;
+
+	UpdateRegions();
+}
+
+void MotionDetector::UpdateRegions()
+{
+	// The last column doesn't map onto the picture
+	unsigned int columns = (m_columns) ? m_columns - 1 : 0;
+
+	for (unsigned int i = 0; i < m_regionCount; ++i)
+	{
+		Region& region = m_regions[i];
+
+		unsigned int right = region.left + region.width;
+		unsigned int bottom = region.top + region.height;
+
+		region.mbLeft = (region.left * columns) / 100;
+		region.mbTop = (region.top * m_rows) / 100;
+		region.mbRight = (((right > 100) ? 100 : right) * columns + 99) / 100;
+		region.mbBottom = (((bottom > 100) ? 100 : bottom) * m_rows + 99) / 100;
+	}
+}
+
+bool MotionDetector::Process(const uint8_t* data, size_t length)
+{
+	// Vectors from before a frame size change
+	if ((!m_columns) || (length < GetVectorBufferSize()))
+		return false;
+
+	const MotionVector* vectors = (const MotionVector*)data;
+
+	m_lastScore = 0;
+	int movingRegion = -1;
+
+	for (unsigned int i = 0; i < m_regionCount; ++i)
+	{
+		const Region& region = m_regions[i];
+
+		unsigned int total = (region.mbRight - region.mbLeft) * (region.mbBottom - region.mbTop);
+		if (!total)
+			continue;
+
+		unsigned int moving = 0;
+		for (unsigned int y = region.mbTop; y < region.mbBottom; ++y)
+		{
+			const MotionVector* row = vectors + (y * m_columns);
+			for (unsigned int x = region.mbLeft; x < region.mbRight; ++x)
+			{
+				const MotionVector& mv = row[x];
+
+				int magnitudeSq = (mv.x * mv.x) + (mv.y * mv.y);
+				if (((unsigned int)magnitudeSq >= m_magnitudeSq) && ((!m_maxSad) || (mv.sad <= m_maxSad)))
+					++moving;
+			}
+		}
+
+		unsigned int score = (moving * 1000) / total;
+		if (score > m_lastScore)
+			m_lastScore = score;
+
+		if ((score >= m_permille) && (movingRegion < 0))
+			movingRegion = i;
+	}
+
+	if (movingRegion < 0)
+	{
+		m_movingFrames = 0;
+		m_inMotion = false;
+		return false;
+	}
+
+	++m_movingFrames;
+	if ((!m_inMotion) && (m_movingFrames >= m_frames))
+	{
+		m_inMotion = true;
+		m_triggerRegion = movingRegion;
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *	MotionDetector
+ *	Scores the encoder's inline motion vectors rather than looking at pixels.
+ *	The encoder emits one vector per macroblock after each frame, with an extra column on the right.
+*/
+
+#define MOTION_MAX_REGIONS 4
+
+struct MotionVector
+{
+	int8_t x;
+	int8_t y;
+	uint16_t sad;
+};
+
+class MotionDetector
+{
+public:
+	MotionDetector();
+
+	// "left,top,width,height" in percent of the frame, separated by ';'. Empty means the whole frame
+	bool SetRegions(const char* regions);
+
+	// magnitude: smallest vector length that counts as moving
+	// maxSad: vectors with a worse match than this are noise, 0 to keep them all
+	// percent: share of a region's macroblocks that need to move
+	// frames: consecutive frames a region needs to be moving for before raising an event
+	void SetThresholds(unsigned int magnitude, unsigned int maxSad, unsigned int percent, unsigned int frames);
+
+	void SetFrameSize(unsigned int width, unsigned int height);
+
+	// Size in bytes of one frame's worth of vectors
+	size_t GetVectorBufferSize() const { return m_columns * m_rows * sizeof(MotionVector); }
+
+	// Feed one frame of vectors, returns true when a motion event starts
+	bool Process(const uint8_t* data, size_t length);
+
+public:
+	bool InMotion() const { return m_inMotion; }
+	int GetTriggerRegion() const { return m_triggerRegion; }
+
+	// Highest share of moving macroblocks in any region for the last frame, in tenths of a percent
+	unsigned int GetLastScore() const { return m_lastScore; }
+
+private:
+	struct Region
+	{
+		// Percent of the frame
+		unsigned int left, top, width, height;
+
+		// Macroblocks, right/bottom exclusive
+		unsigned int mbLeft, mbTop, mbRight, mbBottom;
+	};
+
+	void UpdateRegions();
+
+private:
+	Region m_regions[MOTION_MAX_REGIONS];
+	unsigned int m_regionCount;
+
+	unsigned int m_columns;
+	unsigned int m_rows;
+
+	unsigned int m_magnitudeSq;
+	unsigned int m_maxSad;
+	unsigned int m_permille;
+	unsigned int m_frames;
+
+	unsigned int m_movingFrames;
+	unsigned int m_lastScore;
+	int m_triggerRegion;
+	bool m_inMotion;
+};
@@ -0,0 +1,153 @@
+#include "NalStream.h"
+#include "H264.h"
+#include "Timing.h"
+#include <stdio.h>
+
+NalStream::NalStream()
+{
+	for (unsigned int i = 0; i < NAL_STREAM_MAX_CONSUMERS; i++)
+		m_consumers[i] = nullptr;
+	m_consumerCount = 0;
+
+	m_separate = false;
+
+	m_currentType = 0;
+
+	m_frameStartTime = 0;
+	m_frameNals = 0;
+	m_frameCount = 0;
+	m_nalCount = 0;
+	m_leadTotal = 0;
+	m_leadMax = 0;
+}
+
+bool NalStream::AddConsumer(NalConsumer* consumer)
+{
+	if (m_consumerCount >= NAL_STREAM_MAX_CONSUMERS)
+		return false;
+
+	m_consumers[m_consumerCount++] = consumer;
+	return true;
+}
+
+void NalStream::RemoveConsumer(NalConsumer* consumer)
+{
+	for (unsigned int i = 0; i < m_consumerCount; i++)
+	{
+		if (m_consumers[i] == consumer)
+		{
+			m_consumers[i] = m_consumers[--m_consumerCount];
+			m_consumers[m_consumerCount] = nullptr;
+			return;
+		}
+	}
+}
+
+void NalStream::SetSeparateNALs(bool separate)
+{
+	m_separate = separate;
+}
+
+void NalStream::Deliver(const NalChunk& chunk)
+{
+	for (unsigned int i = 0; i < m_consumerCount; i++)
+		m_consumers[i]->NalReceived(chunk);
+}
+
+bool NalStream::BufferReceived(const uint8_t* data, size_t length, uint32_t flags, uint64_t time)
+{
+	Process(data, length, flags, time, GetMonotonicTime());
+	return true;
+}
+
+void NalStream::Process(const uint8_t* data, size_t length, uint32_t flags, uint64_t time, uint64_t now)
+{
+	// Motion vectors aren't part of the stream
+	if ((!length) || (flags & OMX_BUFFERFLAG_CODECSIDEINFO))
+		return;
+
+	NalChunk chunk;
+	chunk.timestamp = time;
+	chunk.keyframe = (flags & OMX_BUFFERFLAG_SYNCFRAME) != 0;
+	chunk.frameEnd = false;
+
+	// Anything before the first start code continues the NAL from the previous buffer
+	size_t nal = H264FindNal(data, length, 0);
+	size_t start = (nal < length) ? nal - 3 : length;
+	// Drop the zero of a 4 byte start code
+	if ((start > 0) && (nal < length) && (data[start - 1] == 0))
+		start--;
+
+	if (start > 0)
+	{
+		chunk.data = data;
+		chunk.length = start;
+		chunk.type = m_currentType;
+		chunk.nalStart = false;
+		chunk.nalEnd = true;
+		if (nal >= length)
+		{
+			chunk.nalEnd = (flags & (OMX_BUFFERFLAG_ENDOFNAL | OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_CODECCONFIG)) != 0;
+			chunk.frameEnd = (flags & OMX_BUFFERFLAG_ENDOFFRAME) != 0;
+		}
+		Deliver(chunk);
+	}
+
+	if ((nal < length) && (!m_frameStartTime))
+	{
+		m_frameStartTime = now;
+		m_frameNals = 0;
+	}
+
+	while (nal < length)
+	{
+		size_t next = (m_separate) ? length : H264FindNal(data, length, nal + 1);
+		size_t end = (next < length) ? next - 3 : length;
+		if ((next < length) && (end > nal) && (data[end - 1] == 0))
+			end--;
+
+		chunk.data = data + nal;
+		chunk.length = end - nal;
+		chunk.type = H264NalType(data[nal]);
+		chunk.nalStart = true;
+
+		if (next < length)
+		{
+			chunk.nalEnd = true;
+			chunk.frameEnd = false;
+		}
+		else
+		{
+			chunk.nalEnd = (flags & (OMX_BUFFERFLAG_ENDOFNAL | OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_CODECCONFIG)) != 0;
+			chunk.frameEnd = (flags & OMX_BUFFERFLAG_ENDOFFRAME) != 0;
+		}
+
+		m_currentType = chunk.type;
+		m_frameNals++;
+		m_nalCount++;
+
+		Deliver(chunk);
+
+		nal = next;
+	}
+
+	if ((flags & OMX_BUFFERFLAG_ENDOFFRAME) && (m_frameStartTime))
+	{
+		uint64_t lead = now - m_frameStartTime;
+		m_leadTotal += lead;
+		if (lead > m_leadMax)
+			m_leadMax = lead;
+
+		m_frameCount++;
+		m_frameStartTime = 0;
+	}
+}
+
+void NalStream::PrintStats()
+{
+	if (!m_frameCount)
+		return;
+
+	printf("Live stream: %u frames, %llu NALs per frame, first NAL out avg %llu us (max %llu us) before the end of its frame\n", m_frameCount,
+		(unsigned long long)(m_nalCount / m_frameCount), (unsigned long long)(m_leadTotal / m_frameCount), (unsigned long long)m_leadMax);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../libs/OMXHelper/OMXCore.h"
+#include "FrameBroadcaster.h"
+
+/*
+ *	NalStream
+ *	Hands the live view encoder's output to consumers NAL by NAL, as soon as each buffer arrives,
+ *	instead of waiting for whole access units. Nothing is copied, the chunks point straight
+ *	into the OMX buffer and are only valid until NalReceived() returns.
+ *
+ *	A NAL can be split across buffers, so a chunk says whether it starts and/or ends its NAL.
+*/
+
+#define NAL_STREAM_MAX_CONSUMERS 4
+
+struct NalChunk
+{
+	// From the NAL header onwards when nalStart is set, the start code is never included
+	const uint8_t* data;
+	size_t length;
+
+	unsigned int type;
+	// Microseconds
+	uint64_t timestamp;
+
+	bool nalStart;
+	bool nalEnd;
+	bool keyframe;
+
+	// Last chunk of the access unit
+	bool frameEnd;
+};
+
+class NalConsumer
+{
+public:
+	virtual ~NalConsumer() {}
+
+	virtual void NalReceived(const NalChunk& chunk) = 0;
+};
+
+class NalStream : public FrameConsumer
+{
+public:
+	NalStream();
+
+	bool AddConsumer(NalConsumer* consumer);
+	void RemoveConsumer(NalConsumer* consumer);
+
+	// The encoder puts one NAL in each buffer, no need to look for start codes past the first
+	void SetSeparateNALs(bool separate);
+
+	void Process(const uint8_t* data, size_t length, uint32_t flags, uint64_t time, uint64_t now);
+
+	virtual bool BufferReceived(const uint8_t* data, size_t length, uint32_t flags, uint64_t time);
+
+	void PrintStats();
+
+public:
+	bool HasConsumers() const { return m_consumerCount > 0; }
+
+private:
+	void Deliver(const NalChunk& chunk);
+
+private:
+	NalConsumer* m_consumers[NAL_STREAM_MAX_CONSUMERS];
+	unsigned int m_consumerCount;
+
+	bool m_separate;
+
+	// Type of the NAL the previous buffer ended in, for chunks continuing it
+	unsigned int m_currentType;
+
+	// How much earlier the first NAL of a frame goes out than the end of the frame
+	uint64_t m_frameStartTime;
+	unsigned int m_frameNals;
+	unsigned int m_frameCount;
+	uint64_t m_nalCount;
+	uint64_t m_leadTotal;
+	uint64_t m_leadMax;
+};
@@ -0,0 +1,232 @@
+#include "Nmea.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define KNOTS_TO_KMH 1.852f
+
+static int HexValue(char c)
+{
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	if ((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	return -1;
+}
+
+NmeaParser::NmeaParser()
+{
+	m_length = 0;
+	m_inSentence = false;
+	m_lineTime = 0;
+
+	memset(&m_epoch, 0, sizeof(m_epoch));
+	m_epochStarted = false;
+	m_epochRMC = false;
+	m_epochGGA = false;
+	m_epochDone = false;
+
+	memset(&m_fix, 0, sizeof(m_fix));
+
+	m_sentences = 0;
+	m_checksumErrors = 0;
+}
+
+bool NmeaParser::Feed(char c, uint64_t time)
+{
+	if (c == '$')
+	{
+		m_inSentence = true;
+		m_length = 0;
+		m_lineTime = time;
+		return false;
+	}
+
+	if (!m_inSentence)
+		return false;
+
+	if ((c == '\r') || (c == '\n'))
+	{
+		m_inSentence = false;
+		m_line[m_length] = 0;
+		return ParseLine();
+	}
+
+	// Too long for any sentence we want, wait for the next '$'
+	if (m_length == NMEA_MAX_LINE - 1)
+	{
+		m_inSentence = false;
+		return false;
+	}
+
+	m_line[m_length++] = c;
+	return false;
+}
+
+bool NmeaParser::ParseLine()
+{
+	// Checksum is the XOR of everything between the '$' and the '*'
+	char* star = strchr(m_line, '*');
+	if ((!star) || (HexValue(star[1]) < 0) || (HexValue(star[2]) < 0))
+	{
+		m_checksumErrors++;
+		return false;
+	}
+
+	unsigned char checksum = 0;
+	for (const char* p = m_line; p < star; p++)
+		checksum ^= (unsigned char)*p;
+
+	if (checksum != ((HexValue(star[1]) << 4) | HexValue(star[2])))
+	{
+		m_checksumErrors++;
+		return false;
+	}
+
+	m_sentences++;
+	*star = 0;
+
+	char* fields[NMEA_MAX_FIELDS];
+	unsigned int count = 0;
+	char* field = m_line;
+	while (count < NMEA_MAX_FIELDS)
+	{
+		fields[count++] = field;
+
+		char* comma = strchr(field, ',');
+		if (!comma)
+			break;
+		*comma = 0;
+		field = comma + 1;
+	}
+
+	// Two letters of talker, three of sentence
+	if (strlen(fields[0]) != 5)
+		return false;
+
+	const char* type = fields[0] + 2;
+	bool isRMC = (strcmp(type, "RMC") == 0);
+	bool isGGA = (strcmp(type, "GGA") == 0);
+	if (((!isRMC) && (!isGGA)) || (count < 10))
+		return false;
+
+	// Receivers without a time yet send the sentence with its fields empty
+	unsigned int utcTime;
+	if (!ParseTime(fields[1], &utcTime))
+		return false;
+
+	// A new epoch finishes off the last one if it had its RMC but never got a GGA
+	bool complete = false;
+	if ((!m_epochStarted) || (utcTime != m_epoch.utcTime))
+	{
+		if ((m_epochStarted) && (m_epochRMC) && (!m_epochDone))
+		{
+			m_fix = m_epoch;
+			complete = true;
+		}
+
+		StartEpoch(utcTime);
+	}
+
+	if (isRMC)
+		m_epochRMC = ParseRMC(fields);
+	else
+		m_epochGGA = ParseGGA(fields);
+
+	if ((m_epochRMC) && (m_epochGGA) && (!m_epochDone))
+	{
+		m_fix = m_epoch;
+		m_epochDone = true;
+		complete = true;
+	}
+
+	return complete;
+}
+
+void NmeaParser::StartEpoch(unsigned int utcTime)
+{
+	memset(&m_epoch, 0, sizeof(m_epoch));
+	m_epoch.time = m_lineTime;
+	m_epoch.utcTime = utcTime;
+
+	m_epochStarted = true;
+	m_epochRMC = false;
+	m_epochGGA = false;
+	m_epochDone = false;
+}
+
+bool NmeaParser::ParseRMC(char** fields)
+{
+	// time, status, lat, N/S, lon, E/W, speed in knots, course, date
+	m_epoch.valid = (fields[2][0] == 'A');
+
+	double latitude, longitude;
+	if ((ParseCoordinate(fields[3], fields[4], &latitude)) && (ParseCoordinate(fields[5], fields[6], &longitude)))
+	{
+		m_epoch.latitude = latitude;
+		m_epoch.longitude = longitude;
+	}
+	else
+	{
+		m_epoch.valid = false;
+	}
+
+	m_epoch.speed = (float)strtod(fields[7], nullptr) * KNOTS_TO_KMH;
+	m_epoch.course = (float)strtod(fields[8], nullptr);
+	m_epoch.date = (unsigned int)strtoul(fields[9], nullptr, 10);
+
+	return true;
+}
+
+bool NmeaParser::ParseGGA(char** fields)
+{
+	// time, lat, N/S, lon, E/W, quality, satellites, HDOP, altitude, M
+	double latitude, longitude;
+	if ((!m_epochRMC) && (ParseCoordinate(fields[2], fields[3], &latitude)) && (ParseCoordinate(fields[4], fields[5], &longitude)))
+	{
+		m_epoch.latitude = latitude;
+		m_epoch.longitude = longitude;
+	}
+
+	m_epoch.quality = (unsigned int)strtoul(fields[6], nullptr, 10);
+	m_epoch.satellites = (unsigned int)strtoul(fields[7], nullptr, 10);
+	m_epoch.hdop = (float)strtod(fields[8], nullptr);
+	m_epoch.altitude = (float)strtod(fields[9], nullptr);
+	m_epoch.hasGGA = true;
+
+	return true;
+}
+
+bool NmeaParser::ParseTime(const char* field, unsigned int* utcTime)
+{
+	// hhmmss with optional fractions of a second
+	for (unsigned int i = 0; i < 6; i++)
+	{
+		if ((field[i] < '0') || (field[i] > '9'))
+			return false;
+	}
+
+	unsigned int hours = (field[0] - '0') * 10 + (field[1] - '0');
+	unsigned int minutes = (field[2] - '0') * 10 + (field[3] - '0');
+	double seconds = strtod(field + 4, nullptr);
+
+	*utcTime = ((hours * 60) + minutes) * 60000 + (unsigned int)(seconds * 1000 + 0.5);
+	return true;
+}
+
+bool NmeaParser::ParseCoordinate(const char* value, const char* hemisphere, double* degrees)
+{
+	// (d)ddmm.mmmm
+	if ((!value[0]) || (!hemisphere[0]))
+		return false;
+
+	double raw = strtod(value, nullptr);
+	double whole = (double)(int)(raw / 100);
+	*degrees = whole + (raw - whole * 100) / 60;
+
+	if ((hemisphere[0] == 'S') || (hemisphere[0] == 'W'))
+		*degrees = -*degrees;
+
+	return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ *	NMEA parser
+ *	Takes a GPS receiver's output a byte at a time and builds fixes from its RMC and GGA
+ *	sentences, whatever the talker (GP, GN, GL...). Sentences are split in place in a fixed
+ *	line buffer, nothing is allocated. Anything else, or anything with a bad checksum, is skipped.
+ *
+ *	The sentences of one epoch all carry the same UTC time. The fix is stamped with the time the
+ *	first of them started to arrive, and is complete once both RMC and GGA are in, or once the next
+ *	epoch starts for a receiver that doesn't send GGA. Without an RMC there is no fix.
+*/
+
+// 82 by the standard, some receivers go a bit over
+#define NMEA_MAX_LINE 128
+#define NMEA_MAX_FIELDS 24
+
+struct GpsFix
+{
+	// Monotonic time the epoch's first sentence started to arrive
+	uint64_t time;
+
+	// UTC, date as ddmmyy and the time in ms since midnight
+	unsigned int date;
+	unsigned int utcTime;
+
+	// Degrees, south and west are negative
+	double latitude;
+	double longitude;
+
+	// km/h and degrees from true north
+	float speed;
+	float course;
+
+	// Metres above mean sea level
+	float altitude;
+	float hdop;
+	unsigned int satellites;
+
+	// The RMC status is A, GGA quality is only known with hasGGA
+	bool valid;
+	bool hasGGA;
+	unsigned int quality;
+};
+
+class NmeaParser
+{
+public:
+	NmeaParser();
+
+	// One byte from the receiver and the time it arrived, returns true when it completes a fix
+	bool Feed(char c, uint64_t time);
+
+	const GpsFix& GetFix() const { return m_fix; }
+
+public:
+	unsigned int GetSentences() const { return m_sentences; }
+	unsigned int GetChecksumErrors() const { return m_checksumErrors; }
+
+private:
+	bool ParseLine();
+	void StartEpoch(unsigned int utcTime);
+	bool ParseRMC(char** fields);
+	bool ParseGGA(char** fields);
+
+	static bool ParseTime(const char* field, unsigned int* utcTime);
+	static bool ParseCoordinate(const char* value, const char* hemisphere, double* degrees);
+
+private:
+	char m_line[NMEA_MAX_LINE];
+	unsigned int m_length;
+	bool m_inSentence;
+	uint64_t m_lineTime;
+
+	// The epoch being put together, moved to m_fix once it's complete
+	GpsFix m_epoch;
+	bool m_epochStarted;
+	bool m_epochRMC;
+	bool m_epochGGA;
+	bool m_epochDone;
+
+	GpsFix m_fix;
+
+	unsigned int m_sentences;
+	unsigned int m_checksumErrors;
+};
@@ -0,0 +1,166 @@
+#include "ParkingMode.h"
+#include <stdio.h>
+
+ParkingMode::ParkingMode(const RecorderConfig* config, Pipeline* pipeline)
+{
+	m_config = config;
+	m_pipeline = pipeline;
+
+	m_active = false;
+	m_escalated = false;
+
+	m_lastActivity = 0;
+
+	m_triggerTime = 0;
+	m_lastFrameTime = 0;
+
+	m_frameStart = true;
+	m_keepFrame = true;
+
+	m_enterTime = 0;
+	m_bytesWritten = 0;
+	m_escalations = 0;
+	m_latencyTotal = 0;
+	m_latencyCount = 0;
+	m_latencyMax = 0;
+}
+
+void ParkingMode::Enter(uint64_t now)
+{
+	m_active = true;
+	m_escalated = false;
+	m_triggerTime = 0;
+	m_lastFrameTime = 0;
+
+	m_frameStart = true;
+	m_keepFrame = true;
+
+	m_enterTime = now;
+	m_bytesWritten = 0;
+	m_escalations = 0;
+	m_latencyTotal = 0;
+	m_latencyCount = 0;
+	m_latencyMax = 0;
+
+	printf("Parking mode: %s at %u fps\n", (m_config->parkingTimelapse) ? "time-lapse" : "recording", m_config->parking.framerate);
+}
+
+void ParkingMode::Leave(uint64_t now)
+{
+	if (!m_active)
+		return;
+
+	PrintStats(now);
+
+	m_active = false;
+	m_escalated = false;
+}
+
+void ParkingMode::Trigger(uint64_t time)
+{
+	if (!m_active)
+		return;
+
+	m_lastActivity = time;
+
+	if (!m_escalated)
+	{
+		m_triggerTime = time;
+		Escalate();
+	}
+}
+
+void ParkingMode::KeepAlive(uint64_t now)
+{
+	if ((m_active) && (m_escalated))
+		m_lastActivity = now;
+}
+
+void ParkingMode::Update(uint64_t now)
+{
+	if ((m_active) && (m_escalated) && ((now - m_lastActivity) > (uint64_t)m_config->parkingQuietTime * 1000000))
+		Decay(now);
+}
+
+void ParkingMode::Escalate()
+{
+	printf("Parking mode: event, escalating to %u fps\n", m_config->parkingEscalateFramerate);
+
+	m_pipeline->SetRate(m_config->parkingEscalateFramerate, m_config->parkingEscalateBitrate);
+	m_escalated = true;
+	++m_escalations;
+}
+
+void ParkingMode::Decay(uint64_t now)
+{
+	printf("Parking mode: quiet for %u seconds, back to %u fps\n", m_config->parkingQuietTime, m_config->parking.framerate);
+
+	m_pipeline->SetRate(m_config->parking.framerate, m_config->parking.bitrate);
+	m_escalated = false;
+	m_triggerTime = 0;
+
+	PrintStats(now);
+}
+
+bool ParkingMode::ShouldWrite(uint32_t flags)
+{
+	if ((!m_active) || (m_escalated) || (!m_config->parkingTimelapse))
+		return true;
+
+	// Decide per frame so every buffer of a kept IDR goes in
+	if (m_frameStart)
+		m_keepFrame = (flags & (OMX_BUFFERFLAG_SYNCFRAME | OMX_BUFFERFLAG_CODECCONFIG)) != 0;
+
+	m_frameStart = (flags & OMX_BUFFERFLAG_ENDOFFRAME) != 0;
+
+	return m_keepFrame;
+}
+
+void ParkingMode::BufferWritten(uint64_t now, size_t length, uint32_t flags)
+{
+	if (!m_active)
+		return;
+
+	m_bytesWritten += length;
+
+	if ((!(flags & OMX_BUFFERFLAG_ENDOFFRAME)) || (flags & OMX_BUFFERFLAG_CODECCONFIG))
+		return;
+
+	// Escalation is done once frames arrive at the full rate
+	if ((m_triggerTime) && (m_lastFrameTime))
+	{
+		uint64_t fullRateInterval = (1500000 / m_config->parkingEscalateFramerate);
+		if ((now - m_lastFrameTime) <= fullRateInterval)
+		{
+			uint64_t latency = now - m_triggerTime;
+			m_latencyTotal += latency;
+			++m_latencyCount;
+			if (latency > m_latencyMax)
+				m_latencyMax = latency;
+
+			printf("Parking mode: full rate %llu ms after the event\n", (unsigned long long)latency / 1000);
+			m_triggerTime = 0;
+		}
+	}
+
+	m_lastFrameTime = now;
+}
+
+void ParkingMode::PrintStats(uint64_t now)
+{
+	uint64_t parkedTime = now - m_enterTime;
+	if (!parkedTime)
+		return;
+
+	// Bytes per hour, worked out in seconds to stay inside 64 bits
+	uint64_t parkedSeconds = (parkedTime / 1000000) ? (parkedTime / 1000000) : 1;
+	uint64_t bytesPerHour = (m_bytesWritten * 3600) / parkedSeconds;
+
+	printf("Parking mode: %llu s parked, %llu bytes written (%llu MB/hour), %u escalations",
+		(unsigned long long)parkedSeconds, (unsigned long long)m_bytesWritten, (unsigned long long)bytesPerHour / 1048576, m_escalations);
+
+	if (m_latencyCount)
+		printf(", escalation latency avg %llu ms max %llu ms", (unsigned long long)(m_latencyTotal / m_latencyCount) / 1000, (unsigned long long)m_latencyMax / 1000);
+
+	printf("\n");
+}
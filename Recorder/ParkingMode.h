@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Config.h"
+#include "Pipeline.h"
+
+/*
+ *	ParkingMode
+ *	While parked the main stream runs at the parking profile's low frame rate and bitrate,
+ *	or only keeps its IDR frames as a time-lapse. A motion or G-sensor event escalates it
+ *	to full rate straight away, and it decays back once things have been quiet for a while.
+*/
+class ParkingMode
+{
+public:
+	ParkingMode(const RecorderConfig* config, Pipeline* pipeline);
+
+	// Called once the parking profile is active / after leaving it
+	void Enter(uint64_t now);
+	void Leave(uint64_t now);
+
+	// A motion or G-sensor event happened at the given time
+	void Trigger(uint64_t time);
+
+	// Something is still moving, hold off decaying
+	void KeepAlive(uint64_t now);
+
+	void Update(uint64_t now);
+
+	// Whether the buffer with these flags belongs in the recording, only IDR frames are kept in time-lapse
+	bool ShouldWrite(uint32_t flags);
+
+	// A buffer of the main stream was written at the given time
+	void BufferWritten(uint64_t now, size_t length, uint32_t flags);
+
+public:
+	bool IsActive() const { return m_active; }
+	bool IsEscalated() const { return m_escalated; }
+
+	void PrintStats(uint64_t now);
+
+private:
+	void Escalate();
+	void Decay(uint64_t now);
+
+private:
+	const RecorderConfig* m_config;
+	Pipeline* m_pipeline;
+
+	bool m_active;
+	bool m_escalated;
+
+	uint64_t m_lastActivity;
+
+	// Time of the event that caused the current escalation, 0 once full rate has been reached
+	uint64_t m_triggerTime;
+	uint64_t m_lastFrameTime;
+
+	// Time-lapse keyframe tracking
+	bool m_frameStart;
+	bool m_keepFrame;
+
+	// Stats for the current parking session
+	uint64_t m_enterTime;
+	uint64_t m_bytesWritten;
+	unsigned int m_escalations;
+	uint64_t m_latencyTotal;
+	unsigned int m_latencyCount;
+	uint64_t m_latencyMax;
+};
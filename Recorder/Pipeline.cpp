@@ -0,0 +1,358 @@
+#include "Pipeline.h"
+#include <stdio.h>
+
+Pipeline::Pipeline()
+{
+	m_camera = nullptr;
+	m_encoder = nullptr;
+
+	m_resize = nullptr;
+	m_subEncoder = nullptr;
+
+	m_nullSink = nullptr;
+
+	m_imageEncoder = nullptr;
+
+	m_profile = nullptr;
+	m_framerate = 0;
+	m_bitrate = 0;
+	m_bitrateLimit = 0;
+
+	m_keyframeRequestTime = 0;
+	m_keyframeCount = 0;
+	m_keyframeLatencyTotal = 0;
+	m_keyframeLatencyMax = 0;
+}
+
+Pipeline::~Pipeline()
+{
+	if (m_camera)
+	{
+		delete m_camera;
+		m_camera = nullptr;
+	}
+
+	if (m_resize)
+	{
+		delete m_resize;
+		m_resize = nullptr;
+	}
+
+	if (m_subEncoder)
+	{
+		delete m_subEncoder;
+		m_subEncoder = nullptr;
+	}
+
+	if (m_encoder)
+	{
+		delete m_encoder;
+		m_encoder = nullptr;
+	}
+
+	if (m_nullSink)
+	{
+		delete m_nullSink;
+		m_nullSink = nullptr;
+	}
+
+	if (m_imageEncoder)
+	{
+		delete m_imageEncoder;
+		m_imageEncoder = nullptr;
+	}
+}
+
+bool Pipeline::Open(const RecorderConfig* config)
+{
+	printf( "Creating camera component...\n" );
+	m_camera = new OMXCamera();
+	printf( "Opening camera...\n" );
+	if (!m_camera->Open(nullptr))
+	{
+		printf("Failed to open camera\n");
+		return false;
+	}
+
+	printf( "Setting frame info...\n" );
+	const RecordingProfile* profile = &config->driving;
+	m_camera->SetFrameInfo(profile->width, profile->height, profile->framerate);
+	printf( "Setting rotation...\n" );
+	m_camera->SetRotation(config->rotation);
+
+	printf( "Creating encoder component...\n" );
+	m_encoder = new OMXVideoEncoder();
+	if (!m_encoder->Open())
+	{
+		printf("Failed to open encoder\n");
+		return false;
+	}
+
+	m_encoder->SetFrameInfo(profile->width, profile->height, profile->framerate, profile->bitrate);
+	m_encoder->SetBitrate(profile->bitrate);
+	m_encoder->SetOutputFormat(OMX_VIDEO_CodingAVC);
+	m_encoder->SetAVCProfile(OMX_VIDEO_AVCProfileHigh);
+	m_encoder->SetIDRPeriod(config->idrPeriod);
+	if (config->inlineHeaders)
+	{
+		m_encoder->SetInlineHeaders(true);
+		m_encoder->SetSPSTiming(true);
+	}
+	if (config->motionEnabled)
+		m_encoder->SetInlineMotionVectors(true);
+	m_encoder->SetQuantisationLimits(config->bitrateMinQuant, config->bitrateMaxQuant);
+
+	if ((!config->substreamEnabled) || (!OpenSubstream(config)))
+	{
+		printf( "Creating null_sink component...\n" );
+
+		m_nullSink = new OMXNull();
+		m_camera->SetupPreviewTunnel(m_nullSink, 240);
+	}
+
+	// Live view comes from the substream when there is one, that is where the low latency output goes
+	if (config->lowLatency)
+	{
+		OMXVideoEncoder* liveEncoder = (m_subEncoder) ? m_subEncoder : m_encoder;
+		liveEncoder->SetSeparateNALs(true);
+		liveEncoder->SetSliceRows(config->sliceRows);
+	}
+
+	OMXCoreComponent* encodingComponent = m_encoder->GetComponent();
+	if (!m_camera->SetupCaptureTunnel(encodingComponent, encodingComponent->GetInputPort()))
+	{
+		printf("Failed to set up the capture tunnel\n");
+		return false;
+	}
+
+	if (config->stillEnabled)
+		OpenStill(config);
+
+	printf( "Allocating encoder buffers...\n" );
+	// Allocate the buffer AFTER setting up the tunnel else bad things ahppen
+	m_encoder->AllocateBuffers();
+	if (m_subEncoder)
+		m_subEncoder->AllocateBuffers();
+	if (m_imageEncoder)
+		m_imageEncoder->AllocateBuffers();
+
+	m_profile = profile;
+	m_framerate = profile->framerate;
+	m_bitrate = profile->bitrate;
+
+	return true;
+}
+
+bool Pipeline::OpenSubstream(const RecorderConfig* config)
+{
+	printf( "Creating substream components (%ux%u @ %u bps)...\n", config->substreamWidth, config->substreamHeight, config->substreamBitrate );
+
+	m_resize = new OMXResize();
+	m_subEncoder = new OMXVideoEncoder();
+
+	if ((m_resize->Open()) && (m_subEncoder->Open()))
+	{
+		m_subEncoder->SetFrameInfo(config->substreamWidth, config->substreamHeight, config->driving.framerate, config->substreamBitrate);
+		m_subEncoder->SetBitrate(config->substreamBitrate);
+		m_subEncoder->SetOutputFormat(OMX_VIDEO_CodingAVC);
+		m_subEncoder->SetAVCProfile(OMX_VIDEO_AVCProfileHigh);
+		m_subEncoder->SetIDRPeriod(config->idrPeriod);
+		if (config->inlineHeaders)
+		{
+			m_subEncoder->SetInlineHeaders(true);
+			m_subEncoder->SetSPSTiming(true);
+		}
+
+		OMXCoreComponent* resizeComponent = m_resize->GetComponent();
+		OMXCoreComponent* subEncodingComponent = m_subEncoder->GetComponent();
+
+		// The resize input picks up the preview port format from the tunnel
+		if (m_camera->SetupPreviewTunnel(resizeComponent, resizeComponent->GetInputPort()))
+		{
+			m_resize->SetOutputSize(config->substreamWidth, config->substreamHeight);
+
+			if (m_resize->SetupOutputTunnel(subEncodingComponent, subEncodingComponent->GetInputPort()))
+				return true;
+
+			m_camera->StopPreviewTunnel();
+		}
+	}
+
+	printf("Failed to create the substream, falling back to null_sink\n");
+
+	delete m_resize;
+	m_resize = nullptr;
+
+	delete m_subEncoder;
+	m_subEncoder = nullptr;
+
+	return false;
+}
+
+bool Pipeline::OpenStill(const RecorderConfig* config)
+{
+	printf( "Creating image encoder (%ux%u)...\n", config->stillWidth, config->stillHeight );
+
+	m_imageEncoder = new OMXImageEncoder();
+	if (m_imageEncoder->Open())
+	{
+		m_camera->SetStillFrameInfo(config->stillWidth, config->stillHeight);
+
+		m_imageEncoder->SetOutputFormat(OMX_IMAGE_CodingJPEG);
+		m_imageEncoder->SetQuality(config->stillQuality);
+
+		OMXCoreComponent* imageComponent = m_imageEncoder->GetComponent();
+		if (m_camera->SetupStillTunnel(imageComponent, imageComponent->GetInputPort()))
+			return true;
+	}
+
+	printf("Failed to create the still path, stills are disabled\n");
+
+	delete m_imageEncoder;
+	m_imageEncoder = nullptr;
+
+	return false;
+}
+
+void Pipeline::Start()
+{
+	m_encoder->Execute();
+	if (m_imageEncoder)
+		m_imageEncoder->Execute();
+	if (m_subEncoder)
+	{
+		m_subEncoder->Execute();
+		m_resize->Execute();
+	}
+
+	m_camera->Execute();
+	printf( "Enabling camera capture...\n" );
+	m_camera->EnableCapture(true);
+}
+
+void Pipeline::Stop()
+{
+	if (!m_camera)
+		return;
+
+	// Disable capture on exit
+	m_camera->EnableCapture(false);
+	m_camera->StopPreviewTunnel();
+	m_camera->StopCaptureTunnel();
+	m_camera->StopStillTunnel();
+
+	if (m_resize)
+		m_resize->StopOutputTunnel();
+}
+
+bool Pipeline::SwitchProfile(const RecordingProfile* profile)
+{
+	if ((!m_camera) || (!m_encoder))
+		return false;
+
+	// The restart brings its own IDR, don't count it against a request
+	m_keyframeRequestTime = 0;
+
+	printf("Switching to %s profile (%ux%u @ %u fps, %u bps)...\n", profile->name, profile->width, profile->height, profile->framerate, profile->bitrate);
+
+	// Only the capture port and the main encoder are touched, the preview path keeps running
+	m_camera->EnableCapture(false);
+	m_camera->DisableCaptureTunnel();
+	m_encoder->FreeBuffers();
+
+	m_camera->SetCaptureFrameInfo(profile->width, profile->height, profile->framerate);
+	m_profile = profile;
+	m_framerate = profile->framerate;
+	m_bitrate = profile->bitrate;
+
+	m_encoder->SetFrameInfo(profile->width, profile->height, profile->framerate, GetBitrate());
+	m_encoder->SetBitrate(GetBitrate());
+	// Drop any rate left over from SetRate
+	m_encoder->SetFramerate(profile->framerate);
+
+	if (!m_camera->EnableCaptureTunnel())
+	{
+		printf("Failed to re-establish the capture tunnel\n");
+		return false;
+	}
+
+	m_encoder->AllocateBuffers();
+	m_camera->EnableCapture(true);
+
+	return true;
+}
+
+void Pipeline::SetRate(unsigned int framerate, unsigned int bitrate)
+{
+	if ((!m_camera) || (!m_encoder))
+		return;
+
+	m_camera->SetCaptureFramerate(framerate);
+	m_framerate = framerate;
+	m_bitrate = bitrate;
+
+	m_encoder->SetFramerate(framerate);
+	m_encoder->SetTargetBitrate(GetBitrate());
+}
+
+void Pipeline::SetBitrateLimit(unsigned int limit)
+{
+	if (!m_encoder)
+		return;
+
+	unsigned int previous = GetBitrate();
+	m_bitrateLimit = limit;
+
+	if (GetBitrate() != previous)
+		m_encoder->SetTargetBitrate(GetBitrate());
+}
+
+void Pipeline::RequestKeyframe()
+{
+	if (!m_encoder)
+		return;
+
+	// Latency is measured from the first of any requests that are still waiting
+	if (m_keyframeRequestTime)
+		return;
+
+	if (m_encoder->RequestKeyframe())
+		m_keyframeRequestTime = GetMonotonicTime();
+}
+
+void Pipeline::RequestSubstreamKeyframe()
+{
+	if (m_subEncoder)
+		m_subEncoder->RequestKeyframe();
+}
+
+void Pipeline::KeyframeReceived(uint64_t now)
+{
+	if (!m_keyframeRequestTime)
+		return;
+
+	uint64_t latency = now - m_keyframeRequestTime;
+	m_keyframeRequestTime = 0;
+
+	m_keyframeCount++;
+	m_keyframeLatencyTotal += latency;
+	if (latency > m_keyframeLatencyMax)
+		m_keyframeLatencyMax = latency;
+}
+
+void Pipeline::PrintKeyframeStats()
+{
+	if (!m_keyframeCount)
+		return;
+
+	printf("Keyframe requests: %u, request to IDR avg %llu ms, max %llu ms\n", m_keyframeCount,
+		(unsigned long long)(m_keyframeLatencyTotal / m_keyframeCount) / 1000, (unsigned long long)m_keyframeLatencyMax / 1000);
+}
+
+bool Pipeline::CaptureStill()
+{
+	if ((!m_camera) || (!m_imageEncoder))
+		return false;
+
+	return m_camera->CaptureStill();
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "Config.h"
+#include "Timing.h"
+
+#include "../libs/OMXHelper/OMXCore.h"
+#include "../libs/OMXHelper/OMXCamera.h"
+#include "../libs/OMXHelper/OMXVideoEncoder.h"
+#include "../libs/OMXHelper/OMXResize.h"
+#include "../libs/OMXHelper/OMXNull.h"
+#include "../libs/OMXHelper/OMXImageEncoder.h"
+
+/*
+ *	Pipeline
+ *	Owns the OpenMAX components and the tunnels between them
+ *
+ *	camera:71 -> video_encode (main stream)
+ *	camera:70 -> resize -> video_encode (substream), or null_sink when the substream is disabled
+ *	camera:72 -> image_encode (JPEG stills), when enabled
+*/
+class Pipeline
+{
+public:
+	Pipeline();
+	~Pipeline();
+
+	bool Open(const RecorderConfig* config);
+	void Start();
+	void Stop();
+
+	// Reconfigures the capture port and main encoder without tearing the pipeline down
+	// The main encoder's output buffers are reallocated, so none may be held while switching
+	bool SwitchProfile(const RecordingProfile* profile);
+
+	// Changes the capture rate and target bitrate of the main stream on the fly, the resolution stays the same
+	void SetRate(unsigned int framerate, unsigned int bitrate);
+
+	// Caps the main stream's bitrate below whatever the profile or SetRate() asked for, 0 removes the cap
+	void SetBitrateLimit(unsigned int limit);
+
+	// Asks the main encoder for an IDR instead of waiting for the end of the GOP
+	void RequestKeyframe();
+	void RequestSubstreamKeyframe();
+
+	// An IDR came out of the main encoder, completes any outstanding request
+	void KeyframeReceived(uint64_t now);
+	void PrintKeyframeStats();
+
+	// Sends one frame down the still port, the JPEG comes out of GetStillEncoder()
+	bool CaptureStill();
+
+public:
+	const RecordingProfile* GetProfile() const {
+		return m_profile;
+	}
+
+	// Current main stream frame rate, including any SetRate() change
+	unsigned int GetFramerate() const {
+		return m_framerate;
+	}
+
+	// Bitrate the profile or SetRate() asked for, before any limit
+	unsigned int GetNominalBitrate() const {
+		return m_bitrate;
+	}
+
+	unsigned int GetBitrate() const {
+		return ((m_bitrateLimit) && (m_bitrateLimit < m_bitrate)) ? m_bitrateLimit : m_bitrate;
+	}
+
+	// nullptr when stills are disabled
+	OMXCoreComponent* GetStillEncoder() const {
+		return (m_imageEncoder) ? m_imageEncoder->GetComponent() : nullptr;
+	}
+
+	OMXCoreComponent* GetMainEncoder() const {
+		return (m_encoder) ? m_encoder->GetComponent() : nullptr;
+	}
+
+	// nullptr when the substream is disabled
+	OMXCoreComponent* GetSubEncoder() const {
+		return (m_subEncoder) ? m_subEncoder->GetComponent() : nullptr;
+	}
+
+	// Stream used for live view, the substream if there is one
+	OMXCoreComponent* GetLiveEncoder() const {
+		return (m_subEncoder) ? m_subEncoder->GetComponent() : GetMainEncoder();
+	}
+
+private:
+	bool OpenSubstream(const RecorderConfig* config);
+	bool OpenStill(const RecorderConfig* config);
+
+private:
+	OMXCamera* m_camera;
+	OMXVideoEncoder* m_encoder;
+
+	OMXResize* m_resize;
+	OMXVideoEncoder* m_subEncoder;
+
+	OMXNull* m_nullSink;
+
+	OMXImageEncoder* m_imageEncoder;
+
+	const RecordingProfile* m_profile;
+	unsigned int m_framerate;
+	unsigned int m_bitrate;
+	unsigned int m_bitrateLimit;
+
+	// Request to IDR latency
+	uint64_t m_keyframeRequestTime;
+	unsigned int m_keyframeCount;
+	uint64_t m_keyframeLatencyTotal;
+	uint64_t m_keyframeLatencyMax;
+};
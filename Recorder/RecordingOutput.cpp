@@ -0,0 +1,77 @@
+#include "RecordingOutput.h"
+#include "Timing.h"
+
+RecordingOutput::RecordingOutput(SegmentWriter* writer, ParkingMode* parking, FrameStats* stats, Pipeline* pipeline)
+{
+	m_writer = writer;
+	m_parking = parking;
+	m_stats = stats;
+	m_pipeline = pipeline;
+	m_rawLog = nullptr;
+	m_segments = true;
+
+	m_segmentLog = nullptr;
+	m_statsSegment = writer->GetSegmentIndex();
+}
+
+void RecordingOutput::SetSegmentLog(FILE* segmentLog)
+{
+	m_segmentLog = segmentLog;
+}
+
+void RecordingOutput::SetRawLog(RawLogWriter* rawLog, bool segments)
+{
+	m_rawLog = rawLog;
+	m_segments = segments;
+}
+
+bool RecordingOutput::BufferReceived(const uint8_t* data, size_t length, uint32_t flags, uint64_t time)
+{
+	if (!m_parking->ShouldWrite(flags))
+		return true;
+
+	if ((m_rawLog) && (length))
+	{
+		uint32_t recordFlags = 0;
+		if (flags & OMX_BUFFERFLAG_CODECCONFIG)
+			recordFlags |= RAWLOG_RECORD_CONFIG;
+		if (flags & OMX_BUFFERFLAG_SYNCFRAME)
+			recordFlags |= RAWLOG_RECORD_KEYFRAME;
+		if (flags & OMX_BUFFERFLAG_ENDOFFRAME)
+			recordFlags |= RAWLOG_RECORD_FRAME_END;
+
+		// Clips are exported by wall clock time
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		uint64_t wallTime = ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+
+		if (!m_rawLog->Write(data, length, recordFlags, wallTime))
+			return false;
+	}
+
+	if (m_segments)
+	{
+		if (!m_writer->Write(data, length, flags, time))
+			return false;
+
+		// Summarise the finished segment before the first buffer of the next one is counted
+		if (m_writer->GetSegmentIndex() != m_statsSegment)
+		{
+			m_stats->EndSegment(m_segmentLog, m_statsSegment);
+			m_statsSegment = m_writer->GetSegmentIndex();
+		}
+	}
+	m_stats->Process(data, length, flags, time);
+
+	// The segment is full, get the next IDR now rather than at the end of the GOP
+	if ((m_segments) && (m_writer->KeyframeWanted()))
+		m_pipeline->RequestKeyframe();
+
+	m_parking->BufferWritten(GetMonotonicTime(), length, flags);
+	return true;
+}
+
+void RecordingOutput::Finish()
+{
+	m_stats->EndSegment(m_segmentLog, m_statsSegment);
+}
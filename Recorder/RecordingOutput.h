@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdio.h>
+#include "FrameBroadcaster.h"
+#include "SegmentWriter.h"
+#include "ParkingMode.h"
+#include "FrameStats.h"
+#include "Pipeline.h"
+#include "../libs/Storage/RawLogWriter.h"
+
+/*
+ *	RecordingOutput
+ *	The main stream's way to disk: the parking mode filter, the segment writer and the
+ *	statistics of what was actually written, with a summary line per segment in segments.txt.
+ *	With a raw log the stream goes into it as well, or only into it when segments are turned off.
+*/
+class RecordingOutput : public FrameConsumer
+{
+public:
+	RecordingOutput(SegmentWriter* writer, ParkingMode* parking, FrameStats* stats, Pipeline* pipeline);
+
+	void SetSegmentLog(FILE* segmentLog);
+	void SetRawLog(RawLogWriter* rawLog, bool segments);
+
+	virtual bool BufferReceived(const uint8_t* data, size_t length, uint32_t flags, uint64_t time);
+
+	// Summarises the segment still being written
+	void Finish();
+
+private:
+	SegmentWriter* m_writer;
+	ParkingMode* m_parking;
+	FrameStats* m_stats;
+	Pipeline* m_pipeline;
+	RawLogWriter* m_rawLog;
+	bool m_segments;
+
+	FILE* m_segmentLog;
+	unsigned int m_statsSegment;
+};
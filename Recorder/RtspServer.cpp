@@ -0,0 +1,567 @@
+#include "RtspServer.h"
+#include "H264.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <linux/sockios.h>
+
+// Keeps RTP packets inside a 1500 byte MTU with room for IP/UDP headers
+#define RTP_MAX_PAYLOAD 1400
+#define RTP_HEADER_SIZE 12
+#define RTP_PAYLOAD_TYPE 96
+
+#define FU_A_TYPE 28
+
+static bool SetNonBlocking(int socket)
+{
+	int flags = fcntl(socket, F_GETFL, 0);
+	return (flags >= 0) && (fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0);
+}
+
+static void Base64Encode(const uint8_t* data, size_t length, char* out, size_t size)
+{
+	static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	size_t o = 0;
+	for (size_t i = 0; (i < length) && (o + 5 < size); i += 3)
+	{
+		uint32_t value = data[i] << 16;
+		if (i + 1 < length)
+			value |= data[i + 1] << 8;
+		if (i + 2 < length)
+			value |= data[i + 2];
+
+		out[o++] = table[(value >> 18) & 0x3F];
+		out[o++] = table[(value >> 12) & 0x3F];
+		out[o++] = (i + 1 < length) ? table[(value >> 6) & 0x3F] : '=';
+		out[o++] = (i + 2 < length) ? table[value & 0x3F] : '=';
+	}
+	out[o] = 0;
+}
+
+RtspServer::RtspServer()
+{
+	m_listenSocket = -1;
+
+	for (unsigned int i = 0; i < RTSP_MAX_CLIENTS; i++)
+	{
+		m_clients[i].controlSocket = -1;
+		m_clients[i].rtpSocket = -1;
+	}
+
+	m_spsLength = 0;
+	m_ppsLength = 0;
+	m_nalHeader = 0;
+
+	m_keyframeWanted = false;
+	m_nextSession = 0x1000;
+}
+
+RtspServer::~RtspServer()
+{
+	Close();
+}
+
+bool RtspServer::Open(unsigned int port)
+{
+	m_listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+	if (m_listenSocket < 0)
+		return false;
+
+	int reuse = 1;
+	setsockopt(m_listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+
+	if ((bind(m_listenSocket, (struct sockaddr*)&address, sizeof(address)) != 0) || (listen(m_listenSocket, 4) != 0) || (!SetNonBlocking(m_listenSocket)))
+	{
+		printf("Failed to listen for RTSP on port %u (%d)\n", port, errno);
+		close(m_listenSocket);
+		m_listenSocket = -1;
+		return false;
+	}
+
+	printf("RTSP live view on port %u\n", port);
+	return true;
+}
+
+void RtspServer::Close()
+{
+	for (unsigned int i = 0; i < RTSP_MAX_CLIENTS; i++)
+	{
+		if (m_clients[i].controlSocket >= 0)
+			CloseClient(&m_clients[i]);
+	}
+
+	if (m_listenSocket >= 0)
+	{
+		close(m_listenSocket);
+		m_listenSocket = -1;
+	}
+}
+
+void RtspServer::CloseClient(RtspClient* client)
+{
+	printf("RTSP client %s left: %llu packets, %llu bytes, %u drops, send queue peak %u bytes\n", inet_ntoa(client->address.sin_addr),
+		(unsigned long long)client->packets, (unsigned long long)client->bytes, client->drops, client->maxQueueDepth);
+
+	close(client->controlSocket);
+	client->controlSocket = -1;
+
+	if (client->rtpSocket >= 0)
+	{
+		close(client->rtpSocket);
+		client->rtpSocket = -1;
+	}
+}
+
+bool RtspServer::KeyframeWanted()
+{
+	bool wanted = m_keyframeWanted;
+	m_keyframeWanted = false;
+	return wanted;
+}
+
+void RtspServer::Update()
+{
+	if (m_listenSocket < 0)
+		return;
+
+	Accept();
+
+	for (unsigned int i = 0; i < RTSP_MAX_CLIENTS; i++)
+	{
+		if (m_clients[i].controlSocket >= 0)
+			ReadRequests(&m_clients[i]);
+	}
+}
+
+void RtspServer::Accept()
+{
+	struct sockaddr_in address;
+	socklen_t addressLength = sizeof(address);
+
+	int socket = accept(m_listenSocket, (struct sockaddr*)&address, &addressLength);
+	if (socket < 0)
+		return;
+
+	RtspClient* client = nullptr;
+	for (unsigned int i = 0; i < RTSP_MAX_CLIENTS; i++)
+	{
+		if (m_clients[i].controlSocket < 0)
+		{
+			client = &m_clients[i];
+			break;
+		}
+	}
+
+	if ((!client) || (!SetNonBlocking(socket)))
+	{
+		printf("Turning away RTSP client %s, too many clients\n", inet_ntoa(address.sin_addr));
+		close(socket);
+		return;
+	}
+
+	memset(client, 0, sizeof(*client));
+	client->controlSocket = socket;
+	client->rtpSocket = -1;
+	client->address = address;
+	client->ssrc = (uint32_t)rand();
+	client->sequence = (uint16_t)rand();
+
+	printf("RTSP client %s connected\n", inet_ntoa(address.sin_addr));
+}
+
+void RtspServer::ReadRequests(RtspClient* client)
+{
+	ssize_t received = recv(client->controlSocket, client->request + client->requestLength, sizeof(client->request) - 1 - client->requestLength, 0);
+	if (received == 0)
+	{
+		CloseClient(client);
+		return;
+	}
+	if (received < 0)
+	{
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+			CloseClient(client);
+		return;
+	}
+
+	client->requestLength += received;
+	client->request[client->requestLength] = 0;
+
+	// Requests from players don't carry bodies, so a blank line ends each one
+	char* end;
+	while ((client->controlSocket >= 0) && ((end = strstr(client->request, "\r\n\r\n")) != nullptr))
+	{
+		*end = 0;
+		HandleRequest(client, client->request);
+		if (client->controlSocket < 0)
+			return;
+
+		unsigned int used = (end + 4) - client->request;
+		memmove(client->request, end + 4, client->requestLength - used + 1);
+		client->requestLength -= used;
+	}
+
+	if (client->requestLength >= sizeof(client->request) - 1)
+	{
+		printf("RTSP request too large, dropping the client\n");
+		CloseClient(client);
+	}
+}
+
+// Finds a header's value in the request, case insensitively
+static const char* FindHeader(const char* request, const char* name)
+{
+	size_t nameLength = strlen(name);
+
+	const char* line = strstr(request, "\r\n");
+	while (line)
+	{
+		line += 2;
+		if ((strncasecmp(line, name, nameLength) == 0) && (line[nameLength] == ':'))
+		{
+			const char* value = line + nameLength + 1;
+			while (*value == ' ')
+				value++;
+			return value;
+		}
+
+		line = strstr(line, "\r\n");
+	}
+
+	return nullptr;
+}
+
+void RtspServer::HandleRequest(RtspClient* client, char* request)
+{
+	char method[16] = { 0 };
+	char url[256] = { 0 };
+	if (sscanf(request, "%15s %255s", method, url) != 2)
+	{
+		CloseClient(client);
+		return;
+	}
+
+	const char* cseqHeader = FindHeader(request, "CSeq");
+	unsigned int cseq = (cseqHeader) ? (unsigned int)atoi(cseqHeader) : 0;
+
+	char headers[512];
+
+	if (strcmp(method, "OPTIONS") == 0)
+	{
+		SendResponse(client, cseq, "200 OK", "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER\r\n", nullptr);
+	}
+	else if (strcmp(method, "DESCRIBE") == 0)
+	{
+		char sdp[768];
+		WriteSdp(sdp, sizeof(sdp));
+
+		size_t urlLength = strlen(url);
+		snprintf(headers, sizeof(headers), "Content-Base: %s%s\r\nContent-Type: application/sdp\r\n", url, ((urlLength) && (url[urlLength - 1] == '/')) ? "" : "/");
+		SendResponse(client, cseq, "200 OK", headers, sdp);
+	}
+	else if (strcmp(method, "SETUP") == 0)
+	{
+		const char* transport = FindHeader(request, "Transport");
+		unsigned int serverPort = 0;
+
+		// Only RTP over UDP, a TCP interleaved client would back up into our control socket
+		if ((!transport) || (!SetupTransport(client, transport, &serverPort)))
+		{
+			SendResponse(client, cseq, "461 Unsupported Transport", nullptr, nullptr);
+			return;
+		}
+
+		unsigned int clientPort = ntohs(client->address.sin_port);
+		if (client->session == 0)
+			client->session = m_nextSession++;
+
+		snprintf(headers, sizeof(headers), "Transport: RTP/AVP;unicast;client_port=%u-%u;server_port=%u-%u;ssrc=%08X\r\nSession: %08X;timeout=60\r\n",
+			clientPort, clientPort + 1, serverPort, serverPort + 1, client->ssrc, client->session);
+		SendResponse(client, cseq, "200 OK", headers, nullptr);
+	}
+	else if (strcmp(method, "PLAY") == 0)
+	{
+		if (client->rtpSocket < 0)
+		{
+			SendResponse(client, cseq, "455 Method Not Valid in This State", nullptr, nullptr);
+			return;
+		}
+
+		// Start on the next IDR, and ask for one so that isn't a whole GOP away
+		client->playing = true;
+		client->waitingForIDR = true;
+		m_keyframeWanted = true;
+
+		snprintf(headers, sizeof(headers), "Session: %08X\r\nRange: npt=0.000-\r\nRTP-Info: url=%s;seq=%u\r\n", client->session, url, client->sequence);
+		SendResponse(client, cseq, "200 OK", headers, nullptr);
+	}
+	else if (strcmp(method, "TEARDOWN") == 0)
+	{
+		snprintf(headers, sizeof(headers), "Session: %08X\r\n", client->session);
+		SendResponse(client, cseq, "200 OK", headers, nullptr);
+		CloseClient(client);
+	}
+	else if (strcmp(method, "GET_PARAMETER") == 0)
+	{
+		// Keep alive
+		snprintf(headers, sizeof(headers), "Session: %08X\r\n", client->session);
+		SendResponse(client, cseq, "200 OK", headers, nullptr);
+	}
+	else
+	{
+		SendResponse(client, cseq, "501 Not Implemented", nullptr, nullptr);
+	}
+}
+
+bool RtspServer::SetupTransport(RtspClient* client, const char* transport, unsigned int* serverPort)
+{
+	const char* ports = strstr(transport, "client_port=");
+	if ((!ports) || (strncmp(transport, "RTP/AVP", 7) != 0) || (strncmp(transport, "RTP/AVP/TCP", 11) == 0))
+		return false;
+
+	unsigned int rtpPort = (unsigned int)atoi(ports + 12);
+	if (!rtpPort)
+		return false;
+
+	if (client->rtpSocket < 0)
+	{
+		client->rtpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+		if (client->rtpSocket < 0)
+			return false;
+
+		SetNonBlocking(client->rtpSocket);
+	}
+
+	// Connected, so every packet goes out with a plain sendmsg() and no address
+	struct sockaddr_in address = client->address;
+	address.sin_port = htons(rtpPort);
+	if (connect(client->rtpSocket, (struct sockaddr*)&address, sizeof(address)) != 0)
+		return false;
+
+	struct sockaddr_in local;
+	socklen_t localLength = sizeof(local);
+	getsockname(client->rtpSocket, (struct sockaddr*)&local, &localLength);
+	*serverPort = ntohs(local.sin_port);
+
+	// The client port in the reply is the one they asked for, keep it around for that
+	client->address.sin_port = htons(rtpPort);
+
+	return true;
+}
+
+void RtspServer::SendResponse(RtspClient* client, unsigned int cseq, const char* status, const char* headers, const char* body)
+{
+	char response[1536];
+	int length = snprintf(response, sizeof(response), "RTSP/1.0 %s\r\nCSeq: %u\r\nServer: DashPi\r\n%s", status, cseq, (headers) ? headers : "");
+
+	if (body)
+		length += snprintf(response + length, sizeof(response) - length, "Content-Length: %u\r\n\r\n%s", (unsigned int)strlen(body), body);
+	else
+		length += snprintf(response + length, sizeof(response) - length, "\r\n");
+
+	if (length > (int)sizeof(response))
+		length = sizeof(response);
+
+	// Responses are small enough to always fit in an empty socket buffer
+	send(client->controlSocket, response, length, MSG_NOSIGNAL);
+}
+
+void RtspServer::WriteSdp(char* sdp, size_t size)
+{
+	char fmtp[256] = { 0 };
+
+	// Players can also pick the parameter sets up in band, but having them here speeds up the start
+	if ((m_spsLength >= 4) && (m_ppsLength))
+	{
+		char sps[128];
+		char pps[128];
+		Base64Encode(m_sps, m_spsLength, sps, sizeof(sps));
+		Base64Encode(m_pps, m_ppsLength, pps, sizeof(pps));
+
+		snprintf(fmtp, sizeof(fmtp), ";profile-level-id=%02X%02X%02X;sprop-parameter-sets=%s,%s", m_sps[1], m_sps[2], m_sps[3], sps, pps);
+	}
+
+	snprintf(sdp, size,
+		"v=0\r\n"
+		"o=- 0 0 IN IP4 0.0.0.0\r\n"
+		"s=DashPi\r\n"
+		"t=0 0\r\n"
+		"a=control:*\r\n"
+		"m=video 0 RTP/AVP %u\r\n"
+		"a=rtpmap:%u H264/90000\r\n"
+		"a=fmtp:%u packetization-mode=1%s\r\n"
+		"a=control:track0\r\n",
+		RTP_PAYLOAD_TYPE, RTP_PAYLOAD_TYPE, RTP_PAYLOAD_TYPE, fmtp);
+}
+
+void RtspServer::NalReceived(const NalChunk& chunk)
+{
+	if (chunk.nalStart)
+	{
+		m_nalHeader = chunk.data[0];
+
+		if ((chunk.nalEnd) && (chunk.length <= RTSP_PARAMETER_SET_SIZE))
+		{
+			if (chunk.type == H264_NAL_SPS)
+			{
+				memcpy(m_sps, chunk.data, chunk.length);
+				m_spsLength = chunk.length;
+			}
+			else if (chunk.type == H264_NAL_PPS)
+			{
+				memcpy(m_pps, chunk.data, chunk.length);
+				m_ppsLength = chunk.length;
+			}
+		}
+	}
+
+	// 90kHz RTP clock from the microsecond timestamps
+	uint32_t timestamp = (uint32_t)((chunk.timestamp * 9) / 100);
+
+	for (unsigned int i = 0; i < RTSP_MAX_CLIENTS; i++)
+	{
+		RtspClient* client = &m_clients[i];
+		if ((client->controlSocket < 0) || (!client->playing))
+			continue;
+
+		if (client->waitingForIDR)
+		{
+			// Pick the stream up again at the parameter sets in front of an IDR, or the IDR itself
+			if ((!chunk.nalStart) || ((chunk.type != H264_NAL_SPS) && (chunk.type != H264_NAL_IDR)))
+				continue;
+
+			client->waitingForIDR = false;
+		}
+
+		SendChunk(client, chunk, timestamp);
+
+		if (chunk.frameEnd)
+		{
+			int queued = 0;
+			if (ioctl(client->rtpSocket, SIOCOUTQ, &queued) == 0)
+			{
+				client->queueDepth = queued;
+				if ((unsigned int)queued > client->maxQueueDepth)
+					client->maxQueueDepth = queued;
+			}
+		}
+	}
+}
+
+void RtspServer::SendChunk(RtspClient* client, const NalChunk& chunk, uint32_t timestamp)
+{
+	bool lastOfFrame = (chunk.frameEnd) && (chunk.nalEnd);
+
+	// Small enough NALs go out whole
+	if ((chunk.nalStart) && (chunk.nalEnd) && (chunk.length <= RTP_MAX_PAYLOAD))
+	{
+		if (!SendPacket(client, timestamp, lastOfFrame, nullptr, 0, chunk.data, chunk.length))
+			client->waitingForIDR = true;
+		return;
+	}
+
+	// Everything else as FU-A fragments, the NAL header is rebuilt into the FU indicator and header
+	const uint8_t* data = chunk.data;
+	size_t remaining = chunk.length;
+	bool first = chunk.nalStart;
+	if (first)
+	{
+		data++;
+		remaining--;
+	}
+
+	while (remaining > 0)
+	{
+		size_t length = (remaining > RTP_MAX_PAYLOAD - 2) ? RTP_MAX_PAYLOAD - 2 : remaining;
+		bool last = (length == remaining) && (chunk.nalEnd);
+
+		uint8_t fu[2];
+		fu[0] = (m_nalHeader & 0xE0) | FU_A_TYPE;
+		fu[1] = (m_nalHeader & 0x1F) | ((first) ? 0x80 : 0) | ((last) ? 0x40 : 0);
+
+		if (!SendPacket(client, timestamp, (last) && (lastOfFrame), fu, sizeof(fu), data, length))
+		{
+			client->waitingForIDR = true;
+			return;
+		}
+
+		data += length;
+		remaining -= length;
+		first = false;
+	}
+}
+
+bool RtspServer::SendPacket(RtspClient* client, uint32_t timestamp, bool marker, const uint8_t* prefix, size_t prefixLength, const uint8_t* payload, size_t payloadLength)
+{
+	uint8_t header[RTP_HEADER_SIZE];
+	header[0] = 0x80;
+	header[1] = RTP_PAYLOAD_TYPE | ((marker) ? 0x80 : 0);
+	header[2] = client->sequence >> 8;
+	header[3] = client->sequence & 0xFF;
+	header[4] = timestamp >> 24;
+	header[5] = (timestamp >> 16) & 0xFF;
+	header[6] = (timestamp >> 8) & 0xFF;
+	header[7] = timestamp & 0xFF;
+	header[8] = client->ssrc >> 24;
+	header[9] = (client->ssrc >> 16) & 0xFF;
+	header[10] = (client->ssrc >> 8) & 0xFF;
+	header[11] = client->ssrc & 0xFF;
+
+	struct iovec parts[3];
+	unsigned int partCount = 0;
+	parts[partCount].iov_base = header;
+	parts[partCount++].iov_len = sizeof(header);
+	if (prefixLength)
+	{
+		parts[partCount].iov_base = (void*)prefix;
+		parts[partCount++].iov_len = prefixLength;
+	}
+	parts[partCount].iov_base = (void*)payload;
+	parts[partCount++].iov_len = payloadLength;
+
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = parts;
+	message.msg_iovlen = partCount;
+
+	ssize_t sent = sendmsg(client->rtpSocket, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (sent < 0)
+	{
+		// A full socket buffer or the player going away, either way skip ahead to the next IDR
+		client->drops++;
+		return false;
+	}
+
+	client->sequence++;
+	client->packets++;
+	client->bytes += sent;
+
+	return true;
+}
+
+void RtspServer::WriteStatus(FILE* file)
+{
+	for (unsigned int i = 0; i < RTSP_MAX_CLIENTS; i++)
+	{
+		const RtspClient* client = &m_clients[i];
+		if (client->controlSocket < 0)
+			continue;
+
+		fprintf(file, "rtsp client %s: %s, %llu packets, %llu bytes, %u drops, send queue %u bytes (peak %u)\n", inet_ntoa(client->address.sin_addr),
+			(client->playing) ? ((client->waitingForIDR) ? "waiting for idr" : "playing") : "idle",
+			(unsigned long long)client->packets, (unsigned long long)client->bytes, client->drops, client->queueDepth, client->maxQueueDepth);
+	}
+}
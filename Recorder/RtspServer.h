@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include "NalStream.h"
+
+/*
+ *	RtspServer
+ *	Live view over RTSP, with the H.264 stream sent as RTP over UDP (RFC 6184, single NAL and FU-A packets).
+ *	Everything is non-blocking and driven from the main loop through Update(). Packets are sent with
+ *	sendmsg() straight out of the encoder's buffers, a small header on the stack plus the payload in place.
+ *	A client whose socket can't take a packet skips ahead to the next IDR instead of holding anything up.
+*/
+
+#define RTSP_MAX_CLIENTS 4
+#define RTSP_REQUEST_SIZE 2048
+#define RTSP_PARAMETER_SET_SIZE 64
+
+struct RtspClient
+{
+	// -1 when the slot is free
+	int controlSocket;
+	struct sockaddr_in address;
+
+	char request[RTSP_REQUEST_SIZE];
+	unsigned int requestLength;
+
+	int rtpSocket;
+	uint32_t session;
+	uint32_t ssrc;
+	uint16_t sequence;
+
+	bool playing;
+	bool waitingForIDR;
+
+	// Stats
+	uint64_t packets;
+	uint64_t bytes;
+	unsigned int drops;
+	unsigned int queueDepth;
+	unsigned int maxQueueDepth;
+};
+
+class RtspServer : public NalConsumer
+{
+public:
+	RtspServer();
+	~RtspServer();
+
+	bool Open(unsigned int port);
+	void Close();
+
+	// Accepts connections and answers requests, never blocks
+	void Update();
+
+	virtual void NalReceived(const NalChunk& chunk);
+
+	// True once after a client starts playing, the encoder should send an IDR so it doesn't wait a whole GOP
+	bool KeyframeWanted();
+
+	void WriteStatus(FILE* file);
+
+private:
+	void Accept();
+	void ReadRequests(RtspClient* client);
+	void HandleRequest(RtspClient* client, char* request);
+	void SendResponse(RtspClient* client, unsigned int cseq, const char* status, const char* headers, const char* body);
+	void CloseClient(RtspClient* client);
+
+	bool SetupTransport(RtspClient* client, const char* transport, unsigned int* serverPort);
+
+	void SendChunk(RtspClient* client, const NalChunk& chunk, uint32_t timestamp);
+	bool SendPacket(RtspClient* client, uint32_t timestamp, bool marker, const uint8_t* prefix, size_t prefixLength, const uint8_t* payload, size_t payloadLength);
+
+	void WriteSdp(char* sdp, size_t size);
+
+private:
+	int m_listenSocket;
+
+	RtspClient m_clients[RTSP_MAX_CLIENTS];
+
+	// Latest parameter sets for the SDP
+	uint8_t m_sps[RTSP_PARAMETER_SET_SIZE];
+	size_t m_spsLength;
+	uint8_t m_pps[RTSP_PARAMETER_SET_SIZE];
+	size_t m_ppsLength;
+
+	// Header byte of the NAL being fragmented
+	uint8_t m_nalHeader;
+
+	bool m_keyframeWanted;
+	uint32_t m_nextSession;
+};
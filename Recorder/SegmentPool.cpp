@@ -0,0 +1,436 @@
+#include "SegmentPool.h"
+#include "GpsTrack.h"
+#include "../libs/Storage/ChecksumSidecar.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <linux/falloc.h>
+
+SegmentPool::SegmentPool(unsigned int maxFiles, uint64_t fileSize)
+{
+	m_directory[0] = 0;
+	m_maxFiles = maxFiles;
+	m_fileSize = fileSize;
+	m_companionCount = 0;
+
+	m_catalog = -1;
+	m_entries = nullptr;
+	m_entryCount = 0;
+	m_entryCapacity = 0;
+	m_sequence = 0;
+
+	m_created = 0;
+	m_recycled = 0;
+	m_overflow = 0;
+	m_trimmedBytes = 0;
+}
+
+SegmentPool::~SegmentPool()
+{
+	Close();
+}
+
+bool SegmentPool::Open(const char* recordingsDir)
+{
+	Close();
+
+	snprintf(m_directory, sizeof(m_directory), "%s", recordingsDir);
+
+	char catalogName[255];
+	snprintf(catalogName, sizeof(catalogName), "%s/%s", m_directory, POOL_CATALOG_FILE);
+
+	m_catalog = open(catalogName, O_RDWR | O_CREAT, 0644);
+	if (m_catalog < 0)
+	{
+		printf("Failed to open %s: %s, segments won't be recycled\n", catalogName, strerror(errno));
+		return false;
+	}
+
+	PoolEntry entry;
+	while (PoolCatalogRead(m_catalog, m_entryCount, &entry))
+	{
+		int index = AddEntry();
+		if (index < 0)
+			break;
+
+		PoolEntry* poolEntry = &m_entries[index];
+		*poolEntry = entry;
+
+		// Recording stopped without the segment being finished. Past the length it last had in the catalog is
+		// either the rest of it or, up to dirty, footage it hadn't overwritten yet which must not count
+		if (poolEntry->state == POOL_ENTRY_WRITING)
+		{
+			char path[255];
+			GetFullPath(index, path, sizeof(path));
+
+			struct stat sb;
+			if (stat(path, &sb) != 0)
+			{
+				poolEntry->state = POOL_ENTRY_MISSING;
+				poolEntry->length = 0;
+				poolEntry->dirty = 0;
+			}
+			else
+			{
+				// With nothing old left past what was recorded, the rest of the file is this recording's
+				poolEntry->state = POOL_ENTRY_DONE;
+				if (poolEntry->length >= poolEntry->dirty)
+					poolEntry->length = sb.st_size;
+			}
+			WriteEntry(index);
+		}
+
+		// Finished by recovery, or the power went before the file was cut back
+		if (poolEntry->state == POOL_ENTRY_DONE)
+			Trim(index);
+
+		if (poolEntry->sequence > m_sequence)
+			m_sequence = poolEntry->sequence;
+	}
+
+	unsigned int files = 0;
+	for (unsigned int i = 0; i < m_entryCount; i++)
+	{
+		if (m_entries[i].state != POOL_ENTRY_MISSING)
+			files++;
+	}
+
+	printf("Segment pool: %u of %u files in use\n", files, m_maxFiles);
+
+	return true;
+}
+
+void SegmentPool::Close()
+{
+	if (m_catalog >= 0)
+	{
+		fdatasync(m_catalog);
+		close(m_catalog);
+	}
+	m_catalog = -1;
+
+	free(m_entries);
+	m_entries = nullptr;
+	m_entryCount = 0;
+	m_entryCapacity = 0;
+	m_sequence = 0;
+}
+
+void SegmentPool::AddCompanion(const char* suffix)
+{
+	if (m_companionCount == POOL_MAX_COMPANIONS)
+		return;
+
+	snprintf(m_companions[m_companionCount], sizeof(m_companions[0]), "%s", suffix);
+	m_companionCount++;
+}
+
+FILE* SegmentPool::Acquire(const char* path, int* entry)
+{
+	*entry = -1;
+
+	size_t directoryLength = strlen(m_directory);
+	bool inPool = (m_catalog >= 0) && (strncmp(path, m_directory, directoryLength) == 0) && (path[directoryLength] == '/') &&
+		(strlen(path + directoryLength + 1) < sizeof(m_entries[0].path));
+
+	if (!inPool)
+		return fopen(path, "w+");
+
+	const char* relative = path + directoryLength + 1;
+
+	unsigned int files = 0;
+	for (unsigned int i = 0; i < m_entryCount; i++)
+	{
+		if (m_entries[i].state != POOL_ENTRY_MISSING)
+			files++;
+	}
+
+	// Grow the pool while there's room for it, after that recycle
+	while ((files >= m_maxFiles) || (!HasRoom()))
+	{
+		int oldest = FindOldest();
+		if (oldest < 0)
+		{
+			// Everything in the pool is protected, nothing for it but a new file
+			if (!m_overflow)
+				printf("Every file in the segment pool is protected, creating new ones\n");
+			m_overflow++;
+			break;
+		}
+
+		char oldPath[255];
+		GetFullPath(oldest, oldPath, sizeof(oldPath));
+
+		PoolEntry* poolEntry = &m_entries[oldest];
+		if (rename(oldPath, path) != 0)
+		{
+			// Deleted from the stick by hand most likely, forget about it
+			printf("Failed to recycle %s: %s\n", oldPath, strerror(errno));
+			poolEntry->state = POOL_ENTRY_MISSING;
+			WriteEntry(oldest);
+			files--;
+			continue;
+		}
+
+		// The old footage's checksums would only make the new recording look damaged, and its track is of no use
+		char sidecarName[255];
+		ChecksumSidecarName(oldPath, sidecarName, sizeof(sidecarName));
+		unlink(sidecarName);
+		GpsTrackName(oldPath, sidecarName, sizeof(sidecarName));
+		unlink(sidecarName);
+		RemoveCompanions(oldPath);
+
+		// Overwritten in place, into the clusters the last recording left reserved
+		FILE* file = fopen(path, "r+");
+		if (!file)
+		{
+			poolEntry->state = POOL_ENTRY_MISSING;
+			WriteEntry(oldest);
+			return nullptr;
+		}
+
+		snprintf(poolEntry->path, sizeof(poolEntry->path), "%s", relative);
+		poolEntry->state = POOL_ENTRY_WRITING;
+		poolEntry->protect = false;
+		poolEntry->sequence = ++m_sequence;
+		if (poolEntry->length > poolEntry->dirty)
+			poolEntry->dirty = poolEntry->length;
+		poolEntry->length = 0;
+		WriteEntry(oldest);
+
+		m_recycled++;
+		*entry = oldest;
+		return file;
+	}
+
+	// Reuse the line of a file that went missing before adding one
+	int newEntry = -1;
+	for (unsigned int i = 0; i < m_entryCount; i++)
+	{
+		if (m_entries[i].state == POOL_ENTRY_MISSING)
+		{
+			newEntry = i;
+			break;
+		}
+	}
+
+	if (newEntry < 0)
+		newEntry = AddEntry();
+	if (newEntry < 0)
+		return fopen(path, "w+");
+
+	PoolEntry* poolEntry = &m_entries[newEntry];
+	snprintf(poolEntry->path, sizeof(poolEntry->path), "%s", relative);
+
+	FILE* file = CreateFile(path);
+	if (!file)
+		return nullptr;
+
+	poolEntry->state = POOL_ENTRY_WRITING;
+	poolEntry->protect = false;
+	poolEntry->sequence = ++m_sequence;
+	poolEntry->length = 0;
+	poolEntry->dirty = 0;
+	WriteEntry(newEntry);
+
+	m_created++;
+	*entry = newEntry;
+	return file;
+}
+
+FILE* SegmentPool::CreateFile(const char* path)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return nullptr;
+
+	// Ask for the whole file in one go so it ends up in one piece, the size only grows as it's written
+	// so nothing has to be zeroed up front. Filesystems that can't do this allocate as it's written
+	fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, m_fileSize);
+
+	FILE* file = fdopen(fd, "r+");
+	if (!file)
+		close(fd);
+
+	return file;
+}
+
+void SegmentPool::Update(int entry, uint64_t length)
+{
+	if ((entry < 0) || ((unsigned int)entry >= m_entryCount) || (m_entries[entry].state != POOL_ENTRY_WRITING))
+		return;
+
+	m_entries[entry].length = length;
+	WriteEntry(entry);
+}
+
+void SegmentPool::Release(int entry, uint64_t length, bool protect)
+{
+	if ((entry < 0) || ((unsigned int)entry >= m_entryCount))
+		return;
+
+	PoolEntry* poolEntry = &m_entries[entry];
+	poolEntry->state = POOL_ENTRY_DONE;
+	poolEntry->length = length;
+	if (protect)
+		poolEntry->protect = true;
+
+	if (poolEntry->dirty < length)
+		poolEntry->dirty = length;
+	WriteEntry(entry);
+
+	// Whatever the last recording left past this one goes now, before anything can read it as part of this one
+	Trim(entry);
+}
+
+void SegmentPool::Trim(int entry)
+{
+	PoolEntry* poolEntry = &m_entries[entry];
+
+	char path[255];
+	GetFullPath(entry, path, sizeof(path));
+
+	int fd = open(path, O_WRONLY);
+	if (fd < 0)
+	{
+		poolEntry->state = POOL_ENTRY_MISSING;
+		WriteEntry(entry);
+		return;
+	}
+
+	struct stat sb;
+	if ((fstat(fd, &sb) == 0) && ((uint64_t)sb.st_size > poolEntry->length))
+	{
+		if (ftruncate(fd, poolEntry->length) != 0)
+		{
+			printf("Failed to cut %s back to its recording: %s\n", path, strerror(errno));
+			close(fd);
+			return;
+		}
+
+		// Reserve the room for the next recording again without it counting towards the size
+		uint64_t reserve = ((uint64_t)sb.st_size > m_fileSize) ? (uint64_t)sb.st_size : m_fileSize;
+		fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, reserve);
+
+		m_trimmedBytes += sb.st_size - poolEntry->length;
+	}
+	close(fd);
+
+	if (poolEntry->dirty != poolEntry->length)
+	{
+		poolEntry->dirty = poolEntry->length;
+		WriteEntry(entry);
+	}
+}
+
+void SegmentPool::Protect(int entry)
+{
+	if ((entry < 0) || ((unsigned int)entry >= m_entryCount) || (m_entries[entry].protect))
+		return;
+
+	m_entries[entry].protect = true;
+	WriteEntry(entry);
+}
+
+int SegmentPool::FindOldest()
+{
+	int oldest = -1;
+	for (unsigned int i = 0; i < m_entryCount; i++)
+	{
+		if ((m_entries[i].state != POOL_ENTRY_DONE) || (m_entries[i].protect))
+			continue;
+
+		if ((oldest < 0) || (m_entries[i].sequence < m_entries[oldest].sequence))
+			oldest = i;
+	}
+
+	return oldest;
+}
+
+int SegmentPool::AddEntry()
+{
+	if (m_entryCount == m_entryCapacity)
+	{
+		unsigned int capacity = (m_entryCapacity) ? m_entryCapacity * 2 : 64;
+		PoolEntry* entries = (PoolEntry*)realloc(m_entries, capacity * sizeof(PoolEntry));
+		if (!entries)
+			return -1;
+
+		m_entries = entries;
+		m_entryCapacity = capacity;
+	}
+
+	memset(&m_entries[m_entryCount], 0, sizeof(PoolEntry));
+	m_entries[m_entryCount].state = POOL_ENTRY_MISSING;
+	return m_entryCount++;
+}
+
+bool SegmentPool::HasRoom()
+{
+	// Leave enough free for one more file past this one, so the stick never fills up mid segment
+	struct statvfs fs;
+	if (statvfs(m_directory, &fs) != 0)
+		return true;
+
+	return (uint64_t)fs.f_bavail * fs.f_frsize >= m_fileSize * 2;
+}
+
+void SegmentPool::GetFullPath(int entry, char* path, size_t size)
+{
+	snprintf(path, size, "%s/%s", m_directory, m_entries[entry].path);
+}
+
+// The other streams' files of the segment at path, which only the pool's own stream keeps from piling up
+void SegmentPool::RemoveCompanions(const char* path)
+{
+	const char* slash = strrchr(path, '/');
+	const char* dash = strchr((slash) ? slash : path, '-');
+	if (!dash)
+		return;
+
+	char name[255];
+	for (unsigned int i = 0; i < m_companionCount; i++)
+	{
+		snprintf(name, sizeof(name), "%.*s%s", (int)(dash + 1 - path), path, m_companions[i]);
+		unlink(name);
+	}
+}
+
+void SegmentPool::WriteEntry(int entry)
+{
+	if (m_catalog < 0)
+		return;
+
+	PoolCatalogWrite(m_catalog, entry, &m_entries[entry]);
+}
+
+void SegmentPool::WriteStatus(FILE* file)
+{
+	if (m_catalog < 0)
+		return;
+
+	unsigned int files = 0, protect = 0;
+	for (unsigned int i = 0; i < m_entryCount; i++)
+	{
+		if (m_entries[i].state == POOL_ENTRY_MISSING)
+			continue;
+
+		files++;
+		if (m_entries[i].protect)
+			protect++;
+	}
+
+	fprintf(file, "pool.files: %u\n", files);
+	fprintf(file, "pool.protected: %u\n", protect);
+	fprintf(file, "pool.recycled: %u\n", m_recycled);
+}
+
+void SegmentPool::PrintStats()
+{
+	printf("Segment pool: %u files created, %u recycled, %u created because everything was protected, %llu bytes of old footage cut off\n",
+		m_created, m_recycled, m_overflow, (unsigned long long)m_trimmedBytes);
+}
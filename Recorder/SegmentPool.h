@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "../libs/Storage/PoolCatalog.h"
+
+/*
+ *	SegmentPool
+ *	Recycles segment files instead of deleting old ones and creating new ones. Until the pool is
+ *	full every segment is a new file, preallocated where the filesystem can; after that the oldest
+ *	file that isn't protected is renamed into place and overwritten from the start. Its clusters
+ *	are never freed, so once the pool is full the filesystem has nothing left to allocate.
+ *
+ *	The catalog on the stick keeps one fixed size line per file: its state, how much of it is the
+ *	current recording, kept up to date while it's written, and how far the previous one reached.
+ *	While a recycled file is being written the previous recording is still in it past the new one,
+ *	so once the segment is finished the file is cut to the new recording's length and its clusters
+ *	reserved again past the end, and nothing that goes by the file's size sees the old footage.
+*/
+
+// Files of other streams that share a segment's sequence number
+#define POOL_MAX_COMPANIONS 4
+
+// A segment's length in the catalog is brought up to date every this many bytes while it's written
+#define POOL_UPDATE_BYTES (1024 * 1024)
+
+class SegmentPool
+{
+public:
+	SegmentPool(unsigned int maxFiles, uint64_t fileSize);
+	~SegmentPool();
+
+	// Loads the stick's catalog, starting an empty one if it doesn't have one
+	bool Open(const char* recordingsDir);
+	void Close();
+
+	// <sequence>-<suffix> files that go along with each segment, deleted with it when its file is recycled
+	void AddCompanion(const char* suffix);
+
+	// Opens a file at path for a new segment, entry is -1 if it isn't part of the pool
+	FILE* Acquire(const char* path, int* entry);
+
+	// How much of a segment still being written has reached the file, so a power cut can't lose where it ends
+	void Update(int entry, uint64_t length);
+
+	// The segment is finished, a protected one is never recycled
+	void Release(int entry, uint64_t length, bool protect);
+
+	void Protect(int entry);
+
+	void WriteStatus(FILE* file);
+	void PrintStats();
+
+public:
+	bool IsOpen() const { return m_catalog >= 0; }
+
+private:
+	// Oldest finished file that isn't protected, -1 if there is none
+	int FindOldest();
+	int AddEntry();
+	FILE* CreateFile(const char* path);
+	bool HasRoom();
+	void GetFullPath(int entry, char* path, size_t size);
+	void RemoveCompanions(const char* path);
+	// Cuts a finished file back to its recording, keeping its clusters
+	void Trim(int entry);
+	void WriteEntry(int entry);
+
+private:
+	char m_directory[128];
+	unsigned int m_maxFiles;
+	uint64_t m_fileSize;
+
+	char m_companions[POOL_MAX_COMPANIONS][32];
+	unsigned int m_companionCount;
+
+	int m_catalog;
+	PoolEntry* m_entries;
+	unsigned int m_entryCount;
+	unsigned int m_entryCapacity;
+	uint64_t m_sequence;
+
+	unsigned int m_created;
+	unsigned int m_recycled;
+	unsigned int m_overflow;
+	uint64_t m_trimmedBytes;
+};
@@ -0,0 +1,592 @@
+#include "SegmentWriter.h"
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <stdio_ext.h>
+#include "Timing.h"
+#include "H264.h"
+#include "../libs/Storage/SeiMetadata.h"
+
+#define START_NAL_SPS 1
+#define START_NAL_PPS 2
+
+static const uint64_t g_latencyBuckets[WRITE_LATENCY_BUCKETS - 1] = { 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000 };
+
+SegmentWriter::SegmentWriter(const char* directory, const char* suffix, unsigned int maxSegmentSize)
+{
+	strncpy(m_directory, directory, sizeof(m_directory) - 1);
+	m_directory[sizeof(m_directory) - 1] = 0;
+	strncpy(m_suffix, suffix, sizeof(m_suffix) - 1);
+	m_suffix[sizeof(m_suffix) - 1] = 0;
+	m_fileName[0] = 0;
+
+	m_file = nullptr;
+
+	m_segmentIndex = 0;
+	m_segmentBytes = 0;
+	m_maxSegmentBytes = maxSegmentSize;
+	m_segmentStartTime = 0;
+
+	m_pendingIndex = 0;
+	m_rotationPending = false;
+	m_rotated = false;
+	m_keyframeWanted = false;
+	m_frameStart = true;
+
+	m_writeBehind = 0;
+	m_behindStart = 0;
+	m_behindEnd = 0;
+	m_behindTime = 0;
+
+	m_statBytes = 0;
+	m_statWriteTime = 0;
+	m_statMaxLatency = 0;
+	memset(m_latencyCounts, 0, sizeof(m_latencyCounts));
+
+	m_verifying = false;
+	m_startNals = 0;
+
+	m_headerByteCount = 0;
+	m_headersCached = false;
+	m_inConfig = false;
+
+	m_blockSize = 0;
+	m_writeBuffer = nullptr;
+	m_writeBufferSize = 0;
+
+	m_spool = nullptr;
+	m_storageReady = false;
+	m_spooling = false;
+	m_nextIndex = 0;
+	m_storageLostTime = 0;
+
+	m_pool = nullptr;
+	m_poolEntry = -1;
+	m_poolLength = 0;
+	m_previousPoolEntry = -1;
+	m_protectSegment = false;
+	m_previousFileName[0] = 0;
+	m_previousSegmentBytes = 0;
+
+	m_checksumChunk = 0;
+
+	m_metadata = nullptr;
+	m_metadataInterval = 0;
+	m_metadataFrames = 0;
+	m_draining = false;
+}
+
+SegmentWriter::~SegmentWriter()
+{
+	Close();
+	delete m_spool;
+	free(m_writeBuffer);
+}
+
+bool SegmentWriter::Open()
+{
+	return OpenSegment(0);
+}
+
+void SegmentWriter::Close()
+{
+	if (m_file)
+	{
+		fclose(m_file);
+		m_file = nullptr;
+		m_checksums.Close();
+
+		if (m_pool)
+		{
+			m_pool->Release(m_poolEntry, m_segmentBytes, m_protectSegment);
+			m_previousPoolEntry = m_poolEntry;
+			m_poolEntry = -1;
+			m_protectSegment = false;
+		}
+
+		strcpy(m_previousFileName, m_fileName);
+		m_previousSegmentBytes = m_segmentBytes;
+	}
+}
+
+bool SegmentWriter::OpenSegment(unsigned int index)
+{
+	Close();
+
+	// File name is <sequence>-<suffix>.h264
+	sprintf(m_fileName, "%s/%.8u-%s.h264", m_directory, index, m_suffix);
+	m_file = (m_pool) ? m_pool->Acquire(m_fileName, &m_poolEntry) : fopen(m_fileName, "w+");
+	if (!m_file)
+		return false;
+
+	// The old file is closed, so its buffer is free to be replaced
+	if ((m_blockSize) && (m_writeBufferSize != m_blockSize))
+	{
+		free(m_writeBuffer);
+		m_writeBuffer = (char*)malloc(m_blockSize);
+		m_writeBufferSize = (m_writeBuffer) ? m_blockSize : 0;
+	}
+
+	if ((m_blockSize) && (m_writeBuffer))
+		setvbuf(m_file, m_writeBuffer, _IOFBF, m_writeBufferSize);
+
+	if (m_checksumChunk)
+		m_checksums.Open(m_fileName, m_checksumChunk);
+
+	m_segmentIndex = index;
+	m_segmentBytes = 0;
+	m_poolLength = 0;
+	m_behindStart = 0;
+	m_behindEnd = 0;
+	m_segmentStartTime = 0;
+
+	m_verifying = true;
+	m_startNals = 0;
+
+	return true;
+}
+
+bool SegmentWriter::Write(const uint8_t* data, size_t length, uint32_t flags, uint64_t time)
+{
+	if (!length)
+		return true;
+
+	// Without storage, or with a backlog still to catch up on, everything goes through the spool to keep its order
+	if ((m_spool) && ((!m_file) || (!m_spool->IsEmpty())))
+	{
+		// Not worth a mention while a segment is only waiting for its first keyframe
+		if ((!m_spooling) && (!m_storageReady))
+		{
+			printf("Spooling %s in RAM until the storage is back\n", m_suffix);
+			m_spool->ResetStats();
+			m_spooling = true;
+		}
+
+		m_spool->Push(data, length, flags, time);
+		return true;
+	}
+
+	if (!m_file)
+		return false;
+
+	if (!RotateIfDue(flags))
+		return false;
+
+	WriteData(data, length, flags, time);
+	return true;
+}
+
+bool SegmentWriter::RotateIfDue(uint32_t flags)
+{
+	if ((m_segmentBytes > m_maxSegmentBytes) && (!m_rotationPending))
+	{
+		m_rotationPending = true;
+
+		// A backlog brings its own keyframes
+		if (!m_draining)
+			m_keyframeWanted = true;
+	}
+
+	bool isConfig = (flags & OMX_BUFFERFLAG_CODECCONFIG) != 0;
+
+	// Only cut at the start of a keyframe, or the SPS/PPS in front of one, so the new segment starts decodable
+	if ((!m_rotationPending) || (!m_frameStart) || ((!isConfig) && (!(flags & OMX_BUFFERFLAG_SYNCFRAME))))
+		return true;
+
+	unsigned int nextIndex = (m_pendingIndex > m_segmentIndex) ? m_pendingIndex : m_segmentIndex + 1;
+	if (!StartSegment(nextIndex, isConfig))
+		return false;
+
+	// The substream and thumbnail follow live footage, not a backlog being written out
+	if (!m_draining)
+		m_rotated = true;
+
+	return true;
+}
+
+bool SegmentWriter::StartSegment(unsigned int index, bool hasHeaders)
+{
+	if (!OpenSegment(index))
+		return false;
+
+	printf("Changing file to %s...\n", m_fileName);
+
+	// The stream didn't carry its own headers this time, fall back to the cached ones
+	if (!hasHeaders)
+	{
+		printf("No inline SPS/PPS before the IDR, replaying the cached headers\n");
+
+		WriteBytes(m_headerBytes, m_headerByteCount);
+
+		VerifySegmentStart(m_headerBytes, m_headerByteCount);
+	}
+
+	m_rotationPending = false;
+	m_keyframeWanted = false;
+	return true;
+}
+
+void SegmentWriter::WriteData(const uint8_t* data, size_t length, uint32_t flags, uint64_t timestamp)
+{
+	bool isConfig = (flags & OMX_BUFFERFLAG_CODECCONFIG) != 0;
+
+	// The parameter sets don't carry a frame time, the IDR after them does
+	if ((!m_segmentStartTime) && (!isConfig))
+		m_segmentStartTime = timestamp;
+
+	if (m_verifying)
+		VerifySegmentStart(data, length);
+
+	// What the metadata describes is now, which a spooled backlog isn't. A picture starts after the end
+	// of the last one or straight after the parameter sets
+	if ((m_metadata) && ((m_frameStart) || (m_inConfig)) && (!isConfig) && (!m_draining))
+	{
+		m_metadataFrames++;
+		if ((flags & OMX_BUFFERFLAG_SYNCFRAME) || ((m_metadataInterval) && (m_metadataFrames >= m_metadataInterval)))
+		{
+			WriteMetadata();
+			m_metadataFrames = 0;
+		}
+	}
+
+	// Waiting on the stick holds up the main loop as much as a slow write does
+	uint64_t writeStart = GetMonotonicTime();
+	WriteBytes(data, length);
+	if (m_writeBehind)
+		WriteBehind();
+	uint64_t writeTime = GetMonotonicTime() - writeStart;
+
+	if (writeTime > m_statMaxLatency)
+		m_statMaxLatency = writeTime;
+
+	unsigned int bucket = 0;
+	while ((bucket < WRITE_LATENCY_BUCKETS - 1) && (writeTime >= g_latencyBuckets[bucket]))
+		bucket++;
+	m_latencyCounts[bucket]++;
+
+	// Keep the stream's first SPS/PPS in case a cut ever lands on an IDR without them
+	if ((isConfig) && (!m_headersCached))
+	{
+		if (m_headerByteCount + length <= sizeof(m_headerBytes))
+		{
+			memcpy(m_headerBytes + m_headerByteCount, data, length);
+			m_headerByteCount += length;
+		}
+	}
+	else if ((m_inConfig) && (!isConfig))
+	{
+		m_headersCached = true;
+	}
+	m_inConfig = isConfig;
+
+	m_frameStart = (flags & OMX_BUFFERFLAG_ENDOFFRAME) != 0;
+}
+
+void SegmentWriter::WriteBytes(const uint8_t* data, size_t length)
+{
+	fwrite(data, 1, length, m_file);
+	m_segmentBytes += length;
+
+	// A recycled file has old footage after the new, only the catalog knows where one ends and the other
+	// starts. What stdio is still holding on to hasn't reached the file yet
+	if ((m_poolEntry >= 0) && (m_segmentBytes >= m_poolLength + POOL_UPDATE_BYTES))
+	{
+		m_poolLength = m_segmentBytes - __fpending(m_file);
+		m_pool->Update(m_poolEntry, m_poolLength);
+	}
+
+	// Checksummed straight away while the data is still in the cache
+	m_checksums.Update(data, length);
+}
+
+void SegmentWriter::WriteBehind()
+{
+	// Only what stdio has handed to the kernel can be written out
+	uint64_t written = m_segmentBytes - __fpending(m_file);
+	if (written < m_behindEnd + m_writeBehind)
+		return;
+
+	int fd = fileno(m_file);
+
+	// The stick had nothing else of ours to write since the last chunk was started, so if it's still busy with
+	// it the time since then is how long it takes over a chunk. A write() only shows how fast the page cache is
+	if (m_behindEnd > m_behindStart)
+	{
+		uint64_t waitStart = GetMonotonicTime();
+		sync_file_range(fd, m_behindStart, m_behindEnd - m_behindStart, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+
+		uint64_t now = GetMonotonicTime();
+		if (now - waitStart >= WRITE_BEHIND_BLOCKED)
+		{
+			m_statBytes += m_behindEnd - m_behindStart;
+			m_statWriteTime += now - m_behindTime;
+		}
+	}
+
+	sync_file_range(fd, m_behindEnd, written - m_behindEnd, SYNC_FILE_RANGE_WRITE);
+	m_behindTime = GetMonotonicTime();
+	m_behindStart = m_behindEnd;
+	m_behindEnd = written;
+}
+
+void SegmentWriter::WriteMetadata()
+{
+	char text[SEI_METADATA_MAX_TEXT + 1];
+	m_metadata->Format(text, sizeof(text));
+
+	uint8_t nal[SEI_METADATA_MAX_NAL];
+	size_t length = SeiMetadataBuild(text, nal, sizeof(nal));
+	if (length)
+		WriteBytes(nal, length);
+}
+
+void SegmentWriter::SetChecksums(uint32_t chunkSize)
+{
+	m_checksumChunk = chunkSize;
+}
+
+void SegmentWriter::SetMetadata(StreamMetadata* metadata, unsigned int interval)
+{
+	m_metadata = metadata;
+	m_metadataInterval = interval;
+}
+
+void SegmentWriter::SetBlockSize(size_t blockSize)
+{
+	m_blockSize = blockSize;
+}
+
+void SegmentWriter::SetPool(SegmentPool* pool)
+{
+	m_pool = pool;
+}
+
+void SegmentWriter::Flush()
+{
+	if (!m_file)
+		return;
+
+	// Only starts the writeback, waiting for it is what the spool and the bitrate controller are there to avoid
+	fflush(m_file);
+	sync_file_range(fileno(m_file), 0, 0, SYNC_FILE_RANGE_WRITE);
+}
+
+void SegmentWriter::SetWriteBehind(size_t chunkSize)
+{
+	m_writeBehind = chunkSize;
+}
+
+void SegmentWriter::ProtectSegment()
+{
+	if (!m_pool)
+		return;
+
+	// Whatever led up to the event is in the segment before
+	m_protectSegment = true;
+	m_pool->Protect(m_previousPoolEntry);
+}
+
+void SegmentWriter::SetSpool(size_t maxBytes)
+{
+	delete m_spool;
+	m_spool = new StorageSpool(maxBytes);
+}
+
+void SegmentWriter::StorageAvailable(const char* directory, unsigned int segmentIndex)
+{
+	strncpy(m_directory, directory, sizeof(m_directory) - 1);
+	m_directory[sizeof(m_directory) - 1] = 0;
+
+	m_nextIndex = segmentIndex;
+	m_storageReady = true;
+
+	// Pool entries belong to the stick they were on
+	m_previousPoolEntry = -1;
+
+	if (m_storageLostTime)
+	{
+		printf("Storage back for %s after %llu ms\n", m_suffix, (unsigned long long)(GetMonotonicTime() - m_storageLostTime) / 1000);
+		m_storageLostTime = 0;
+	}
+}
+
+void SegmentWriter::StorageLost()
+{
+	if (m_file)
+		printf("Storage went away while writing %s\n", m_fileName);
+
+	// Whatever is still in the page cache for the old stick is gone, don't wait on it
+	Close();
+	m_storageReady = false;
+	m_storageLostTime = GetMonotonicTime();
+
+	// The backlog has to start a new segment on a keyframe, the sooner there is one the less is dropped
+	m_keyframeWanted = true;
+}
+
+void SegmentWriter::Drain(size_t maxBytes)
+{
+	if ((!m_spool) || (!m_storageReady) || (m_spool->IsEmpty()))
+		return;
+
+	size_t written = 0;
+	m_draining = true;
+	while ((written < maxBytes) && (!m_spool->IsEmpty()))
+	{
+		if (!m_file)
+		{
+			// A segment can only start at a keyframe, anything before the first one can't be decoded anyway
+			m_spool->DropToKeyframe();
+
+			const SpoolRecord* record = m_spool->Front();
+			if (!record)
+				break;
+
+			m_frameStart = true;
+			m_inConfig = false;
+			if (!StartSegment(m_nextIndex, (record->flags & OMX_BUFFERFLAG_CODECCONFIG) != 0))
+			{
+				printf("Failed to open %s, still spooling\n", m_fileName);
+				m_storageReady = false;
+				m_draining = false;
+				return;
+			}
+		}
+
+		// The backlog is cut into segments of the same size as live footage
+		const SpoolRecord* record = m_spool->Front();
+		if (!RotateIfDue(record->flags))
+		{
+			printf("Failed to open %s, still spooling\n", m_fileName);
+			m_storageReady = false;
+			m_draining = false;
+			return;
+		}
+
+		WriteData(record->data, record->length, record->flags, record->timestamp);
+		written += record->length;
+		m_spool->Pop();
+	}
+	m_draining = false;
+
+	if ((m_spool->IsEmpty()) && (m_spooling) && (m_file))
+	{
+		m_spool->PrintStats(m_suffix);
+		m_spooling = false;
+	}
+}
+
+void SegmentWriter::WriteStatus(FILE* file)
+{
+	if (m_spool)
+		m_spool->WriteStatus(file, m_suffix);
+
+	// Pool files are longer than what has been written to them
+	if (m_pool)
+	{
+		if (m_file)
+			fprintf(file, "segment.length: %u\n", m_segmentBytes);
+		if (m_previousFileName[0])
+			fprintf(file, "segment.previous: %u %s\n", m_previousSegmentBytes, m_previousFileName);
+
+		m_pool->WriteStatus(file);
+	}
+
+	fprintf(file, "write.latency:");
+	for (unsigned int i = 0; i < WRITE_LATENCY_BUCKETS; i++)
+		fprintf(file, " %llu", (unsigned long long)m_latencyCounts[i]);
+	fprintf(file, "\n");
+}
+
+void SegmentWriter::RequestRotation(unsigned int segmentIndex)
+{
+	m_pendingIndex = segmentIndex;
+	m_rotationPending = true;
+	m_keyframeWanted = true;
+}
+
+void SegmentWriter::StreamRestarted()
+{
+	// Whatever was in flight is gone, the next buffers are a fresh SPS/PPS and IDR
+	m_frameStart = true;
+	m_inConfig = false;
+	m_headerByteCount = 0;
+	m_headersCached = false;
+
+	m_pendingIndex = 0;
+	m_rotationPending = true;
+}
+
+void SegmentWriter::TakeWriteStats(uint64_t* bytes, uint64_t* writeTime, uint64_t* maxLatency)
+{
+	*bytes = m_statBytes;
+	*writeTime = m_statWriteTime;
+	*maxLatency = m_statMaxLatency;
+
+	m_statBytes = 0;
+	m_statWriteTime = 0;
+	m_statMaxLatency = 0;
+}
+
+void SegmentWriter::PrintLatency()
+{
+	uint64_t total = 0;
+	for (unsigned int i = 0; i < WRITE_LATENCY_BUCKETS; i++)
+		total += m_latencyCounts[i];
+
+	if (!total)
+		return;
+
+	printf("%s write latency (%s):\n", m_suffix, (m_pool) ? "segment pool" : "new file per segment");
+	for (unsigned int i = 0; i < WRITE_LATENCY_BUCKETS; i++)
+	{
+		if (i < WRITE_LATENCY_BUCKETS - 1)
+			printf("\t< %6llu us: %llu (%llu.%.2llu%%)\n", (unsigned long long)g_latencyBuckets[i], (unsigned long long)m_latencyCounts[i],
+				(unsigned long long)(m_latencyCounts[i] * 100 / total), (unsigned long long)(m_latencyCounts[i] * 10000 / total % 100));
+		else
+			printf("\t>= %5llu us: %llu (%llu.%.2llu%%)\n", (unsigned long long)g_latencyBuckets[i - 1], (unsigned long long)m_latencyCounts[i],
+				(unsigned long long)(m_latencyCounts[i] * 100 / total), (unsigned long long)(m_latencyCounts[i] * 10000 / total % 100));
+	}
+}
+
+void SegmentWriter::VerifySegmentStart(const uint8_t* data, size_t len)
+{
+	size_t offset = 0;
+	while ((offset = H264FindNal(data, len, offset)) < len)
+	{
+		unsigned int type = H264NalType(data[offset]);
+
+		if (type == H264_NAL_SPS)
+		{
+			m_startNals |= START_NAL_SPS;
+		}
+		else if (type == H264_NAL_PPS)
+		{
+			if (m_startNals & START_NAL_SPS)
+				m_startNals |= START_NAL_PPS;
+		}
+		else if ((type == H264_NAL_IDR) || (type == H264_NAL_SLICE))
+		{
+			// First picture, the segment is decodable on its own only if it's an IDR after both parameter sets
+			if ((type != H264_NAL_IDR) || (m_startNals != (START_NAL_SPS | START_NAL_PPS)))
+				printf("Warning: %s doesn't start with SPS+PPS+IDR\n", m_fileName);
+
+			m_verifying = false;
+			return;
+		}
+	}
+}
+
+bool SegmentWriter::KeyframeWanted()
+{
+	bool wanted = m_keyframeWanted;
+	m_keyframeWanted = false;
+	return wanted;
+}
+
+bool SegmentWriter::Rotated()
+{
+	bool rotated = m_rotated;
+	m_rotated = false;
+	return rotated;
+}
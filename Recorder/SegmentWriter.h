@@ -0,0 +1,189 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "../libs/OMXHelper/OMXCore.h"
+#include "FrameBroadcaster.h"
+#include "StorageSpool.h"
+#include "SegmentPool.h"
+#include "StreamMetadata.h"
+#include "../libs/Storage/ChecksumSidecar.h"
+
+/*
+ *	SegmentWriter
+ *	Writes an encoded H.264 stream into numbered segment files, rotating on a keyframe
+ *	once the segment is full. With inline headers the encoder repeats the SPS/PPS in front
+ *	of every IDR and the cut lands on them. Only if a cut has to be made on a bare IDR are the
+ *	stream's first SPS/PPS replayed. Every segment is checked to start with SPS+PPS+IDR.
+ *
+ *	With a spool the writer carries on while the storage is away: buffers queue up in RAM and are
+ *	written out a bit at a time through Drain() once it is back, starting a new segment on a keyframe.
+ *
+ *	With a pool the segment files come from it and are overwritten in place, so the status file
+ *	carries how much of the file is the recording for anyone reading it while it's written.
+ *
+ *	With metadata an SEI goes in front of every IDR, and every so many frames in between. It is
+ *	written on its own just before the frame, the encoder's buffer is never copied or changed.
+*/
+// Backlog written per Drain() call, small enough for the main loop to keep up with the encoder
+#define SPOOL_DRAIN_BYTES (512 * 1024)
+
+// Chunk the bitrate controller has the main stream written out in
+#define WRITE_BEHIND_CHUNK (1024 * 1024)
+
+// A wait for the stick shorter than this means it had already written the chunk
+#define WRITE_BEHIND_BLOCKED 1000
+
+// Write latency histogram, upper bound of each bucket in microseconds with the last one open ended
+#define WRITE_LATENCY_BUCKETS 10
+
+class SegmentWriter : public FrameConsumer
+{
+public:
+	SegmentWriter(const char* directory, const char* suffix, unsigned int maxSegmentSize);
+	~SegmentWriter();
+
+	bool Open();
+	void Close();
+
+	// Returns false if the next segment couldn't be opened. time is the encoder's timestamp in microseconds
+	bool Write(const uint8_t* data, size_t length, uint32_t flags, uint64_t time);
+
+	// Keep up to maxBytes in RAM whenever the storage isn't available
+	void SetSpool(size_t maxBytes);
+
+	// The storage is mounted, carry on in the given directory from the given segment index
+	void StorageAvailable(const char* directory, unsigned int segmentIndex);
+	void StorageLost();
+
+	// Writes up to maxBytes of the spooled backlog
+	void Drain(size_t maxBytes);
+
+	void WriteStatus(FILE* file);
+
+	// stdio buffer size for the segment files, 0 for the default. Applies from the next segment
+	void SetBlockSize(size_t blockSize);
+
+	// Take the segment files from a pool, nullptr creates a new file for each segment
+	void SetPool(SegmentPool* pool);
+
+	// Hands what stdio holds to the kernel and starts writing it out, without waiting for the storage
+	void Flush();
+
+	// Starts writing out every chunkSize bytes as they're written and waits for the chunk before, so no more than
+	// that is ever waiting in the page cache and the stick's own speed can be measured. 0 leaves it to the kernel
+	void SetWriteBehind(size_t chunkSize);
+
+	// Keeps the segment being written and the one before it from being recycled
+	void ProtectSegment();
+
+	// CRC-32C of every chunkSize bytes into a .crc sidecar, 0 for none. Applies from the next segment
+	void SetChecksums(uint32_t chunkSize);
+
+	// SEI metadata before each IDR and every interval frames, 0 for IDRs only. nullptr for none
+	void SetMetadata(StreamMetadata* metadata, unsigned int interval);
+
+	virtual bool BufferReceived(const uint8_t* data, size_t length, uint32_t flags, uint64_t time) { return Write(data, length, flags, time); }
+
+	// Rotate at the next keyframe, using the given segment index
+	void RequestRotation(unsigned int segmentIndex);
+
+	// The encoder was reconfigured, start a new segment with the new parameter sets
+	void StreamRestarted();
+
+	// True once for every rotation that has happened
+	bool Rotated();
+
+	// True once whenever a rotation starts waiting, so the caller can ask the encoder for an IDR
+	bool KeyframeWanted();
+
+	// Bytes the stick was seen to write and how long it took over them, and the slowest single write since the last call
+	void TakeWriteStats(uint64_t* bytes, uint64_t* writeTime, uint64_t* maxLatency);
+
+	// Every write since the start, by latency
+	void PrintLatency();
+
+public:
+	unsigned int GetSegmentIndex() const { return m_segmentIndex; }
+	const char* GetFileName() const { return m_fileName; }
+
+	// Encoder timestamp of the segment's first frame, 0 until it has one
+	uint64_t GetSegmentStartTime() const { return m_segmentStartTime; }
+
+	// Writing to a segment with nothing spooled, so what comes out of the encoder now goes straight in
+	bool IsLive() const { return (m_file) && ((!m_spool) || (m_spool->IsEmpty())); }
+
+private:
+	bool OpenSegment(unsigned int index);
+	bool RotateIfDue(uint32_t flags);
+	bool StartSegment(unsigned int index, bool hasHeaders);
+	void WriteData(const uint8_t* data, size_t length, uint32_t flags, uint64_t timestamp);
+	void WriteBytes(const uint8_t* data, size_t length);
+	void WriteBehind();
+	void WriteMetadata();
+	void VerifySegmentStart(const uint8_t* data, size_t len);
+
+private:
+	char m_directory[255];
+	char m_suffix[32];
+	char m_fileName[255];
+
+	FILE* m_file;
+	size_t m_blockSize;
+	char* m_writeBuffer;
+	size_t m_writeBufferSize;
+
+	unsigned int m_segmentIndex;
+	unsigned int m_segmentBytes;
+	unsigned int m_maxSegmentBytes;
+	uint64_t m_segmentStartTime;
+
+	unsigned int m_pendingIndex;
+	bool m_rotationPending;
+	bool m_rotated;
+	bool m_keyframeWanted;
+	bool m_frameStart;
+
+	// The chunk being written out, from when it was started
+	size_t m_writeBehind;
+	uint64_t m_behindStart;
+	uint64_t m_behindEnd;
+	uint64_t m_behindTime;
+
+	uint64_t m_statBytes;
+	uint64_t m_statWriteTime;
+	uint64_t m_statMaxLatency;
+	uint64_t m_latencyCounts[WRITE_LATENCY_BUCKETS];
+
+	// NALs seen at the start of the segment until its first slice
+	bool m_verifying;
+	unsigned int m_startNals;
+
+	unsigned char m_headerBytes[128];
+	unsigned int m_headerByteCount;
+	bool m_headersCached;
+	bool m_inConfig;
+
+	StorageSpool* m_spool;
+	bool m_storageReady;
+	bool m_spooling;
+	unsigned int m_nextIndex;
+	uint64_t m_storageLostTime;
+
+	SegmentPool* m_pool;
+	int m_poolEntry;
+	// What the catalog was last told of the segment's length
+	unsigned int m_poolLength;
+	int m_previousPoolEntry;
+	bool m_protectSegment;
+	char m_previousFileName[255];
+	unsigned int m_previousSegmentBytes;
+
+	ChecksumWriter m_checksums;
+	uint32_t m_checksumChunk;
+
+	StreamMetadata* m_metadata;
+	unsigned int m_metadataInterval;
+	unsigned int m_metadataFrames;
+	bool m_draining;
+};
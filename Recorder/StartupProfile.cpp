@@ -0,0 +1,62 @@
+#include "StartupProfile.h"
+#include <string.h>
+#include "Timing.h"
+
+StartupProfile::StartupProfile()
+{
+	m_startTime = GetMonotonicTime();
+	m_count = 0;
+	m_printed = false;
+}
+
+void StartupProfile::Mark(const char* phase)
+{
+	if ((m_count == STARTUP_MAX_PHASES) || (HasMark(phase)))
+		return;
+
+	m_names[m_count] = phase;
+	m_times[m_count] = GetMonotonicTime();
+	m_count++;
+}
+
+bool StartupProfile::HasMark(const char* phase) const
+{
+	for (unsigned int i = 0; i < m_count; i++)
+	{
+		if (strcmp(m_names[i], phase) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+int StartupProfile::Format(char* text, size_t size)
+{
+	int length = snprintf(text, size, "%llu ms after boot:", (unsigned long long)m_startTime / 1000);
+	for (unsigned int i = 0; (i < m_count) && (length < (int)size); i++)
+	{
+		length += snprintf(text + length, size - length, "%s %s %llu", (i) ? "," : "", m_names[i],
+			(unsigned long long)(m_times[i] - m_startTime) / 1000);
+	}
+
+	if (length < (int)size)
+		length += snprintf(text + length, size - length, " ms");
+
+	return length;
+}
+
+void StartupProfile::Print()
+{
+	char text[256];
+	Format(text, sizeof(text));
+	printf("Startup %s\n", text);
+
+	m_printed = true;
+}
+
+void StartupProfile::WriteStatus(FILE* file)
+{
+	char text[256];
+	Format(text, sizeof(text));
+	fprintf(file, "startup: %s\n", text);
+}
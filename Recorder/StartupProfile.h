@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ *	StartupProfile
+ *	Times how long the recorder takes to get going, from main() to the first frame and the first
+ *	byte on the stick. Each phase is marked with the monotonic clock as it completes and the lot
+ *	is logged on one line. The monotonic clock counts from boot, so the line also says how long
+ *	after the Pi was powered (the ignition, in a car) the recorder started.
+*/
+
+#define STARTUP_MAX_PHASES 12
+
+class StartupProfile
+{
+public:
+	// Starts the clock
+	StartupProfile();
+
+	// phase must be a literal, only the pointer is kept
+	void Mark(const char* phase);
+	bool HasMark(const char* phase) const;
+
+	// Logs the phases once, e.g.
+	// Startup 4210 ms after boot: config 2, omx 95, pipeline 503, capture 540, frame 702, storage 1630 ms
+	void Print();
+	bool IsPrinted() const { return m_printed; }
+
+	void WriteStatus(FILE* file);
+
+private:
+	int Format(char* text, size_t size);
+
+private:
+	uint64_t m_startTime;
+
+	const char* m_names[STARTUP_MAX_PHASES];
+	uint64_t m_times[STARTUP_MAX_PHASES];
+	unsigned int m_count;
+
+	bool m_printed;
+};
@@ -0,0 +1,146 @@
+#include "StillCapture.h"
+#include <string.h>
+#include <unistd.h>
+
+// Give up on a still that hasn't come out of the encoder after this long
+#define STILL_TIMEOUT 3000000
+
+StillCapture::StillCapture(Pipeline* pipeline)
+{
+	m_pipeline = pipeline;
+
+	m_fileName[0] = 0;
+	m_pendingFileName[0] = 0;
+	m_pending = false;
+
+	m_file = nullptr;
+	m_busy = false;
+	m_bytes = 0;
+
+	m_startTime = 0;
+	m_lastVideoFrame = 0;
+	m_droppedFrames = 0;
+}
+
+StillCapture::~StillCapture()
+{
+	if (m_file)
+	{
+		fclose(m_file);
+		m_file = nullptr;
+	}
+}
+
+bool StillCapture::Request(const char* fileName)
+{
+	if (!m_pipeline->GetStillEncoder())
+		return false;
+
+	if (m_busy)
+	{
+		// Only the latest request is kept
+		strncpy(m_pendingFileName, fileName, sizeof(m_pendingFileName) - 1);
+		m_pendingFileName[sizeof(m_pendingFileName) - 1] = 0;
+		m_pending = true;
+		return true;
+	}
+
+	strncpy(m_fileName, fileName, sizeof(m_fileName) - 1);
+	m_fileName[sizeof(m_fileName) - 1] = 0;
+
+	return Start(GetMonotonicTime());
+}
+
+bool StillCapture::Start(uint64_t now)
+{
+	m_bytes = 0;
+	m_droppedFrames = 0;
+	m_startTime = now;
+
+	if (!m_pipeline->CaptureStill())
+		return false;
+
+	m_busy = true;
+	return true;
+}
+
+void StillCapture::Finish(uint64_t now, bool success)
+{
+	if (m_file)
+	{
+		fclose(m_file);
+		m_file = nullptr;
+	}
+
+	if (success)
+	{
+		printf("Still %s: %u bytes, %llu ms capture to file, %u video frames dropped\n", m_fileName, m_bytes,
+			(unsigned long long)(now - m_startTime) / 1000, m_droppedFrames);
+	}
+	else
+	{
+		printf("Still %s timed out\n", m_fileName);
+		unlink(m_fileName);
+	}
+
+	m_busy = false;
+
+	if (m_pending)
+	{
+		m_pending = false;
+		strcpy(m_fileName, m_pendingFileName);
+		Start(now);
+	}
+}
+
+void StillCapture::Update(uint64_t now)
+{
+	OMXCoreComponent* encoder = m_pipeline->GetStillEncoder();
+	if (!encoder)
+		return;
+
+	OMX_BUFFERHEADERTYPE* buffer = nullptr;
+	while ((buffer = encoder->GetOutputBuffer(0)) != nullptr)
+	{
+		bool done = false;
+
+		// Stray buffers outside of a capture just go straight back
+		if ((m_busy) && (buffer->nFilledLen))
+		{
+			if (!m_file)
+				m_file = fopen(m_fileName, "wb");
+
+			if (m_file)
+				fwrite(buffer->pBuffer + buffer->nOffset, 1, buffer->nFilledLen, m_file);
+
+			m_bytes += buffer->nFilledLen;
+		}
+
+		if ((m_busy) && (buffer->nFlags & (OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_EOS)))
+			done = true;
+
+		encoder->FillThisBuffer(buffer);
+
+		if (done)
+			Finish(GetMonotonicTime(), true);
+	}
+
+	if ((m_busy) && ((now - m_startTime) > STILL_TIMEOUT))
+		Finish(now, false);
+}
+
+void StillCapture::VideoFrame(uint64_t now)
+{
+	if ((m_busy) && (m_lastVideoFrame))
+	{
+		unsigned int framerate = m_pipeline->GetFramerate();
+		uint64_t interval = (framerate) ? (1000000 / framerate) : 0;
+
+		// Anything more than half a frame late counts as dropped frames
+		uint64_t gap = now - m_lastVideoFrame;
+		if ((interval) && (gap > interval + (interval / 2)))
+			m_droppedFrames += (unsigned int)((gap + (interval / 2)) / interval) - 1;
+	}
+
+	m_lastVideoFrame = now;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "Pipeline.h"
+#include "Timing.h"
+
+/*
+ *	StillCapture
+ *	Takes JPEG stills through the camera's still port while the video keeps recording.
+ *	Nothing here blocks, the main loop calls Update() to drain the image encoder.
+*/
+class StillCapture
+{
+public:
+	StillCapture(Pipeline* pipeline);
+	~StillCapture();
+
+	// Queue a still for the given file, one request can wait behind the one being taken
+	bool Request(const char* fileName);
+
+	void Update(uint64_t now);
+
+	// A main stream frame arrived, used to spot frames dropped while the still is taken
+	void VideoFrame(uint64_t now);
+
+public:
+	bool IsBusy() const { return m_busy; }
+
+private:
+	bool Start(uint64_t now);
+	void Finish(uint64_t now, bool success);
+
+private:
+	Pipeline* m_pipeline;
+
+	char m_fileName[255];
+	char m_pendingFileName[255];
+	bool m_pending;
+
+	FILE* m_file;
+	bool m_busy;
+	unsigned int m_bytes;
+
+	uint64_t m_startTime;
+	uint64_t m_lastVideoFrame;
+	unsigned int m_droppedFrames;
+};
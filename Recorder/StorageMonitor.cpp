@@ -0,0 +1,78 @@
+#include "StorageMonitor.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#define MOUNTINFO_FILE "/proc/self/mountinfo"
+
+StorageMonitor::StorageMonitor(const char* mountPoint, bool requireMount)
+{
+	snprintf(m_mountPoint, sizeof(m_mountPoint), "%s", mountPoint);
+
+	// The mount table never has trailing slashes
+	size_t length = strlen(m_mountPoint);
+	while ((length > 1) && (m_mountPoint[length - 1] == '/'))
+		m_mountPoint[--length] = 0;
+
+	m_requireMount = requireMount;
+	m_mountInfo = -1;
+	m_available = true;
+
+	if (m_requireMount)
+	{
+		m_mountInfo = open(MOUNTINFO_FILE, O_RDONLY);
+		if (m_mountInfo < 0)
+			printf("Failed to open %s, assuming %s is always mounted\n", MOUNTINFO_FILE, m_mountPoint);
+		else
+			m_available = IsMounted();
+	}
+}
+
+StorageMonitor::~StorageMonitor()
+{
+	if (m_mountInfo >= 0)
+		close(m_mountInfo);
+}
+
+bool StorageMonitor::Update()
+{
+	if (m_mountInfo < 0)
+		return false;
+
+	struct pollfd fd;
+	fd.fd = m_mountInfo;
+	fd.events = POLLPRI;
+	fd.revents = 0;
+	if ((poll(&fd, 1, 0) <= 0) || (!(fd.revents & (POLLPRI | POLLERR))))
+		return false;
+
+	bool available = IsMounted();
+	if (available == m_available)
+		return false;
+
+	m_available = available;
+	printf("Storage %s %s\n", m_mountPoint, (available) ? "mounted" : "went away");
+	return true;
+}
+
+bool StorageMonitor::IsMounted()
+{
+	FILE* file = fopen(MOUNTINFO_FILE, "r");
+	if (!file)
+		return false;
+
+	// The fifth field is the mount point: id parent major:minor root mountpoint options ...
+	bool mounted = false;
+	char line[512];
+	while ((!mounted) && (fgets(line, sizeof(line), file)))
+	{
+		char mountPoint[256];
+		if ((sscanf(line, "%*u %*u %*s %*s %255s", mountPoint) == 1) && (strcmp(mountPoint, m_mountPoint) == 0))
+			mounted = true;
+	}
+
+	fclose(file);
+	return mounted;
+}
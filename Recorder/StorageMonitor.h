@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ *	StorageMonitor
+ *	Watches the mount table for the recordings directory coming and going, so the recorder can
+ *	keep running while the USB stick is out. The kernel flags /proc/self/mountinfo with POLLPRI
+ *	whenever a mount changes, so checking it every loop costs a poll() and nothing else.
+*/
+class StorageMonitor
+{
+public:
+	// With requireMount unset the directory is always treated as available
+	StorageMonitor(const char* mountPoint, bool requireMount);
+	~StorageMonitor();
+
+	// Never blocks, returns true when the storage has appeared or gone away since the last call
+	bool Update();
+
+public:
+	bool IsAvailable() const { return m_available; }
+
+private:
+	bool IsMounted();
+
+private:
+	char m_mountPoint[128];
+	bool m_requireMount;
+
+	int m_mountInfo;
+	bool m_available;
+};
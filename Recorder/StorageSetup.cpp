@@ -0,0 +1,201 @@
+#include "StorageSetup.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "Timing.h"
+#include "../StorageBench/StorageBench.h"
+#include "../libs/Storage/SessionRecovery.h"
+
+StorageSetup::StorageSetup(const RecorderConfig* config)
+{
+	m_config = config;
+
+	m_started = false;
+	m_done = false;
+	m_cancelled = false;
+	m_benchPid = 0;
+
+	m_directory[0] = 0;
+	m_newSession = false;
+	m_result = false;
+
+	m_startTime = 0;
+	m_benchTime = 0;
+	m_recoverTime = 0;
+	m_sessionTime = 0;
+}
+
+StorageSetup::~StorageSetup()
+{
+	Cancel();
+}
+
+bool StorageSetup::Start(const char* session)
+{
+	if (m_started)
+		return false;
+
+	snprintf(m_directory, sizeof(m_directory), "%s", (session) ? session : "");
+	m_newSession = false;
+	m_result = false;
+	m_done = false;
+	m_cancelled = false;
+	m_benchPid = 0;
+
+	m_startTime = GetMonotonicTime();
+	m_benchTime = 0;
+	m_recoverTime = 0;
+	m_sessionTime = 0;
+
+	if (pthread_create(&m_thread, NULL, ThreadMain, this) != 0)
+	{
+		printf("Failed to start the storage setup thread\n");
+		return false;
+	}
+
+	m_started = true;
+	return true;
+}
+
+bool StorageSetup::Finish()
+{
+	if (!m_started)
+		return false;
+
+	pthread_join(m_thread, NULL);
+	m_started = false;
+
+	return m_result;
+}
+
+void StorageSetup::Cancel()
+{
+	if (!m_started)
+		return;
+
+	// The thread checks m_cancelled after starting the benchmark, so one of the two kills it
+	m_cancelled = true;
+	pid_t pid = m_benchPid;
+	if (pid)
+		kill(pid, SIGTERM);
+
+	pthread_join(m_thread, NULL);
+	m_started = false;
+}
+
+void* StorageSetup::ThreadMain(void* param)
+{
+	((StorageSetup*)param)->Run();
+	return nullptr;
+}
+
+void StorageSetup::Run()
+{
+	// Nothing is written to the stick yet, so the benchmark can have it to itself
+	uint64_t phaseStart = GetMonotonicTime();
+	pid_t pid = StartBench();
+	if (pid)
+	{
+		m_benchPid = pid;
+		if (m_cancelled)
+			kill(pid, SIGTERM);
+
+		while ((waitpid(pid, nullptr, 0) < 0) && (errno == EINTR))
+			;
+		m_benchPid = 0;
+	}
+	m_benchTime = GetMonotonicTime() - phaseStart;
+
+	if (m_cancelled)
+	{
+		m_done = true;
+		return;
+	}
+
+	// Repairs whatever a power cut left unclosed before anything new goes onto the stick
+	phaseStart = GetMonotonicTime();
+	if (m_config->storageRecover)
+	{
+		SessionRecovery recovery;
+		if (recovery.RecoverAll(m_config->recordingsDir, (m_directory[0]) ? m_directory : nullptr))
+			recovery.PrintStats();
+	}
+	m_recoverTime = GetMonotonicTime() - phaseStart;
+
+	// The same stick coming back carries on in the same session, anything else starts a new one
+	phaseStart = GetMonotonicTime();
+	struct stat sb;
+	if ((m_directory[0]) && (stat(m_directory, &sb) == 0) && (S_ISDIR(sb.st_mode)))
+	{
+		m_result = true;
+	}
+	else
+	{
+		m_newSession = true;
+		m_result = CreateSession();
+	}
+	m_sessionTime = GetMonotonicTime() - phaseStart;
+
+	m_done = true;
+}
+
+// Runs the benchmark on a stick that hasn't been measured yet, returns its pid or 0 if there's nothing to wait for
+pid_t StorageSetup::StartBench()
+{
+	char resultsName[255];
+	snprintf(resultsName, sizeof(resultsName), "%s/%s", m_config->recordingsDir, BENCH_RESULTS_FILE);
+
+	if ((!m_config->storageBench[0]) || (access(resultsName, F_OK) == 0))
+		return 0;
+
+	if (access(m_config->storageBench, X_OK) != 0)
+	{
+		printf("Can't run %s, using the configured settings\n", m_config->storageBench);
+		return 0;
+	}
+
+	printf("Measuring the storage at %s...\n", m_config->recordingsDir);
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		execl(m_config->storageBench, m_config->storageBench, m_config->recordingsDir, (char*)nullptr);
+		_exit(1);
+	}
+
+	return (pid > 0) ? pid : 0;
+}
+
+// Picks the next free numbered directory for this session's recordings
+bool StorageSetup::CreateSession()
+{
+	struct stat sb;
+	for (unsigned int index = 0; ; index++)
+	{
+		snprintf(m_directory, sizeof(m_directory), "%s/%u", m_config->recordingsDir, index);
+
+		// Skips files as well as directories, a file can't be recorded into either
+		if (stat(m_directory, &sb) == 0)
+			continue;
+
+		// Straight to the syscall, a shell for mkdir costs more than everything else here
+		printf("Creating directory %s...\n", m_directory);
+		if (mkdir(m_directory, 0777) == 0)
+			return true;
+
+		printf("Failed to create %s: %s\n", m_directory, strerror(errno));
+		m_directory[0] = 0;
+		return false;
+	}
+}
+
+void StorageSetup::PrintStats()
+{
+	printf("Storage ready %llu ms after it was found: benchmark %llu ms, recovery %llu ms, session %llu ms\n",
+		(unsigned long long)(GetMonotonicTime() - m_startTime) / 1000, (unsigned long long)m_benchTime / 1000,
+		(unsigned long long)m_recoverTime / 1000, (unsigned long long)m_sessionTime / 1000);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "Config.h"
+
+/*
+ *	StorageSetup
+ *	Gets a freshly mounted stick ready on a thread of its own: measures it if it hasn't been
+ *	measured yet, repairs sessions a power cut left unclosed and picks the session directory.
+ *	At startup this runs while OpenMAX and the camera pipeline are brought up, and once the
+ *	recorder is running the spool holds the footage meanwhile, so none of it holds up capture.
+ *
+ *	The thread only reads the config. The benchmark results are loaded by the main loop once
+ *	the thread has finished.
+*/
+class StorageSetup
+{
+public:
+	StorageSetup(const RecorderConfig* config);
+	~StorageSetup();
+
+	// session is the directory being recorded into, which carries on if it's still on the stick
+	bool Start(const char* session);
+
+	bool IsRunning() const { return m_started; }
+	bool IsDone() const { return m_done; }
+
+	// Waits for the thread, returns false if there's no session directory to record into
+	bool Finish();
+
+	// Kills the benchmark and waits for the rest, for a stick that has gone away
+	void Cancel();
+
+	void PrintStats();
+
+public:
+	const char* GetDirectory() const { return m_directory; }
+
+	// A new directory rather than the one passed to Start()
+	bool IsNewSession() const { return m_newSession; }
+
+private:
+	static void* ThreadMain(void* param);
+	void Run();
+
+	pid_t StartBench();
+	bool CreateSession();
+
+private:
+	const RecorderConfig* m_config;
+
+	pthread_t m_thread;
+	bool m_started;
+	volatile bool m_done;
+	volatile bool m_cancelled;
+	volatile pid_t m_benchPid;
+
+	char m_directory[255];
+	bool m_newSession;
+	bool m_result;
+
+	// Only touched by the thread until it has finished
+	uint64_t m_startTime;
+	uint64_t m_benchTime;
+	uint64_t m_recoverTime;
+	uint64_t m_sessionTime;
+};
@@ -0,0 +1,142 @@
+#include "StorageSpool.h"
+#include "../libs/OMXHelper/OMXCore.h"
+#include <string.h>
+#include <stdlib.h>
+
+StorageSpool::StorageSpool(size_t maxBytes)
+{
+	m_maxBytes = maxBytes;
+	m_bytes = 0;
+
+	m_head = nullptr;
+	m_tail = nullptr;
+
+	m_frameStart = true;
+
+	ResetStats();
+}
+
+StorageSpool::~StorageSpool()
+{
+	Clear();
+}
+
+static bool IsKeyframeStart(const SpoolRecord* record)
+{
+	return (record->frameStart) && (record->flags & (OMX_BUFFERFLAG_SYNCFRAME | OMX_BUFFERFLAG_CODECCONFIG));
+}
+
+bool StorageSpool::Push(const uint8_t* data, size_t length, uint32_t flags, uint64_t timestamp)
+{
+	bool frameStart = m_frameStart;
+	m_frameStart = (flags & (OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_CODECCONFIG)) != 0;
+
+	size_t size = offsetof(SpoolRecord, data) + length;
+	if (size > m_maxBytes)
+		return false;
+
+	// Make room by dropping whole GOPs from the front, the newest footage is worth more
+	while ((m_head) && (m_bytes + size > m_maxBytes))
+		DropFront();
+
+	SpoolRecord* record = (SpoolRecord*)malloc(size);
+	if (!record)
+		return false;
+
+	record->next = nullptr;
+	record->length = length;
+	record->flags = flags;
+	record->timestamp = timestamp;
+	record->frameStart = frameStart;
+	memcpy(record->data, data, length);
+
+	if (m_tail)
+		m_tail->next = record;
+	else
+		m_head = record;
+	m_tail = record;
+
+	m_bytes += size;
+	if (m_bytes > m_peakBytes)
+		m_peakBytes = m_bytes;
+
+	if (!m_spooled)
+		m_firstTimestamp = timestamp;
+	m_spooled = true;
+	m_lastTimestamp = timestamp;
+
+	return true;
+}
+
+void StorageSpool::Pop()
+{
+	if (!m_head)
+		return;
+
+	SpoolRecord* record = m_head;
+	m_head = record->next;
+	if (!m_head)
+		m_tail = nullptr;
+
+	m_bytes -= offsetof(SpoolRecord, data) + record->length;
+	free(record);
+}
+
+void StorageSpool::DropFront()
+{
+	uint64_t start = m_head->timestamp;
+
+	// Always drop at least the record at the front, then everything up to the next keyframe
+	do
+	{
+		m_lostBytes += m_head->length;
+		Pop();
+	} while ((m_head) && (!IsKeyframeStart(m_head)));
+
+	m_lostTime += ((m_head) ? m_head->timestamp : m_lastTimestamp) - start;
+}
+
+void StorageSpool::DropToKeyframe()
+{
+	if ((m_head) && (!IsKeyframeStart(m_head)))
+	{
+		uint64_t start = m_head->timestamp;
+		while ((m_head) && (!IsKeyframeStart(m_head)))
+		{
+			m_lostBytes += m_head->length;
+			Pop();
+		}
+		m_lostTime += ((m_head) ? m_head->timestamp : m_lastTimestamp) - start;
+	}
+}
+
+void StorageSpool::Clear()
+{
+	while (m_head)
+		Pop();
+}
+
+void StorageSpool::ResetStats()
+{
+	m_spooled = false;
+	m_firstTimestamp = 0;
+	m_lastTimestamp = 0;
+	m_lostTime = 0;
+	m_lostBytes = 0;
+	m_peakBytes = m_bytes;
+}
+
+void StorageSpool::PrintStats(const char* name)
+{
+	uint64_t covered = (m_lastTimestamp > m_firstTimestamp) ? (m_lastTimestamp - m_firstTimestamp) : 0;
+	uint64_t gapFree = (covered > m_lostTime) ? (covered - m_lostTime) : 0;
+
+	printf("%s spool: covered %llu ms in RAM, %llu ms gap free (%llu ms / %llu bytes dropped), peak %u bytes\n", name,
+		(unsigned long long)(covered / 1000), (unsigned long long)(gapFree / 1000), (unsigned long long)(m_lostTime / 1000),
+		(unsigned long long)m_lostBytes, (unsigned int)m_peakBytes);
+}
+
+void StorageSpool::WriteStatus(FILE* file, const char* name)
+{
+	fprintf(file, "%s spool: %u bytes (peak %u), %llu ms dropped\n", name, (unsigned int)m_bytes, (unsigned int)m_peakBytes, (unsigned long long)(m_lostTime / 1000));
+}
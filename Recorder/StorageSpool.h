@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *	StorageSpool
+ *	Holds a stream's buffers in RAM while there is nowhere to write them, in order, up to a fixed
+ *	number of bytes. When it is full the oldest whole GOP is dropped, so what is left always starts
+ *	at a keyframe and still decodes. The memory is only allocated while there is something in it.
+*/
+
+struct SpoolRecord
+{
+	SpoolRecord* next;
+	uint32_t length;
+	uint32_t flags;
+	uint64_t timestamp;
+	// The buffer starts a frame
+	bool frameStart;
+	uint8_t data[1];
+};
+
+class StorageSpool
+{
+public:
+	StorageSpool(size_t maxBytes);
+	~StorageSpool();
+
+	// Returns false if the buffer had to be dropped
+	bool Push(const uint8_t* data, size_t length, uint32_t flags, uint64_t timestamp);
+
+	// Oldest buffer, still in the spool until Pop()
+	const SpoolRecord* Front() const { return m_head; }
+	void Pop();
+
+	// Drops buffers up to the next keyframe, a segment can't start in the middle of a GOP
+	void DropToKeyframe();
+
+	void Clear();
+
+	// Starts a new spooling period for the coverage stats
+	void ResetStats();
+	void PrintStats(const char* name);
+	void WriteStatus(FILE* file, const char* name);
+
+public:
+	bool IsEmpty() const { return m_head == nullptr; }
+	size_t GetBytes() const { return m_bytes; }
+
+private:
+	// Drops the oldest GOP
+	void DropFront();
+
+private:
+	size_t m_maxBytes;
+	size_t m_bytes;
+
+	SpoolRecord* m_head;
+	SpoolRecord* m_tail;
+
+	bool m_frameStart;
+
+	// Coverage of the current spooling period, first to last timestamp and what was dropped in between
+	bool m_spooled;
+	uint64_t m_firstTimestamp;
+	uint64_t m_lastTimestamp;
+	uint64_t m_lostTime;
+	uint64_t m_lostBytes;
+	size_t m_peakBytes;
+};
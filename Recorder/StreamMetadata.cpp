@@ -0,0 +1,45 @@
+#include "StreamMetadata.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "Timing.h"
+
+StreamMetadata::StreamMetadata()
+{
+	memset(&m_fix, 0, sizeof(m_fix));
+	m_hasFix = false;
+
+	m_hasSensor = false;
+	m_peak = 0;
+}
+
+void StreamMetadata::SetFix(const GpsFix& fix)
+{
+	m_fix = fix;
+	m_hasFix = fix.valid;
+}
+
+void StreamMetadata::AddAcceleration(unsigned int magnitude)
+{
+	m_hasSensor = true;
+	if (magnitude > m_peak)
+		m_peak = magnitude;
+}
+
+void StreamMetadata::Format(char* text, size_t size)
+{
+	struct timeval now;
+	gettimeofday(&now, nullptr);
+
+	int length = snprintf(text, size, "dashpi=%s time=%lu.%03u", RECORDER_VERSION, (unsigned long)now.tv_sec, (unsigned int)(now.tv_usec / 1000));
+
+	if ((m_hasFix) && (GetMonotonicTime() - m_fix.time <= METADATA_FIX_AGE) && (length < (int)size))
+	{
+		length += snprintf(text + length, size - length, " gps=%.6f,%.6f,%.0f,%.0f", m_fix.latitude, m_fix.longitude,
+			m_fix.speed, m_fix.course);
+	}
+
+	if ((m_hasSensor) && (length < (int)size))
+		snprintf(text + length, size - length, " g=%u", m_peak);
+	m_peak = 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Nmea.h"
+
+/*
+ *	StreamMetadata
+ *	What the recorder knows about the moment a frame was recorded, for the SEI the segment
+ *	writer puts in front of it: the wall clock, the last GPS fix and the hardest the G-sensor
+ *	was shaken since the SEI before. See libs/Storage/SeiMetadata.h for the format.
+*/
+
+#ifndef RECORDER_VERSION
+#define RECORDER_VERSION "unknown"
+#endif
+
+// A fix older than this is left out rather than put next to footage it doesn't belong to
+#define METADATA_FIX_AGE 2000000
+
+class StreamMetadata
+{
+public:
+	StreamMetadata();
+
+	void SetFix(const GpsFix& fix);
+
+	// Acceleration over gravity of each G-sensor sample in mg
+	void AddAcceleration(unsigned int magnitude);
+
+	// Text for the next SEI, starts a new acceleration peak
+	void Format(char* text, size_t size);
+
+private:
+	GpsFix m_fix;
+	bool m_hasFix;
+
+	bool m_hasSensor;
+	unsigned int m_peak;
+};
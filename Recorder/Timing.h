@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// Microseconds since an arbitrary point, unaffected by the wall clock being set
+static inline uint64_t GetMonotonicTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
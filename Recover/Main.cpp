@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../libs/Storage/SessionRecovery.h"
+#include "SelfTest.h"
+
+static void Usage(const char* name)
+{
+	printf("Usage: %s [-n] [-s session directory] [recordings directory]\n", name);
+	printf("  Repairs every session without a length.txt, or just the one given with -s\n");
+	printf("  -n only shows what would be done\n");
+	printf("Usage: %s -t <scratch directory>\n", name);
+	printf("  Recovers sample sessions, pool files among them, and checks the result\n");
+}
+
+int main(int argc, char** argv)
+{
+	const char* recordingsDir = "/recordings";
+	const char* session = nullptr;
+	bool dryRun = false;
+
+	int option;
+	while ((option = getopt(argc, argv, "ns:t:h")) != -1)
+	{
+		switch (option)
+		{
+		case 'n':
+			dryRun = true;
+			break;
+		case 's':
+			session = optarg;
+			break;
+		case 't':
+			return RunSelfTest(optarg);
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc)
+		recordingsDir = argv[optind];
+
+	SessionRecovery recovery;
+	recovery.SetDryRun(dryRun);
+
+	if (session)
+	{
+		if (!recovery.RecoverSession(session))
+			return 1;
+	}
+	else if (!recovery.RecoverAll(recordingsDir, nullptr))
+	{
+		printf("Nothing to recover in %s\n", recordingsDir);
+		return 0;
+	}
+
+	recovery.PrintStats();
+	return 0;
+}
@@ -0,0 +1,222 @@
+#include "SelfTest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "../libs/Storage/SessionRecovery.h"
+#include "../libs/Storage/PoolCatalog.h"
+
+#define TEST_FILE_SIZE (2 * 1024 * 1024)
+#define TEST_FRAME_SIZE 7000
+#define TEST_GOP 10
+
+// Where the recorder had got to, and how far the catalog had been told
+#define TEST_WRITTEN 300000
+#define TEST_RECORDED 262144
+
+struct TestSession
+{
+	const char* name;
+	const char* description;
+	bool inPool;
+	// Old footage from 0 to here before the new recording was written over it
+	uint64_t oldEnd;
+};
+
+static const TestSession g_sessions[] =
+{
+	{ "0", "recycled pool file with old footage after the recording", true, TEST_FILE_SIZE },
+	{ "1", "recycled pool file written past the old footage", true, 100000 },
+	{ "2", "file outside the pool", false, 0 },
+};
+
+#define TEST_SESSIONS (sizeof(g_sessions) / sizeof(g_sessions[0]))
+
+// Access units of filler slices with the given payload byte, every frame the same size
+static void WriteStream(uint8_t* data, uint64_t end, uint8_t payload)
+{
+	static const uint8_t headers[] = { 0, 0, 0, 1, 0x67, 0x80, 0, 0, 0, 1, 0x68, 0x80 };
+
+	uint64_t offset = 0;
+	for (unsigned int frame = 0; offset < end; frame++)
+	{
+		uint8_t au[TEST_FRAME_SIZE];
+		size_t length = 0;
+		if (frame % TEST_GOP == 0)
+		{
+			memcpy(au, headers, sizeof(headers));
+			length = sizeof(headers);
+		}
+
+		// first_mb_in_slice 0, then nothing that looks like a start code
+		uint8_t slice[] = { 0, 0, 0, 1, (uint8_t)((frame % TEST_GOP == 0) ? 0x65 : 0x41), 0x80 };
+		memcpy(au + length, slice, sizeof(slice));
+		length += sizeof(slice);
+		memset(au + length, payload, sizeof(au) - length);
+
+		size_t copy = (end - offset < sizeof(au)) ? (size_t)(end - offset) : sizeof(au);
+		memcpy(data + offset, au, copy);
+		offset += copy;
+	}
+}
+
+// Start of the last access unit before end, which is where recovery should cut
+static uint64_t GetLastFrameStart(uint64_t end)
+{
+	return ((end - 1) / TEST_FRAME_SIZE) * TEST_FRAME_SIZE;
+}
+
+static bool WriteSession(const char* recordingsDir, const TestSession* session, int catalog, unsigned int index, uint64_t* expectedCut)
+{
+	char path[255];
+	snprintf(path, sizeof(path), "%s/%s", recordingsDir, session->name);
+	if (mkdir(path, 0777) != 0)
+		return false;
+
+	uint8_t* data = (uint8_t*)calloc(1, TEST_FILE_SIZE);
+	if (!data)
+		return false;
+
+	WriteStream(data, session->oldEnd, 0x22);
+	WriteStream(data, TEST_WRITTEN, 0x11);
+
+	// A pool file is zeros past the old footage, a file outside it ends at what was written. While there's
+	// old footage after the recording only what the catalog was told about can be trusted
+	uint64_t fileSize = (session->inPool) ? TEST_FILE_SIZE : TEST_WRITTEN;
+	*expectedCut = GetLastFrameStart((session->oldEnd > TEST_WRITTEN) ? TEST_RECORDED : TEST_WRITTEN);
+
+	snprintf(path, sizeof(path), "%s/%s/00000000-recording.h264", recordingsDir, session->name);
+	FILE* file = fopen(path, "w");
+	bool success = (file) && (fwrite(data, 1, fileSize, file) == fileSize);
+	if (file)
+		fclose(file);
+	free(data);
+
+	if ((!success) || (!session->inPool))
+		return success;
+
+	PoolEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	snprintf(entry.path, sizeof(entry.path), "%s/00000000-recording.h264", session->name);
+	entry.state = POOL_ENTRY_WRITING;
+	entry.sequence = index + 1;
+	entry.length = TEST_RECORDED;
+	entry.dirty = session->oldEnd;
+	return PoolCatalogWrite(catalog, index, &entry);
+}
+
+static bool CheckSession(const char* recordingsDir, const TestSession* session, int catalog, unsigned int index, uint64_t expectedCut)
+{
+	char path[255];
+	snprintf(path, sizeof(path), "%s/%s/00000000-recording.h264", recordingsDir, session->name);
+
+	struct stat sb;
+	if (stat(path, &sb) != 0)
+	{
+		printf("  %s is gone\n", path);
+		return false;
+	}
+
+	bool success = true;
+	uint64_t length = sb.st_size;
+	if (session->inPool)
+	{
+		PoolEntry entry;
+		if ((!PoolCatalogRead(catalog, index, &entry)) || (entry.state != POOL_ENTRY_DONE))
+		{
+			printf("  catalog entry wasn't finished\n");
+			return false;
+		}
+
+		length = entry.length;
+		if (sb.st_size != TEST_FILE_SIZE)
+		{
+			printf("  pool file was shortened to %llu bytes\n", (unsigned long long)sb.st_size);
+			success = false;
+		}
+		if (entry.dirty < TEST_FILE_SIZE)
+		{
+			printf("  only %llu bytes left to be cut off\n", (unsigned long long)entry.dirty);
+			success = false;
+		}
+	}
+
+	if (length != expectedCut)
+	{
+		printf("  recording ends at %llu, expected %llu\n", (unsigned long long)length, (unsigned long long)expectedCut);
+		success = false;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s/length.txt", recordingsDir, session->name);
+	if (access(path, F_OK) != 0)
+	{
+		printf("  no length.txt\n");
+		success = false;
+	}
+
+	return success;
+}
+
+static void RemoveSession(const char* recordingsDir, const TestSession* session)
+{
+	static const char* names[] = { "00000000-recording.h264", "00000000-recording.crc", "filelist.txt", "length.txt" };
+
+	char path[255];
+	for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		snprintf(path, sizeof(path), "%s/%s/%s", recordingsDir, session->name, names[i]);
+		unlink(path);
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", recordingsDir, session->name);
+	rmdir(path);
+}
+
+int RunSelfTest(const char* directory)
+{
+	char recordingsDir[255];
+	snprintf(recordingsDir, sizeof(recordingsDir), "%s/recovertest.XXXXXX", directory);
+	if (!mkdtemp(recordingsDir))
+	{
+		printf("Failed to create a directory in %s\n", directory);
+		return 1;
+	}
+
+	char catalogName[255];
+	snprintf(catalogName, sizeof(catalogName), "%s/%s", recordingsDir, POOL_CATALOG_FILE);
+	int catalog = open(catalogName, O_RDWR | O_CREAT, 0644);
+
+	uint64_t expectedCuts[TEST_SESSIONS];
+	bool success = catalog >= 0;
+	for (unsigned int i = 0; (i < TEST_SESSIONS) && (success); i++)
+		success = WriteSession(recordingsDir, &g_sessions[i], catalog, i, &expectedCuts[i]);
+
+	if (!success)
+		printf("Failed to write the test sessions to %s\n", recordingsDir);
+
+	if (success)
+	{
+		SessionRecovery recovery;
+		recovery.RecoverAll(recordingsDir, nullptr);
+
+		for (unsigned int i = 0; i < TEST_SESSIONS; i++)
+		{
+			bool passed = CheckSession(recordingsDir, &g_sessions[i], catalog, i, expectedCuts[i]);
+			printf("%s: %s\n", passed ? "pass" : "FAIL", g_sessions[i].description);
+			success = success && passed;
+		}
+	}
+
+	if (catalog >= 0)
+		close(catalog);
+
+	for (unsigned int i = 0; i < TEST_SESSIONS; i++)
+		RemoveSession(recordingsDir, &g_sessions[i]);
+	unlink(catalogName);
+	rmdir(recordingsDir);
+
+	return (success) ? 0 : 1;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Writes sessions a power cut could have left behind into a new directory under directory, recovers
+// them and checks where each recording was cut. Returns the exit code
+int RunSelfTest(const char* directory);
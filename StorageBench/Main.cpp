@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "StorageBench.h"
+
+static void Usage(const char* name)
+{
+	printf("Usage: %s [-s MB per block size] [-o results file] [-n] [directory]\n", name);
+	printf("  Results go to <directory>/%s unless -n is given\n", BENCH_RESULTS_FILE);
+}
+
+int main(int argc, char** argv)
+{
+	const char* directory = "/recordings";
+	const char* resultsName = nullptr;
+	bool writeResults = true;
+	unsigned int size = 0;
+
+	int option;
+	while ((option = getopt(argc, argv, "s:o:nh")) != -1)
+	{
+		switch (option)
+		{
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'o':
+			resultsName = optarg;
+			break;
+		case 'n':
+			writeResults = false;
+			break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc)
+		directory = argv[optind];
+
+	StorageBench bench;
+	if (size)
+		bench.SetSize((size_t)size * 1024 * 1024);
+
+	if (!bench.Run(directory))
+		return 1;
+
+	bench.PrintResults();
+
+	if (writeResults)
+	{
+		char defaultName[512];
+		if (!resultsName)
+		{
+			snprintf(defaultName, sizeof(defaultName), "%s/%s", directory, BENCH_RESULTS_FILE);
+			resultsName = defaultName;
+		}
+
+		if (!bench.WriteResults(resultsName))
+			return 1;
+
+		printf("Results written to %s\n", resultsName);
+	}
+
+	return 0;
+}
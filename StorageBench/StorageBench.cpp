@@ -0,0 +1,281 @@
+#include "StorageBench.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/statvfs.h>
+
+// 8MB per block size keeps the whole run to a few seconds on a slow stick
+#define BENCH_DEFAULT_SIZE (8 * 1024 * 1024)
+#define BENCH_MIN_SIZE (1024 * 1024)
+
+// Only this much of the measured throughput is handed to the main stream, the rest is
+// headroom for the substream, filesystem metadata and the stick's own garbage collection
+#define BENCH_BITRATE_PERCENT 50
+
+static const size_t g_blockSizes[BENCH_BLOCK_SIZES] = { 4096, 16384, 65536, 262144, 1048576 };
+
+static uint64_t GetMonotonicTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+StorageBench::StorageBench()
+{
+	m_size = BENCH_DEFAULT_SIZE;
+	m_directory[0] = 0;
+
+	memset(m_results, 0, sizeof(m_results));
+
+	m_syncAverage = 0;
+	m_syncMax = 0;
+	m_maxStall = 0;
+
+	m_blockSize = 0;
+	m_bitrate = 0;
+}
+
+void StorageBench::SetSize(size_t size)
+{
+	m_size = size;
+}
+
+bool StorageBench::Run(const char* directory)
+{
+	strncpy(m_directory, directory, sizeof(m_directory) - 1);
+	m_directory[sizeof(m_directory) - 1] = 0;
+
+	// Never fill the stick up, a full stick is exactly what the recorder has to avoid
+	struct statvfs fs;
+	if (statvfs(directory, &fs) != 0)
+	{
+		printf("Failed to stat %s: %s\n", directory, strerror(errno));
+		return false;
+	}
+
+	uint64_t freeBytes = (uint64_t)fs.f_bavail * fs.f_frsize;
+	if (m_size > freeBytes / 4)
+		m_size = (size_t)(freeBytes / 4);
+
+	if (m_size < BENCH_MIN_SIZE)
+	{
+		printf("Not enough free space on %s to run the benchmark\n", directory);
+		return false;
+	}
+
+	char scratchName[512];
+	snprintf(scratchName, sizeof(scratchName), "%s/%s", directory, BENCH_SCRATCH_FILE);
+
+	int file = open(scratchName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (file < 0)
+	{
+		printf("Failed to create %s: %s\n", scratchName, strerror(errno));
+		return false;
+	}
+
+	bool success = true;
+	m_maxStall = 0;
+
+	for (unsigned int i = 0; (i < BENCH_BLOCK_SIZES) && (success); i++)
+	{
+		m_results[i].blockSize = g_blockSizes[i];
+		success = RunSequential(file, &m_results[i]);
+
+		if (m_results[i].maxLatency > m_maxStall)
+			m_maxStall = m_results[i].maxLatency;
+	}
+
+	if (success)
+		success = RunSync(file);
+
+	close(file);
+	unlink(scratchName);
+
+	if (!success)
+		return false;
+
+	// The smallest block size that gets close to the best throughput, bigger blocks only cost RAM
+	uint64_t best = 0;
+	for (unsigned int i = 0; i < BENCH_BLOCK_SIZES; i++)
+	{
+		if (m_results[i].throughput > best)
+			best = m_results[i].throughput;
+	}
+
+	for (unsigned int i = 0; i < BENCH_BLOCK_SIZES; i++)
+	{
+		if (m_results[i].throughput >= (best * 9) / 10)
+		{
+			uint64_t bitrate = (m_results[i].throughput * 8 * BENCH_BITRATE_PERCENT) / 100;
+
+			m_blockSize = m_results[i].blockSize;
+			m_bitrate = (bitrate > 0xFFFFFFFF) ? 0xFFFFFFFF : (unsigned int)bitrate;
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool StorageBench::RunSequential(int file, BenchBlockResult* result)
+{
+	// Every run starts on an empty file, so each one has to allocate its blocks like a new segment
+	if ((ftruncate(file, 0) != 0) || (lseek(file, 0, SEEK_SET) != 0) || (fdatasync(file) != 0))
+	{
+		printf("Failed to reset the scratch file: %s\n", strerror(errno));
+		return false;
+	}
+
+	uint8_t* block = (uint8_t*)malloc(result->blockSize);
+	if (!block)
+		return false;
+
+	// Not all zeroes, in case the stick compresses
+	for (size_t i = 0; i < result->blockSize; i++)
+		block[i] = (uint8_t)((i * 2654435761u) >> 24);
+
+	result->maxLatency = 0;
+
+	size_t written = 0;
+	size_t unsynced = 0;
+	uint64_t start = GetMonotonicTime();
+
+	while (written < m_size)
+	{
+		uint64_t callStart = GetMonotonicTime();
+		ssize_t ret = write(file, block, result->blockSize);
+		uint64_t latency = GetMonotonicTime() - callStart;
+
+		if (ret <= 0)
+		{
+			printf("Write failed: %s\n", strerror(errno));
+			free(block);
+			return false;
+		}
+
+		if (latency > result->maxLatency)
+			result->maxLatency = latency;
+
+		written += ret;
+		unsynced += ret;
+
+		if ((unsynced >= BENCH_SYNC_INTERVAL) || (written >= m_size))
+		{
+			callStart = GetMonotonicTime();
+			if (fdatasync(file) != 0)
+			{
+				printf("fdatasync failed: %s\n", strerror(errno));
+				free(block);
+				return false;
+			}
+			latency = GetMonotonicTime() - callStart;
+
+			if (latency > result->maxLatency)
+				result->maxLatency = latency;
+
+			unsynced = 0;
+		}
+	}
+
+	uint64_t elapsed = GetMonotonicTime() - start;
+	result->throughput = (elapsed) ? ((uint64_t)written * 1000000) / elapsed : 0;
+
+	free(block);
+	return true;
+}
+
+bool StorageBench::RunSync(int file)
+{
+	if ((ftruncate(file, 0) != 0) || (lseek(file, 0, SEEK_SET) != 0))
+		return false;
+
+	uint8_t block[4096];
+	memset(block, 0x5a, sizeof(block));
+
+	uint64_t total = 0;
+	m_syncMax = 0;
+
+	for (unsigned int i = 0; i < BENCH_SYNC_WRITES; i++)
+	{
+		if (write(file, block, sizeof(block)) != (ssize_t)sizeof(block))
+			return false;
+
+		uint64_t start = GetMonotonicTime();
+		if (fdatasync(file) != 0)
+			return false;
+		uint64_t latency = GetMonotonicTime() - start;
+
+		total += latency;
+		if (latency > m_syncMax)
+			m_syncMax = latency;
+	}
+
+	m_syncAverage = total / BENCH_SYNC_WRITES;
+	if (m_syncMax > m_maxStall)
+		m_maxStall = m_syncMax;
+
+	return true;
+}
+
+bool StorageBench::WriteResults(const char* fileName)
+{
+	char tempName[520];
+	snprintf(tempName, sizeof(tempName), "%s.tmp", fileName);
+
+	FILE* file = fopen(tempName, "w");
+	if (!file)
+	{
+		printf("Failed to create %s: %s\n", tempName, strerror(errno));
+		return false;
+	}
+
+	char date[64] = { 0 };
+	time_t now = time(0);
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&now));
+
+	fprintf(file, "# Written by storagebench.bin on %s, %u MB per block size\n", date, (unsigned int)(m_size / (1024 * 1024)));
+	fprintf(file, "# Delete this file to have the recorder measure the stick again\n");
+	fprintf(file, "#\n");
+	fprintf(file, "# block size, throughput (kB/s), slowest write or sync (ms)\n");
+	for (unsigned int i = 0; i < BENCH_BLOCK_SIZES; i++)
+	{
+		fprintf(file, "# %u %llu %llu\n", (unsigned int)m_results[i].blockSize, (unsigned long long)m_results[i].throughput / 1000,
+			(unsigned long long)m_results[i].maxLatency / 1000);
+	}
+	fprintf(file, "# fdatasync after 4kB: %llu ms average, %llu ms worst\n", (unsigned long long)m_syncAverage / 1000, (unsigned long long)m_syncMax / 1000);
+	fprintf(file, "\n");
+	fprintf(file, "storage.bitrate = %u\n", m_bitrate);
+	fprintf(file, "storage.stall = %llu\n", (unsigned long long)(m_maxStall + 999) / 1000);
+	fprintf(file, "segment.blocksize = %u\n", (unsigned int)m_blockSize);
+
+	// Make sure the results don't outlive the stick's contents if the power goes
+	bool success = (fflush(file) == 0) && (fdatasync(fileno(file)) == 0);
+	fclose(file);
+
+	if ((!success) || (rename(tempName, fileName) != 0))
+	{
+		printf("Failed to write %s\n", fileName);
+		unlink(tempName);
+		return false;
+	}
+
+	return true;
+}
+
+void StorageBench::PrintResults()
+{
+	printf("Storage benchmark of %s, %u MB per block size:\n", m_directory, (unsigned int)(m_size / (1024 * 1024)));
+	for (unsigned int i = 0; i < BENCH_BLOCK_SIZES; i++)
+	{
+		printf("  %7u byte writes: %6llu kB/s, slowest call %llu ms\n", (unsigned int)m_results[i].blockSize,
+			(unsigned long long)m_results[i].throughput / 1000, (unsigned long long)m_results[i].maxLatency / 1000);
+	}
+	printf("  fdatasync after 4kB: %llu ms average, %llu ms worst\n", (unsigned long long)m_syncAverage / 1000, (unsigned long long)m_syncMax / 1000);
+	printf("  Worst stall %llu ms\n", (unsigned long long)m_maxStall / 1000);
+	printf("Recommended: %u bps main stream, %u byte writes\n", m_bitrate, (unsigned int)m_blockSize);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *	StorageBench
+ *	Short, non-destructive characterisation of whatever is mounted at a directory. Everything is
+ *	written to a scratch file which is removed again afterwards, nothing else is touched.
+ *
+ *	Sequential writes are timed at a few block sizes with an fdatasync() every megabyte, so the
+ *	page cache can't hide how fast the stick really is. Every write() and fdatasync() is timed to
+ *	find the worst stall, and a run of small synced writes gives the flush latency on its own.
+ *	The results are written in recorder.conf syntax so the recorder can just load them.
+*/
+
+#define BENCH_BLOCK_SIZES 5
+#define BENCH_SYNC_INTERVAL (1024 * 1024)
+#define BENCH_SYNC_WRITES 32
+
+#define BENCH_SCRATCH_FILE ".storagebench.tmp"
+#define BENCH_RESULTS_FILE "storagebench.conf"
+
+struct BenchBlockResult
+{
+	size_t blockSize;
+
+	// Bytes per second, including the syncs
+	uint64_t throughput;
+
+	// Slowest single write() or fdatasync(), in microseconds
+	uint64_t maxLatency;
+};
+
+class StorageBench
+{
+public:
+	StorageBench();
+
+	// Bytes written per block size, shrunk to fit if the storage is nearly full
+	void SetSize(size_t size);
+
+	bool Run(const char* directory);
+
+	// Writes the measurements and the recommended recorder settings
+	bool WriteResults(const char* fileName);
+	void PrintResults();
+
+public:
+	// Recommended settings, only valid after Run()
+	size_t GetBlockSize() const { return m_blockSize; }
+	unsigned int GetBitrate() const { return m_bitrate; }
+	uint64_t GetMaxStall() const { return m_maxStall; }
+
+private:
+	bool RunSequential(int file, BenchBlockResult* result);
+	bool RunSync(int file);
+
+private:
+	size_t m_size;
+	char m_directory[256];
+
+	BenchBlockResult m_results[BENCH_BLOCK_SIZES];
+
+	uint64_t m_syncAverage;
+	uint64_t m_syncMax;
+	uint64_t m_maxStall;
+
+	size_t m_blockSize;
+	unsigned int m_bitrate;
+};
@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "../libs/Storage/Crc32c.h"
+#include "../libs/Storage/ChecksumSidecar.h"
+#include "../libs/Storage/SeiMetadata.h"
+#include "../Recorder/H264.h"
+
+#define CHUNK_UNCHECKED 0
+#define CHUNK_GOOD 1
+#define CHUNK_BAD 2
+#define CHUNK_SHORT 3
+
+// The main stream's bitrate the checksum cost is measured against
+#define BENCH_BITRATE 25000000
+#define BENCH_BUFFER_SIZE (16 * 1024 * 1024)
+
+struct Segment
+{
+	char name[512];
+	uint64_t size;
+	ChecksumChunk* chunks;
+	unsigned int chunkCount;
+	uint32_t chunkSize;
+	unsigned char* results;
+};
+
+struct VerifyJobs
+{
+	Segment* segments;
+	unsigned int segmentCount;
+	uint32_t maxChunkSize;
+
+	// Next chunk to check, shared by the workers
+	pthread_mutex_t lock;
+	unsigned int nextSegment;
+	unsigned int nextChunk;
+};
+
+static uint64_t GetMonotonicTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+static void Usage(const char* name)
+{
+	printf("Usage: %s [-j threads] [-m] <segment or directory>...\n", name);
+	printf("       %s -b\n", name);
+	printf("  Checks every segment against its .crc sidecar, directories are searched for segments\n");
+	printf("  -m lists the metadata the recorder put in the stream instead\n");
+	printf("  -b measures the checksum throughput on this machine instead\n");
+}
+
+static bool HasExtension(const char* name, const char* extension)
+{
+	size_t length = strlen(name);
+	size_t extensionLength = strlen(extension);
+	return (length > extensionLength) && (strcmp(name + length - extensionLength, extension) == 0);
+}
+
+static bool AddSegment(Segment** segments, unsigned int* count, unsigned int* capacity, const char* name)
+{
+	if (*count == *capacity)
+	{
+		*capacity = (*capacity) ? *capacity * 2 : 64;
+		Segment* grown = (Segment*)realloc(*segments, *capacity * sizeof(Segment));
+		if (!grown)
+			return false;
+		*segments = grown;
+	}
+
+	Segment* segment = &(*segments)[(*count)++];
+	memset(segment, 0, sizeof(Segment));
+	snprintf(segment->name, sizeof(segment->name), "%s", name);
+	return true;
+}
+
+static void FindSegments(const char* path, Segment** segments, unsigned int* count, unsigned int* capacity)
+{
+	struct stat sb;
+	if (stat(path, &sb) != 0)
+	{
+		printf("%s: %s\n", path, strerror(errno));
+		return;
+	}
+
+	if (!S_ISDIR(sb.st_mode))
+	{
+		AddSegment(segments, count, capacity, path);
+		return;
+	}
+
+	DIR* dir = opendir(path);
+	if (!dir)
+		return;
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr)
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+
+		char child[512];
+		snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+
+		if (stat(child, &sb) != 0)
+			continue;
+
+		if (S_ISDIR(sb.st_mode))
+			FindSegments(child, segments, count, capacity);
+		else if (HasExtension(entry->d_name, ".h264"))
+			AddSegment(segments, count, capacity, child);
+	}
+
+	closedir(dir);
+}
+
+static int CompareSegments(const void* a, const void* b)
+{
+	return strcmp(((const Segment*)a)->name, ((const Segment*)b)->name);
+}
+
+static void* VerifyThread(void* arg)
+{
+	VerifyJobs* jobs = (VerifyJobs*)arg;
+
+	uint8_t* buffer = (uint8_t*)malloc(jobs->maxChunkSize);
+	if (!buffer)
+		return nullptr;
+
+	int fd = -1;
+	unsigned int openSegment = 0;
+
+	while (true)
+	{
+		pthread_mutex_lock(&jobs->lock);
+		while ((jobs->nextSegment < jobs->segmentCount) && (jobs->nextChunk >= jobs->segments[jobs->nextSegment].chunkCount))
+		{
+			jobs->nextSegment++;
+			jobs->nextChunk = 0;
+		}
+
+		unsigned int segmentIndex = jobs->nextSegment;
+		unsigned int chunkIndex = jobs->nextChunk++;
+		pthread_mutex_unlock(&jobs->lock);
+
+		if (segmentIndex >= jobs->segmentCount)
+			break;
+
+		Segment* segment = &jobs->segments[segmentIndex];
+		const ChecksumChunk* chunk = &segment->chunks[chunkIndex];
+
+		// Chunks are handed out in order, so a thread mostly stays on the same file
+		if ((fd < 0) || (openSegment != segmentIndex))
+		{
+			if (fd >= 0)
+				close(fd);
+			fd = open(segment->name, O_RDONLY);
+			openSegment = segmentIndex;
+		}
+
+		if ((fd < 0) || (chunk->length > jobs->maxChunkSize) || (pread(fd, buffer, chunk->length, chunk->offset) != (ssize_t)chunk->length))
+		{
+			segment->results[chunkIndex] = CHUNK_SHORT;
+			continue;
+		}
+
+		segment->results[chunkIndex] = (Crc32c(0, buffer, chunk->length) == chunk->crc) ? CHUNK_GOOD : CHUNK_BAD;
+	}
+
+	if (fd >= 0)
+		close(fd);
+	free(buffer);
+	return nullptr;
+}
+
+// Whatever follows the last checksummed chunk, a recycled segment file is zeroed past its recording
+static bool IsZeroTail(const Segment* segment, uint64_t start)
+{
+	int fd = open(segment->name, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	uint8_t buffer[65536];
+	bool zero = true;
+	ssize_t got;
+	while ((zero) && ((got = pread(fd, buffer, sizeof(buffer), start)) > 0))
+	{
+		for (ssize_t i = 0; i < got; i++)
+		{
+			if (buffer[i])
+			{
+				zero = false;
+				break;
+			}
+		}
+		start += got;
+	}
+
+	close(fd);
+	return zero;
+}
+
+// Prints the segment's result, returns false if any of it is damaged
+static bool Report(const Segment* segment)
+{
+	if (!segment->results)
+	{
+		printf("%s: no checksums\n", segment->name);
+		return true;
+	}
+
+	unsigned int good = 0;
+	bool damaged = false;
+	for (unsigned int i = 0; i < segment->chunkCount; i++)
+	{
+		const ChecksumChunk* chunk = &segment->chunks[i];
+		if (segment->results[i] == CHUNK_GOOD)
+		{
+			good++;
+			continue;
+		}
+
+		if (!damaged)
+			printf("%s:\n", segment->name);
+		damaged = true;
+
+		printf("\tbytes %llu-%llu %s\n", (unsigned long long)chunk->offset, (unsigned long long)(chunk->offset + chunk->length - 1),
+			(segment->results[i] == CHUNK_BAD) ? "don't match their checksum" : "are missing");
+	}
+
+	uint64_t checked = (segment->chunkCount) ? segment->chunks[segment->chunkCount - 1].offset + segment->chunks[segment->chunkCount - 1].length : 0;
+	bool untrusted = (segment->size > checked) && (!IsZeroTail(segment, checked));
+
+	if (damaged)
+		printf("\t%u of %u chunks intact\n", good, segment->chunkCount);
+	else
+		printf("%s: %u chunks intact\n", segment->name, good);
+
+	// The checksums of the last chunks hadn't been written yet when the recording stopped
+	if (untrusted)
+		printf("\tbytes %llu-%llu have no checksum\n", (unsigned long long)checked, (unsigned long long)(segment->size - 1));
+
+	return !damaged;
+}
+
+// Every metadata SEI in the segment with its offset, returns how many there were
+static unsigned int PrintMetadata(const char* name)
+{
+	int fd = open(name, O_RDONLY);
+	if (fd < 0)
+	{
+		printf("%s: %s\n", name, strerror(errno));
+		return 0;
+	}
+
+	struct stat sb;
+	if ((fstat(fd, &sb) != 0) || (sb.st_size == 0))
+	{
+		close(fd);
+		return 0;
+	}
+
+	size_t size = sb.st_size;
+	const uint8_t* data = (const uint8_t*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		printf("%s: failed to map\n", name);
+		return 0;
+	}
+	madvise((void*)data, size, MADV_SEQUENTIAL);
+
+	printf("%s:\n", name);
+
+	unsigned int found = 0;
+	size_t offset = H264FindNal(data, size, 0);
+	while (offset < size)
+	{
+		size_t next = H264FindNal(data, size, offset + 1);
+
+		char text[SEI_METADATA_MAX_TEXT + 1];
+		if ((H264NalType(data[offset]) == H264_NAL_SEI) && (SeiMetadataParse(data + offset, ((next < size) ? next - 3 : size) - offset, text, sizeof(text))))
+		{
+			printf("  %12llu %s\n", (unsigned long long)offset, text);
+			found++;
+		}
+
+		offset = next;
+	}
+
+	munmap((void*)data, size);
+	return found;
+}
+
+static int Benchmark()
+{
+	uint8_t* buffer = (uint8_t*)malloc(BENCH_BUFFER_SIZE);
+	if (!buffer)
+		return 1;
+
+	for (size_t i = 0; i < BENCH_BUFFER_SIZE; i++)
+		buffer[i] = (uint8_t)(rand() >> 7);
+
+	const char* names[2] = { Crc32cImplementation(), "slice-by-8" };
+	uint32_t (*functions[2])(uint32_t, const void*, size_t) = { Crc32c, Crc32cTable };
+	unsigned int count = (strcmp(names[0], names[1]) == 0) ? 1 : 2;
+
+	// What the writer hands over per buffer at the main stream's bitrate
+	for (unsigned int i = 0; i < count; i++)
+	{
+		uint64_t bytes = 0;
+		uint32_t crc = 0;
+		uint64_t start = GetMonotonicTime();
+		while (GetMonotonicTime() - start < 1000000)
+		{
+			for (size_t offset = 0; offset < BENCH_BUFFER_SIZE; offset += 65536)
+				crc = functions[i](crc, buffer + offset, 65536);
+			bytes += BENCH_BUFFER_SIZE;
+		}
+		uint64_t elapsed = GetMonotonicTime() - start;
+
+		uint64_t rate = bytes * 1000000 / elapsed;
+		uint64_t load = (uint64_t)(BENCH_BITRATE / 8) * 10000 / rate;
+
+		printf("%-10s %6llu MB/s, %llu.%.2llu%% of a core at %u Mbps (crc %08x)\n", names[i], (unsigned long long)(rate / (1024 * 1024)),
+			(unsigned long long)(load / 100), (unsigned long long)(load % 100), BENCH_BITRATE / 1000000, crc);
+	}
+
+	free(buffer);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	bool benchmark = false;
+	bool metadata = false;
+
+	int option;
+	while ((option = getopt(argc, argv, "j:bmh")) != -1)
+	{
+		switch (option)
+		{
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'b':
+			benchmark = true;
+			break;
+		case 'm':
+			metadata = true;
+			break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (benchmark)
+		return Benchmark();
+
+	if ((optind >= argc) || (threads < 1))
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	Segment* segments = nullptr;
+	unsigned int segmentCount = 0;
+	unsigned int capacity = 0;
+	for (int i = optind; i < argc; i++)
+		FindSegments(argv[i], &segments, &segmentCount, &capacity);
+
+	if (!segmentCount)
+	{
+		printf("No segments found\n");
+		return 1;
+	}
+
+	qsort(segments, segmentCount, sizeof(Segment), CompareSegments);
+
+	if (metadata)
+	{
+		unsigned int found = 0;
+		for (unsigned int i = 0; i < segmentCount; i++)
+			found += PrintMetadata(segments[i].name);
+
+		printf("%u segments, %u metadata SEIs\n", segmentCount, found);
+		free(segments);
+		return 0;
+	}
+
+	VerifyJobs jobs;
+	jobs.segments = segments;
+	jobs.segmentCount = segmentCount;
+	jobs.maxChunkSize = 0;
+	jobs.nextSegment = 0;
+	jobs.nextChunk = 0;
+	pthread_mutex_init(&jobs.lock, nullptr);
+
+	uint64_t totalBytes = 0;
+	for (unsigned int i = 0; i < segmentCount; i++)
+	{
+		Segment* segment = &segments[i];
+
+		struct stat sb;
+		if (stat(segment->name, &sb) == 0)
+			segment->size = sb.st_size;
+
+		char sidecarName[512];
+		ChecksumSidecarName(segment->name, sidecarName, sizeof(sidecarName));
+		if (!ChecksumSidecarLoad(sidecarName, &segment->chunkSize, &segment->chunks, &segment->chunkCount))
+			continue;
+
+		segment->results = (unsigned char*)calloc(segment->chunkCount + 1, 1);
+
+		for (unsigned int c = 0; c < segment->chunkCount; c++)
+		{
+			if (segment->chunks[c].length > jobs.maxChunkSize)
+				jobs.maxChunkSize = segment->chunks[c].length;
+			totalBytes += segment->chunks[c].length;
+		}
+	}
+
+	uint64_t start = GetMonotonicTime();
+
+	pthread_t* workers = (pthread_t*)malloc(threads * sizeof(pthread_t));
+	for (long i = 0; i < threads; i++)
+		pthread_create(&workers[i], nullptr, VerifyThread, &jobs);
+	for (long i = 0; i < threads; i++)
+		pthread_join(workers[i], nullptr);
+	free(workers);
+
+	uint64_t elapsed = GetMonotonicTime() - start;
+
+	unsigned int damaged = 0;
+	unsigned int unchecked = 0;
+	for (unsigned int i = 0; i < segmentCount; i++)
+	{
+		if (!segments[i].results)
+			unchecked++;
+		if (!Report(&segments[i]))
+			damaged++;
+	}
+
+	printf("%u segments, %u damaged, %u without checksums. %llu MB checked in %llu ms with %ld threads (%s)\n", segmentCount, damaged, unchecked,
+		(unsigned long long)(totalBytes / (1024 * 1024)), (unsigned long long)(elapsed / 1000), threads, Crc32cImplementation());
+
+	for (unsigned int i = 0; i < segmentCount; i++)
+	{
+		free(segments[i].chunks);
+		free(segments[i].results);
+	}
+	free(segments);
+	pthread_mutex_destroy(&jobs.lock);
+
+	return (damaged) ? 1 : 0;
+}
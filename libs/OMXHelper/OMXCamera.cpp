@@ -1,4 +1,5 @@
 #include "OMXCamera.h"
+#include <stdio.h>
 
 
 
@@ -7,6 +8,9 @@ OMXCamera::OMXCamera()
 	m_omxCamera = nullptr;
 	m_clock = nullptr;
 	m_omxTunnelClock = nullptr;
+	m_omxTunnelPreview = nullptr;
+	m_omxTunnelCapture = nullptr;
+	m_omxTunnelStill = nullptr;
 }
 
 
@@ -26,6 +30,13 @@ OMXCamera::~OMXCamera()
 		m_omxTunnelCapture = nullptr;
 	}
 
+	if (m_omxTunnelStill)
+	{
+		m_omxTunnelStill->Deestablish();
+		delete m_omxTunnelStill;
+		m_omxTunnelStill = nullptr;
+	}
+
 	if (m_omxTunnelClock)
 	{
 		m_omxTunnelClock->Deestablish();
@@ -77,6 +88,35 @@ bool OMXCamera::Open(OMXClock* clock)
 }
 
 void OMXCamera::SetFrameInfo(unsigned int width, unsigned int height, unsigned int framerate)
+{
+	if (m_omxCamera)
+	{
+		// Preview port 70 and capture port 71
+		SetPortFrameInfo(m_omxCamera->GetOutputPort(), width, height, framerate);
+		SetPortFrameInfo(m_omxCamera->GetOutputPort() + 1, width, height, framerate);
+	}
+}
+
+void OMXCamera::SetCaptureFrameInfo(unsigned int width, unsigned int height, unsigned int framerate)
+{
+	if (m_omxCamera)
+	{
+		// Only the capture port needs to be disabled for this, the preview keeps its size
+		SetPortFrameInfo(71, width, height, framerate);
+		SetFramerate(71, framerate);
+	}
+}
+
+void OMXCamera::SetCaptureFramerate(unsigned int framerate)
+{
+	if (m_omxCamera)
+	{
+		// Frame rate is a config so it can change while capturing
+		SetFramerate(71, framerate);
+	}
+}
+
+void OMXCamera::SetStillFrameInfo(unsigned int width, unsigned int height)
 {
 	if (m_omxCamera)
 	{
@@ -84,47 +124,64 @@ void OMXCamera::SetFrameInfo(unsigned int width, unsigned int height, unsigned i
 
 		OMX_PARAM_PORTDEFINITIONTYPE portDef;
 		OMX_INIT_STRUCTURE(portDef);
-		portDef.nPortIndex = m_omxCamera->GetOutputPort();
+		portDef.nPortIndex = 72;
 
 		if ((omxErr = m_omxCamera->GetParameter(OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone)
 		{
 			// Unable to get port defs
 		}
 
-		portDef.format.video.nFrameWidth = width;
-		portDef.format.video.nFrameHeight = height;
-		portDef.format.video.xFramerate = framerate << 16;
-		portDef.format.video.nStride = (portDef.format.video.nFrameWidth + portDef.nBufferAlignment - 1) & (~(portDef.nBufferAlignment - 1));
-		portDef.format.video.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+		portDef.format.image.nFrameWidth = width;
+		portDef.format.image.nFrameHeight = height;
+		portDef.format.image.nStride = (width + portDef.nBufferAlignment - 1) & (~(portDef.nBufferAlignment - 1));
+		portDef.format.image.nSliceHeight = 0;
+		portDef.format.image.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
 
 		if ((omxErr = m_omxCamera->SetParameter(OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone)
 		{
-			// Unable to set port def
+			printf("Failed to set still port definition. (%u)\n", omxErr);
 		}
+	}
+}
 
-		portDef.nPortIndex = m_omxCamera->GetOutputPort();
-		if ((omxErr = m_omxCamera->GetParameter(OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone)
-		{
-			// Unable to get port defs
-		}
-		portDef.nPortIndex = m_omxCamera->GetOutputPort() + 1; // Port 71
-		if ((omxErr = m_omxCamera->SetParameter(OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone)
-		{
-			// Unable to set port def
-		}
+void OMXCamera::SetPortFrameInfo(OMX_U32 port, unsigned int width, unsigned int height, unsigned int framerate)
+{
+	OMX_ERRORTYPE omxErr = OMX_ErrorNone;
 
-		OMX_CONFIG_FRAMERATETYPE frameratePortSet;
-		OMX_INIT_STRUCTURE(frameratePortSet);
-		frameratePortSet.nPortIndex = m_omxCamera->GetOutputPort();
-		frameratePortSet.xEncodeFramerate = portDef.format.video.xFramerate;
-		if ((omxErr = m_omxCamera->SetConfig(OMX_IndexConfigVideoFramerate, &frameratePortSet)) != OMX_ErrorNone)
-		{
+	OMX_PARAM_PORTDEFINITIONTYPE portDef;
+	OMX_INIT_STRUCTURE(portDef);
+	portDef.nPortIndex = port;
+
+	if ((omxErr = m_omxCamera->GetParameter(OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone)
+	{
+		// Unable to get port defs
+	}
+
+	portDef.format.video.nFrameWidth = width;
+	portDef.format.video.nFrameHeight = height;
+	portDef.format.video.xFramerate = framerate << 16;
+	portDef.format.video.nStride = (portDef.format.video.nFrameWidth + portDef.nBufferAlignment - 1) & (~(portDef.nBufferAlignment - 1));
+	portDef.format.video.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+
+	if ((omxErr = m_omxCamera->SetParameter(OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone)
+	{
+		// Unable to set port def
+	}
+
+	SetFramerate(port, framerate);
+}
+
+void OMXCamera::SetFramerate(OMX_U32 port, unsigned int framerate)
+{
+	OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+	OMX_CONFIG_FRAMERATETYPE frameratePortSet;
+	OMX_INIT_STRUCTURE(frameratePortSet);
+	frameratePortSet.nPortIndex = port;
+	frameratePortSet.xEncodeFramerate = framerate << 16;
+	if ((omxErr = m_omxCamera->SetConfig(OMX_IndexConfigVideoFramerate, &frameratePortSet)) != OMX_ErrorNone)
+	{
 
-		}
-		frameratePortSet.nPortIndex = 71;
-		if ((omxErr = m_omxCamera->SetConfig(OMX_IndexConfigVideoFramerate, &frameratePortSet)) != OMX_ErrorNone)
-		{
-		}
 	}
 }
 
@@ -221,6 +278,60 @@ void OMXCamera::StopCaptureTunnel()
 	}
 }
 
+bool OMXCamera::SetupStillTunnel(OMXCoreComponent * component, OMX_U32 dstPort)
+{
+	m_omxTunnelStill = new OMXCoreTunnel();
+	m_omxTunnelStill->Init(m_omxCamera, 72, component, dstPort);
+
+	OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+	omxErr = m_omxTunnelStill->Establish(false);
+	if (omxErr != OMX_ErrorNone)
+	{
+		// Failed to establish tunnel
+
+		delete m_omxTunnelStill;
+		m_omxTunnelStill = nullptr;
+
+		return false;
+	}
+
+	return true;
+}
+
+void OMXCamera::StopStillTunnel()
+{
+	if (m_omxTunnelStill)
+	{
+		m_omxTunnelStill->Deestablish();
+		delete m_omxTunnelStill;
+		m_omxTunnelStill = nullptr;
+	}
+}
+
+bool OMXCamera::DisableCaptureTunnel()
+{
+	if (!m_omxTunnelCapture)
+		return false;
+
+	// Keep the tunnel object around so it can be re-established with the new port settings
+	return (m_omxTunnelCapture->Deestablish() == OMX_ErrorNone);
+}
+
+bool OMXCamera::EnableCaptureTunnel()
+{
+	if (!m_omxTunnelCapture)
+		return false;
+
+	OMX_ERRORTYPE omxErr = m_omxTunnelCapture->Establish(false);
+	if (omxErr != OMX_ErrorNone)
+	{
+		// Failed to establish tunnel
+		return false;
+	}
+
+	return true;
+}
+
 #include <stdio.h>
 void OMXCamera::Execute()
 {
@@ -248,3 +359,24 @@ void OMXCamera::EnableCapture(bool enabled)
 		printf("Done\n");
 	}
 }
+
+bool OMXCamera::CaptureStill()
+{
+	if ((!m_omxCamera) || (!m_omxTunnelStill))
+		return false;
+
+	// One shot, the camera clears this again once the frame has gone out of port 72
+	OMX_CONFIG_PORTBOOLEANTYPE capture;
+	OMX_INIT_STRUCTURE(capture);
+	capture.nPortIndex = 72;
+	capture.bEnabled = OMX_TRUE;
+
+	OMX_ERRORTYPE omxErr = m_omxCamera->SetParameter(OMX_IndexConfigPortCapturing, &capture);
+	if (omxErr != OMX_ErrorNone)
+	{
+		printf("Failed to capture still. (%u)\n", omxErr);
+		return false;
+	}
+
+	return true;
+}
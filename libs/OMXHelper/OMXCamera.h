@@ -12,6 +12,9 @@ public:
 	bool Open(OMXClock* clock);
 
 	void SetFrameInfo(unsigned int width, unsigned int height, unsigned int framerate);
+	void SetCaptureFrameInfo(unsigned int width, unsigned int height, unsigned int framerate);
+	void SetCaptureFramerate(unsigned int framerate);
+	void SetStillFrameInfo(unsigned int width, unsigned int height);
 	void SetRotation(OMX_S32 deg);
 	void SetMirror(OMX_MIRRORTYPE mirror);
 
@@ -20,6 +23,15 @@ public:
 	void StopPreviewTunnel();
 	void StopCaptureTunnel();
 
+	// Still port 72, CaptureStill() sends a single frame down it without stopping the video ports
+	bool SetupStillTunnel(OMXCoreComponent* component, OMX_U32 dstPort);
+	void StopStillTunnel();
+	bool CaptureStill();
+
+	// Used to reconfigure the capture port while the rest of the pipeline keeps running
+	bool DisableCaptureTunnel();
+	bool EnableCaptureTunnel();
+
 	void Execute();
 	void EnableCapture(bool enabled);
 
@@ -28,6 +40,10 @@ public:
 		return m_omxCamera;
 	}
 
+private:
+	void SetPortFrameInfo(OMX_U32 port, unsigned int width, unsigned int height, unsigned int framerate);
+	void SetFramerate(OMX_U32 port, unsigned int framerate);
+
 private:
 	OMXClock* m_clock;
 
@@ -35,5 +51,6 @@ private:
 	OMXCoreTunnel* m_omxTunnelClock;
 	OMXCoreTunnel* m_omxTunnelPreview;
 	OMXCoreTunnel* m_omxTunnelCapture;
+	OMXCoreTunnel* m_omxTunnelStill;
 };
 
@@ -201,6 +201,9 @@ OMX_ERRORTYPE OMXCoreTunnel::Deestablish(bool noWait)
 		m_portSettingsChanged = false;
 	}
 
+	bool srcEnabled = (m_srcComponent->GetComponent()) && (m_srcComponent->IsPortEnabled(m_srcPort));
+	bool dstEnabled = (m_dstComponent->GetComponent()) && (m_dstComponent->IsPortEnabled(m_dstPort));
+
 	if (m_srcComponent->GetComponent())
 	{
 		omxErr = m_srcComponent->DisablePort(m_srcPort, false);
@@ -219,6 +222,13 @@ OMX_ERRORTYPE OMXCoreTunnel::Deestablish(bool noWait)
 		}
 	}
 
+	// The tunnel can only be torn down once both ends are disabled
+	if ((srcEnabled) && (!noWait))
+		m_srcComponent->WaitForCommand(OMX_CommandPortDisable, m_srcPort);
+
+	if ((dstEnabled) && (!noWait))
+		m_dstComponent->WaitForCommand(OMX_CommandPortDisable, m_dstPort);
+
 	if (m_srcComponent->GetComponent())
 	{
 		omxErr = OMX_SetupTunnel(m_srcComponent->GetComponent(), m_srcPort, NULL, 0);
@@ -573,8 +583,9 @@ OMX_ERRORTYPE OMXCoreComponent::AllocInputBuffers(bool useBuffers)
 		return omxErr;
 
 	{
+		// Buffers can be added to a running component once the port is enabled again
 		OMX_STATETYPE state = GetState();
-		if (state != OMX_StateIdle)
+		if ((state != OMX_StateIdle) && (state != OMX_StateExecuting))
 		{
 			if (state != OMX_StateLoaded)
 				SetStateForComponent(OMX_StateLoaded);
@@ -648,8 +659,9 @@ OMX_ERRORTYPE OMXCoreComponent::AllocOutputBuffers(bool useBuffers)
 		return omxErr;
 
 	{
+		// Buffers can be added to a running component once the port is enabled again
 		OMX_STATETYPE state = GetState();
-		if (state != OMX_StateIdle)
+		if ((state != OMX_StateIdle) && (state != OMX_StateExecuting))
 		{
 			if (state != OMX_StateLoaded)
 				SetStateForComponent(OMX_StateLoaded);
@@ -761,7 +773,23 @@ OMX_ERRORTYPE OMXCoreComponent::FreeOutputBuffers(bool wait)
 	pthread_mutex_lock(&m_omxOutputMutex);
 	pthread_cond_broadcast(&m_outputBufferCond);
 
-	omxErr = DisablePort(m_outputPort, wait);
+	// The disable only completes once every buffer has been freed, so wait for that afterwards
+	bool portEnabled = IsPortEnabled(m_outputPort);
+	omxErr = DisablePort(m_outputPort, false);
+
+	if ((portEnabled) && (!m_exit))
+	{
+		// Let the component hand back the buffers it is still holding before freeing them
+		struct timespec endtime;
+		clock_gettime(CLOCK_REALTIME, &endtime);
+		add_timespecs(endtime, 200);
+
+		while (m_omxOutputAvailable.size() < m_omxOutputBuffers.size())
+		{
+			if (pthread_cond_timedwait(&m_outputBufferCond, &m_omxOutputMutex, &endtime) != 0)
+				break;
+		}
+	}
 
 	for (std::size_t i = 0; i < m_omxOutputBuffers.size(); ++i)
 	{
@@ -784,6 +812,9 @@ OMX_ERRORTYPE OMXCoreComponent::FreeOutputBuffers(bool wait)
 
 	pthread_mutex_unlock(&m_omxOutputMutex);
 
+	if ((wait) && (portEnabled))
+		omxErr = WaitForCommand(OMX_CommandPortDisable, m_outputPort);
+
 	return omxErr;
 }
 
@@ -1146,7 +1177,7 @@ OMX_ERRORTYPE OMXCoreComponent::DisablePort(unsigned int port, bool wait)
 	
 	OMX_ERRORTYPE omxErr = OMX_ErrorNone;
 	
-	if (!bEnabled)
+	if (bEnabled)
 	{
 		omxErr = OMX_SendCommand(m_handle, OMX_CommandPortDisable, port, NULL);
 		if (omxErr != OMX_ErrorNone)
@@ -1175,6 +1206,25 @@ OMX_ERRORTYPE OMXCoreComponent::DisablePort(unsigned int port, bool wait)
 	return omxErr;
 }
 
+bool OMXCoreComponent::IsPortEnabled(unsigned int port)
+{
+	Lock();
+
+	bool bEnabled = false;
+
+	for (unsigned int i = 0; i < OMX_MAX_PORTS; ++i)
+	{
+		if (m_portsEnabled[i] == port)
+		{
+			bEnabled = true;
+			break;
+		}
+	}
+
+	Unlock();
+	return bEnabled;
+}
+
 #pragma region Callbacks
 OMX_ERRORTYPE OMXCoreComponent::DecoderEventHandlerCallback(OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2, OMX_PTR pEventData)
 {
@@ -104,6 +104,7 @@ public:
 
 	OMX_ERRORTYPE EnablePort(unsigned int port, bool wait = true);
 	OMX_ERRORTYPE DisablePort(unsigned int port, bool wait = true);
+	bool IsPortEnabled(unsigned int port);
 
 public:
 	OMX_ERRORTYPE EmptyThisBuffer(OMX_BUFFERHEADERTYPE* omxBuffer);
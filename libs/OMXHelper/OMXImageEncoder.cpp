@@ -0,0 +1,92 @@
+#include "OMXImageEncoder.h"
+#include <stdio.h>
+
+OMXImageEncoder::OMXImageEncoder()
+{
+	m_omxEncoder = nullptr;
+}
+
+
+OMXImageEncoder::~OMXImageEncoder()
+{
+	if (m_omxEncoder)
+	{
+		delete m_omxEncoder;
+		m_omxEncoder = nullptr;
+	}
+}
+
+bool OMXImageEncoder::Open()
+{
+	m_omxEncoder = new OMXCoreComponent();
+
+	if (!m_omxEncoder->Initialise("OMX.broadcom.image_encode", OMX_IndexParamImageInit))
+	{
+		// Failed
+		delete m_omxEncoder;
+		m_omxEncoder = nullptr;
+
+		return false;
+	}
+
+	return true;
+}
+
+void OMXImageEncoder::SetOutputFormat(OMX_IMAGE_CODINGTYPE type)
+{
+	if (m_omxEncoder)
+	{
+		OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+		OMX_PARAM_PORTDEFINITIONTYPE portDef;
+		OMX_INIT_STRUCTURE(portDef);
+		portDef.nPortIndex = m_omxEncoder->GetOutputPort();
+
+		if ((omxErr = m_omxEncoder->GetParameter(OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone)
+		{
+			// Unable to get port defs
+		}
+
+		portDef.format.image.eCompressionFormat = type;
+		portDef.format.image.eColorFormat = OMX_COLOR_FormatUnused;
+
+		if ((omxErr = m_omxEncoder->SetParameter(OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone)
+		{
+			printf("Failed to set image output format. (%u)\n", omxErr);
+		}
+	}
+}
+
+void OMXImageEncoder::SetQuality(unsigned int quality)
+{
+	if (m_omxEncoder)
+	{
+		OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+		OMX_IMAGE_PARAM_QFACTORTYPE qfactor;
+		OMX_INIT_STRUCTURE(qfactor);
+		qfactor.nPortIndex = m_omxEncoder->GetOutputPort();
+		qfactor.nQFactor = quality;
+
+		if ((omxErr = m_omxEncoder->SetParameter(OMX_IndexParamQFactor, &qfactor)) != OMX_ErrorNone)
+		{
+			printf("Failed to set image quality. (%u)\n", omxErr);
+		}
+	}
+}
+
+void OMXImageEncoder::AllocateBuffers()
+{
+	if (m_omxEncoder)
+	{
+		m_omxEncoder->AllocOutputBuffers();
+	}
+}
+
+void OMXImageEncoder::Execute()
+{
+	if (m_omxEncoder)
+	{
+		m_omxEncoder->SetStateForComponent(OMX_StateExecuting);
+	}
+}
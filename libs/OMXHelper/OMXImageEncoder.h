@@ -0,0 +1,27 @@
+#pragma once
+
+#include "OMXCore.h"
+
+class OMXImageEncoder
+{
+public:
+	OMXImageEncoder();
+	~OMXImageEncoder();
+
+	bool Open();
+
+	void SetOutputFormat(OMX_IMAGE_CODINGTYPE type);
+	void SetQuality(unsigned int quality);
+
+	void AllocateBuffers();
+
+	void Execute();
+
+public:
+	OMXCoreComponent* GetComponent() const {
+		return m_omxEncoder;
+	}
+
+private:
+	OMXCoreComponent* m_omxEncoder;
+};
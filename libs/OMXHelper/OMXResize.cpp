@@ -0,0 +1,103 @@
+#include "OMXResize.h"
+#include <stdio.h>
+
+OMXResize::OMXResize()
+{
+	m_omxResize = nullptr;
+	m_omxTunnelOutput = nullptr;
+}
+
+
+OMXResize::~OMXResize()
+{
+	StopOutputTunnel();
+
+	if (m_omxResize)
+	{
+		delete m_omxResize;
+		m_omxResize = nullptr;
+	}
+}
+
+bool OMXResize::Open()
+{
+	m_omxResize = new OMXCoreComponent();
+
+	if (!m_omxResize->Initialise("OMX.broadcom.resize", OMX_IndexParamImageInit))
+	{
+		// Failed
+		delete m_omxResize;
+		m_omxResize = nullptr;
+
+		return false;
+	}
+
+	return true;
+}
+
+void OMXResize::SetOutputSize(unsigned int width, unsigned int height)
+{
+	if (m_omxResize)
+	{
+		OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+		OMX_PARAM_PORTDEFINITIONTYPE portDef;
+		OMX_INIT_STRUCTURE(portDef);
+		portDef.nPortIndex = m_omxResize->GetOutputPort();
+
+		if ((omxErr = m_omxResize->GetParameter(OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone)
+		{
+			// Unable to get port defs
+		}
+
+		// The resizer works on images, the encoder picks the frame rate up from the camera
+		portDef.format.image.nFrameWidth = width;
+		portDef.format.image.nFrameHeight = height;
+		portDef.format.image.nStride = 0;
+		portDef.format.image.nSliceHeight = 0;
+		portDef.format.image.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+
+		if ((omxErr = m_omxResize->SetParameter(OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone)
+		{
+			printf("Failed to set resize output size. (%u)\n", omxErr);
+		}
+	}
+}
+
+void OMXResize::Execute()
+{
+	if (m_omxResize)
+	{
+		m_omxResize->SetStateForComponent(OMX_StateExecuting);
+	}
+}
+
+bool OMXResize::SetupOutputTunnel(OMXCoreComponent * component, OMX_U32 dstPort)
+{
+	m_omxTunnelOutput = new OMXCoreTunnel();
+	m_omxTunnelOutput->Init(m_omxResize, m_omxResize->GetOutputPort(), component, dstPort);
+
+	OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+	omxErr = m_omxTunnelOutput->Establish(false);
+	if (omxErr != OMX_ErrorNone)
+	{
+		// Failed to establish tunnel
+
+		delete m_omxTunnelOutput;
+		m_omxTunnelOutput = nullptr;
+
+		return false;
+	}
+
+	return true;
+}
+
+void OMXResize::StopOutputTunnel()
+{
+	if (m_omxTunnelOutput)
+	{
+		m_omxTunnelOutput->Deestablish();
+		delete m_omxTunnelOutput;
+		m_omxTunnelOutput = nullptr;
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "OMXCore.h"
+
+class OMXResize
+{
+public:
+	OMXResize();
+	~OMXResize();
+
+	bool Open();
+
+	void SetOutputSize(unsigned int width, unsigned int height);
+
+	void Execute();
+
+	bool SetupOutputTunnel(OMXCoreComponent* component, OMX_U32 dstPort);
+	void StopOutputTunnel();
+
+public:
+	OMXCoreComponent* GetComponent() const {
+		return m_omxResize;
+	}
+
+private:
+	OMXCoreComponent* m_omxResize;
+
+	OMXCoreTunnel* m_omxTunnelOutput;
+};
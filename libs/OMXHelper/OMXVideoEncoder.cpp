@@ -96,6 +96,74 @@ void OMXVideoEncoder::SetBitrate(OMX_U32 rate)
 	}
 }
 
+void OMXVideoEncoder::SetTargetBitrate(OMX_U32 rate)
+{
+	if (m_omxEncoder)
+	{
+		OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+		// Unlike SetBitrate this can be changed while encoding
+		OMX_VIDEO_CONFIG_BITRATETYPE bitrate;
+		OMX_INIT_STRUCTURE(bitrate);
+		bitrate.nPortIndex = m_omxEncoder->GetOutputPort();
+		bitrate.nEncodeBitrate = rate;
+
+		if ((omxErr = m_omxEncoder->SetConfig(OMX_IndexConfigVideoBitrate, &bitrate)) != OMX_ErrorNone)
+		{
+			printf("Failed to set target bitrate. (%u)\n", omxErr);
+		}
+	}
+}
+
+void OMXVideoEncoder::SetQuantisationLimits(unsigned int minQuant, unsigned int maxQuant)
+{
+	if (m_omxEncoder)
+	{
+		OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+		// 0 leaves the encoder's own limit in place
+		OMX_PARAM_U32TYPE quant;
+		OMX_INIT_STRUCTURE(quant);
+		quant.nPortIndex = m_omxEncoder->GetOutputPort();
+
+		if (minQuant)
+		{
+			quant.nU32 = minQuant;
+			if ((omxErr = m_omxEncoder->SetParameter(OMX_IndexParamBrcmVideoEncodeMinQuant, &quant)) != OMX_ErrorNone)
+			{
+				printf("Failed to set minimum quantiser. (%u)\n", omxErr);
+			}
+		}
+
+		if (maxQuant)
+		{
+			quant.nU32 = maxQuant;
+			if ((omxErr = m_omxEncoder->SetParameter(OMX_IndexParamBrcmVideoEncodeMaxQuant, &quant)) != OMX_ErrorNone)
+			{
+				printf("Failed to set maximum quantiser. (%u)\n", omxErr);
+			}
+		}
+	}
+}
+
+void OMXVideoEncoder::SetFramerate(unsigned int framerate)
+{
+	if (m_omxEncoder)
+	{
+		OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+		OMX_CONFIG_FRAMERATETYPE frameratePortSet;
+		OMX_INIT_STRUCTURE(frameratePortSet);
+		frameratePortSet.nPortIndex = m_omxEncoder->GetOutputPort();
+		frameratePortSet.xEncodeFramerate = framerate << 16;
+
+		if ((omxErr = m_omxEncoder->SetConfig(OMX_IndexConfigVideoFramerate, &frameratePortSet)) != OMX_ErrorNone)
+		{
+			printf("Failed to set framerate. (%u)\n", omxErr);
+		}
+	}
+}
+
 void OMXVideoEncoder::SetOutputFormat(OMX_VIDEO_CODINGTYPE type)
 {
 	if (m_omxEncoder)
@@ -138,6 +206,145 @@ void OMXVideoEncoder::SetAVCProfile(OMX_VIDEO_AVCPROFILETYPE type)
 	}
 }
 
+void OMXVideoEncoder::SetIDRPeriod(unsigned int frames)
+{
+	if ((m_omxEncoder) && (frames))
+	{
+		OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+		OMX_VIDEO_PARAM_AVCTYPE avcPortDef;
+		OMX_INIT_STRUCTURE(avcPortDef);
+		avcPortDef.nPortIndex = m_omxEncoder->GetOutputPort();
+
+		if ((omxErr = m_omxEncoder->GetParameter(OMX_IndexParamVideoAvc, &avcPortDef)) != OMX_ErrorNone)
+		{
+			// Unable to get port defs
+		}
+
+		// Number of P frames between each IDR
+		avcPortDef.nPFrames = frames - 1;
+
+		if ((omxErr = m_omxEncoder->SetParameter(OMX_IndexParamVideoAvc, &avcPortDef)) != OMX_ErrorNone)
+		{
+			printf("Failed to set IDR period. (%u)\n", omxErr);
+		}
+	}
+}
+
+void OMXVideoEncoder::SetInlineMotionVectors(bool enabled)
+{
+	if (m_omxEncoder)
+	{
+		OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+		// Vectors come out as their own buffer after each frame, flagged with OMX_BUFFERFLAG_CODECSIDEINFO
+		OMX_CONFIG_PORTBOOLEANTYPE vectors;
+		OMX_INIT_STRUCTURE(vectors);
+		vectors.nPortIndex = m_omxEncoder->GetOutputPort();
+		vectors.bEnabled = (enabled) ? OMX_TRUE : OMX_FALSE;
+
+		if ((omxErr = m_omxEncoder->SetParameter(OMX_IndexParamBrcmVideoAVCInlineVectorsEnable, &vectors)) != OMX_ErrorNone)
+		{
+			printf("Failed to set inline motion vectors. (%u)\n", omxErr);
+		}
+	}
+}
+
+void OMXVideoEncoder::SetInlineHeaders(bool enabled)
+{
+	if (m_omxEncoder)
+	{
+		OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+		// Repeats the SPS/PPS in front of every IDR, as OMX_BUFFERFLAG_CODECCONFIG buffers
+		OMX_CONFIG_PORTBOOLEANTYPE headers;
+		OMX_INIT_STRUCTURE(headers);
+		headers.nPortIndex = m_omxEncoder->GetOutputPort();
+		headers.bEnabled = (enabled) ? OMX_TRUE : OMX_FALSE;
+
+		if ((omxErr = m_omxEncoder->SetParameter(OMX_IndexParamBrcmVideoAVCInlineHeaderEnable, &headers)) != OMX_ErrorNone)
+		{
+			printf("Failed to set inline headers. (%u)\n", omxErr);
+		}
+	}
+}
+
+void OMXVideoEncoder::SetSPSTiming(bool enabled)
+{
+	if (m_omxEncoder)
+	{
+		OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+		// Puts the frame rate into the SPS VUI so players get the timing right from a raw segment
+		OMX_CONFIG_PORTBOOLEANTYPE timing;
+		OMX_INIT_STRUCTURE(timing);
+		timing.nPortIndex = m_omxEncoder->GetOutputPort();
+		timing.bEnabled = (enabled) ? OMX_TRUE : OMX_FALSE;
+
+		if ((omxErr = m_omxEncoder->SetParameter(OMX_IndexParamBrcmVideoAVCSPSTimingEnable, &timing)) != OMX_ErrorNone)
+		{
+			printf("Failed to set SPS timing. (%u)\n", omxErr);
+		}
+	}
+}
+
+void OMXVideoEncoder::SetSeparateNALs(bool enabled)
+{
+	if (m_omxEncoder)
+	{
+		OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+		OMX_CONFIG_PORTBOOLEANTYPE separate;
+		OMX_INIT_STRUCTURE(separate);
+		separate.nPortIndex = m_omxEncoder->GetOutputPort();
+		separate.bEnabled = (enabled) ? OMX_TRUE : OMX_FALSE;
+
+		if ((omxErr = m_omxEncoder->SetParameter(OMX_IndexParamBrcmNALSSeparate, &separate)) != OMX_ErrorNone)
+		{
+			printf("Failed to set separate NALs. (%u)\n", omxErr);
+		}
+	}
+}
+
+void OMXVideoEncoder::SetSliceRows(unsigned int rows)
+{
+	if ((m_omxEncoder) && (rows))
+	{
+		OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+		OMX_PARAM_U32TYPE slice;
+		OMX_INIT_STRUCTURE(slice);
+		slice.nPortIndex = m_omxEncoder->GetOutputPort();
+		slice.nU32 = rows;
+
+		// Only exists as a config, there is no parameter for it
+		if ((omxErr = m_omxEncoder->SetConfig(OMX_IndexConfigBrcmVideoEncoderMBRowsPerSlice, &slice)) != OMX_ErrorNone)
+		{
+			printf("Failed to set slice rows. (%u)\n", omxErr);
+		}
+	}
+}
+
+bool OMXVideoEncoder::RequestKeyframe()
+{
+	if (!m_omxEncoder)
+		return false;
+
+	OMX_CONFIG_PORTBOOLEANTYPE request;
+	OMX_INIT_STRUCTURE(request);
+	request.nPortIndex = m_omxEncoder->GetOutputPort();
+	request.bEnabled = OMX_TRUE;
+
+	OMX_ERRORTYPE omxErr = m_omxEncoder->SetConfig(OMX_IndexConfigBrcmVideoRequestIFrame, &request);
+	if (omxErr != OMX_ErrorNone)
+	{
+		printf("Failed to request keyframe. (%u)\n", omxErr);
+		return false;
+	}
+
+	return true;
+}
+
 void OMXVideoEncoder::AllocateBuffers()
 {
 	if (m_omxEncoder)
@@ -146,6 +353,14 @@ void OMXVideoEncoder::AllocateBuffers()
 	}
 }
 
+void OMXVideoEncoder::FreeBuffers()
+{
+	if (m_omxEncoder)
+	{
+		m_omxEncoder->FreeOutputBuffers(true);
+	}
+}
+
 void OMXVideoEncoder::Execute()
 {
 	if (m_omxEncoder)
@@ -12,10 +12,26 @@ public:
 
 	void SetFrameInfo(unsigned int width, unsigned int height, unsigned int framerate, OMX_U32 bitrate);
 	void SetBitrate(OMX_U32 bitrate);
+	void SetTargetBitrate(OMX_U32 bitrate);
+	void SetQuantisationLimits(unsigned int minQuant, unsigned int maxQuant);
+	void SetFramerate(unsigned int framerate);
 	void SetOutputFormat(OMX_VIDEO_CODINGTYPE type);
 	void SetAVCProfile( OMX_VIDEO_AVCPROFILETYPE type );
+	void SetIDRPeriod(unsigned int frames);
+	void SetInlineMotionVectors(bool enabled);
+	void SetInlineHeaders(bool enabled);
+	void SetSPSTiming(bool enabled);
+
+	// Low latency output, each buffer holds a single NAL (ending with OMX_BUFFERFLAG_ENDOFNAL)
+	// and the frame is split into slices of the given number of macroblock rows
+	void SetSeparateNALs(bool enabled);
+	void SetSliceRows(unsigned int rows);
+
+	// Asks for the next frame to be an IDR, can be called while encoding
+	bool RequestKeyframe();
 
 	void AllocateBuffers();
+	void FreeBuffers();
 
 	void Execute();
 
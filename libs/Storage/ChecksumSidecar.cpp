@@ -0,0 +1,165 @@
+#include "ChecksumSidecar.h"
+#include "Crc32c.h"
+#include <string.h>
+#include <stdlib.h>
+
+void ChecksumSidecarName(const char* segmentName, char* sidecarName, size_t size)
+{
+	const char* extension = strrchr(segmentName, '.');
+	const char* slash = strrchr(segmentName, '/');
+	int baseLength = ((extension) && ((!slash) || (extension > slash))) ? (int)(extension - segmentName) : (int)strlen(segmentName);
+
+	snprintf(sidecarName, size, "%.*s.crc", baseLength, segmentName);
+}
+
+bool ChecksumSidecarLoad(const char* sidecarName, uint32_t* chunkSize, ChecksumChunk** chunks, unsigned int* chunkCount)
+{
+	*chunks = nullptr;
+	*chunkCount = 0;
+
+	FILE* file = fopen(sidecarName, "r");
+	if (!file)
+		return false;
+
+	char line[128];
+	if ((!fgets(line, sizeof(line), file)) || (sscanf(line, "crc32c %u", chunkSize) != 1))
+	{
+		printf("%s isn't a checksum sidecar\n", sidecarName);
+		fclose(file);
+		return false;
+	}
+
+	unsigned int capacity = 0;
+	while (fgets(line, sizeof(line), file))
+	{
+		unsigned long long offset;
+		unsigned int length, crc;
+
+		// A line cut short by a power cut is as good as no line
+		if ((!strchr(line, '\n')) || (sscanf(line, "%llu %u %x", &offset, &length, &crc) != 3))
+			break;
+
+		if (*chunkCount == capacity)
+		{
+			capacity = (capacity) ? capacity * 2 : 64;
+			ChecksumChunk* grown = (ChecksumChunk*)realloc(*chunks, capacity * sizeof(ChecksumChunk));
+			if (!grown)
+				break;
+			*chunks = grown;
+		}
+
+		ChecksumChunk* chunk = &(*chunks)[(*chunkCount)++];
+		chunk->offset = offset;
+		chunk->length = length;
+		chunk->crc = crc;
+	}
+
+	fclose(file);
+	return true;
+}
+
+ChecksumWriter::ChecksumWriter()
+{
+	m_file = nullptr;
+	m_chunkSize = 0;
+
+	m_chunkOffset = 0;
+	m_chunkUsed = 0;
+	m_crc = 0;
+
+	m_batchUsed = 0;
+	m_batchChunks = 0;
+}
+
+ChecksumWriter::~ChecksumWriter()
+{
+	Close();
+}
+
+bool ChecksumWriter::Open(const char* segmentName, uint32_t chunkSize)
+{
+	Close();
+
+	char sidecarName[255];
+	ChecksumSidecarName(segmentName, sidecarName, sizeof(sidecarName));
+
+	m_file = fopen(sidecarName, "w");
+	if (!m_file)
+	{
+		printf("Failed to create %s\n", sidecarName);
+		return false;
+	}
+
+	fprintf(m_file, "crc32c %u\n", chunkSize);
+
+	m_chunkSize = chunkSize;
+	m_chunkOffset = 0;
+	m_chunkUsed = 0;
+	m_crc = 0;
+	m_batchUsed = 0;
+	m_batchChunks = 0;
+
+	return true;
+}
+
+void ChecksumWriter::Close()
+{
+	if (!m_file)
+		return;
+
+	if (m_chunkUsed)
+		FinishChunk();
+	WriteBatch();
+
+	fclose(m_file);
+	m_file = nullptr;
+}
+
+void ChecksumWriter::Update(const void* data, size_t length)
+{
+	if (!m_file)
+		return;
+
+	const uint8_t* bytes = (const uint8_t*)data;
+	while (length)
+	{
+		size_t piece = m_chunkSize - m_chunkUsed;
+		if (piece > length)
+			piece = length;
+
+		m_crc = Crc32c(m_crc, bytes, piece);
+		m_chunkUsed += piece;
+		bytes += piece;
+		length -= piece;
+
+		if (m_chunkUsed == m_chunkSize)
+			FinishChunk();
+	}
+}
+
+void ChecksumWriter::FinishChunk()
+{
+	m_batchUsed += snprintf(m_batch + m_batchUsed, sizeof(m_batch) - m_batchUsed, "%llu %u %08x\n",
+		(unsigned long long)m_chunkOffset, m_chunkUsed, m_crc);
+	m_batchChunks++;
+
+	m_chunkOffset += m_chunkUsed;
+	m_chunkUsed = 0;
+	m_crc = 0;
+
+	if (m_batchChunks == CHECKSUM_BATCH_CHUNKS)
+		WriteBatch();
+}
+
+void ChecksumWriter::WriteBatch()
+{
+	if (!m_batchUsed)
+		return;
+
+	// One write for the whole batch, the sidecar never holds up the segment for long
+	fwrite(m_batch, 1, m_batchUsed, m_file);
+	fflush(m_file);
+
+	m_batchUsed = 0;
+	m_batchChunks = 0;
+}
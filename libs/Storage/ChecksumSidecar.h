@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *	Checksum sidecar
+ *	A segment's CRC-32C checksums, one per fixed size chunk, in a text file next to it with the
+ *	extension swapped for .crc:
+ *
+ *	  crc32c <chunk size>
+ *	  <offset> <length> <crc in hex>
+ *	  ...
+ *
+ *	A line is only written once its whole chunk has gone into the segment, and the last
+ *	chunk is usually shorter. After a power cut the chunks with a matching checksum are the part of
+ *	the segment that can be trusted, anything past the last line was never checked.
+*/
+
+#define CHECKSUM_DEFAULT_CHUNK (1024 * 1024)
+
+// Lines are gathered and written this many at a time
+#define CHECKSUM_BATCH_CHUNKS 8
+
+struct ChecksumChunk
+{
+	uint64_t offset;
+	uint32_t length;
+	uint32_t crc;
+};
+
+// <name>.h264 becomes <name>.crc
+void ChecksumSidecarName(const char* segmentName, char* sidecarName, size_t size);
+
+// Reads a whole sidecar, the chunks are malloc'd and belong to the caller
+bool ChecksumSidecarLoad(const char* sidecarName, uint32_t* chunkSize, ChecksumChunk** chunks, unsigned int* chunkCount);
+
+class ChecksumWriter
+{
+public:
+	ChecksumWriter();
+	~ChecksumWriter();
+
+	bool Open(const char* segmentName, uint32_t chunkSize);
+
+	// Writes out the last partial chunk
+	void Close();
+
+	// Data as it goes into the segment
+	void Update(const void* data, size_t length);
+
+public:
+	bool IsOpen() const { return m_file != nullptr; }
+
+private:
+	void FinishChunk();
+	void WriteBatch();
+
+private:
+	FILE* m_file;
+	uint32_t m_chunkSize;
+
+	uint64_t m_chunkOffset;
+	uint32_t m_chunkUsed;
+	uint32_t m_crc;
+
+	char m_batch[CHECKSUM_BATCH_CHUNKS * 48];
+	size_t m_batchUsed;
+	unsigned int m_batchChunks;
+};
@@ -0,0 +1,140 @@
+#include "Crc32c.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42
+#endif
+
+// Reflected form of the Castagnoli polynomial 0x1EDC6F41
+#define CRC32C_POLYNOMIAL 0x82F63B78
+
+struct Crc32cTables
+{
+	// table[0] is the plain byte table, table[n] advances a byte's CRC through n more zero bytes
+	uint32_t table[8][256];
+
+	Crc32cTables()
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; bit++)
+				crc = (crc & 1) ? ((crc >> 1) ^ CRC32C_POLYNOMIAL) : (crc >> 1);
+
+			table[0][i] = crc;
+		}
+
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			for (int slice = 1; slice < 8; slice++)
+				table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+		}
+	}
+};
+
+// Built on first use. A function static is only ever initialised once, even when several threads get here together
+static const Crc32cTables& GetTables()
+{
+	static const Crc32cTables tables;
+	return tables;
+}
+
+uint32_t Crc32cTable(uint32_t crc, const void* data, size_t length)
+{
+	const uint32_t (*table)[256] = GetTables().table;
+
+	const uint8_t* bytes = (const uint8_t*)data;
+
+	crc = ~crc;
+
+	// Byte at a time up to an aligned word, the ARM1176 can't load unaligned words in one go
+	while ((length) && ((uintptr_t)bytes & 3))
+	{
+		crc = table[0][(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+		length--;
+	}
+
+	// Slice-by-8, two words per step with no dependency between the eight lookups
+	while (length >= 8)
+	{
+		uint32_t low = *(const uint32_t*)bytes ^ crc;
+		uint32_t high = *(const uint32_t*)(bytes + 4);
+
+		crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+			table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+
+		bytes += 8;
+		length -= 8;
+	}
+
+	while (length--)
+		crc = table[0][(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t Crc32cSse42(uint32_t crc, const void* data, size_t length)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+
+	crc = ~crc;
+
+	while ((length) && ((uintptr_t)bytes & 7))
+	{
+		crc = _mm_crc32_u8(crc, *bytes++);
+		length--;
+	}
+
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+	while (length >= 8)
+	{
+		crc64 = _mm_crc32_u64(crc64, *(const uint64_t*)bytes);
+		bytes += 8;
+		length -= 8;
+	}
+	crc = (uint32_t)crc64;
+#endif
+
+	while (length >= 4)
+	{
+		crc = _mm_crc32_u32(crc, *(const uint32_t*)bytes);
+		bytes += 4;
+		length -= 4;
+	}
+
+	while (length--)
+		crc = _mm_crc32_u8(crc, *bytes++);
+
+	return ~crc;
+}
+
+static bool HaveSse42()
+{
+	static const bool supported = __builtin_cpu_supports("sse4.2");
+	return supported;
+}
+#endif
+
+uint32_t Crc32c(uint32_t crc, const void* data, size_t length)
+{
+#ifdef CRC32C_HAVE_SSE42
+	if (HaveSse42())
+		return Crc32cSse42(crc, data, length);
+#endif
+
+	return Crc32cTable(crc, data, length);
+}
+
+const char* Crc32cImplementation()
+{
+#ifdef CRC32C_HAVE_SSE42
+	if (HaveSse42())
+		return "SSE4.2";
+#endif
+
+	return "slice-by-8";
+}
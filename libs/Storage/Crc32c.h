@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *	CRC-32C (Castagnoli), the checksum used for everything the recorder verifies on the storage.
+ *	Pass the previous result back in to checksum data in pieces, start with 0.
+ *
+ *	The ARM1176 has no CRC instructions, so the Pi uses slice-by-8 tables. On a PC with SSE4.2 the
+ *	crc32 instruction is used instead, checked for at run time. Safe to call from any thread.
+*/
+uint32_t Crc32c(uint32_t crc, const void* data, size_t length);
+
+// Always the table version, to measure what the Pi will do
+uint32_t Crc32cTable(uint32_t crc, const void* data, size_t length);
+
+// Which one Crc32c() uses on this machine
+const char* Crc32cImplementation();
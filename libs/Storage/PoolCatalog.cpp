@@ -0,0 +1,60 @@
+#include "PoolCatalog.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+static const char* g_stateNames[] = { "missing", "writing", "done" };
+
+bool PoolCatalogRead(int catalog, unsigned int index, PoolEntry* entry)
+{
+	char line[POOL_LINE_SIZE + 1];
+	if (pread(catalog, line, POOL_LINE_SIZE, (off_t)index * POOL_LINE_SIZE) != POOL_LINE_SIZE)
+		return false;
+	line[POOL_LINE_SIZE] = 0;
+
+	memset(entry, 0, sizeof(PoolEntry));
+	entry->state = POOL_ENTRY_MISSING;
+
+	unsigned int id, protect;
+	char state[16];
+	unsigned long long sequence, length, dirty;
+	if (sscanf(line, "%u %15s %u %llu %llu %llu %95s", &id, state, &protect, &sequence, &length, &dirty, entry->path) != 7)
+	{
+		entry->path[0] = 0;
+		return true;
+	}
+
+	for (unsigned int i = 0; i < sizeof(g_stateNames) / sizeof(g_stateNames[0]); i++)
+	{
+		if (strcmp(state, g_stateNames[i]) == 0)
+			entry->state = i;
+	}
+
+	entry->protect = protect != 0;
+	entry->sequence = sequence;
+	entry->length = length;
+	entry->dirty = dirty;
+	return true;
+}
+
+bool PoolCatalogWrite(int catalog, unsigned int index, const PoolEntry* entry)
+{
+	char line[POOL_LINE_SIZE + 1];
+	int length = snprintf(line, sizeof(line), "%6u %-7s %u %10llu %12llu %12llu %s", index, g_stateNames[entry->state],
+		entry->protect ? 1 : 0, (unsigned long long)entry->sequence, (unsigned long long)entry->length,
+		(unsigned long long)entry->dirty, entry->path);
+
+	if ((length < 0) || (length >= POOL_LINE_SIZE))
+		length = POOL_LINE_SIZE - 1;
+	memset(line + length, ' ', POOL_LINE_SIZE - 1 - length);
+	line[POOL_LINE_SIZE - 1] = '\n';
+
+	if (pwrite(catalog, line, POOL_LINE_SIZE, (off_t)index * POOL_LINE_SIZE) != POOL_LINE_SIZE)
+	{
+		printf("Failed to update the segment pool catalog: %s\n", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
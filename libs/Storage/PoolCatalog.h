@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *	Pool catalog
+ *	The segment pool's record of its files, segmentpool.txt in the recordings directory. Every
+ *	line is the same size so an entry is updated in place and the catalog never moves:
+ *
+ *	  <id> <missing|writing|done> <protect> <sequence> <length> <dirty> <path>
+ *
+ *	length is how much of the file is the current recording, dirty how far old footage may still
+ *	reach past it. The recorder keeps the catalog, recovery reads it to tell a recycled file's
+ *	new recording from the old one it overwrote.
+*/
+
+#define POOL_CATALOG_FILE "segmentpool.txt"
+#define POOL_LINE_SIZE 128
+
+enum PoolEntryState
+{
+	POOL_ENTRY_MISSING,
+	POOL_ENTRY_WRITING,
+	POOL_ENTRY_DONE
+};
+
+struct PoolEntry
+{
+	// Relative to the recordings directory
+	char path[96];
+	unsigned int state;
+	bool protect;
+	// Order the files were handed out in, the lowest is the oldest
+	uint64_t sequence;
+	// The current recording and the end of whatever may still be left after it
+	uint64_t length;
+	uint64_t dirty;
+};
+
+// Reads line index, false past the end. A line that doesn't parse is a missing entry
+bool PoolCatalogRead(int catalog, unsigned int index, PoolEntry* entry);
+
+bool PoolCatalogWrite(int catalog, unsigned int index, const PoolEntry* entry);
@@ -0,0 +1,144 @@
+#include "RawLog.h"
+#include "Crc32c.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+static uint64_t AlignUp(uint64_t value)
+{
+	return (value + RAWLOG_ALIGNMENT - 1) & ~(uint64_t)(RAWLOG_ALIGNMENT - 1);
+}
+
+bool RawLogGetDeviceSize(int fd, uint64_t* size)
+{
+	struct stat sb;
+	if (fstat(fd, &sb) != 0)
+		return false;
+
+	if (S_ISBLK(sb.st_mode))
+		return ioctl(fd, BLKGETSIZE64, size) == 0;
+
+	*size = sb.st_size;
+	return true;
+}
+
+bool RawLogFormat(int fd, uint32_t extentSize)
+{
+	if ((!extentSize) || (extentSize % RAWLOG_ALIGNMENT))
+	{
+		printf("Extent size must be a multiple of %u\n", RAWLOG_ALIGNMENT);
+		return false;
+	}
+
+	uint64_t size;
+	if (!RawLogGetDeviceSize(fd, &size))
+	{
+		printf("Failed to get the device size: %s\n", strerror(errno));
+		return false;
+	}
+
+	// Every extent costs an index entry as well
+	uint64_t extentCount = (size - RAWLOG_ALIGNMENT) / (extentSize + sizeof(RawLogIndexEntry));
+	while ((extentCount) && (RAWLOG_ALIGNMENT + AlignUp(extentCount * sizeof(RawLogIndexEntry)) + extentCount * extentSize > size))
+		extentCount--;
+
+	if (extentCount < RAWLOG_MIN_EXTENTS)
+	{
+		printf("Device is too small for %u extents of %u bytes\n", RAWLOG_MIN_EXTENTS, extentSize);
+		return false;
+	}
+
+	if (extentCount > 0xFFFFFFFF)
+		extentCount = 0xFFFFFFFF;
+
+	RawLogSuperblock superblock;
+	memset(&superblock, 0, sizeof(superblock));
+	memcpy(superblock.magic, RAWLOG_MAGIC, sizeof(superblock.magic));
+	superblock.version = RAWLOG_VERSION;
+	superblock.extentSize = extentSize;
+	superblock.extentCount = (uint32_t)extentCount;
+	superblock.indexOffset = RAWLOG_ALIGNMENT;
+	superblock.dataOffset = RAWLOG_ALIGNMENT + AlignUp(extentCount * sizeof(RawLogIndexEntry));
+	superblock.created = time(0);
+	superblock.crc = RawLogSuperblockCrc(&superblock);
+
+	// An empty index is all it takes, the old extent headers won't match any sequence in it.
+	// Their magic is cleared as well so a scan can't pick up a previous log's extents
+	uint8_t* block = (uint8_t*)calloc(1, RAWLOG_ALIGNMENT);
+	if (!block)
+		return false;
+
+	bool success = true;
+	for (uint64_t offset = superblock.indexOffset; (offset < superblock.dataOffset) && (success); offset += RAWLOG_ALIGNMENT)
+		success = pwrite(fd, block, RAWLOG_ALIGNMENT, offset) == RAWLOG_ALIGNMENT;
+
+	for (uint32_t slot = 0; (slot < superblock.extentCount) && (success); slot++)
+		success = pwrite(fd, block, sizeof(RawLogExtentHeader), RawLogExtentOffset(&superblock, slot)) == sizeof(RawLogExtentHeader);
+
+	// The superblock goes last, a format that didn't finish doesn't leave a valid log behind
+	if (success)
+	{
+		memcpy(block, &superblock, sizeof(superblock));
+		success = (pwrite(fd, block, RAWLOG_ALIGNMENT, 0) == RAWLOG_ALIGNMENT) && (fdatasync(fd) == 0);
+	}
+
+	free(block);
+
+	if (!success)
+	{
+		printf("Failed to write the log: %s\n", strerror(errno));
+		return false;
+	}
+
+	printf("Formatted %u extents of %u bytes, %llu MB of data\n", superblock.extentCount, superblock.extentSize,
+		(unsigned long long)superblock.extentCount * superblock.extentSize / (1024 * 1024));
+	return true;
+}
+
+bool RawLogReadSuperblock(int fd, RawLogSuperblock* superblock)
+{
+	if (pread(fd, superblock, sizeof(*superblock), 0) != sizeof(*superblock))
+		return false;
+
+	if (memcmp(superblock->magic, RAWLOG_MAGIC, sizeof(superblock->magic)))
+	{
+		printf("Not a raw log, format it first\n");
+		return false;
+	}
+
+	if ((superblock->crc != RawLogSuperblockCrc(superblock)) || (superblock->version != RAWLOG_VERSION) ||
+		(!superblock->extentSize) || (superblock->extentCount < RAWLOG_MIN_EXTENTS))
+	{
+		printf("Raw log superblock is damaged or from a different version\n");
+		return false;
+	}
+
+	return true;
+}
+
+uint32_t RawLogSuperblockCrc(const RawLogSuperblock* superblock)
+{
+	RawLogSuperblock copy = *superblock;
+	copy.crc = 0;
+	return Crc32c(0, &copy, sizeof(copy));
+}
+
+uint32_t RawLogIndexEntryCrc(const RawLogIndexEntry* entry)
+{
+	RawLogIndexEntry copy = *entry;
+	copy.crc = 0;
+	return Crc32c(0, &copy, sizeof(copy));
+}
+
+uint32_t RawLogExtentHeaderCrc(const RawLogExtentHeader* header)
+{
+	RawLogExtentHeader copy = *header;
+	copy.headerCrc = 0;
+	return Crc32c(0, &copy, sizeof(copy));
+}
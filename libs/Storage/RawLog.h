@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *	Raw log
+ *	On-disk format for recording straight onto a partition (or a file standing in for one),
+ *	without a filesystem. The device is a superblock, an index and a ring of fixed size extents:
+ *
+ *	  | superblock | index: one entry per extent | extent 0 | extent 1 | ... | extent n-1 |
+ *
+ *	Extents are written whole, in order of their sequence number, and sequence s always goes into
+ *	slot (s - 1) % extentCount so the oldest extent is recycled once the ring is full. Each extent
+ *	starts with a header carrying its sequence, time span and checksums, followed by records of the
+ *	stream data. The index is only a copy of the headers so a reader doesn't have to visit every
+ *	extent, when the two disagree the extent header wins.
+ *
+ *	Everything is little endian, as both the Pi and a PC are, and times are wall clock microseconds.
+*/
+
+#define RAWLOG_MAGIC "DASHRAWL"
+#define RAWLOG_VERSION 1
+
+// Superblock, index and extents all start on a boundary of this
+#define RAWLOG_ALIGNMENT 4096
+#define RAWLOG_DEFAULT_EXTENT_SIZE (1024 * 1024)
+#define RAWLOG_MIN_EXTENTS 4
+
+#define RAWLOG_EXTENT_MAGIC 0x31545845
+
+// Extent flags
+#define RAWLOG_EXTENT_KEYFRAME 0x1
+
+// Record flags
+#define RAWLOG_RECORD_CONFIG 0x1
+#define RAWLOG_RECORD_KEYFRAME 0x2
+#define RAWLOG_RECORD_FRAME_END 0x4
+// The record carries on from the end of the previous extent
+#define RAWLOG_RECORD_CONTINUED 0x8
+
+struct RawLogSuperblock
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t extentSize;
+	uint32_t extentCount;
+	uint32_t reserved;
+	uint64_t indexOffset;
+	uint64_t dataOffset;
+	uint64_t created;
+	uint32_t crc;
+	uint32_t padding;
+};
+
+struct RawLogIndexEntry
+{
+	// 0 for a slot that has never been written
+	uint64_t sequence;
+	uint64_t firstTime;
+	uint64_t lastTime;
+	uint32_t flags;
+	uint32_t crc;
+};
+
+struct RawLogExtentHeader
+{
+	uint32_t magic;
+	uint32_t flags;
+	uint64_t sequence;
+	uint64_t firstTime;
+	uint64_t lastTime;
+	// Bytes of records following the header
+	uint32_t used;
+	uint32_t payloadCrc;
+	uint32_t headerCrc;
+	uint32_t reserved;
+};
+
+struct RawLogRecord
+{
+	uint32_t length;
+	uint32_t flags;
+	uint64_t time;
+};
+
+// Size of a file or block device
+bool RawLogGetDeviceSize(int fd, uint64_t* size);
+
+// Lays out an empty log over the whole device, extentSize must be a multiple of RAWLOG_ALIGNMENT
+bool RawLogFormat(int fd, uint32_t extentSize);
+
+bool RawLogReadSuperblock(int fd, RawLogSuperblock* superblock);
+
+// Checksums, computed with the crc field itself zeroed
+uint32_t RawLogSuperblockCrc(const RawLogSuperblock* superblock);
+uint32_t RawLogIndexEntryCrc(const RawLogIndexEntry* entry);
+uint32_t RawLogExtentHeaderCrc(const RawLogExtentHeader* header);
+
+// Records start on an 8 byte boundary, the ARMv6 can't load a misaligned 64 bit time
+static inline size_t RawLogRecordPadding(size_t length)
+{
+	return (length + 7) & ~(size_t)7;
+}
+
+// Slot of the extent with the given sequence
+static inline uint32_t RawLogSlot(const RawLogSuperblock* superblock, uint64_t sequence)
+{
+	return (uint32_t)((sequence - 1) % superblock->extentCount);
+}
+
+static inline uint64_t RawLogExtentOffset(const RawLogSuperblock* superblock, uint32_t slot)
+{
+	return superblock->dataOffset + (uint64_t)slot * superblock->extentSize;
+}
@@ -0,0 +1,198 @@
+#include "RawLogReader.h"
+#include "Crc32c.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+static int CompareSequence(const void* a, const void* b)
+{
+	uint64_t first = ((const RawLogIndexEntry*)a)->sequence;
+	uint64_t second = ((const RawLogIndexEntry*)b)->sequence;
+	return (first < second) ? -1 : ((first > second) ? 1 : 0);
+}
+
+RawLogReader::RawLogReader()
+{
+	m_fd = -1;
+	memset(&m_superblock, 0, sizeof(m_superblock));
+
+	m_extents = nullptr;
+	m_extentCount = 0;
+	m_damaged = 0;
+
+	m_buffer = nullptr;
+	m_bufferUsed = 0;
+	m_position = 0;
+}
+
+RawLogReader::~RawLogReader()
+{
+	Close();
+}
+
+bool RawLogReader::Open(const char* device)
+{
+	Close();
+
+	m_fd = open(device, O_RDONLY);
+	if (m_fd < 0)
+	{
+		printf("Failed to open %s: %s\n", device, strerror(errno));
+		return false;
+	}
+
+	if ((!RawLogReadSuperblock(m_fd, &m_superblock)) || (!LoadIndex()))
+	{
+		Close();
+		return false;
+	}
+
+	m_buffer = (uint8_t*)malloc(m_superblock.extentSize);
+	if (!m_buffer)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void RawLogReader::Close()
+{
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+
+	free(m_extents);
+	m_extents = nullptr;
+	m_extentCount = 0;
+	m_damaged = 0;
+
+	free(m_buffer);
+	m_buffer = nullptr;
+	m_bufferUsed = 0;
+	m_position = 0;
+}
+
+bool RawLogReader::LoadIndex()
+{
+	size_t indexSize = (size_t)m_superblock.extentCount * sizeof(RawLogIndexEntry);
+	m_extents = (RawLogIndexEntry*)malloc(indexSize);
+	if (!m_extents)
+		return false;
+
+	if (pread(m_fd, m_extents, indexSize, m_superblock.indexOffset) != (ssize_t)indexSize)
+	{
+		printf("Failed to read the raw log index: %s\n", strerror(errno));
+		return false;
+	}
+
+	// Keep the written entries, packed at the front
+	uint64_t newest = 0;
+	for (uint32_t i = 0; i < m_superblock.extentCount; i++)
+	{
+		if ((!m_extents[i].sequence) || (m_extents[i].crc != RawLogIndexEntryCrc(&m_extents[i])))
+			continue;
+
+		if (m_extents[i].sequence > newest)
+			newest = m_extents[i].sequence;
+
+		m_extents[m_extentCount++] = m_extents[i];
+	}
+
+	// Extents written after the last index update, the writer carries on after these too
+	for (uint32_t probe = 0; probe < m_superblock.extentCount; probe++)
+	{
+		RawLogExtentHeader header;
+		if (pread(m_fd, &header, sizeof(header), RawLogExtentOffset(&m_superblock, RawLogSlot(&m_superblock, newest + 1))) != sizeof(header))
+			break;
+
+		if ((header.magic != RAWLOG_EXTENT_MAGIC) || (header.sequence != newest + 1) || (header.headerCrc != RawLogExtentHeaderCrc(&header)))
+			break;
+
+		// Its slot held an older extent which is gone now
+		for (unsigned int i = 0; i < m_extentCount; i++)
+		{
+			if (RawLogSlot(&m_superblock, m_extents[i].sequence) == RawLogSlot(&m_superblock, header.sequence))
+			{
+				m_extents[i] = m_extents[--m_extentCount];
+				break;
+			}
+		}
+
+		RawLogIndexEntry* entry = &m_extents[m_extentCount++];
+		entry->sequence = header.sequence;
+		entry->firstTime = header.firstTime;
+		entry->lastTime = header.lastTime;
+		entry->flags = header.flags;
+		entry->crc = RawLogIndexEntryCrc(entry);
+
+		newest++;
+	}
+
+	qsort(m_extents, m_extentCount, sizeof(RawLogIndexEntry), CompareSequence);
+	return true;
+}
+
+unsigned int RawLogReader::FindExtent(uint64_t time) const
+{
+	// Extents are in recording order, so the times only go backwards if the clock was set
+	for (unsigned int i = 0; i < m_extentCount; i++)
+	{
+		if (m_extents[i].lastTime >= time)
+			return i;
+	}
+
+	return m_extentCount;
+}
+
+bool RawLogReader::ReadExtent(unsigned int extent)
+{
+	m_bufferUsed = 0;
+	m_position = 0;
+
+	if (extent >= m_extentCount)
+		return false;
+
+	const RawLogIndexEntry* entry = &m_extents[extent];
+	uint64_t offset = RawLogExtentOffset(&m_superblock, RawLogSlot(&m_superblock, entry->sequence));
+
+	const RawLogExtentHeader* header = (const RawLogExtentHeader*)m_buffer;
+	bool valid = pread(m_fd, m_buffer, sizeof(RawLogExtentHeader), offset) == sizeof(RawLogExtentHeader);
+	valid = (valid) && (header->magic == RAWLOG_EXTENT_MAGIC) && (header->sequence == entry->sequence) &&
+		(header->headerCrc == RawLogExtentHeaderCrc(header)) && (header->used <= m_superblock.extentSize - sizeof(RawLogExtentHeader));
+
+	if (valid)
+	{
+		size_t size = sizeof(RawLogExtentHeader) + header->used;
+		valid = (pread(m_fd, m_buffer, size, offset) == (ssize_t)size) && (header->payloadCrc == Crc32c(0, m_buffer + sizeof(RawLogExtentHeader), header->used));
+	}
+
+	if (!valid)
+	{
+		printf("Extent %llu is damaged, skipping it\n", (unsigned long long)entry->sequence);
+		m_damaged++;
+		return false;
+	}
+
+	m_bufferUsed = sizeof(RawLogExtentHeader) + header->used;
+	m_position = sizeof(RawLogExtentHeader);
+	return true;
+}
+
+const RawLogRecord* RawLogReader::NextRecord(const uint8_t** data)
+{
+	if (m_position + sizeof(RawLogRecord) > m_bufferUsed)
+		return nullptr;
+
+	const RawLogRecord* record = (const RawLogRecord*)(m_buffer + m_position);
+	if (record->length > m_bufferUsed - m_position - sizeof(RawLogRecord))
+		return nullptr;
+
+	*data = (const uint8_t*)(record + 1);
+	m_position += sizeof(RawLogRecord) + RawLogRecordPadding(record->length);
+	return record;
+}
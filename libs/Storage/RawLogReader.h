@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "RawLog.h"
+
+/*
+ *	RawLogReader
+ *	Finds the extents of a raw log from its index, oldest first, and reads them back one at a time.
+ *	An extent is only handed out once its header matches the index and its payload checksum is
+ *	good, anything else (an extent torn by a power cut, or a slot recycled after the index entry
+ *	was written) is counted as damaged and skipped.
+*/
+class RawLogReader
+{
+public:
+	RawLogReader();
+	~RawLogReader();
+
+	bool Open(const char* device);
+	void Close();
+
+	// Index of the first extent ending at or after the given time, GetExtentCount() if there is none
+	unsigned int FindExtent(uint64_t time) const;
+
+	// Reads and verifies an extent, its records can then be walked with NextRecord()
+	bool ReadExtent(unsigned int extent);
+
+	// Returns nullptr once the extent has no records left
+	const RawLogRecord* NextRecord(const uint8_t** data);
+
+public:
+	const RawLogSuperblock* GetSuperblock() const { return &m_superblock; }
+	unsigned int GetExtentCount() const { return m_extentCount; }
+	const RawLogIndexEntry* GetExtent(unsigned int extent) const { return &m_extents[extent]; }
+	unsigned int GetDamaged() const { return m_damaged; }
+
+private:
+	bool LoadIndex();
+
+private:
+	int m_fd;
+	RawLogSuperblock m_superblock;
+
+	// Written extents sorted by sequence
+	RawLogIndexEntry* m_extents;
+	unsigned int m_extentCount;
+	unsigned int m_damaged;
+
+	uint8_t* m_buffer;
+	size_t m_bufferUsed;
+	size_t m_position;
+};
@@ -0,0 +1,285 @@
+#include "RawLogWriter.h"
+#include "Crc32c.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+static uint64_t GetMonotonicTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+RawLogWriter::RawLogWriter()
+{
+	m_fd = -1;
+	memset(&m_superblock, 0, sizeof(m_superblock));
+
+	m_extent = nullptr;
+	m_header = nullptr;
+	m_used = 0;
+	m_sequence = 0;
+
+	m_behindOffset = 0;
+	m_behindLength = 0;
+	m_behindTime = 0;
+
+	m_statBytes = 0;
+	m_statWriteTime = 0;
+	m_statMaxLatency = 0;
+
+	m_totalExtents = 0;
+	m_recycled = 0;
+	m_failures = 0;
+}
+
+RawLogWriter::~RawLogWriter()
+{
+	Close();
+}
+
+bool RawLogWriter::Open(const char* device)
+{
+	Close();
+
+	m_fd = open(device, O_RDWR);
+	if (m_fd < 0)
+	{
+		printf("Failed to open %s: %s\n", device, strerror(errno));
+		return false;
+	}
+
+	if ((!RawLogReadSuperblock(m_fd, &m_superblock)) || (!FindHead()))
+	{
+		close(m_fd);
+		m_fd = -1;
+		return false;
+	}
+
+	m_extent = (uint8_t*)calloc(1, m_superblock.extentSize);
+	if (!m_extent)
+	{
+		close(m_fd);
+		m_fd = -1;
+		return false;
+	}
+
+	m_header = (RawLogExtentHeader*)m_extent;
+	m_used = 0;
+
+	printf("Raw log %s: %u extents of %u bytes, carrying on at extent %llu\n", device, m_superblock.extentCount,
+		m_superblock.extentSize, (unsigned long long)m_sequence);
+	return true;
+}
+
+void RawLogWriter::Close()
+{
+	if (m_fd < 0)
+		return;
+
+	Flush();
+	fdatasync(m_fd);
+	close(m_fd);
+	m_fd = -1;
+	m_behindLength = 0;
+
+	free(m_extent);
+	m_extent = nullptr;
+	m_header = nullptr;
+}
+
+bool RawLogWriter::FindHead()
+{
+	size_t indexSize = (size_t)m_superblock.extentCount * sizeof(RawLogIndexEntry);
+	RawLogIndexEntry* index = (RawLogIndexEntry*)malloc(indexSize);
+	if (!index)
+		return false;
+
+	if (pread(m_fd, index, indexSize, m_superblock.indexOffset) != (ssize_t)indexSize)
+	{
+		printf("Failed to read the raw log index: %s\n", strerror(errno));
+		free(index);
+		return false;
+	}
+
+	uint64_t newest = 0;
+	for (uint32_t i = 0; i < m_superblock.extentCount; i++)
+	{
+		if ((index[i].sequence > newest) && (index[i].crc == RawLogIndexEntryCrc(&index[i])))
+			newest = index[i].sequence;
+	}
+
+	free(index);
+
+	// Extents whose index entry didn't make it before the power went
+	for (uint32_t i = 0; i < m_superblock.extentCount; i++)
+	{
+		RawLogExtentHeader header;
+		if (pread(m_fd, &header, sizeof(header), RawLogExtentOffset(&m_superblock, RawLogSlot(&m_superblock, newest + 1))) != sizeof(header))
+			break;
+
+		if ((header.magic != RAWLOG_EXTENT_MAGIC) || (header.sequence != newest + 1) || (header.headerCrc != RawLogExtentHeaderCrc(&header)))
+			break;
+
+		newest++;
+	}
+
+	m_sequence = newest + 1;
+	return true;
+}
+
+bool RawLogWriter::Write(const uint8_t* data, size_t length, uint32_t flags, uint64_t time)
+{
+	if (m_fd < 0)
+		return false;
+
+	size_t capacity = m_superblock.extentSize - sizeof(RawLogExtentHeader);
+	bool continued = false;
+
+	// A buffer that doesn't fit is split, each extent has to stand on its own
+	while (length)
+	{
+		if (m_used + sizeof(RawLogRecord) >= capacity)
+		{
+			if (!Flush())
+				return false;
+			continue;
+		}
+
+		size_t piece = (capacity - m_used - sizeof(RawLogRecord)) & ~(size_t)7;
+		if (piece > length)
+			piece = length;
+
+		RawLogRecord* record = (RawLogRecord*)(m_extent + sizeof(RawLogExtentHeader) + m_used);
+		record->length = piece;
+		record->flags = flags;
+		record->time = time;
+
+		if (continued)
+			record->flags |= RAWLOG_RECORD_CONTINUED;
+		if (piece < length)
+			record->flags &= ~RAWLOG_RECORD_FRAME_END;
+
+		memcpy(record + 1, data, piece);
+		memset((uint8_t*)(record + 1) + piece, 0, RawLogRecordPadding(piece) - piece);
+
+		if (!m_used)
+			m_header->firstTime = time;
+		m_header->lastTime = time;
+
+		if ((flags & RAWLOG_RECORD_KEYFRAME) && (!continued))
+			m_header->flags |= RAWLOG_EXTENT_KEYFRAME;
+
+		m_used += sizeof(RawLogRecord) + RawLogRecordPadding(piece);
+		data += piece;
+		length -= piece;
+		continued = true;
+	}
+
+	return true;
+}
+
+bool RawLogWriter::Flush()
+{
+	if ((m_fd < 0) || (!m_used))
+		return true;
+
+	m_header->magic = RAWLOG_EXTENT_MAGIC;
+	m_header->sequence = m_sequence;
+	m_header->used = m_used;
+	m_header->payloadCrc = Crc32c(0, m_extent + sizeof(RawLogExtentHeader), m_used);
+	m_header->reserved = 0;
+	m_header->headerCrc = RawLogExtentHeaderCrc(m_header);
+
+	// Only whole blocks are written, the unused tail of the extent is left alone
+	size_t size = sizeof(RawLogExtentHeader) + m_used;
+	size_t aligned = (size + RAWLOG_ALIGNMENT - 1) & ~(size_t)(RAWLOG_ALIGNMENT - 1);
+	if (aligned > m_superblock.extentSize)
+		aligned = m_superblock.extentSize;
+	memset(m_extent + size, 0, aligned - size);
+
+	uint32_t slot = RawLogSlot(&m_superblock, m_sequence);
+
+	uint64_t offset = RawLogExtentOffset(&m_superblock, slot);
+	uint64_t writeStart = GetMonotonicTime();
+	bool success = pwrite(m_fd, m_extent, aligned, offset) == (ssize_t)aligned;
+
+	if (success)
+	{
+		RawLogIndexEntry entry;
+		entry.sequence = m_sequence;
+		entry.firstTime = m_header->firstTime;
+		entry.lastTime = m_header->lastTime;
+		entry.flags = m_header->flags;
+		entry.crc = RawLogIndexEntryCrc(&entry);
+
+		success = pwrite(m_fd, &entry, sizeof(entry), m_superblock.indexOffset + (uint64_t)slot * sizeof(entry)) == sizeof(entry);
+	}
+
+	// The device had nothing else of ours to write since the last extent was started, so if it's still busy
+	// with it the time since then is how long it takes over an extent
+	if ((success) && (m_behindLength))
+	{
+		uint64_t waitStart = GetMonotonicTime();
+		sync_file_range(m_fd, m_behindOffset, m_behindLength, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+
+		uint64_t now = GetMonotonicTime();
+		if (now - waitStart >= RAWLOG_WAIT_BLOCKED)
+		{
+			m_statBytes += m_behindLength;
+			m_statWriteTime += now - m_behindTime;
+		}
+	}
+
+	if (success)
+	{
+		sync_file_range(m_fd, offset, aligned, SYNC_FILE_RANGE_WRITE);
+		m_behindOffset = offset;
+		m_behindLength = aligned;
+		m_behindTime = GetMonotonicTime();
+	}
+	uint64_t writeTime = GetMonotonicTime() - writeStart;
+
+	if (!success)
+	{
+		if (!m_failures)
+			printf("Failed to write raw log extent %llu: %s\n", (unsigned long long)m_sequence, strerror(errno));
+		m_failures++;
+		return false;
+	}
+
+	if (writeTime > m_statMaxLatency)
+		m_statMaxLatency = writeTime;
+
+	if (m_sequence > m_superblock.extentCount)
+		m_recycled++;
+	m_totalExtents++;
+
+	m_sequence++;
+	m_used = 0;
+	memset(m_header, 0, sizeof(RawLogExtentHeader));
+
+	return true;
+}
+
+void RawLogWriter::TakeWriteStats(uint64_t* bytes, uint64_t* writeTime, uint64_t* maxLatency)
+{
+	*bytes = m_statBytes;
+	*writeTime = m_statWriteTime;
+	*maxLatency = m_statMaxLatency;
+
+	m_statBytes = 0;
+	m_statWriteTime = 0;
+	m_statMaxLatency = 0;
+}
+
+void RawLogWriter::PrintStats()
+{
+	printf("Raw log: %llu extents written, %llu of them recycled the oldest, %llu failed writes\n",
+		(unsigned long long)m_totalExtents, (unsigned long long)m_recycled, (unsigned long long)m_failures);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "RawLog.h"
+
+/*
+ *	RawLogWriter
+ *	Appends a stream to a raw log. Records are gathered in a RAM copy of the current extent, which
+ *	goes to the device in a single write once it is full, followed by its index entry. Nothing is
+ *	ever allocated on the device, so there are no filesystem tables to update and nothing that can
+ *	be left half updated by a power cut: at worst the extent being written fails its checksum.
+ *
+ *	On Open() the log carries on after the newest extent, whether the index knows about it or
+ *	only its header made it to the device.
+ *
+ *	Each extent is started on its way to the device as soon as it's written, and the one before it
+ *	waited for, so no more than an extent sits in the page cache and the write stats are the
+ *	device's rather than the cache's.
+*/
+
+// A wait for the device shorter than this means it had already written the extent
+#define RAWLOG_WAIT_BLOCKED 1000
+class RawLogWriter
+{
+public:
+	RawLogWriter();
+	~RawLogWriter();
+
+	bool Open(const char* device);
+	void Close();
+
+	// time is wall clock microseconds, flags are RAWLOG_RECORD_*
+	bool Write(const uint8_t* data, size_t length, uint32_t flags, uint64_t time);
+
+	// Writes out the partly filled extent, the next write starts a new one
+	bool Flush();
+
+	// Bytes the device was seen to write and how long it took over them, and the slowest single write since the last call
+	void TakeWriteStats(uint64_t* bytes, uint64_t* writeTime, uint64_t* maxLatency);
+
+	void PrintStats();
+
+public:
+	bool IsOpen() const { return m_fd >= 0; }
+	uint64_t GetSequence() const { return m_sequence; }
+	const RawLogSuperblock* GetSuperblock() const { return &m_superblock; }
+
+private:
+	bool FindHead();
+
+private:
+	int m_fd;
+	RawLogSuperblock m_superblock;
+
+	// The extent being filled, header included
+	uint8_t* m_extent;
+	RawLogExtentHeader* m_header;
+	size_t m_used;
+	uint64_t m_sequence;
+
+	// The extent being written out, from when it was started
+	uint64_t m_behindOffset;
+	uint64_t m_behindLength;
+	uint64_t m_behindTime;
+
+	uint64_t m_statBytes;
+	uint64_t m_statWriteTime;
+	uint64_t m_statMaxLatency;
+
+	uint64_t m_totalExtents;
+	uint64_t m_recycled;
+	uint64_t m_failures;
+};
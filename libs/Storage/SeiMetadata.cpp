@@ -0,0 +1,114 @@
+#include "SeiMetadata.h"
+#include <string.h>
+
+#define SEI_NAL_HEADER 0x06
+#define SEI_USER_DATA_UNREGISTERED 5
+#define SEI_RBSP_TRAILING 0x80
+
+size_t SeiMetadataBuild(const char* text, uint8_t* nal, size_t size)
+{
+	size_t textLength = strlen(text);
+	if (textLength > SEI_METADATA_MAX_TEXT)
+		return 0;
+
+	// SEI message before escaping: type, size in 255s, UUID, text, stop bit
+	uint8_t rbsp[SEI_METADATA_MAX_TEXT + SEI_METADATA_UUID_SIZE + 8];
+	size_t rbspLength = 0;
+	size_t payloadSize = SEI_METADATA_UUID_SIZE + textLength;
+
+	rbsp[rbspLength++] = SEI_USER_DATA_UNREGISTERED;
+	for (; payloadSize >= 255; payloadSize -= 255)
+		rbsp[rbspLength++] = 0xff;
+	rbsp[rbspLength++] = (uint8_t)payloadSize;
+	memcpy(rbsp + rbspLength, SEI_METADATA_UUID, SEI_METADATA_UUID_SIZE);
+	rbspLength += SEI_METADATA_UUID_SIZE;
+	memcpy(rbsp + rbspLength, text, textLength);
+	rbspLength += textLength;
+	rbsp[rbspLength++] = SEI_RBSP_TRAILING;
+
+	// Start code and header, then the payload with emulation prevention bytes wherever two zeros would run into a 0-3
+	if (size < 5 + rbspLength + rbspLength / 2)
+		return 0;
+
+	size_t length = 0;
+	nal[length++] = 0;
+	nal[length++] = 0;
+	nal[length++] = 0;
+	nal[length++] = 1;
+	nal[length++] = SEI_NAL_HEADER;
+
+	unsigned int zeros = 0;
+	for (size_t i = 0; i < rbspLength; i++)
+	{
+		if ((zeros == 2) && (rbsp[i] <= 3))
+		{
+			nal[length++] = 3;
+			zeros = 0;
+		}
+
+		nal[length++] = rbsp[i];
+		zeros = (rbsp[i] == 0) ? zeros + 1 : 0;
+	}
+
+	return length;
+}
+
+bool SeiMetadataParse(const uint8_t* nal, size_t length, char* text, size_t size)
+{
+	if ((length < 2) || ((nal[0] & 0x1f) != SEI_NAL_HEADER))
+		return false;
+
+	// Take the emulation prevention bytes back out, only as far as a metadata SEI can go
+	uint8_t rbsp[SEI_METADATA_MAX_NAL];
+	size_t rbspLength = 0;
+	unsigned int zeros = 0;
+	for (size_t i = 1; (i < length) && (rbspLength < sizeof(rbsp)); i++)
+	{
+		if ((zeros == 2) && (nal[i] == 3))
+		{
+			zeros = 0;
+			continue;
+		}
+
+		rbsp[rbspLength++] = nal[i];
+		zeros = (nal[i] == 0) ? zeros + 1 : 0;
+	}
+
+	// One or more messages, each with its type and size coded in 255s
+	size_t offset = 0;
+	while ((offset < rbspLength) && (rbsp[offset] != SEI_RBSP_TRAILING))
+	{
+		unsigned int type = 0;
+		while ((offset < rbspLength) && (rbsp[offset] == 0xff))
+			type += rbsp[offset++];
+		if (offset == rbspLength)
+			return false;
+		type += rbsp[offset++];
+
+		size_t payloadSize = 0;
+		while ((offset < rbspLength) && (rbsp[offset] == 0xff))
+			payloadSize += rbsp[offset++];
+		if (offset == rbspLength)
+			return false;
+		payloadSize += rbsp[offset++];
+
+		if (offset + payloadSize > rbspLength)
+			return false;
+
+		if ((type == SEI_USER_DATA_UNREGISTERED) && (payloadSize >= SEI_METADATA_UUID_SIZE) &&
+			(memcmp(rbsp + offset, SEI_METADATA_UUID, SEI_METADATA_UUID_SIZE) == 0))
+		{
+			size_t textLength = payloadSize - SEI_METADATA_UUID_SIZE;
+			if (textLength > size - 1)
+				textLength = size - 1;
+
+			memcpy(text, rbsp + offset + SEI_METADATA_UUID_SIZE, textLength);
+			text[textLength] = 0;
+			return true;
+		}
+
+		offset += payloadSize;
+	}
+
+	return false;
+}
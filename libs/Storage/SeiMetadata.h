@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *	SEI metadata
+ *	Text the recorder puts in the stream itself, as an H.264 SEI user_data_unregistered message
+ *	in front of the frames, so a segment still says when and where it was recorded once it has
+ *	been copied away from its sidecars. Decoders skip it, and ffprobe/strings show it as is.
+ *	The message is told apart from anyone else's by its UUID, which reads DashPiMetadata01.
+ *
+ *	The text is space separated key=value pairs, for example:
+ *	  dashpi=1a2b3c4 time=1464343201.250 gps=51.507220,-0.127500,87,90 g=1032
+*/
+
+#define SEI_METADATA_UUID "DashPiMetadata01"
+#define SEI_METADATA_UUID_SIZE 16
+
+// Longest text that goes into one SEI, and room for the NAL around it
+#define SEI_METADATA_MAX_TEXT 200
+#define SEI_METADATA_MAX_NAL 320
+
+// Builds the whole NAL with its start code, returns its size or 0 if the text is too long
+size_t SeiMetadataBuild(const char* text, uint8_t* nal, size_t size);
+
+// nal points at the NAL header byte, returns false if it's not one of our SEIs
+bool SeiMetadataParse(const uint8_t* nal, size_t length, char* text, size_t size);
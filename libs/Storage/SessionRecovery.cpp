@@ -0,0 +1,636 @@
+#include "SessionRecovery.h"
+#include "ChecksumSidecar.h"
+#include "Crc32c.h"
+#include "../../Recorder/H264.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define RECOVERY_MAX_STREAMS 4
+#define RECOVERY_ZERO_BLOCK 65536
+
+struct SegmentName
+{
+	char name[64];
+	unsigned int index;
+	char suffix[32];
+};
+
+static uint64_t GetMonotonicTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+static int CompareSegmentNames(const void* a, const void* b)
+{
+	return strcmp(((const SegmentName*)a)->name, ((const SegmentName*)b)->name);
+}
+
+// <index>-<suffix>.h264 as the recorder names them
+static bool ParseSegmentName(const char* name, SegmentName* segment)
+{
+	int length = 0;
+	if ((sscanf(name, "%8u-%31[^.].h264%n", &segment->index, segment->suffix, &length) != 2) || (name[length]) || (!length))
+		return false;
+
+	snprintf(segment->name, sizeof(segment->name), "%s", name);
+	return true;
+}
+
+SessionRecovery::SessionRecovery()
+{
+	m_dryRun = false;
+
+	m_catalog = -1;
+	m_poolEntries = nullptr;
+	m_poolIndices = nullptr;
+	m_poolEntryCount = 0;
+	m_sessionNameLength = 0;
+
+	m_sessions = 0;
+	m_segments = 0;
+	m_droppedBytes = 0;
+	m_readBytes = 0;
+	m_time = 0;
+}
+
+unsigned int SessionRecovery::RecoverAll(const char* recordingsDir, const char* skipDirectory)
+{
+	DIR* dir = opendir(recordingsDir);
+	if (!dir)
+		return 0;
+
+	uint64_t start = GetMonotonicTime();
+	unsigned int recovered = 0;
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr)
+	{
+		// Sessions are plain numbers
+		if ((!entry->d_name[0]) || (strspn(entry->d_name, "0123456789") != strlen(entry->d_name)))
+			continue;
+
+		char directory[255];
+		snprintf(directory, sizeof(directory), "%s/%s", recordingsDir, entry->d_name);
+
+		// The session being recorded right now isn't closed either
+		if ((skipDirectory) && (strcmp(directory, skipDirectory) == 0))
+			continue;
+
+		struct stat sb;
+		if ((stat(directory, &sb) != 0) || (!S_ISDIR(sb.st_mode)))
+			continue;
+
+		char lengthName[255];
+		snprintf(lengthName, sizeof(lengthName), "%s/length.txt", directory);
+		if (access(lengthName, F_OK) == 0)
+			continue;
+
+		if (RecoverSession(directory))
+			recovered++;
+	}
+
+	closedir(dir);
+
+	m_time += GetMonotonicTime() - start;
+	return recovered;
+}
+
+bool SessionRecovery::RecoverSession(const char* directory)
+{
+	// Taken before anything is written, it's when the newest file was created
+	struct stat dirStat;
+	if (stat(directory, &dirStat) != 0)
+		return false;
+
+	DIR* dir = opendir(directory);
+	if (!dir)
+		return false;
+
+	SegmentName* segments = nullptr;
+	unsigned int segmentCount = 0;
+	unsigned int capacity = 0;
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr)
+	{
+		SegmentName segment;
+		if (!ParseSegmentName(entry->d_name, &segment))
+			continue;
+
+		if (segmentCount == capacity)
+		{
+			capacity = (capacity) ? capacity * 2 : 64;
+			SegmentName* grown = (SegmentName*)realloc(segments, capacity * sizeof(SegmentName));
+			if (!grown)
+				break;
+			segments = grown;
+		}
+
+		segments[segmentCount++] = segment;
+	}
+
+	closedir(dir);
+
+	printf("Recovering %s (%u segments)\n", directory, segmentCount);
+
+	qsort(segments, segmentCount, sizeof(SegmentName), CompareSegmentNames);
+
+	// Only the newest segment of each stream was still being written
+	const SegmentName* last[RECOVERY_MAX_STREAMS] = { nullptr };
+	for (unsigned int i = 0; i < segmentCount; i++)
+	{
+		for (unsigned int s = 0; s < RECOVERY_MAX_STREAMS; s++)
+		{
+			if ((!last[s]) || (strcmp(last[s]->suffix, segments[i].suffix) == 0))
+			{
+				if ((!last[s]) || (segments[i].index > last[s]->index))
+					last[s] = &segments[i];
+				break;
+			}
+		}
+	}
+
+	LoadPoolEntries(directory);
+
+	uint64_t lastSizes[RECOVERY_MAX_STREAMS] = { 0 };
+	for (unsigned int s = 0; (s < RECOVERY_MAX_STREAMS) && (last[s]); s++)
+	{
+		if (!RecoverSegment(directory, last[s]->name, &lastSizes[s]))
+			last[s] = nullptr;
+	}
+
+	// Durations of the segments that were finished, the rest is estimated from their size
+	uint64_t loggedBytes = 0, loggedMs = 0;
+	unsigned int* loggedIndices = nullptr;
+	unsigned int loggedCount = 0;
+
+	char logName[255];
+	snprintf(logName, sizeof(logName), "%s/segments.txt", directory);
+	FILE* log = fopen(logName, "r");
+	if (log)
+	{
+		char line[256];
+		unsigned int logCapacity = 0;
+		while (fgets(line, sizeof(line), log))
+		{
+			unsigned int index;
+			unsigned long long bytes, ms;
+			if (sscanf(line, "%u frames=%*u idr=%*u bytes=%llu duration=%llums", &index, &bytes, &ms) != 3)
+				continue;
+
+			if (loggedCount == logCapacity)
+			{
+				logCapacity = (logCapacity) ? logCapacity * 2 : 64;
+				unsigned int* grown = (unsigned int*)realloc(loggedIndices, logCapacity * sizeof(unsigned int));
+				if (!grown)
+					break;
+				loggedIndices = grown;
+			}
+
+			loggedIndices[loggedCount++] = index;
+			loggedBytes += bytes;
+			loggedMs += ms;
+		}
+		fclose(log);
+	}
+
+	uint64_t unloggedBytes = 0;
+	time_t newest = 0;
+	for (unsigned int i = 0; i < segmentCount; i++)
+	{
+		if (strcmp(segments[i].suffix, "recording") != 0)
+			continue;
+
+		char path[255];
+		snprintf(path, sizeof(path), "%s/%s", directory, segments[i].name);
+
+		struct stat sb;
+		if (stat(path, &sb) != 0)
+			continue;
+
+		if (sb.st_mtime > newest)
+			newest = sb.st_mtime;
+
+		bool logged = false;
+		for (unsigned int l = 0; (l < loggedCount) && (!logged); l++)
+			logged = (loggedIndices[l] == segments[i].index);
+
+		if (logged)
+			continue;
+
+		// A pool file is as long as the longest recording it ever held
+		uint64_t length = sb.st_size;
+		unsigned int poolIndex;
+		const PoolEntry* poolEntry = FindPoolEntry(segments[i].name, &poolIndex);
+		if ((poolEntry) && (poolEntry->state == POOL_ENTRY_DONE) && (poolEntry->length < length))
+			length = poolEntry->length;
+
+		for (unsigned int s = 0; s < RECOVERY_MAX_STREAMS; s++)
+		{
+			if (last[s] == &segments[i])
+				length = lastSizes[s];
+		}
+
+		unloggedBytes += length;
+	}
+	free(loggedIndices);
+	FreePoolEntries();
+
+	uint64_t durationMs = loggedMs;
+	if (loggedBytes)
+		durationMs += unloggedBytes * loggedMs / loggedBytes;
+	else if ((unloggedBytes) && (newest > dirStat.st_mtime))
+		durationMs += (uint64_t)(newest - dirStat.st_mtime) * 1000;
+
+	if (!m_dryRun)
+	{
+		// The same as the recorder writes on a clean exit
+		char name[255];
+		snprintf(name, sizeof(name), "%s/filelist.txt", directory);
+		FILE* file = fopen(name, "w");
+		if (file)
+		{
+			for (unsigned int i = 0; i < segmentCount; i++)
+			{
+				if (strcmp(segments[i].suffix, "recording") == 0)
+					fprintf(file, "file '%s/%s'\n", directory, segments[i].name);
+			}
+			fclose(file);
+		}
+
+		snprintf(name, sizeof(name), "%s/length.txt", directory);
+		file = fopen(name, "w");
+		if (file)
+		{
+			fprintf(file, "%llu seconds\n\n", (unsigned long long)(durationMs / 1000));
+			fclose(file);
+		}
+	}
+
+	printf("Recovered %s: about %llu seconds\n", directory, (unsigned long long)(durationMs / 1000));
+
+	free(segments);
+	m_sessions++;
+	return true;
+}
+
+bool SessionRecovery::RecoverSegment(const char* directory, const char* name, uint64_t* size)
+{
+	char path[255];
+	snprintf(path, sizeof(path), "%s/%s", directory, name);
+
+	int fd = open(path, m_dryRun ? O_RDONLY : O_RDWR);
+	if (fd < 0)
+	{
+		printf("Failed to open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	struct stat sb;
+	fstat(fd, &sb);
+	*size = sb.st_size;
+
+	// The pool finished its recording before it went, it just didn't get to the rest of the session
+	unsigned int poolIndex = 0;
+	const PoolEntry* poolEntry = FindPoolEntry(name, &poolIndex);
+	if ((poolEntry) && (poolEntry->state == POOL_ENTRY_DONE))
+	{
+		if (poolEntry->length < *size)
+			*size = poolEntry->length;
+		close(fd);
+		return true;
+	}
+
+	// A sidecar that accounts for every byte was closed along with its segment
+	char sidecarName[255];
+	ChecksumSidecarName(path, sidecarName, sizeof(sidecarName));
+
+	uint32_t chunkSize;
+	ChecksumChunk* chunks;
+	unsigned int chunkCount;
+	uint64_t covered = 0;
+	if (ChecksumSidecarLoad(sidecarName, &chunkSize, &chunks, &chunkCount))
+	{
+		covered = (chunkCount) ? chunks[chunkCount - 1].offset + chunks[chunkCount - 1].length : 0;
+		free(chunks);
+
+		if ((!poolEntry) && (covered == *size))
+		{
+			close(fd);
+			return true;
+		}
+	}
+
+	// Until the new recording has got past where the old one reached, the old footage after it looks just
+	// as valid, so only what the catalog or the sidecar have seen written counts
+	uint64_t dataEnd;
+	if ((poolEntry) && (poolEntry->length < poolEntry->dirty))
+	{
+		dataEnd = (covered > poolEntry->length) ? covered : poolEntry->length;
+		if (dataEnd > *size)
+			dataEnd = *size;
+	}
+	else
+	{
+		dataEnd = FindDataEnd(fd, *size);
+	}
+
+	uint64_t cut = 0;
+	if ((dataEnd) && (!FindLastAccessUnit(fd, dataEnd, &cut)))
+		printf("No complete access unit in %s\n", path);
+
+	if (poolEntry)
+	{
+		// Pool files keep their size here, the recorder cuts them back when it opens the pool and keeps their clusters
+		printf("Ending %s at %llu of its %llu bytes\n", path, (unsigned long long)cut, (unsigned long long)*size);
+
+		if (!m_dryRun)
+		{
+			RepairSidecar(path, cut);
+
+			PoolEntry recovered = *poolEntry;
+			recovered.state = POOL_ENTRY_DONE;
+			recovered.length = cut;
+			if (recovered.dirty < *size)
+				recovered.dirty = *size;
+
+			if (PoolCatalogWrite(m_catalog, poolIndex, &recovered))
+				fdatasync(m_catalog);
+		}
+
+		m_droppedBytes += dataEnd - cut;
+		m_segments++;
+		*size = cut;
+	}
+	else if (cut < *size)
+	{
+		printf("Cutting %s from %llu to %llu bytes\n", path, (unsigned long long)*size, (unsigned long long)cut);
+
+		if (!m_dryRun)
+		{
+			if (ftruncate(fd, cut) != 0)
+			{
+				printf("Failed to truncate %s: %s\n", path, strerror(errno));
+				close(fd);
+				return false;
+			}
+			fsync(fd);
+
+			RepairSidecar(path, cut);
+		}
+
+		m_droppedBytes += *size - cut;
+		m_segments++;
+		*size = cut;
+	}
+
+	close(fd);
+	return true;
+}
+
+void SessionRecovery::LoadPoolEntries(const char* directory)
+{
+	FreePoolEntries();
+
+	// The catalog is in the recordings directory and its paths start with the session's name
+	char parent[255];
+	snprintf(parent, sizeof(parent), "%s", directory);
+	size_t length = strlen(parent);
+	while ((length > 1) && (parent[length - 1] == '/'))
+		parent[--length] = 0;
+
+	char* slash = strrchr(parent, '/');
+	const char* session = (slash) ? slash + 1 : parent;
+	m_sessionNameLength = strlen(session);
+
+	char catalogName[255];
+	if (slash)
+		snprintf(catalogName, sizeof(catalogName), "%.*s/%s", (int)(slash - parent), parent, POOL_CATALOG_FILE);
+	else
+		snprintf(catalogName, sizeof(catalogName), "%s", POOL_CATALOG_FILE);
+
+	m_catalog = open(catalogName, m_dryRun ? O_RDONLY : O_RDWR);
+	if (m_catalog < 0)
+		return;
+
+	unsigned int capacity = 0;
+	PoolEntry entry;
+	for (unsigned int i = 0; PoolCatalogRead(m_catalog, i, &entry); i++)
+	{
+		if ((entry.state == POOL_ENTRY_MISSING) || (strncmp(entry.path, session, m_sessionNameLength) != 0) ||
+			(entry.path[m_sessionNameLength] != '/'))
+		{
+			continue;
+		}
+
+		if (m_poolEntryCount == capacity)
+		{
+			capacity = (capacity) ? capacity * 2 : 64;
+			PoolEntry* entries = (PoolEntry*)realloc(m_poolEntries, capacity * sizeof(PoolEntry));
+			if (entries)
+				m_poolEntries = entries;
+			unsigned int* indices = (unsigned int*)realloc(m_poolIndices, capacity * sizeof(unsigned int));
+			if (indices)
+				m_poolIndices = indices;
+			if ((!entries) || (!indices))
+				break;
+		}
+
+		m_poolEntries[m_poolEntryCount] = entry;
+		m_poolIndices[m_poolEntryCount] = i;
+		m_poolEntryCount++;
+	}
+	m_readBytes += (uint64_t)lseek(m_catalog, 0, SEEK_END);
+}
+
+void SessionRecovery::FreePoolEntries()
+{
+	if (m_catalog >= 0)
+		close(m_catalog);
+	m_catalog = -1;
+
+	free(m_poolEntries);
+	free(m_poolIndices);
+	m_poolEntries = nullptr;
+	m_poolIndices = nullptr;
+	m_poolEntryCount = 0;
+}
+
+const PoolEntry* SessionRecovery::FindPoolEntry(const char* name, unsigned int* index)
+{
+	for (unsigned int i = 0; i < m_poolEntryCount; i++)
+	{
+		if (strcmp(m_poolEntries[i].path + m_sessionNameLength + 1, name) == 0)
+		{
+			*index = m_poolIndices[i];
+			return &m_poolEntries[i];
+		}
+	}
+
+	return nullptr;
+}
+
+uint64_t SessionRecovery::FindDataEnd(int fd, uint64_t size)
+{
+	static uint8_t block[RECOVERY_ZERO_BLOCK];
+
+	uint64_t end = size;
+	while (end)
+	{
+		size_t length = (end > RECOVERY_ZERO_BLOCK) ? RECOVERY_ZERO_BLOCK : (size_t)end;
+		if (pread(fd, block, length, end - length) != (ssize_t)length)
+			return end;
+		m_readBytes += length;
+
+		for (size_t i = length; i > 0; i--)
+		{
+			if (block[i - 1])
+				return end - length + i;
+		}
+
+		end -= length;
+	}
+
+	return 0;
+}
+
+bool SessionRecovery::FindLastAccessUnit(int fd, uint64_t dataEnd, uint64_t* start)
+{
+	uint64_t pageSize = sysconf(_SC_PAGESIZE);
+
+	// Usually the last frame is well within the first window, an IDR at a high bitrate may need more
+	for (uint64_t window = RECOVERY_TAIL_WINDOW; ; window *= 2)
+	{
+		uint64_t windowStart = (dataEnd > window) ? dataEnd - window : 0;
+		uint64_t mapStart = windowStart & ~(pageSize - 1);
+
+		uint8_t* map = (uint8_t*)mmap(nullptr, dataEnd - mapStart, PROT_READ, MAP_SHARED, fd, mapStart);
+		if (map == MAP_FAILED)
+		{
+			printf("Failed to map the tail: %s\n", strerror(errno));
+			return false;
+		}
+
+		const uint8_t* data = map + (windowStart - mapStart);
+		size_t length = dataEnd - windowStart;
+		m_readBytes += length;
+
+		// An access unit starts at its first slice, or the parameter sets, SEI or delimiter right in front of it
+		bool found = false;
+		size_t lastStart = 0;
+		size_t runStart = 0;
+		bool inRun = false;
+
+		size_t offset = 0;
+		while ((offset = H264FindNal(data, length, offset)) < length)
+		{
+			size_t codeStart = offset - 3;
+			if ((codeStart) && (!data[codeStart - 1]))
+				codeStart--;
+
+			unsigned int type = H264NalType(data[offset]);
+			if ((type == H264_NAL_SPS) || (type == H264_NAL_PPS) || (type == H264_NAL_SEI) || (type == H264_NAL_AUD))
+			{
+				if (!inRun)
+					runStart = codeStart;
+				inRun = true;
+			}
+			else
+			{
+				// first_mb_in_slice is 0, coded as a single 1 bit, for the first slice of a picture
+				if (((type == H264_NAL_SLICE) || (type == H264_NAL_IDR)) && (offset + 1 < length) && (data[offset + 1] & 0x80))
+				{
+					lastStart = (inRun) ? runStart : codeStart;
+					found = true;
+				}
+				inRun = false;
+			}
+		}
+
+		munmap(map, dataEnd - mapStart);
+
+		if (found)
+		{
+			*start = windowStart + lastStart;
+			return true;
+		}
+
+		if ((!windowStart) || (window >= RECOVERY_MAX_WINDOW))
+			return false;
+	}
+}
+
+void SessionRecovery::RepairSidecar(const char* path, uint64_t size)
+{
+	char sidecarName[255];
+	ChecksumSidecarName(path, sidecarName, sizeof(sidecarName));
+
+	uint32_t chunkSize;
+	ChecksumChunk* chunks;
+	unsigned int chunkCount;
+	if ((!ChecksumSidecarLoad(sidecarName, &chunkSize, &chunks, &chunkCount)) || (!chunkSize))
+		return;
+
+	char tempName[255];
+	snprintf(tempName, sizeof(tempName), "%s.tmp", sidecarName);
+
+	FILE* file = fopen(tempName, "w");
+	int fd = open(path, O_RDONLY);
+	uint8_t* buffer = (uint8_t*)malloc(chunkSize);
+	bool success = (file) && (fd >= 0) && (buffer);
+
+	if (success)
+	{
+		fprintf(file, "crc32c %u\n", chunkSize);
+
+		// The chunks that are still whole keep their checksums
+		uint64_t end = 0;
+		for (unsigned int i = 0; (i < chunkCount) && (chunks[i].offset + chunks[i].length <= size); i++)
+		{
+			fprintf(file, "%llu %u %08x\n", (unsigned long long)chunks[i].offset, chunks[i].length, chunks[i].crc);
+			end = chunks[i].offset + chunks[i].length;
+		}
+
+		// Whatever the sidecar hadn't caught up with is checksummed now
+		while ((success) && (end < size))
+		{
+			uint32_t length = (size - end > chunkSize) ? chunkSize : (uint32_t)(size - end);
+			success = pread(fd, buffer, length, end) == (ssize_t)length;
+			if (success)
+				fprintf(file, "%llu %u %08x\n", (unsigned long long)end, length, Crc32c(0, buffer, length));
+
+			m_readBytes += length;
+			end += length;
+		}
+	}
+
+	free(chunks);
+	free(buffer);
+	if (fd >= 0)
+		close(fd);
+
+	if (file)
+	{
+		fclose(file);
+		if (success)
+			rename(tempName, sidecarName);
+		else
+			unlink(tempName);
+	}
+}
+
+void SessionRecovery::PrintStats()
+{
+	printf("Recovery: %u sessions, %u segments cut, %llu bytes dropped, %llu bytes read in %llu ms\n", m_sessions, m_segments,
+		(unsigned long long)m_droppedBytes, (unsigned long long)m_readBytes, (unsigned long long)(m_time / 1000));
+}
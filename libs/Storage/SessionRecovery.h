@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "PoolCatalog.h"
+
+/*
+ *	SessionRecovery
+ *	Repairs sessions the recorder never closed, which is what a power cut leaves behind. A session
+ *	is closed once it has its length.txt, so any numbered directory without one is recovered:
+ *	the last segment of each stream is cut back to the end of its last complete access unit, its
+ *	checksum sidecar is brought in line with it, and filelist.txt and length.txt are written just
+ *	as a clean exit would have.
+ *
+ *	Only the tails of the last segments are read, the tail is mapped and the last access unit found
+ *	from there, so a session takes the same time however long it is. A segment whose sidecar covers
+ *	all of it was closed properly and isn't touched.
+ *
+ *	A file from the segment pool is never shortened. Once it has been recycled, whatever the last
+ *	recording in it left behind can't be told from the new one, so the access unit is only looked
+ *	for up to the length the pool's catalog or the sidecar vouch for. The catalog then gets the
+ *	recovered length, and the recorder cuts the file back to it when it next opens the pool, as it
+ *	does for any recycled file.
+*/
+
+#define RECOVERY_TAIL_WINDOW (1024 * 1024)
+#define RECOVERY_MAX_WINDOW (32 * 1024 * 1024)
+
+class SessionRecovery
+{
+public:
+	SessionRecovery();
+
+	// Only report what would be done
+	void SetDryRun(bool dryRun) { m_dryRun = dryRun; }
+
+	// Recovers every unclosed session under recordingsDir apart from skipDirectory, returns how many
+	unsigned int RecoverAll(const char* recordingsDir, const char* skipDirectory);
+
+	bool RecoverSession(const char* directory);
+
+	void PrintStats();
+
+private:
+	// Cuts the segment back to its last complete access unit, size is what is left
+	bool RecoverSegment(const char* directory, const char* name, uint64_t* size);
+
+	// The pool's entries for the session's files, from the catalog next to the session directory
+	void LoadPoolEntries(const char* directory);
+	void FreePoolEntries();
+	const PoolEntry* FindPoolEntry(const char* name, unsigned int* index);
+
+	// End of the data, past any zeros a recycled pool file has after its recording
+	uint64_t FindDataEnd(int fd, uint64_t size);
+
+	// Start of the last access unit before dataEnd, which may not be complete
+	bool FindLastAccessUnit(int fd, uint64_t dataEnd, uint64_t* start);
+
+	void RepairSidecar(const char* path, uint64_t size);
+
+private:
+	bool m_dryRun;
+
+	int m_catalog;
+	PoolEntry* m_poolEntries;
+	unsigned int* m_poolIndices;
+	unsigned int m_poolEntryCount;
+	size_t m_sessionNameLength;
+
+	unsigned int m_sessions;
+	unsigned int m_segments;
+	uint64_t m_droppedBytes;
+	uint64_t m_readBytes;
+	uint64_t m_time;
+};
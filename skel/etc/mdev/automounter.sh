@@ -4,10 +4,9 @@ destdir=/recordings
 
 my_umount()
 {
-	# Stop the recording process when unmounting
-	killall recorder.bin
-
-        umount -f "${destdir}"
+	# The recorder keeps running and spools in RAM until the next stick is mounted.
+	# Lazy so a file still open for writing can't keep the dead mount around
+        umount -l "${destdir}" 2> /dev/null
 }
 
 my_mount()
@@ -16,9 +15,6 @@ my_mount()
                 # failed to mount
                 exit 1
         fi
-
-	# Fire up the recorder when a USB stick is inserted
-	/dashpi/bin/recorder.bin &
 }
 
 case "${ACTION}" in